@@ -41,6 +41,8 @@ service is similar to a regular process service, but the process daemonizes
 or otherwise forks from the original process which starts it, and the
 process ID is written to a file. Dinit can read the process ID from the
 file and, if it is running as the system init process, can supervise it.
+Otherwise, on systems which support it (Linux 5.3 and later), Dinit can still
+detect termination of the process, but cannot determine its exit status.
 .IP \(bu
 \fBScripted\fR services are services which are started and stopped by a
 command (which need not actually be a script, despite the name). They can
@@ -111,6 +113,17 @@ minimum prevents Dinit from consuming a large number of process cycles in
 case a process continuously fails immediately after it is started. The
 default is 0.2 (200 milliseconds).
 .TP
+\fBrestart\-delay\-max\fR = \fIXXX.YYYY\fR
+Enables exponential backoff of the restart delay: each successive automatic restart doubles
+the delay (starting from \fBrestart\-delay\fR), up to this maximum. If the process runs
+for at least the maximum delay before it terminates, the delay is reset to the initial value.
+The default is 0, meaning the delay does not increase.
+.TP
+\fBrestart\-jitter\fR = \fIXXX.YYYY\fR
+Specifies a maximum random time added to the delay before each automatic restart, so that
+services which fail at the same time (for example, due to the failure of a common dependency)
+do not all restart at the same time. The default is 0.
+.TP
 \fBrestart\-limit\-interval\fR = \fIXXX.YYYY\fR
 Sets the interval, in seconds, over which restarts are limited. If a process
 automatically restarts more than a certain number of times (specified by the
@@ -131,6 +144,12 @@ terminated via SIGKILL). The timeout period begins only when all dependencies
 have been stopped. The default timeout is 60 seconds. Specify a value of 0 to
 allow unlimited start time.
 .TP
+\fBstart\-priority\fR = \fINNN\fR
+Specifies the priority of the service for starting, when the number of services that may
+concurrently be starting is limited (see the \fB\-\-max\-starting\fR option in \fBdinit\fR(8)).
+A service with a higher priority is started before services with a lower priority that are also
+waiting to start. The value may be negative; the default is 0.
+.TP
 \fBstop\-timeout\fR = \fIXXX.YYY\fR
 Specifies the time in seconds allowed for the service to stop. If the
 service takes longer than this, its process group is sent a SIGKILL signal
@@ -138,6 +157,19 @@ which should cause it to terminate immediately. The timeout period begins
 only when all dependent services have already stopped. The default
 timeout is 10 seconds. Specify a value of 0 to allow unlimited stop time.
 .TP
+\fBactivation\-lifetime\fR = \fIXXX.YYY\fR
+For services with the \fBon-demand\fR option only; specifies the maximum time in seconds for
+which a service that was started by a connection to its activation socket remains started, after
+which it is stopped again (as if by \fBdinitctl release\fR; it remains started if another service
+depends on it). This is not an idle timeout: once the service has accepted its connections,
+\fBdinit\fR cannot tell whether it is busy, and the service is stopped even if it is still serving
+clients. Only if a connection is waiting to be accepted when the time expires is the service
+left running, with the period beginning again. The service should be prepared to terminate
+gracefully (for instance, completing any requests in progress) when it receives its termination
+signal. A service which can determine for itself that it is idle may instead simply exit (with
+\fBrestart\fR not enabled); \fBdinit\fR then resumes listening on its socket. The default is 0,
+meaning that the service is not stopped automatically.
+.TP
 \fBpid\-file\fR = \fIpath-to-file\fR
 For \fBbgprocess\fR type services only; specifies the path of the file where
 daemon will write its process ID before detaching. Dinit will read the
@@ -197,7 +229,17 @@ Pre-open a socket for the service and pass it to the service using the
 \fBsystemd\fR activation protocol. This by itself does not give so called
 "socket activation", but does allow that any process trying to connect to the
 specified socket will be able to do so, even before the service is properly
-prepared to accept connections.
+prepared to accept connections. The sockets of all services that are to be
+started at boot (and their dependencies) are opened when \fBdinit\fR starts,
+before any service is started; see also the \fBready-on-socket\fR and \fBon-demand\fR options.
+When \fBdinit\fR is the system init, a socket which cannot be opened then, because the
+filesystem is not yet writable or the socket directory does not yet exist, is opened (without
+an error being reported) once the root filesystem becomes writable (see the \fBstarts-rwfs\fR
+option), or otherwise when the service starts. At that time, the socket of a stopped service is
+also re-created if its file has disappeared, for example because a filesystem has since been
+mounted over its directory. The socket path should not be within a filesystem that is mounted
+later than this: the socket may be hidden by the mount, and (for an \fBon-demand\fR service,
+whose socket remains open while it is stopped) is then not re-created.
 .TP
 \fBsocket\-permissions\fR = \fIoctal-permissions-mask\fR
 Gives the permissions for the socket specified using \fBsocket-listen\fR.
@@ -221,10 +263,10 @@ to terminate (applies to 'process' services only). SIGTERM is always
 sent along with the specified signal, unless the \fBno\-sigterm\fR option is
 specified via the \fBoptions\fR parameter.
 .TP
-\fBready\-notification\fR = {\fBpipefd:\fR\fIfd-number\fR | \fBpipevar:\fR\fIenv-var-name\fR}
+\fBready\-notification\fR = {\fBpipefd:\fR\fIfd-number\fR | \fBpipevar:\fR\fIenv-var-name\fR | \fBsocket\fR}
 Specifies the mechanism, if any, by which a process service will notify that it is ready
 (successfully started). If not specified, a process service is considered started as soon as it
-has begun execution. The two options are:
+has begun execution. The options are:
 .RS
 .IP \(bu
 \fBpipefd:\fR\fIfd-number\fR \(em the service will write a message to the specified file descriptor,
@@ -234,11 +276,42 @@ with the S6 supervision suite.
 \fBpipevar:\fR\fIenv-var-name\fR \(em the service will write a message to file descriptor identified
 using the contents of the specified environment variable, which will be set by \fBdinit\fR before
 execution to a file descriptor (chosen arbitrarily) attached to the write end of a pipe.
+.IP \(bu
+\fBsocket\fR \(em the service will send a datagram containing the line \fBREADY=1\fR to the
+notification socket shared by all services, the path of which \fBdinit\fR sets in the
+\fBNOTIFY_SOCKET\fR environment variable (this is compatible with \fBsd_notify\fR(3)). Messages
+are only accepted from the service process itself. A message may also contain a line of the form
+\fBSTATUS=\fR\fItext\fR, to set the status text of the service (which can be displayed using
+\fBdinitctl status-text\fR), or \fBWATCHDOG=1\fR (see \fBwatchdog\-timeout\fR). This option
+is only supported on Linux.
 .RE
 .TP
+\fBwatchdog\-timeout\fR = \fIXXX.YYY\fR
+For services with \fBready\-notification = socket\fR only; specifies the time in seconds
+within which the service must send \fBWATCHDOG=1\fR to the notification socket, once it has
+notified readiness and after each such message. The value is passed to the service (in
+microseconds) via the \fBWATCHDOG_USEC\fR environment variable. If the service fails to send
+the message in time, its process group is sent SIGKILL, and the service is then handled as for
+any other unexpected termination (it is restarted if \fBrestart\fR is set). The default is 0,
+meaning no watchdog.
+.TP
 \fBlogfile\fR = \fIlog-file-path\fR
 Specifies the log file for the service. Output from the service process
-will go this file.
+will go this file. Unless \fBlog-type\fR is also specified, this implies
+\fBlog-type = file\fR.
+.TP
+\fBlog-type\fR = {file | buffer | none}
+Specifies how the output (standard output and standard error) of the service process is
+handled. With \fBfile\fR, output is appended to the file specified via \fBlogfile\fR.
+With \fBbuffer\fR, \fBdinit\fR reads the output (via a pipe) into a buffer in memory, of
+the size specified by \fBlog-buffer-size\fR; once the buffer is full, new output replaces
+the oldest output. The buffer persists across restarts of the service process, and its
+contents can be displayed (and followed) using \fBdinitctl catlog\fR. With \fBnone\fR,
+output is discarded (this is the default if no \fBlogfile\fR is specified).
+Output is not redirected for a service which runs on the console.
+.TP
+\fBlog-buffer-size\fR = \fIsize-in-bytes\fR
+Specifies the size of the output buffer, for \fBlog-type = buffer\fR. The default is 4096 bytes.
 .TP
 \fBoptions\fR = \fIoption\fR...
 Specifies various options for this service. See the \fBOPTIONS\fR section. This
@@ -373,6 +446,32 @@ will instead be considered stopped.
 \fBsignal-process-only\fR
 Signal the service process only, rather than its entire process group, whenever
 sending it a signal for any reason.
+.TP
+\fBcgroup\fR
+This service runs its process in a (cgroup v2) control group of its own, named after the
+service and created within the directory given by the \fB\-\-cgroup\-path\fR option of
+\fBdinit\fR(8). All processes in the cgroup, including any which have left the process group of
+the service process, are killed when the service process is killed after the stop timeout
+expires, and when the service process terminates; the service is not considered to have
+stopped until the cgroup is empty. This option is only valid for \fBprocess\fR services, and is
+only supported on Linux; if the cgroup cannot be created (including if the directory is not
+within a cgroup v2 filesystem), a warning is logged and the process group is used instead.
+.TP
+\fBready-on-socket\fR
+Dependents of this service need not wait for it to start, once its activation socket (see
+\fBsocket-listen\fR) is open; they are started in parallel with it, and connections they make
+to the socket are queued until the service accepts them. This does not apply to milestone
+(\fBdepends-ms\fR) dependencies. If the service fails to start, dependents which depend on it
+via \fBdepends-on\fR are stopped.
+.TP
+\fBon-demand\fR
+Start this service when a connection to its activation socket (see \fBsocket-listen\fR) is
+made. The socket is opened when the service is loaded, and \fBdinit\fR listens for
+connections on it whenever the service is stopped; the first connection starts the service
+(marking it active, as \fBdinitctl start\fR does), and is accepted by the service once it
+runs. When the service stops again, \fBdinit\fR resumes listening. If the service fails to
+start, the socket is closed instead (and is opened again if the service is later started
+explicitly). See also the \fBactivation-lifetime\fR setting.
 .RE
 .LP
 The next section contains example service descriptions including some of the
@@ -8,8 +8,13 @@ dinit \- supervise processes and manage services
 .HP \w'\ 'u
 .B dinit
 [\fB\-s\fR|\fB\-\-system\fR|\fB\-u\fR|\fB\-\-user\fR] [\fB\-d\fR|\fB\-\-services\-dir\fR \fIdir\fR]
-[\fB\-p\fR|\fB\-\-socket\-path\fR \fIpath\fR] [\fB\-e\fR|\fB\-\-env\-file\fR \fIpath\fR]
+[\fB\-p\fR|\fB\-\-socket\-path\fR \fIpath\fR] [\fB\-\-notify\-socket\-path\fR \fIpath\fR]
+[\fB\-e\fR|\fB\-\-env\-file\fR \fIpath\fR]
 [\fB\-l\fR|\fB\-\-log\-file\fR \fIpath\fR]
+[\fB\-\-control\-buffer\-limit\fR \fIbytes\fR]
+[\fB\-\-max\-starting\fR \fIcount\fR]
+[\fB\-\-restart\-budget\fR \fIcount\fR/\fIseconds\fR]
+[\fB\-\-cgroup\-path\fR \fIdir\fR]
 [\fIservice-name\fR...]
 .\"
 .SH DESCRIPTION
@@ -56,6 +61,12 @@ commands from the \fBdinitctl\fR program. The default for the system service
 manager is usually \fI/dev/dinitctl\fR (but can be configured at build time).
 For a user service manager the default is \fI$HOME/.dinitctl\fR.
 .TP
+\fB\-\-notify\-socket\-path\fR \fIpath\fP
+Specifies \fIpath\fP as the path to the datagram socket on which Dinit receives readiness,
+status and watchdog notifications from services configured with
+\fBready\-notification = socket\fR (see \fBdinit-service\fR(5)). The default is the control
+socket path with \fI.notify\fR appended. The socket is only supported on Linux.
+.TP
 \fB\-l\fR \fIpath\fP, \fB\-\-log\-file\fR \fIpath\fP
 Species \fIpath\fP as the path to the log file, to which Dinit will log status
 and error messages. Note that when running as the system service manager, Dinit
@@ -76,6 +87,35 @@ not invoked as the root user.
 Run with no output to the terminal/console. This disables service status messages
 and sets the log level for the console log to \fBNONE\fR.
 .TP
+\fB\-\-control\-buffer\-limit\fR \fIbytes\fR
+Specifies the buffer limit for each control socket connection (the default is 65536 bytes).
+A request larger than this size is rejected, and no further requests from a client
+are processed while the output waiting to be sent to that client exceeds this size.
+The minimum is 1024 bytes.
+.TP
+\fB\-\-max\-starting\fR \fIcount\fR
+Limits the number of services which may concurrently be starting a process (that is, services of
+type \fBprocess\fR, \fBbgprocess\fR or \fBscripted\fR which have launched their process, or
+start command, but have not yet finished starting). Other services which are ready to start wait
+until one of these has started (or failed to start). Waiting services are started in order of
+their \fBstart\-priority\fR (see \fBdinit-service\fR(5)) and then in favour of those on the
+longest chain of dependent services that are also waiting to start. The default, 0, imposes no
+limit.
+.TP
+\fB\-\-restart\-budget\fR \fIcount\fR/\fIseconds\fR
+Limits the rate of automatic restarts across all services. Up to \fIcount\fR services may
+restart at once, but beyond that restarts are spread out evenly so that no more than \fIcount\fR
+restarts occur in any period of \fIseconds\fR. A restart beyond the budget is deferred rather than
+cancelled. This avoids spikes in load when many services fail together (for example due to the
+failure of a service they all depend on). By default, there is no limit.
+.TP
+\fB\-\-cgroup\-path\fR \fIdir\fR
+Specifies the (cgroup v2) directory within which a cgroup is created for each service with the
+\fBcgroup\fR option (see \fBdinit-service\fR(5)). The directory is created if it does not exist.
+The default for the system service manager is \fI/sys/fs/cgroup/dinit\fR; for a user service
+manager there is no default, and the \fBcgroup\fR option has no effect unless this option is
+given. This option is only supported on Linux.
+.TP
 \fB\-\-help\fR
 Display brief help text and then exit.
 .TP
@@ -8,6 +8,8 @@ dinitcheck \- check service configuration
 .HP \w'\ 'u
 .B dinitcheck
 [\fB\-d\fR|\fB\-\-services\-dir\fR \fIdir\fR]
+[\fB\-\-update\-cache\fR]
+[\fB\-\-verify\-cache\fR]
 [\fIservice-name\fR...]
 .\"
 .SH DESCRIPTION
@@ -39,6 +41,22 @@ If not specified, the default is \fI$HOME/dinit.d\fR or, for the
 system service manager, each of \fI/etc/dinit.d/fR, \fI/usr/local/lib/dinit.d\fR,
 and \fI/lib/dinit.d\fR (searched in that order).
 .TP
+\fB\-\-update\-cache\fR
+If no errors are found, write a compiled description cache (named
+\fI.dinit\-cache\fR) into each service directory, containing the parsed settings of
+the checked services found in that directory.
+Any existing cache is replaced.
+When loading a service, \fBdinit\fR uses the cache entry instead of reading and
+parsing the service description file, provided that the description file (and any
+dependency directory it names) has not been modified since the cache was written.
+The cache also records the resolved user and group IDs of the service, and so is
+disregarded entirely if \fI/etc/passwd\fR or \fI/etc/group\fR has been modified;
+it should be rebuilt after other changes to the user or group databases.
+.TP
+\fB\-\-verify\-cache\fR
+Report an error for each checked service which does not have an up-to-date entry in
+the compiled description cache.
+.TP
 \fB\-\-help\fR
 Display brief help text and then exit.
 .TP
@@ -6,10 +6,10 @@ dinitctl \- control services supervised by Dinit
 .SH SYNOPSIS
 .\"
 .B dinitctl
-[\fIoptions\fR] \fBstart\fR [\fB\-\-no\-wait\fR] [\fB\-\-pin\fR] \fIservice-name\fR
+[\fIoptions\fR] \fBstart\fR [\fB\-\-no\-wait\fR] [\fB\-\-pin\fR] \fIservice-name\fR...
 .br
 .B dinitctl
-[\fIoptions\fR] \fBstop\fR [\fB\-\-no\-wait\fR] [\fB\-\-pin\fR] \fIservice-name\fR
+[\fIoptions\fR] \fBstop\fR [\fB\-\-no\-wait\fR] [\fB\-\-pin\fR] \fIservice-name\fR...
 .br
 .B dinitctl
 [\fIoptions\fR] \fBrestart\fR [\fB\-\-no\-wait\fR] \fIservice-name\fR
@@ -46,6 +46,21 @@ dinitctl \- control services supervised by Dinit
 .br
 .B dinitctl
 [\fIoptions\fR] \fBdisable\fR [\fB\-\-from\fR \fIfrom-service\fR] \fIto-service\fR
+.br
+.B dinitctl
+[\fIoptions\fR] \fBanalyze-boot\fR [\fIservice-name\fR]
+.br
+.B dinitctl
+[\fIoptions\fR] \fBcatlog\fR [\fB\-\-clear\fR] [\fB\-\-follow\fR] \fIservice-name\fR
+.br
+.B dinitctl
+[\fIoptions\fR] \fBloop-stats\fR [\fB\-\-reset\fR]
+.br
+.B dinitctl
+[\fIoptions\fR] \fBstatus-text\fR \fIservice-name\fR
+.br
+.B dinitctl
+[\fIoptions\fR] \fBwatch\fR
 .\"
 .SH DESCRIPTION
 .\"
@@ -87,8 +102,23 @@ start/stop commands will be "remembered" while the service is pinned.
 \fB\-\-force\fR
 Stop the service even if it will require stopping other services which depend on the specified service.
 .TP
+\fB\-\-clear\fR
+For the \fBcatlog\fR command: clear the buffered output of the service once it has been displayed.
+.TP
+\fB\-f\fR, \fB\-\-follow\fR
+For the \fBcatlog\fR command: after displaying the buffered output, continue to display output from the
+service as it is produced (until interrupted).
+.TP
+\fB\-\-reset\fR
+For the \fBloop-stats\fR command: reset the statistics once they have been displayed.
+.TP
 \fIservice-name\fR
 Specifies the name of the service to which the command applies.
+The \fBstart\fR and \fBstop\fR commands accept multiple service names; the services are then
+loaded and started (or stopped) together, using a single request to \fBdinit\fR for each batch
+of services rather than separate requests for each service.
+When stopping multiple services, a service is not prevented from stopping by dependents which are
+themselves named in the same command.
 .TP
 \fBstart\fR
 Start the specified service. The service is marked as explicitly activated and will not be stopped
@@ -193,6 +223,40 @@ If the \fB--from\fR option is not used to specify the dependent, the dependency
 \fBdisable\fR
 Permanently disable a \fBwaits-for\fR dependency between two services. This is the complement of the
 \fBenable\fR command; see the description above for more information.
+.TP
+\fBanalyze-boot\fR
+Show the critical path of service startup: the chain of dependencies which determined when the
+specified service (or, if none is specified, the service which most recently started) started. For
+each service in the chain, the time at which its own startup began (once its dependencies had
+started, relative to the first service start) and the time its startup took are shown. The services
+which waited longest for their dependencies to start are also listed. The times shown are those of
+the most recent start of each service.
+.TP
+\fBcatlog\fR
+Display the output of the specified service, as buffered in memory by \fBdinit\fR. This is only available
+for services with \fBlog-type\fR set to \fBbuffer\fR (see \fBdinit-service\fR(5)). The buffer holds
+the most recent output of the service, up to its configured size; if output has been lost while following,
+a note is displayed (on standard error) in its place.
+.TP
+\fBloop-stats\fR
+Display statistics recorded by the event loop of \fBdinit\fR: the number of events retrieved from the
+operating system at a time, and, for each category of event source (signals, child processes, timers,
+control connections, log output, and other file descriptors), the number of events processed, the
+latency between each event being received and being processed, and the time taken to process it. These
+statistics are only available if \fBdinit\fR was built with instrumentation enabled (by defining
+\fBDASYNQ_INSTRUMENT\fR to 1).
+.TP
+\fBstatus-text\fR
+Display the status text most recently reported by the specified service (via a \fBSTATUS=\fR
+message to the notification socket; see \fBready\-notification\fR in \fBdinit-service\fR(5)).
+If the service has not reported a status, an empty line is displayed.
+.TP
+\fBwatch\fR
+Display changes in the state of all services, as they occur, until \fBdinit\fR closes the
+connection (or \fBdinitctl\fR is interrupted). Each change is shown with the service name, the
+old and new states, and the process id of the service (if it has one). If changes occur more
+quickly than they can be displayed, changes to the same service may be combined, in which case
+intermediate states are not shown.
 .\"
 .SH SERVICE OPERATION
 .\"
@@ -1,11 +1,13 @@
 #include <cstring>
 #include <cstdlib>
+#include <random>
 
 #include <sys/un.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <poll.h>
 
 #include "dinit.h"
 #include "dinit-log.h"
@@ -20,6 +22,35 @@
  * See proc-service.h for interface documentation.
  */
 
+namespace {
+
+// Return a random time between 0 and the given maximum (inclusive), used to spread out restarts of
+// services which would otherwise restart in lockstep.
+time_val random_jitter(const time_val &max) noexcept
+{
+    uint64_t max_ns = uint64_t(max.seconds()) * 1000000000u + max.nseconds();
+    if (max_ns == 0) {
+        return time_val(0, 0);
+    }
+
+    // Seed from the clock and process ID (when first used) so that separate instances
+    // don't produce the same sequence:
+    static std::minstd_rand rng;
+    static bool seeded = false;
+    if (! seeded) {
+        time_val now;
+        event_loop.get_time(now, clock_type::MONOTONIC);
+        rng.seed(now.nseconds() ^ now.seconds() ^ getpid());
+        seeded = true;
+    }
+
+    uint64_t r = (uint64_t(rng()) << 31) ^ rng();
+    r %= (max_ns + 1);
+    return time_val(r / 1000000000u, r % 1000000000u);
+}
+
+} // anon namespace
+
 void base_process_service::do_smooth_recovery() noexcept
 {
     if (! restart_ps_process()) {
@@ -40,8 +71,10 @@ bool base_process_service::bring_up() noexcept
         if (! open_socket()) {
             return false;
         }
+        unwatch_activation_socket();
 
         restart_interval_count = 0;
+        next_restart_delay = restart_delay;
         if (start_ps_process(exec_arg_parts,
                 onstart_flags.starts_on_console || onstart_flags.shares_console)) {
             // start_ps_process updates last_start_time, use it also for restart_interval_time:
@@ -78,7 +111,7 @@ bool base_process_service::start_ps_process(const std::vector<const char *> &cmd
     }
 
     const char * logfile = this->logfile.c_str();
-    if (*logfile == 0) {
+    if (*logfile == 0 || log_type == log_type_id::NONE) {
         logfile = "/dev/null";
     }
 
@@ -91,6 +124,18 @@ bool base_process_service::start_ps_process(const std::vector<const char *> &cmd
     ready_notify_watcher * rwatcher = have_notify ? get_ready_watcher() : nullptr;
     bool ready_watcher_registered = false;
 
+    if (log_type == log_type_id::BUFFER && ! on_console) {
+        if (! ensure_log_pipe()) {
+            goto out_p;
+        }
+    }
+
+    if (use_notify_socket && services->get_notify_socket_path().empty()) {
+        log(loglevel_t::ERROR, get_name(), ": can't launch process: notification socket is not "
+                "available");
+        goto out_p;
+    }
+
     if (onstart_flags.pass_cs_fd) {
         if (dinit_socketpair(AF_UNIX, SOCK_STREAM, /* protocol */ 0, control_socket, SOCK_NONBLOCK)) {
             log(loglevel_t::ERROR, get_name(), ": can't create control socket: ", strerror(errno));
@@ -131,44 +176,79 @@ bool base_process_service::start_ps_process(const std::vector<const char *> &cmd
         }
     }
 
-    // Set up complete, now fork and exec:
-
-    pid_t forkpid;
-
-    try {
-        child_status_listener.add_watch(event_loop, pipefd[0], dasynq::IN_EVENTS);
-        child_status_registered = true;
-
-        // We specify a high priority (i.e. low priority value) so that process termination is
-        // handled early. This means we have always recorded that the process is terminated by the
-        // time that we handle events that might otherwise cause us to signal the process, so we
-        // avoid sending a signal to an invalid (and possibly recycled) process ID.
-        forkpid = child_listener.fork(event_loop, reserved_child_watch, dasynq::DEFAULT_PRIORITY - 10);
-        reserved_child_watch = true;
-    }
-    catch (std::exception &e) {
-        log(loglevel_t::ERROR, get_name(), ": Could not fork: ", e.what());
-        goto out_cs_h;
+    if (onstart_flags.use_cgroup && cgroup_fd == -1 && ! services->get_cgroup_parent().empty()) {
+        cgroup_fd = bp_sys::cgroup_open(services->get_cgroup_parent().c_str(), get_name().c_str());
+        if (cgroup_fd == -1) {
+            log(loglevel_t::WARN, get_name(), ": can't create cgroup (using process group instead): ",
+                    strerror(errno));
+        }
     }
 
-    if (forkpid == 0) {
+    // Set up complete, now prepare the launch, and create the process:
+
+    {
         const char * working_dir_c = nullptr;
         if (! working_dir.empty()) working_dir_c = working_dir.c_str();
-        after_fork(getpid());
         run_proc_params run_params{cmd.data(), working_dir_c, logfile, pipefd[1], run_as_uid, run_as_gid, rlimits};
         run_params.on_console = on_console;
+        if (log_type == log_type_id::BUFFER) run_params.output_fd = log_output_fd;
         run_params.in_foreground = !onstart_flags.shares_console;
         run_params.csfd = control_socket[1];
         run_params.socket_fd = socket_fd;
         run_params.notify_fd = notify_pipe[1];
         run_params.force_notify_fd = force_notification_fd;
         run_params.notify_var = notification_var.c_str();
+        if (use_notify_socket) {
+            run_params.notify_socket = services->get_notify_socket_path().c_str();
+            run_params.watchdog_usec = uint64_t(watchdog_timeout.seconds()) * 1000000u
+                    + watchdog_timeout.nseconds() / 1000u;
+        }
         run_params.env_file = env_file.c_str();
-        run_child_proc(run_params);
-    }
-    else {
-        // Parent process
+        run_params.cgroup_fd = cgroup_fd;
+
+        run_proc_plan run_plan;
+        pid_t forkpid;
+
+        try {
+            prepare_child_proc(run_params, proc_env, run_plan);
+
+            child_status_listener.add_watch(event_loop, pipefd[0], dasynq::IN_EVENTS);
+            child_status_registered = true;
+
+            // The child is created via vfork(), so that our address space need not be copied; the
+            // child runs only the (async-signal-safe) launch sequence, up to exec.
+            // We specify a high priority (i.e. low priority value) so that process termination is
+            // handled early. This means we have always recorded that the process is terminated by the
+            // time that we handle events that might otherwise cause us to signal the process, so we
+            // avoid sending a signal to an invalid (and possibly recycled) process ID.
+            forkpid = child_listener.vfork(event_loop,
+                    [&run_params, &run_plan]() { run_child_proc(run_params, run_plan); },
+                    reserved_child_watch, dasynq::DEFAULT_PRIORITY - 10);
+            reserved_child_watch = true;
+        }
+        catch (std::exception &e) {
+            log(loglevel_t::ERROR, get_name(), ": Could not fork: ", e.what());
+            goto out_cs_h;
+        }
+
         pid = forkpid;
+        mark_changed();
+        if (use_notify_socket) {
+            notify_ready_received = false;
+            try {
+                services->add_notify_pid(forkpid, this);
+                notify_pid = forkpid;
+            }
+            catch (std::bad_alloc &exc) {
+                // (The process can't notify readiness; the start will time out)
+                log(loglevel_t::ERROR, get_name(), ": can't register process for notification: ",
+                        exc.what());
+            }
+        }
+        if (get_state() == service_state_t::STARTING) {
+            start_timeline.record(timeline_event_t::FORKED);
+        }
+        after_fork(forkpid);
 
         bp_sys::close(pipefd[1]); // close the 'other end' fd
         if (control_socket[1] != -1) bp_sys::close(control_socket[1]);
@@ -211,7 +291,7 @@ base_process_service::base_process_service(service_set *sset, string name,
         const std::list<std::pair<unsigned,unsigned>> &command_offsets,
         const std::list<prelim_dep> &deplist_p)
      : service_record(sset, name, service_type_p, deplist_p), child_listener(this),
-       child_status_listener(this), restart_timer(this)
+       child_status_listener(this), log_output_listener(this), restart_timer(this)
 {
     program_name = std::move(command);
     exec_arg_parts = separate_args(program_name, command_offsets);
@@ -220,6 +300,8 @@ base_process_service::base_process_service(service_set *sset, string name,
     restart_interval_time = {0, 0};
     restart_timer.service = this;
     restart_timer.add_timer(event_loop);
+    lifetime_timer.add_timer(event_loop);
+    watchdog.add_timer(event_loop);
 
     // By default, allow a maximum of 3 restarts within 10.0 seconds:
     restart_interval.seconds() = 10;
@@ -282,25 +364,112 @@ bool base_process_service::restart_ps_process() noexcept
         }
     }
 
-    // Check if enough time has lapsed since the previous restart. If not, start a timer:
+    // Determine the delay (since the previous start) before restarting. With backoff, the delay
+    // doubles with each restart, but a process which ran for at least the maximum delay is restarted
+    // after the initial delay again:
     time_val tdiff = current_time - last_start_time;
-    if (restart_delay <= tdiff) {
-        // > restart delay (normally 200ms)
+    time_val delay = restart_delay;
+    if (restart_delay_max > restart_delay) {
+        if (tdiff < restart_delay_max) {
+            delay = next_restart_delay;
+        }
+        next_restart_delay = delay << 1;
+        if (next_restart_delay > restart_delay_max) {
+            next_restart_delay = restart_delay_max;
+        }
+    }
+    delay += random_jitter(restart_jitter);
+
+    // The restart may be deferred further if there are too many restarts across all services:
+    time_val restart_time = last_start_time + delay;
+    if (restart_time < current_time) {
+        restart_time = current_time;
+    }
+    restart_time = services->get_restart_budget().reserve(restart_time);
+
+    // If enough time has lapsed since the previous restart, restart now. If not, start a timer:
+    if (restart_time <= current_time) {
         do_restart();
     }
     else {
-        time_val timeout = restart_delay - tdiff;
+        time_val timeout = restart_time - current_time;
         restart_timer.arm_timer_rel(event_loop, timeout);
         waiting_restart_timer = true;
     }
     return true;
 }
 
+bool base_process_service::ensure_log_pipe() noexcept
+{
+    if (! log_buffer.set_capacity(log_buf_max)) {
+        log(loglevel_t::ERROR, get_name(), ": can't resize log buffer: out of memory");
+        return false;
+    }
+
+    if (log_output_fd != -1) {
+        return true;
+    }
+
+    int pipefds[2];
+    if (bp_sys::pipe2(pipefds, O_CLOEXEC) != 0) {
+        log(loglevel_t::ERROR, get_name(), ": can't create output pipe: ", strerror(errno));
+        return false;
+    }
+
+    // The write end is given to the process (as stdout/stderr); we read from the (non-blocking)
+    // read end as output becomes available.
+    int fdflags = bp_sys::fcntl(pipefds[0], F_GETFL);
+    bp_sys::fcntl(pipefds[0], F_SETFL, fdflags | O_NONBLOCK);
+
+    try {
+        log_output_listener.add_watch(event_loop, pipefds[0], dasynq::IN_EVENTS);
+    }
+    catch (std::exception &exc) {
+        log(loglevel_t::ERROR, get_name(), ": can't add output watch: ", exc.what());
+        bp_sys::close(pipefds[0]);
+        bp_sys::close(pipefds[1]);
+        return false;
+    }
+
+    log_output_fd = pipefds[1];
+    return true;
+}
+
+dasynq::rearm base_process_service::read_log_output(int fd) noexcept
+{
+    // Read what is available, but no more than the buffer capacity at once, so that a process which
+    // produces output continuously can't monopolise the event loop.
+    unsigned total = 0;
+    int r;
+    do {
+        r = log_buffer.fill(fd);
+        if (r > 0) total += r;
+    } while (r > 0 && total < log_buffer.get_capacity());
+    int read_errno = errno;
+
+    if (total != 0) {
+        notify_log_output();
+    }
+
+    if (r > 0 || (r == -1 && (read_errno == EAGAIN || read_errno == EWOULDBLOCK || read_errno == EINTR))) {
+        return dasynq::rearm::REARM;
+    }
+
+    // End-of-file (not expected, since we hold the write end) or error: stop capturing output.
+    if (r == -1) {
+        log(loglevel_t::WARN, get_name(), ": error reading process output: ", strerror(read_errno));
+    }
+    log_output_listener.deregister(event_loop);
+    bp_sys::close(fd);
+    bp_sys::close(log_output_fd);
+    log_output_fd = -1;
+    return dasynq::rearm::REMOVED;
+}
+
 bool base_process_service::interrupt_start() noexcept
 {
     if (waiting_restart_timer) {
-        restart_timer.stop_timer(event_loop);
-        waiting_restart_timer = false;
+        cancel_restart();
         return service_record::interrupt_start();
     }
     else {
@@ -333,6 +502,13 @@ void base_process_service::kill_with_fire() noexcept
 
 void base_process_service::kill_pg(int signo) noexcept
 {
+    if (signo == SIGKILL && cgroup_fd != -1) {
+        // Kill everything in the cgroup (including any processes which have left the group):
+        if (bp_sys::cgroup_kill(cgroup_fd) == 0) {
+            return;
+        }
+    }
+
     if (onstart_flags.signal_process_only) {
         bp_sys::kill(pid, signo);
     }
@@ -348,6 +524,58 @@ void base_process_service::kill_pg(int signo) noexcept
     }
 }
 
+bool base_process_service::wait_cgroup_empty() noexcept
+{
+    if (cgroup_fd == -1 || bp_sys::cgroup_populated(cgroup_fd) != 1) {
+        return false;
+    }
+
+    // Start watching before killing the remaining processes, so that we can't miss the cgroup
+    // becoming empty:
+    int watch_fd = bp_sys::cgroup_watch_events(cgroup_fd);
+    if (watch_fd == -1) {
+        log(loglevel_t::WARN, get_name(), ": can't watch cgroup: ", strerror(errno));
+        bp_sys::cgroup_kill(cgroup_fd);
+        return false;
+    }
+
+    try {
+        cgroup_watcher.add_watch(event_loop, watch_fd, dasynq::IN_EVENTS);
+    }
+    catch (std::exception &exc) {
+        log(loglevel_t::WARN, get_name(), ": can't watch cgroup: ", exc.what());
+        bp_sys::close(watch_fd);
+        bp_sys::cgroup_kill(cgroup_fd);
+        return false;
+    }
+
+    bp_sys::cgroup_kill(cgroup_fd);
+    if (bp_sys::cgroup_populated(cgroup_fd) != 1) {
+        cgroup_watcher.deregister(event_loop);
+        bp_sys::close(watch_fd);
+        return false;
+    }
+
+    waiting_cgroup_empty = true;
+    return true;
+}
+
+void base_process_service::release_cgroup() noexcept
+{
+    if (waiting_cgroup_empty) {
+        int watch_fd = cgroup_watcher.get_watched_fd();
+        cgroup_watcher.deregister(event_loop);
+        bp_sys::close(watch_fd);
+        waiting_cgroup_empty = false;
+    }
+    if (cgroup_fd != -1) {
+        bp_sys::close(cgroup_fd);
+        cgroup_fd = -1;
+        // (fails if processes remain in the cgroup, in which case we leave it):
+        bp_sys::cgroup_remove(services->get_cgroup_parent().c_str(), get_name().c_str());
+    }
+}
+
 void base_process_service::timer_expired() noexcept
 {
     stop_timer_armed = false;
@@ -381,13 +609,149 @@ void base_process_service::emergency_stop() noexcept
 
 void base_process_service::becoming_inactive() noexcept
 {
+    release_cgroup();
+    stop_lifetime_timer();
     if (socket_fd != -1) {
+        // An on-demand service keeps its socket open, so that a connection starts it again. If it
+        // failed to start, however, the socket is closed (rather than have connections queue, or
+        // repeatedly trigger a failing start); it is opened again if the service is started.
+        if (onstart_flags.on_demand && ! did_start_fail() && ! services->is_shutting_down()) {
+            watch_activation_socket();
+            return;
+        }
+        unwatch_activation_socket();
+        close(socket_fd);
+        socket_fd = -1;
+    }
+}
+
+void base_process_service::open_activation_socket(bool report_ro_failure) noexcept
+{
+    bool inactive = get_state() == service_state_t::STOPPED
+            && get_target_state() == service_state_t::STOPPED;
+
+    if (socket_fd != -1 && inactive && ! socket_path.empty()) {
+        // If the socket file has disappeared (eg because a filesystem has been mounted over its
+        // directory since the socket was opened), re-create it. This is not done while the service
+        // is active, since its process may already have the socket.
+        struct stat stat_buf;
+        if (stat(socket_path.c_str(), &stat_buf) != 0 && errno == ENOENT) {
+            unwatch_activation_socket();
+            close(socket_fd);
+            socket_fd = -1;
+        }
+    }
+
+    if (open_socket(report_ro_failure) && inactive) {
+        watch_activation_socket();
+    }
+}
+
+void base_process_service::close_activation_socket() noexcept
+{
+    unwatch_activation_socket();
+    stop_lifetime_timer();
+
+    if (socket_fd != -1 && get_state() == service_state_t::STOPPED
+            && get_target_state() == service_state_t::STOPPED) {
         close(socket_fd);
         socket_fd = -1;
     }
 }
 
-bool base_process_service::open_socket() noexcept
+void base_process_service::watch_activation_socket() noexcept
+{
+    if (! onstart_flags.on_demand || socket_fd == -1 || watching_activation) {
+        return;
+    }
+
+    try {
+        activation_watcher.add_watch(event_loop, socket_fd, dasynq::IN_EVENTS);
+        watching_activation = true;
+    }
+    catch (std::exception &exc) {
+        log(loglevel_t::ERROR, get_name(), ": can't watch activation socket: ", exc.what());
+    }
+}
+
+void base_process_service::unwatch_activation_socket() noexcept
+{
+    if (watching_activation) {
+        activation_watcher.deregister(event_loop);
+        watching_activation = false;
+    }
+}
+
+void base_process_service::cancel_restart() noexcept
+{
+    if (waiting_restart_timer) {
+        restart_timer.stop_timer(event_loop);
+        waiting_restart_timer = false;
+        services->get_restart_budget().release();
+    }
+}
+
+void base_process_service::stop_lifetime_timer() noexcept
+{
+    if (lifetime_timer_armed) {
+        lifetime_timer.stop_timer(event_loop);
+        lifetime_timer_armed = false;
+    }
+}
+
+void base_process_service::arm_watchdog() noexcept
+{
+    if (watchdog_timeout != time_val(0,0)) {
+        watchdog.arm_timer_rel(event_loop, watchdog_timeout);
+        watchdog_armed = true;
+    }
+}
+
+void base_process_service::release_notify() noexcept
+{
+    if (notify_pid != -1) {
+        services->remove_notify_pid(notify_pid);
+        notify_pid = -1;
+    }
+    if (watchdog_armed) {
+        watchdog.stop_timer(event_loop);
+        watchdog_armed = false;
+    }
+}
+
+void base_process_service::watchdog_expired() noexcept
+{
+    watchdog_armed = false;
+    if (pid != -1 && get_state() != service_state_t::STOPPING) {
+        log(loglevel_t::WARN, "Service ", get_name(), " with pid ", pid,
+                " exceeded watchdog timeout; killing.");
+        kill_pg(SIGKILL);
+    }
+}
+
+void base_process_service::lifetime_expired() noexcept
+{
+    lifetime_timer_armed = false;
+
+    // If a connection is waiting to be accepted, don't stop the service just as it is about to
+    // handle it; check again after another period.
+    struct pollfd pfd = { socket_fd, POLLIN, 0 };
+    if (socket_fd != -1 && poll(&pfd, 1, 0) == 1) {
+        lifetime_timer.arm_timer_rel(event_loop, activation_lifetime);
+        lifetime_timer_armed = true;
+        return;
+    }
+
+    // Remove the activation (by the connection which started the service), as for a "release"
+    // command. The service stops unless it is also required by another service.
+    if (is_marked_active()) {
+        log(loglevel_t::INFO, get_name(), ": activation lifetime expired; stopping.");
+        stop(false);
+        services->process_queues();
+    }
+}
+
+bool base_process_service::open_socket(bool report_ro_failure) noexcept
 {
     if (socket_path.empty() || socket_fd != -1) {
         // No socket, or already open
@@ -434,7 +798,9 @@ bool base_process_service::open_socket() noexcept
     }
 
     if (bind(sockfd, (struct sockaddr *) name, sockaddr_size) == -1) {
-        log(loglevel_t::ERROR, get_name(), ": Error binding activation socket: ", strerror(errno));
+        if ((errno != EROFS && errno != ENOENT) || report_ro_failure) {
+            log(loglevel_t::ERROR, get_name(), ": Error binding activation socket: ", strerror(errno));
+        }
         close(sockfd);
         free(name);
         return false;
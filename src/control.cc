@@ -8,13 +8,24 @@
 // Server-side control protocol implementation. This implements the functionality that allows
 // clients (such as dinitctl) to query service state and issue commands to control services.
 
+unsigned control_conn_t::buffer_limit = 65536;
+
 namespace {
     constexpr auto OUT_EVENTS = dasynq::OUT_EVENTS;
     constexpr auto IN_EVENTS = dasynq::IN_EVENTS;
 
     // Control protocol minimum compatible version and current version:
     constexpr uint16_t min_compat_version = 1;
-    constexpr uint16_t cp_version = 1;
+    constexpr uint16_t cp_version = 8;
+
+    // Maximum amount of service output returned in a single SERVICELOG reply:
+    constexpr uint32_t max_log_chunk = 16384;
+
+    // Event loop statistics categories, as reported in LOOPSTATS replies:
+    static_assert(DINIT_LS_SIGNAL == dasynq::STATS_SIGNAL && DINIT_LS_FD == dasynq::STATS_FD
+            && DINIT_LS_CHILD == dasynq::STATS_CHILD && DINIT_LS_TIMER == dasynq::STATS_TIMER
+            && DINIT_LS_CONTROL == STATS_CONTROL && DINIT_LS_LOG == STATS_LOG,
+            "event loop statistics categories must match protocol");
 
     // check for value in a set
     template <typename T, int N, typename U>
@@ -51,6 +62,9 @@ bool control_conn_t::process_packet()
             || pktType == DINIT_CP_WAKESERVICE || pktType == DINIT_CP_RELEASESERVICE) {
         return process_start_stop(pktType);
     }
+    if (pktType == DINIT_CP_BATCHSTARTSTOP) {
+        return process_batch_start_stop();
+    }
     if (pktType == DINIT_CP_UNPINSERVICE) {
         return process_unpin_service();
     }
@@ -86,6 +100,24 @@ bool control_conn_t::process_packet()
     if (pktType == DINIT_CP_LISTSERVICES) {
         return list_services();
     }
+    if (pktType == DINIT_CP_LISTSERVICESSINCE) {
+        return list_services_since();
+    }
+    if (pktType == DINIT_CP_SUBSCRIBEALL) {
+        return process_subscribe_all();
+    }
+    if (pktType == DINIT_CP_QUERYTIMELINE) {
+        return list_timeline();
+    }
+    if (pktType == DINIT_CP_CATLOG) {
+        return process_catlog();
+    }
+    if (pktType == DINIT_CP_QUERYLOOPSTATS) {
+        return process_query_loop_stats();
+    }
+    if (pktType == DINIT_CP_QUERYSTATUSTEXT) {
+        return process_query_status_text();
+    }
     if (pktType == DINIT_CP_ADD_DEP) {
         return add_service_dep();
     }
@@ -181,6 +213,173 @@ bool control_conn_t::process_find_load(int pktType)
     return true;
 }
 
+bool control_conn_t::process_batch_start_stop()
+{
+    using std::string;
+
+    constexpr int hdr_size = 3 + 2 * sizeof(uint16_t);
+
+    if (rbuf.get_length() < hdr_size) {
+        chklen = hdr_size;
+        return true;
+    }
+
+    // 1 byte: packet type
+    // 1 byte: command (start/stop)
+    // 1 byte: flags
+    // 2 bytes: number of services
+    // 2 bytes: length of name data
+
+    int command = rbuf[1];
+    bool do_pin = ((rbuf[2] & 1) == 1);
+    bool gentle = ((rbuf[2] & 2) == 2);
+    uint16_t num_services;
+    uint16_t data_len;
+    rbuf.extract((char *) &num_services, 3, sizeof(num_services));
+    rbuf.extract((char *) &data_len, 3 + sizeof(num_services), sizeof(data_len));
+
+    if ((command != DINIT_CP_STARTSERVICE && command != DINIT_CP_STOPSERVICE)
+            || data_len > rbuf.get_size() - hdr_size) {
+        char badreq_rep[] = { DINIT_RP_BADREQ };
+        if (! queue_packet(badreq_rep, 1)) return false;
+        bad_conn_close = true;
+        iob.set_watches(OUT_EVENTS);
+        return true;
+    }
+
+    chklen = hdr_size + data_len;
+    if (rbuf.get_length() < chklen) {
+        // packet not complete yet; read more
+        return true;
+    }
+
+    // Extract the names, checking that they are consistent with the specified count and length:
+    std::vector<string> names;
+    names.reserve(num_services);
+    unsigned pos = hdr_size;
+    unsigned end = chklen;
+    for (unsigned i = 0; i < num_services; i++) {
+        uint16_t name_len;
+        if (end - pos < sizeof(name_len)) break;
+        rbuf.extract((char *) &name_len, pos, sizeof(name_len));
+        pos += sizeof(name_len);
+        if (name_len == 0 || name_len > end - pos) break;
+        names.push_back(rbuf.extract_string(pos, name_len));
+        pos += name_len;
+    }
+
+    if (names.size() != num_services || pos != end) {
+        char badreq_rep[] = { DINIT_RP_BADREQ };
+        if (! queue_packet(badreq_rep, 1)) return false;
+        bad_conn_close = true;
+        iob.set_watches(OUT_EVENTS);
+        return true;
+    }
+
+    // Find/load all services and allocate handles before issuing any start/stop, so that once we
+    // start modifying service state we cannot fail (other than in queueing the reply):
+    std::vector<service_record *> records;
+    std::vector<handle_t> svc_handles;
+    records.reserve(num_services);
+    svc_handles.reserve(num_services);
+    for (auto &name : names) {
+        service_record *record = nullptr;
+        try {
+            record = services->load_service(name.c_str());
+        }
+        catch (service_load_exc &slexc) {
+            log(loglevel_t::ERROR, "Could not load service ", slexc.service_name, ": ",
+                    slexc.exc_description);
+        }
+        records.push_back(record);
+
+        // Re-use an existing handle for the service if there is one (so that repeated batches
+        // don't multiply the service event notifications we send):
+        handle_t handle = 0;
+        if (record != nullptr) {
+            if (! handles.find_handle(record, handle)) {
+                handle = allocate_service_handle(record);
+            }
+        }
+        svc_handles.push_back(handle);
+    }
+
+    constexpr int entry_size = 2 + sizeof(handle_t);
+    std::vector<char> rp_buf(1 + sizeof(uint16_t) + num_services * entry_size);
+    std::vector<char> results(num_services, DINIT_RP_ACK);
+
+    bool do_stop = (command == DINIT_CP_STOPSERVICE);
+
+    if (! do_stop && services->is_shutting_down()) {
+        std::fill(results.begin(), results.end(), DINIT_RP_NAK);
+    }
+    else {
+        // For a gentle stop, services which will be stopped as part of this same batch don't
+        // prevent their dependencies from stopping.
+        std::unordered_set<service_record *> batch_set;
+        if (do_stop && gentle) {
+            batch_set.insert(records.begin(), records.end());
+        }
+
+        for (unsigned i = 0; i < num_services; i++) {
+            service_record *service = records[i];
+            if (service == nullptr) {
+                results[i] = DINIT_RP_NOSERVICE;
+                continue;
+            }
+            if (! do_stop) {
+                if (do_pin) service->pin_start();
+                service->start();
+                continue;
+            }
+            if (gentle) {
+                bool has_dependents = false;
+                for (service_dep *dep : service->get_dependents()) {
+                    if (dep->dep_type == dependency_type::REGULAR && dep->holding_acq
+                            && batch_set.count(dep->get_from()) == 0) {
+                        has_dependents = true;
+                        break;
+                    }
+                }
+                if (has_dependents) {
+                    results[i] = DINIT_RP_DEPENDENTS;
+                    continue;
+                }
+            }
+            if (do_pin) service->pin_stop();
+            service->stop(true);
+            service->forced_stop();
+        }
+
+        services->process_queues();
+
+        service_state_t wanted_state = do_stop ? service_state_t::STOPPED : service_state_t::STARTED;
+        for (unsigned i = 0; i < num_services; i++) {
+            if (results[i] == DINIT_RP_ACK && records[i]->get_state() == wanted_state) {
+                results[i] = DINIT_RP_ALREADYSS;
+            }
+        }
+    }
+
+    // Reply: packet type, count, and (result, handle, state) for each service
+    rp_buf[0] = DINIT_RP_BATCHRESULT;
+    memcpy(rp_buf.data() + 1, &num_services, sizeof(num_services));
+    char *rp_entry = rp_buf.data() + 1 + sizeof(num_services);
+    for (unsigned i = 0; i < num_services; i++) {
+        rp_entry[0] = results[i];
+        memcpy(rp_entry + 1, &svc_handles[i], sizeof(handle_t));
+        rp_entry[1 + sizeof(handle_t)] = (records[i] != nullptr)
+                ? static_cast<char>(records[i]->get_state()) : 0;
+        rp_entry += entry_size;
+    }
+    if (! queue_packet(std::move(rp_buf))) return false;
+
+    // Clear the packet from the buffer
+    rbuf.consume(chklen);
+    chklen = 0;
+    return true;
+}
+
 bool control_conn_t::check_dependents(service_record *service, bool &had_dependents)
 {
     std::vector<char> reply_pkt;
@@ -417,9 +616,8 @@ bool control_conn_t::process_unload_service()
         services->remove_service(service);
         delete service;
 
-        // drop handle
-        service_key_map.erase(service);
-        key_service_map.erase(handle);
+        // drop handle(s)
+        handles.release_all(service);
 
         // send ack
         char ack_buf[] = { (char) DINIT_RP_ACK };
@@ -477,9 +675,8 @@ bool control_conn_t::process_reload_service()
                 service->remove_listener(this);
             }
 
-            // drop handle
-            key_service_map.erase(handle);
-            service_key_map.erase(service);
+            // drop handle(s)
+            handles.release_all(service);
 
             services->process_queues();
 
@@ -501,6 +698,42 @@ bool control_conn_t::process_reload_service()
     return true;
 }
 
+bool control_conn_t::queue_svc_info(service_record *sptr)
+{
+    constexpr int hdrsize = 8 + (sizeof(int) > sizeof(pid_t) ? sizeof(int) : sizeof(pid_t));
+    char hdr_buf[hdrsize];
+
+    const std::string &name = sptr->get_name();
+    int nameLen = std::min((size_t)256, name.length());
+
+    hdr_buf[0] = DINIT_RP_SVCINFO;
+    hdr_buf[1] = nameLen;
+    hdr_buf[2] = static_cast<char>(sptr->get_state());
+    hdr_buf[3] = static_cast<char>(sptr->get_target_state());
+
+    char b0 = sptr->is_waiting_for_console() ? 1 : 0;
+    b0 |= sptr->has_console() ? 2 : 0;
+    b0 |= sptr->was_start_skipped() ? 4 : 0;
+    hdr_buf[4] = b0;
+    hdr_buf[5] = static_cast<char>(sptr->get_stop_reason());
+
+    hdr_buf[6] = 0; // reserved
+    hdr_buf[7] = 0;
+
+    // Next: either the exit status, or the process ID
+    memset(hdr_buf + 8, 0, hdrsize - 8);
+    if (sptr->get_state() != service_state_t::STOPPED) {
+        pid_t proc_pid = sptr->get_pid();
+        memcpy(hdr_buf + 8, &proc_pid, sizeof(proc_pid));
+    }
+    else {
+        int exit_status = sptr->get_exit_status();
+        memcpy(hdr_buf + 8, &exit_status, sizeof(exit_status));
+    }
+
+    return queue_packet({{hdr_buf, (size_t)hdrsize}, {name.data(), (size_t)nameLen}});
+}
+
 bool control_conn_t::list_services()
 {
     rbuf.consume(1); // clear request packet
@@ -509,49 +742,143 @@ bool control_conn_t::list_services()
     try {
         auto slist = services->list_services();
         for (auto sptr : slist) {
-            std::vector<char> pkt_buf;
-            
-            int hdrsize = 8 + std::max(sizeof(int), sizeof(pid_t));
+            if (! queue_svc_info(sptr)) return false;
+            if (bad_conn_close) return true;
+        }
+        
+        char ack_buf[] = { (char) DINIT_RP_LISTDONE };
+        if (! queue_packet(ack_buf, 1)) return false;
+        
+        return true;
+    }
+    catch (std::bad_alloc &exc)
+    {
+        do_oom_close();
+        return true;
+    }
+}
+
+bool control_conn_t::list_services_since()
+{
+    // 1 byte packet type
+    // 8 bytes state generation
+
+    constexpr int pkt_size = 1 + sizeof(uint64_t);
 
+    if (rbuf.get_length() < pkt_size) {
+        chklen = pkt_size;
+        return true;
+    }
+
+    uint64_t since_gen;
+    rbuf.extract((char *) &since_gen, 1, sizeof(since_gen));
+    rbuf.consume(pkt_size);
+    chklen = 0;
+
+    // If services have been removed since the given generation (or the generation is not one
+    // that we issued), the client must be sent a full list, so that it can discard removed
+    // services. Otherwise, only services changed since the given generation are listed.
+    uint64_t current_gen = services->get_state_generation();
+    bool full_list = since_gen == 0 || since_gen < services->get_removal_generation()
+            || since_gen > current_gen;
+
+    char hdr_buf[2 + sizeof(current_gen)];
+    hdr_buf[0] = DINIT_RP_LISTGENERATION;
+    hdr_buf[1] = full_list ? 1 : 0;
+    memcpy(hdr_buf + 2, &current_gen, sizeof(current_gen));
+    if (! queue_packet(hdr_buf, sizeof(hdr_buf))) return false;
+    if (bad_conn_close) return true;
+
+    if (full_list) {
+        for (auto sptr : services->list_services()) {
+            if (! queue_svc_info(sptr)) return false;
+            if (bad_conn_close) return true;
+        }
+    }
+    else {
+        for (service_record *sptr = services->first_changed_since(since_gen); sptr != nullptr;
+                sptr = services->next_changed(sptr)) {
+            if (! queue_svc_info(sptr)) return false;
+            if (bad_conn_close) return true;
+        }
+    }
+
+    char ack_buf[] = { (char) DINIT_RP_LISTDONE };
+    return queue_packet(ack_buf, 1);
+}
+
+static uint64_t to_nanoseconds(const dasynq::time_val &tv) noexcept
+{
+    return uint64_t(tv.seconds()) * 1000000000u + tv.nseconds();
+}
+
+bool control_conn_t::list_timeline()
+{
+    rbuf.consume(1); // clear request packet
+    chklen = 0;
+
+    try {
+        auto slist = services->list_services();
+
+        // Dependencies are identified by their position in the list:
+        std::unordered_map<service_record *, uint32_t> indices;
+        indices.reserve(slist.size());
+        uint32_t index = 0;
+        for (auto sptr : slist) {
+            indices.emplace(sptr, index++);
+        }
+
+        dasynq::time_val now;
+        event_loop.get_time(now, dasynq::clock_type::MONOTONIC);
+        uint32_t count = slist.size();
+        uint64_t now_ns = to_nanoseconds(now);
+
+        char hdr_buf[1 + sizeof(count) + sizeof(now_ns)];
+        hdr_buf[0] = DINIT_RP_TIMELINE;
+        memcpy(hdr_buf + 1, &count, sizeof(count));
+        memcpy(hdr_buf + 1 + sizeof(count), &now_ns, sizeof(now_ns));
+        if (! queue_packet(hdr_buf, sizeof(hdr_buf))) return false;
+        if (bad_conn_close) return true;
+
+        constexpr int dep_entry_size = sizeof(uint32_t) + 1;
+        std::vector<char> dep_buf;
+
+        for (auto sptr : slist) {
             const std::string &name = sptr->get_name();
-            int nameLen = std::min((size_t)256, name.length());
-            pkt_buf.resize(hdrsize + nameLen);
-            
-            pkt_buf[0] = DINIT_RP_SVCINFO;
-            pkt_buf[1] = nameLen;
-            pkt_buf[2] = static_cast<char>(sptr->get_state());
-            pkt_buf[3] = static_cast<char>(sptr->get_target_state());
-            
-            char b0 = sptr->is_waiting_for_console() ? 1 : 0;
-            b0 |= sptr->has_console() ? 2 : 0;
-            b0 |= sptr->was_start_skipped() ? 4 : 0;
-            pkt_buf[4] = b0;
-            pkt_buf[5] = static_cast<char>(sptr->get_stop_reason());
-
-            pkt_buf[6] = 0; // reserved
-            pkt_buf[7] = 0;
-            
-            // Next: either the exit status, or the process ID
-            if (sptr->get_state() != service_state_t::STOPPED) {
-                pid_t proc_pid = sptr->get_pid();
-                memcpy(pkt_buf.data() + 8, &proc_pid, sizeof(proc_pid));
-            }
-            else {
-                int exit_status = sptr->get_exit_status();
-                memcpy(pkt_buf.data() + 8, &exit_status, sizeof(exit_status));
+            uint16_t name_len = std::min(name.length(), (size_t)std::numeric_limits<uint16_t>::max());
+            auto &deps = sptr->get_dependencies();
+            uint32_t num_deps = deps.size();
+
+            constexpr int svc_hdr_size = 2 + sizeof(name_len) + sizeof(num_deps)
+                    + NUM_TIMELINE_EVENTS * sizeof(uint64_t);
+            char svc_buf[svc_hdr_size];
+            svc_buf[0] = DINIT_RP_SVCTIMELINE;
+            svc_buf[1] = static_cast<char>(sptr->get_state());
+            memcpy(svc_buf + 2, &name_len, sizeof(name_len));
+            memcpy(svc_buf + 2 + sizeof(name_len), &num_deps, sizeof(num_deps));
+            char *times_buf = svc_buf + 2 + sizeof(name_len) + sizeof(num_deps);
+            auto &timeline = sptr->get_start_timeline();
+            for (int i = 0; i < NUM_TIMELINE_EVENTS; i++) {
+                uint64_t t_ns = to_nanoseconds(timeline.get((timeline_event_t)i));
+                memcpy(times_buf + i * sizeof(uint64_t), &t_ns, sizeof(t_ns));
             }
 
-            for (int i = 0; i < nameLen; i++) {
-                pkt_buf[hdrsize+i] = name[i];
+            dep_buf.resize(num_deps * dep_entry_size);
+            char *dep_ptr = dep_buf.data();
+            for (auto &dep : deps) {
+                uint32_t dep_index = indices[dep.get_to()];
+                memcpy(dep_ptr, &dep_index, sizeof(dep_index));
+                dep_ptr[sizeof(dep_index)] = static_cast<char>(dep.dep_type);
+                dep_ptr += dep_entry_size;
             }
-            
-            if (! queue_packet(std::move(pkt_buf))) return false;
+
+            if (! queue_packet({{svc_buf, (size_t)svc_hdr_size}, {name.data(), (size_t)name_len},
+                    {dep_buf.data(), dep_buf.size()}})) return false;
+            if (bad_conn_close) return true;
         }
-        
+
         char ack_buf[] = { (char) DINIT_RP_LISTDONE };
-        if (! queue_packet(ack_buf, 1)) return false;
-        
-        return true;
+        return queue_packet(ack_buf, 1);
     }
     catch (std::bad_alloc &exc)
     {
@@ -560,6 +887,365 @@ bool control_conn_t::list_services()
     }
 }
 
+bool control_conn_t::process_subscribe_all()
+{
+    // 1 byte packet type
+    // 1 byte: 1 = subscribe, 0 = unsubscribe
+
+    constexpr int pkt_size = 2;
+
+    if (rbuf.get_length() < pkt_size) {
+        chklen = pkt_size;
+        return true;
+    }
+
+    bool subscribe = (rbuf[1] != 0);
+    rbuf.consume(pkt_size);
+    chklen = 0;
+
+    if (subscribe && ! subscribed_all) {
+        services->add_listener(this);
+        subscribed_all = true;
+    }
+    else if (! subscribe && subscribed_all) {
+        services->remove_listener(this);
+        subscribed_all = false;
+        clear_state_events();
+    }
+
+    char ack_buf[] = { (char) DINIT_RP_ACK };
+    return queue_packet(ack_buf, 1);
+}
+
+bool control_conn_t::process_catlog()
+{
+    // 1 byte packet type
+    // 1 byte flags: 1 = discard returned output, 2 = wait for output if none available
+    // handle: service
+    // 8 bytes: stream position from which to read
+    constexpr int pkt_size = 2 + sizeof(handle_t) + sizeof(uint64_t);
+
+    if (rbuf.get_length() < pkt_size) {
+        chklen = pkt_size;
+        return true;
+    }
+
+    char flags = rbuf[1];
+    handle_t handle;
+    uint64_t from_pos;
+    rbuf.extract(&handle, 2, sizeof(handle));
+    rbuf.extract(&from_pos, 2 + sizeof(handle), sizeof(from_pos));
+    rbuf.consume(pkt_size);
+    chklen = 0;
+
+    service_record *service = find_service_for_key(handle);
+    if (service == nullptr) {
+        // Service handle is bad
+        char badreq_rep[] = { DINIT_RP_BADREQ };
+        if (! queue_packet(badreq_rep, 1)) return false;
+        bad_conn_close = true;
+        iob.set_watches(OUT_EVENTS);
+        return true;
+    }
+
+    service_log_buffer *log_buf = service->get_log_buffer();
+    if (log_buf == nullptr) {
+        // Output of this service is not buffered
+        char nak_rep[] = { DINIT_RP_NAK };
+        return queue_packet(nak_rep, 1);
+    }
+
+    if ((flags & 2) && from_pos >= log_buf->get_end_pos()) {
+        // Reply when output becomes available (see service_log_output()).
+        log_wait_service = service;
+        log_wait_pos = from_pos;
+        log_wait_flags = flags;
+        return true;
+    }
+
+    return queue_log_output(log_buf, from_pos, flags);
+}
+
+bool control_conn_t::process_query_loop_stats()
+{
+    // 1 byte packet type
+    // 1 byte flags: 1 = reset statistics
+    constexpr int pkt_size = 2;
+
+    if (rbuf.get_length() < pkt_size) {
+        chklen = pkt_size;
+        return true;
+    }
+
+    bool reset = (rbuf[1] & 1) != 0;
+    rbuf.consume(pkt_size);
+    chklen = 0;
+
+    dasynq::loop_stats stats;
+    if (! loop.get_stats(stats, reset)) {
+        // Not built with instrumentation
+        char nak_rep[] = { DINIT_RP_NAK };
+        return queue_packet(nak_rep, 1);
+    }
+
+    // Reply:
+    // 1 byte packet type = DINIT_RP_LOOPSTATS
+    // 1 byte number of categories, 1 byte number of buckets
+    // histograms (see control-cmds.h)
+    constexpr unsigned num_cats = dasynq::STATS_CATEGORIES;
+    constexpr unsigned num_buckets = dasynq::stats_histogram::num_buckets;
+    constexpr size_t hist_size = (3 + num_buckets) * sizeof(uint64_t);
+
+    std::vector<char> pkt;
+    try {
+        pkt.resize(3 + (1 + 2 * num_cats) * hist_size);
+    }
+    catch (std::bad_alloc &exc) {
+        do_oom_close();
+        return true;
+    }
+
+    pkt[0] = DINIT_RP_LOOPSTATS;
+    pkt[1] = (char)num_cats;
+    pkt[2] = (char)num_buckets;
+
+    char *pkt_ptr = pkt.data() + 3;
+    auto put_histogram = [&pkt_ptr](const dasynq::stats_histogram &hist) {
+        memcpy(pkt_ptr, &hist.count, sizeof(uint64_t));
+        memcpy(pkt_ptr + sizeof(uint64_t), &hist.total, sizeof(uint64_t));
+        memcpy(pkt_ptr + 2 * sizeof(uint64_t), &hist.max, sizeof(uint64_t));
+        memcpy(pkt_ptr + 3 * sizeof(uint64_t), hist.buckets, sizeof(hist.buckets));
+        pkt_ptr += hist_size;
+    };
+
+    put_histogram(stats.batch_size);
+    for (auto &hist : stats.dispatch_latency) put_histogram(hist);
+    for (auto &hist : stats.callback_time) put_histogram(hist);
+
+    return queue_packet(std::move(pkt));
+}
+
+bool control_conn_t::process_query_status_text()
+{
+    // 1 byte packet type
+    // handle: service
+    constexpr int pkt_size = 1 + sizeof(handle_t);
+
+    if (rbuf.get_length() < pkt_size) {
+        chklen = pkt_size;
+        return true;
+    }
+
+    handle_t handle;
+    rbuf.extract(&handle, 1, sizeof(handle));
+    rbuf.consume(pkt_size);
+    chklen = 0;
+
+    service_record *service = find_service_for_key(handle);
+    if (service == nullptr) {
+        // Service handle is bad
+        char badreq_rep[] = { DINIT_RP_BADREQ };
+        if (! queue_packet(badreq_rep, 1)) return false;
+        bad_conn_close = true;
+        iob.set_watches(OUT_EVENTS);
+        return true;
+    }
+
+    // Reply:
+    // 1 byte packet type = DINIT_RP_STATUSTEXT
+    // 1 byte reserved
+    // uint32_t length
+    // N bytes status text
+    const std::string &status_text = service->get_status_text();
+    uint32_t length = status_text.length();
+
+    constexpr size_t hdr_size = 2 + sizeof(uint32_t);
+    std::vector<char> reply;
+    try {
+        reply.resize(hdr_size + length);
+    }
+    catch (std::bad_alloc &exc) {
+        do_oom_close();
+        return true;
+    }
+
+    reply[0] = DINIT_RP_STATUSTEXT;
+    reply[1] = 0;
+    memcpy(reply.data() + 2, &length, sizeof(length));
+    memcpy(reply.data() + hdr_size, status_text.data(), length);
+
+    return queue_packet(std::move(reply));
+}
+
+bool control_conn_t::queue_log_output(service_log_buffer *log_buf, uint64_t from_pos, char flags)
+{
+    // Reply:
+    // 1 byte packet type = DINIT_RP_SERVICELOG
+    // 1 byte reserved
+    // 8 bytes: stream position of returned output
+    // 8 bytes: stream position following the most recent output in the buffer
+    // uint32_t length
+    // N bytes output
+
+    uint64_t end_pos = log_buf->get_end_pos();
+    uint64_t start_pos = std::min(std::max(from_pos, log_buf->get_start_pos()), end_pos);
+    uint32_t length = std::min(end_pos - start_pos, uint64_t(max_log_chunk));
+
+    constexpr size_t hdr_size = 2 + 2 * sizeof(uint64_t) + sizeof(uint32_t);
+    std::vector<char> reply(hdr_size + length);
+    reply[0] = DINIT_RP_SERVICELOG;
+    reply[1] = 0;
+    memcpy(reply.data() + 2, &start_pos, sizeof(start_pos));
+    memcpy(reply.data() + 2 + sizeof(uint64_t), &end_pos, sizeof(end_pos));
+    memcpy(reply.data() + 2 + 2 * sizeof(uint64_t), &length, sizeof(length));
+    log_buf->extract(reply.data() + hdr_size, start_pos, length);
+
+    if (flags & 1) {
+        log_buf->discard_to(start_pos + length);
+    }
+
+    return queue_packet(std::move(reply));
+}
+
+void control_conn_t::service_log_output(service_record *service) noexcept
+{
+    if (service != log_wait_service) return;
+    log_wait_service = nullptr;
+
+    // Queue the reply to the waiting request. Once it has been written, processing of requests will
+    // resume (see send_data()).
+    bool was_deferred = defer_output;
+    defer_output = true;
+    try {
+        queue_log_output(service->get_log_buffer(), log_wait_pos, log_wait_flags);
+    }
+    catch (std::bad_alloc &exc) {
+        do_oom_close();
+    }
+    defer_output = was_deferred;
+
+    if (! defer_output) {
+        set_io_watches();
+    }
+}
+
+void control_conn_t::service_state_change(service_record *service, service_state_t old_state) noexcept
+{
+    if (bad_conn_close) return;
+
+    try {
+        uint32_t id = service->get_id();
+        pid_t pid = service->get_pid();
+        service_state_t new_state = service->get_state();
+
+        time_val now;
+        loop.get_time(now, clock_type::MONOTONIC);
+        uint64_t timestamp = uint64_t(now.seconds()) * 1000000000u + now.nseconds();
+
+        // If a change for this service is already pending, merge this change into it:
+        auto pi = pending_index.find(id);
+        if (pi != pending_index.end()) {
+            state_event &pending = pending_events[pi->second];
+            pending.new_state = new_state;
+            pending.coalesced = true;
+            pending.pid = pid;
+            pending.timestamp = timestamp;
+            return;
+        }
+
+        state_event event = { id, old_state, new_state, false, pid, timestamp, {} };
+        if (id >= announced_ids.size() || ! announced_ids[id]) {
+            event.name = service->get_name();
+        }
+
+        // Send now, unless output is backed up (or earlier changes are pending):
+        if (pending_head == pending_events.size() && outbuf.size() < buffer_limit) {
+            queue_state_event(event);
+            return;
+        }
+
+        pending_index.emplace(id, pending_events.size());
+        try {
+            pending_events.push_back(std::move(event));
+        }
+        catch (...) {
+            pending_index.erase(id);
+            throw;
+        }
+    }
+    catch (std::bad_alloc &exc) {
+        do_oom_close();
+    }
+}
+
+void control_conn_t::queue_state_event(state_event &event)
+{
+    uint32_t id = event.service_id;
+
+    if (! event.name.empty()) {
+        if (id >= announced_ids.size()) {
+            announced_ids.resize(id + 1);
+        }
+
+        constexpr size_t hdr_size = 2 + sizeof(id);
+        constexpr size_t max_name_len = 255 - hdr_size;
+        size_t name_len = std::min(event.name.length(), max_name_len);
+        char hdr_buf[hdr_size];
+        hdr_buf[0] = DINIT_IP_SERVICENAMEID;
+        hdr_buf[1] = hdr_size + name_len;
+        memcpy(hdr_buf + 2, &id, sizeof(id));
+        if (! queue_packet({{hdr_buf, hdr_size}, {event.name.data(), name_len}})) return;
+        if (bad_conn_close) return;
+        announced_ids[id] = true;
+    }
+
+    constexpr size_t pkt_size = 2 + sizeof(id) + 3 + sizeof(pid_t) + sizeof(uint64_t);
+    char pkt[pkt_size];
+    pkt[0] = DINIT_IP_SERVICESTATE;
+    pkt[1] = pkt_size;
+    memcpy(pkt + 2, &id, sizeof(id));
+    pkt[2 + sizeof(id)] = static_cast<char>(event.old_state);
+    pkt[3 + sizeof(id)] = static_cast<char>(event.new_state);
+    pkt[4 + sizeof(id)] = event.coalesced ? 1 : 0;
+    memcpy(pkt + 5 + sizeof(id), &event.pid, sizeof(pid_t));
+    memcpy(pkt + 5 + sizeof(id) + sizeof(pid_t), &event.timestamp, sizeof(uint64_t));
+    queue_packet(pkt, pkt_size);
+}
+
+void control_conn_t::flush_state_events() noexcept
+{
+    bool was_deferred = defer_output;
+    defer_output = true;
+
+    try {
+        while (pending_head < pending_events.size() && outbuf.size() < buffer_limit
+                && ! bad_conn_close) {
+            state_event &event = pending_events[pending_head];
+            pending_index.erase(event.service_id);
+            ++pending_head;
+            queue_state_event(event);
+        }
+    }
+    catch (std::bad_alloc &exc) {
+        do_oom_close();
+    }
+
+    if (pending_head == pending_events.size()) {
+        clear_state_events();
+    }
+    else if (pending_head > pending_events.size() / 2) {
+        // Discard sent changes, so that the queue remains bounded (by the number of services)
+        // even if it never fully drains:
+        pending_events.erase(pending_events.begin(), pending_events.begin() + pending_head);
+        for (auto &entry : pending_index) {
+            entry.second -= pending_head;
+        }
+        pending_head = 0;
+    }
+
+    defer_output = was_deferred;
+}
+
 bool control_conn_t::add_service_dep(bool do_enable)
 {
     // 1 byte packet type
@@ -848,151 +1534,112 @@ bool control_conn_t::query_load_mech()
 
 control_conn_t::handle_t control_conn_t::allocate_service_handle(service_record *record)
 {
-    // Try to find a unique handle (integer) in a single pass. Since the map is ordered, we can search until
-    // we find a gap in the handle values.
-    handle_t candidate = 0;
-    for (auto p : key_service_map) {
-        if (p.first == candidate) ++candidate;
-        else break;
-    }
+    bool first_for_service;
+    handle_t handle = handles.allocate(record, first_for_service);
 
-    bool is_unique = (service_key_map.find(record) == service_key_map.end());
-
-    // The following operations perform allocation (can throw std::bad_alloc). If an exception occurs we
-    // must undo any previous actions:
-    if (is_unique) {
-        record->add_listener(this);
-    }
-    
-    try {
-        key_service_map[candidate] = record;
-        service_key_map.insert(std::make_pair(record, candidate));
-    }
-    catch (...) {
-        if (is_unique) {
-            record->remove_listener(this);
+    if (first_for_service) {
+        try {
+            record->add_listener(this);
+        }
+        catch (...) {
+            handles.release_all(record);
+            throw;
         }
-
-        key_service_map.erase(candidate);
     }
-    
-    return candidate;
+
+    return handle;
 }
 
-bool control_conn_t::queue_packet(const char *pkt, unsigned size) noexcept
+bool control_conn_t::queue_packet(std::initializer_list<control_outbuf::part> parts) noexcept
 {
-    int in_flag = bad_conn_close ? 0 : IN_EVENTS;
     bool was_empty = outbuf.empty();
 
-    // If the queue is empty, we can try to write the packet out now rather than queueing it.
-    // If the write is unsuccessful or partial, we queue the remainder.
-    if (was_empty) {
-        int wr = bp_sys::write(iob.get_watched_fd(), pkt, size);
-        if (wr == -1) {
-            if (errno == EPIPE) {
-                return false;
-            }
-            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
-                log(loglevel_t::WARN, "Error writing to control connection: ", strerror(errno));
-                return false;
-            }
-            // EAGAIN etc: fall through to below
-        }
-        else {
-            if ((unsigned)wr == size) {
-                // Ok, all written.
-                iob.set_watches(in_flag);
-                return true;
-            }
-            pkt += wr;
-            size -= wr;
-        }
-    }
-    
-    // Create a vector out of the (remaining part of the) packet:
     try {
-        outbuf.emplace_back(pkt, pkt + size);
-        iob.set_watches(in_flag | OUT_EVENTS);
-        return true;
+        outbuf.append(parts);
     }
     catch (std::bad_alloc &baexc) {
-        // Mark the connection bad, and stop reading further requests
-        bad_conn_close = true;
-        oom_close = true;
-        if (was_empty) {
-            // We can't send out-of-memory response as we already wrote as much as we
-            // could above. Neither can we later send the response since we have currently
-            // sent an incomplete packet. All we can do is close the connection.
-            return false;
-        }
-        else {
-            iob.set_watches(OUT_EVENTS);
-            return true;
-        }
+        // Mark the connection bad, and stop reading further requests. Since the output buffer
+        // holds only complete packets, the out-of-memory response can be sent once the buffer
+        // has been written.
+        do_oom_close();
+        return true;
     }
+
+    // If deferring output, the packet will be written (along with any others) once processing
+    // is complete:
+    if (defer_output) return true;
+
+    // If the queue was empty, we can try to write the packet out now. Otherwise, we're already
+    // waiting for the connection to become writable.
+    if (was_empty) {
+        if (! write_output()) return false;
+    }
+
+    set_io_watches();
+    return true;
+}
+
+bool control_conn_t::queue_packet(const char *pkt, unsigned size) noexcept
+{
+    return queue_packet({{pkt, size}});
 }
 
-// This queue_packet method is frustratingly similar to the one above, but the subtle differences
-// make them extraordinary difficult to combine into a single method.
 bool control_conn_t::queue_packet(std::vector<char> &&pkt) noexcept
 {
-    int in_flag = bad_conn_close ? 0 : IN_EVENTS;
-    bool was_empty = outbuf.empty();
-    
-    if (was_empty) {
-        outpkt_index = 0;
-        // We can try sending the packet immediately:
-        int wr = bp_sys::write(iob.get_watched_fd(), pkt.data(), pkt.size());
-        if (wr == -1) {
+    return queue_packet({{pkt.data(), pkt.size()}});
+}
+
+bool control_conn_t::write_output() noexcept
+{
+    while (! outbuf.empty()) {
+        struct iovec iov[control_outbuf::max_iov];
+        int iovcnt = outbuf.get_iov(iov, control_outbuf::max_iov);
+        size_t iov_total = 0;
+        for (int i = 0; i < iovcnt; i++) {
+            iov_total += iov[i].iov_len;
+        }
+
+        ssize_t written = bp_sys::writev(iob.get_watched_fd(), iov, iovcnt);
+        if (written == -1) {
             if (errno == EPIPE) {
+                // read end closed
                 return false;
             }
-            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
-                log(loglevel_t::WARN, "Error writing to control connection: ", strerror(errno));
-                return false;
-            }
-            // EAGAIN etc: fall through to below
-        }
-        else {
-            if ((unsigned)wr == pkt.size()) {
-                // Ok, all written.
-                iob.set_watches(in_flag);
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                // can't write any more now
                 return true;
             }
-            outpkt_index = wr;
-        }
-    }
-    
-    try {
-        outbuf.emplace_back(pkt);
-        iob.set_watches(in_flag | OUT_EVENTS);
-        return true;
-    }
-    catch (std::bad_alloc &baexc) {
-        // Mark the connection bad, and stop reading further requests
-        bad_conn_close = true;
-        oom_close = true;
-        if (was_empty) {
-            // We can't send out-of-memory response as we already wrote as much as we
-            // could above. Neither can we later send the response since we have currently
-            // sent an incomplete packet. All we can do is close the connection.
+            log(loglevel_t::WARN, "Error writing to control connection: ", strerror(errno));
             return false;
         }
-        else {
-            iob.set_watches(OUT_EVENTS);
-            return true;
+
+        outbuf.consume(written);
+        if ((size_t)written < iov_total) {
+            // Partial write; socket buffer is presumably full
+            break;
         }
     }
+
+    return true;
 }
 
 bool control_conn_t::data_ready() noexcept
 {
     int fd = iob.get_watched_fd();
-    
+
+    if (outbuf.size() >= buffer_limit || rbuf.is_full()) {
+        // Input is currently suspended (the input watch should not be enabled)
+        return false;
+    }
+
     int r = rbuf.fill(fd);
     
     // Note file descriptor is non-blocking
     if (r == -1) {
+        if (errno == ENOMEM) {
+            do_oom_close();
+            return false;
+        }
         if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
             log(loglevel_t::WARN, "Error writing to control connection: ", strerror(errno));
             return true;
@@ -1004,30 +1651,61 @@ bool control_conn_t::data_ready() noexcept
         return true;
     }
     
-    // complete packet?
-    if (rbuf.get_length() >= chklen) {
-        try {
-            return !process_packet();
-        }
-        catch (std::bad_alloc &baexc) {
-            do_oom_close();
-            return false;
+    return process_packets();
+}
+
+bool control_conn_t::process_packets() noexcept
+{
+    // Process all complete packets. Output is deferred while processing, so that all packets
+    // queued as a result (replies and any service events) are written together.
+    defer_output = true;
+    bool keep_conn = true;
+    try {
+        while (! bad_conn_close && rbuf.get_length() > 0 && rbuf.get_length() >= chklen
+                && outbuf.size() < buffer_limit && log_wait_service == nullptr) {
+            int prev_length = rbuf.get_length();
+            keep_conn = process_packet();
+            if (! keep_conn || rbuf.get_length() == prev_length) {
+                // connection to be closed, or packet not complete
+                break;
+            }
         }
     }
-    else if (rbuf.get_length() == rbuf.get_size()) {
-        // Too big packet
+    catch (std::bad_alloc &baexc) {
+        do_oom_close();
+    }
+    defer_output = false;
+
+    if (! keep_conn) return true;
+
+    if (! bad_conn_close && rbuf.is_full() && outbuf.size() < buffer_limit && log_wait_service == nullptr) {
+        // The buffer is full, but doesn't contain a complete packet
         log(loglevel_t::WARN, "Received too-large control packet; dropping connection");
         bad_conn_close = true;
-        iob.set_watches(OUT_EVENTS);
-    }
-    else {
-        int out_flags = (bad_conn_close || !outbuf.empty()) ? OUT_EVENTS : 0;
-        iob.set_watches(IN_EVENTS | out_flags);
     }
-    
+
+    if (! write_output()) return true;
+    set_io_watches();
     return false;
 }
 
+void control_conn_t::set_io_watches() noexcept
+{
+    if (bad_conn_close) {
+        // Connection will be closed once output has been written
+        iob.set_watches(OUT_EVENTS);
+        return;
+    }
+
+    // Stop reading requests while there's too much output pending; the client must read
+    // some first. (While a request is waiting for service output, we continue reading, to detect
+    // the connection being closed, until the buffer is full).
+    int in_flag = (outbuf.size() < buffer_limit) ? IN_EVENTS : 0;
+    if (log_wait_service != nullptr && rbuf.is_full()) in_flag = 0;
+    int out_flag = outbuf.empty() ? 0 : OUT_EVENTS;
+    iob.set_watches(in_flag | out_flag);
+}
+
 bool control_conn_t::send_data() noexcept
 {
     if (outbuf.empty() && bad_conn_close) {
@@ -1039,39 +1717,30 @@ bool control_conn_t::send_data() noexcept
         return true;
     }
     
-    vector<char> & pkt = outbuf.front();
-    char *data = pkt.data();
-    int written = bp_sys::write(iob.get_watched_fd(), data + outpkt_index, pkt.size() - outpkt_index);
-    if (written == -1) {
-        if (errno == EPIPE) {
-            // read end closed
-            return true;
-        }
-        else if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
-            // spurious readiness notification?
-        }
-        else {
-            log(loglevel_t::ERROR, "Error writing to control connection: ", strerror(errno));
+    if (! write_output()) {
+        return true;
+    }
+
+    if (bad_conn_close) {
+        return outbuf.empty() && ! oom_close;
+    }
+
+    // Send any state changes held back while output was at the limit:
+    if (pending_head != pending_events.size() && outbuf.size() < buffer_limit) {
+        flush_state_events();
+        if (! write_output()) {
             return true;
         }
-        return false;
     }
 
-    outpkt_index += written;
-    if (outpkt_index == pkt.size()) {
-        // We've finished this packet, move on to the next:
-        outbuf.pop_front();
-        outpkt_index = 0;
-        if (outbuf.empty() && ! oom_close) {
-            if (! bad_conn_close) {
-                iob.set_watches(IN_EVENTS);
-            }
-            else {
-                return true;
-            }
-        }
+    // If processing was suspended due to pending output (or a request waiting for service output),
+    // resume:
+    if (outbuf.size() < buffer_limit && rbuf.get_length() > 0 && rbuf.get_length() >= chklen
+            && log_wait_service == nullptr) {
+        return process_packets();
     }
-    
+
+    set_io_watches();
     return false;
 }
 
@@ -1081,8 +1750,11 @@ control_conn_t::~control_conn_t() noexcept
     iob.deregister(loop);
     
     // Clear service listeners
-    for (auto p : service_key_map) {
-        p.first->remove_listener(this);
+    handles.for_each_service([this](service_record *sr) {
+        sr->remove_listener(this);
+    });
+    if (subscribed_all) {
+        services->remove_listener(this);
     }
     
     active_control_conns--;
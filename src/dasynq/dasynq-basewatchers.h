@@ -121,6 +121,11 @@ namespace dprivate {
         prio_queue::handle_t heap_handle;
         int priority;
 
+#if DASYNQ_INSTRUMENT
+        unsigned stats_category;  // category for statistics (STATS_SIGNAL etc)
+        uint64_t queued_time;     // time at which the watcher was queued (for statistics)
+#endif
+
         static void set_priority(base_watcher &p, int prio)
         {
             p.priority = prio;
@@ -138,7 +143,23 @@ namespace dprivate {
             priority = DEFAULT_PRIORITY;
         }
 
-        base_watcher(watch_type_t wt) noexcept : watchType(wt) { }
+        base_watcher(watch_type_t wt) noexcept : watchType(wt)
+        {
+#if DASYNQ_INSTRUMENT
+            stats_category = (wt == watch_type_t::SIGNAL) ? STATS_SIGNAL
+                    : (wt == watch_type_t::CHILD) ? STATS_CHILD
+                    : (wt == watch_type_t::TIMER) ? STATS_TIMER
+                    : STATS_FD;
+#endif
+        }
+
+        // Set the category used for statistics (has no effect unless DASYNQ_INSTRUMENT is enabled).
+        void set_stats_category(unsigned category) noexcept
+        {
+#if DASYNQ_INSTRUMENT
+            stats_category = category;
+#endif
+        }
         base_watcher(const base_watcher &) = delete;
         base_watcher &operator=(const base_watcher &) = delete;
 
@@ -30,6 +30,17 @@
 // If the pselect system call is available:
 //     #define HAVE_PSELECT 1
 //
+// To use a hierarchical timing wheel, rather than a heap, for the timer queues (see
+// dasynq-timerwheel.h). This allows timers to expire late, by up to around 1/8 of their timeout,
+// but makes adding and removing timers cheaper, which may be worthwhile if there are many (thousands
+// of) active timers which are frequently re-armed. The resolution (tick length) is in nanoseconds:
+//     #define DASYNQ_TIMER_WHEEL 1
+//     #define DASYNQ_TIMER_WHEEL_RESOLUTION 1000000
+//
+// To record statistics (histograms of event batch size, dispatch latency and callback duration) in the
+// event loop; see dasynq-stats.h. This adds some overhead (reading the clock) for each event:
+//     #define DASYNQ_INSTRUMENT 1
+//
 // A tag to include at the end of a class body for a class which is allowed to have zero size.
 // Normally, C++ mandates that all objects (except empty base subobjects) have non-zero size, but on some
 // compilers (at least GCC and LLVM-Clang) there are tricks to get around this awkward limitation. Note that
@@ -74,6 +85,22 @@
 #endif
 #endif
 
+// Timer queue implementation
+
+#if ! defined(DASYNQ_TIMER_WHEEL)
+#define DASYNQ_TIMER_WHEEL 0
+#endif
+
+#if ! defined(DASYNQ_TIMER_WHEEL_RESOLUTION)
+#define DASYNQ_TIMER_WHEEL_RESOLUTION 1000000
+#endif
+
+// Instrumentation
+
+#if ! defined(DASYNQ_INSTRUMENT)
+#define DASYNQ_INSTRUMENT 0
+#endif
+
 // General feature availability
 
 #if (defined(__OpenBSD__) || defined(__linux__)) && ! defined(HAVE_PIPE2)
@@ -112,6 +112,7 @@ template <class Base> class epoll_loop : public Base
     void process_events(epoll_event *events, int r)
     {
         std::lock_guard<decltype(Base::lock)> guard(Base::lock);
+        Base::record_batch(r);
         
         for (int i = 0; i < r; i++) {
             void * ptr = events[i].data.ptr;
@@ -97,6 +97,7 @@ template <class Base> class macos_kqueue_loop : public signal_events<Base, true>
     void process_events(struct kevent *events, int r)
     {
         std::lock_guard<decltype(Base::lock)> guard(Base::lock);
+        Base::record_batch(r);
 
         for (int i = 0; i < r; i++) {
             if (events[i].filter == EVFILT_READ || events[i].filter == EVFILT_WRITE) {
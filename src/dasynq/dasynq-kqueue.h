@@ -206,6 +206,7 @@ template <class Base> class kqueue_loop : public Base
     void process_events(struct kevent *events, int r)
     {
         std::lock_guard<decltype(Base::lock)> guard(Base::lock);
+        Base::record_batch(r);
         
         for (int i = 0; i < r; i++) {
             if (events[i].filter == EVFILT_SIGNAL) {
@@ -0,0 +1,76 @@
+#ifndef DASYNQ_STATS_H_INCLUDED
+#define DASYNQ_STATS_H_INCLUDED
+
+#include <cstdint>
+
+#include <time.h>
+
+namespace dasynq {
+
+// Event loop instrumentation (see DASYNQ_INSTRUMENT in dasynq-config.h).
+//
+// When enabled, the event loop records:
+//  - the number of events retrieved from the backend mechanism at a time (batch size)
+//  - the latency between an event being queued and its watcher being dispatched
+//  - the time taken by watcher callbacks
+// The latter two are recorded separately for each of a number of watcher categories. By default a
+// watcher's category is determined by its type (STATS_SIGNAL etc); a watcher can be assigned to
+// another category via its set_stats_category() function, with STATS_USER and above available for
+// application-defined categories.
+
+constexpr unsigned STATS_SIGNAL = 0;
+constexpr unsigned STATS_FD = 1;
+constexpr unsigned STATS_CHILD = 2;
+constexpr unsigned STATS_TIMER = 3;
+constexpr unsigned STATS_USER = 4;
+
+constexpr unsigned STATS_CATEGORIES = 8;
+
+// A histogram of values with logarithmic (base 2) buckets: bucket 0 counts values 0 and 1, and bucket
+// N (N > 0) counts values from 2^N up to (2^(N+1) - 1). The last bucket counts all values too large
+// for the other buckets.
+class stats_histogram
+{
+    public:
+    static constexpr unsigned num_buckets = 32;
+
+    uint64_t count = 0;   // number of recorded values
+    uint64_t total = 0;   // sum of recorded values
+    uint64_t max = 0;     // largest recorded value
+    uint64_t buckets[num_buckets] = {};
+
+    void record(uint64_t value) noexcept
+    {
+        unsigned bucket = (value <= 1) ? 0 : (63 - __builtin_clzll(value));
+        if (bucket >= num_buckets) bucket = num_buckets - 1;
+        buckets[bucket]++;
+        count++;
+        total += value;
+        if (value > max) max = value;
+    }
+};
+
+// Statistics recorded by an event loop. Times are in nanoseconds.
+class loop_stats
+{
+    public:
+    stats_histogram batch_size;
+    stats_histogram dispatch_latency[STATS_CATEGORIES];
+    stats_histogram callback_time[STATS_CATEGORIES];
+};
+
+namespace dprivate {
+
+// Get the current (monotonic) time, in nanoseconds, for statistics purposes
+inline uint64_t stats_now() noexcept
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000u + ts.tv_nsec;
+}
+
+} // namespace dprivate
+
+} // namespace dasynq
+
+#endif
@@ -6,7 +6,10 @@
 
 #include <time.h>
 
+#include "dasynq-config.h"
+#include "dasynq-flags.h"
 #include "dasynq-daryheap.h"
+#include "dasynq-timerwheel.h"
 
 namespace dasynq {
 
@@ -210,7 +213,11 @@ class compare_timespec
     }
 };
 
+#if DASYNQ_TIMER_WHEEL
+using timer_queue_t = timer_wheel<timer_data, time_val, DASYNQ_TIMER_WHEEL_RESOLUTION>;
+#else
 using timer_queue_t = dary_heap<timer_data, time_val, compare_timespec>;
+#endif
 using timer_handle_t = timer_queue_t::handle_t;
 
 static inline void init_timer_handle(timer_handle_t &hnd) noexcept
@@ -303,6 +310,17 @@ template <typename Base> class timer_base : public Base
     {
         return timer_queue.empty() && mono_timer_queue.empty();
     }
+
+#if DASYNQ_TIMER_WHEEL
+    public:
+    timer_base()
+    {
+        timer_queue.set_clock(clock_type::SYSTEM);
+        mono_timer_queue.set_clock(clock_type::MONOTONIC);
+    }
+
+    protected:
+#endif
 #else
     // If there is no monotonic clock, map both clock_type::MONOTONIC and clock_type::SYSTEM to a
     // single clock (based on gettimeofday).
@@ -24,10 +24,21 @@ template <class Base> class timer_fd_events : public timer_base<Base>
     private:
     int timerfd_fd = -1;
     int systemtime_fd = -1;
-    
+
+    // The time to which each timerfd is currently set ({0, 0} if disabled). Used to avoid re-arming
+    // a timerfd with the time it is already set to.
+    time_val timerfd_armed {0, 0};
+    time_val systemtime_armed {0, 0};
+
+    time_val &armed_time_for_fd(int fd) noexcept
+    {
+        return (fd == timerfd_fd) ? timerfd_armed : systemtime_armed;
+    }
+
     // Set the timerfd timeout to match the first timer in the queue (disable the timerfd
-    // if there are no active timers).
-    static void set_timer_from_queue(int fd, timer_queue_t &queue) noexcept
+    // if there are no active timers). Unless forced, the timerfd is not re-armed if it is
+    // already set to the required time.
+    void set_timer_from_queue(int fd, timer_queue_t &queue, bool force = false) noexcept
     {
         struct itimerspec newtime;
         if (queue.empty()) {
@@ -38,6 +49,12 @@ template <class Base> class timer_fd_events : public timer_base<Base>
             newtime.it_value = queue.get_root_priority();
             newtime.it_interval = {0, 0};
         }
+
+        time_val &armed = armed_time_for_fd(fd);
+        if (! force && armed == time_val(newtime.it_value)) {
+            return;
+        }
+        armed = newtime.it_value;
         timerfd_settime(fd, TFD_TIMER_ABSTIME, &newtime, nullptr);
     }
     
@@ -58,8 +75,9 @@ template <class Base> class timer_fd_events : public timer_base<Base>
 
         timer_base<Base>::process_timer_queue(queue, curtime);
 
-        // arm timerfd with timeout from head of queue
-        set_timer_from_queue(fd, queue);
+        // arm timerfd with timeout from head of queue (the timerfd has expired, so this must be
+        // done even if the time is unchanged)
+        set_timer_from_queue(fd, queue, true);
     }
 
     void set_timer(timer_handle_t & timer_id, const time_val &timeouttv, const time_val &intervaltv,
@@ -0,0 +1,345 @@
+#ifndef DASYNQ_TIMERWHEEL_H_INCLUDED
+#define DASYNQ_TIMERWHEEL_H_INCLUDED
+
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+#include <new>
+
+#include <time.h>
+
+#include "dasynq-flags.h"
+
+namespace dasynq {
+
+namespace dprivate {
+
+constexpr int log2_floor(uint64_t v)
+{
+    return v <= 1 ? 0 : 1 + log2_floor(v / 2);
+}
+
+} // namespace dprivate
+
+/**
+ * Timer queue implementation based on a hierarchical timing wheel. This can be used in place of a
+ * heap (dary_heap) for the timer queues, and has the same interface; see DASYNQ_TIMER_WHEEL in
+ * dasynq-config.h.
+ *
+ * Time is divided into "ticks" of a fixed length (the resolution). The wheel has a number of levels,
+ * each with 64 slots; at level 0 each slot spans a single tick, and at each subsequent level each
+ * slot spans 8 times as many ticks as at the previous level. A timer is placed at the lowest level
+ * which can hold its expiry time, relative to a "base" time which is no later than the current time
+ * (nor than the expiry of any queued timer), and its expiry time is rounded up to the end of the
+ * slot. Timers are never moved between levels.
+ *
+ * The result is that a timer may expire late, by up to one tick or around 1/8 of its timeout
+ * (whichever is greater), but in exchange adding and removing a timer is O(1), finding the earliest
+ * timer is O(levels), and timers due at around the same time share an expiry time, so that the
+ * earliest expiry time (from which the system timer is set) changes less often.
+ *
+ * Since timers are placed according to the current time, the queue must know which clock is used
+ * for its timers (see set_clock()). Only expired timers should be removed via pull_root().
+ *
+ * Node data is stored as part of the handle, as for dary_heap. No other storage is allocated, so
+ * allocate() will not fail (unless the data constructor throws).
+ *
+ * Parameters:
+ *
+ * T : node data type
+ * P : priority (time) type, constructible from seconds and nanoseconds, and with seconds() and
+ *     nseconds() accessors (i.e. time_val)
+ * Resolution : tick length, in nanoseconds
+ */
+template <typename T, typename P, uint64_t Resolution = 1000000>
+class timer_wheel
+{
+    static_assert(Resolution > 0 && Resolution <= 1000000000, "Resolution must be between 1ns and 1s");
+
+    static constexpr int slot_bits = 6;
+    static constexpr unsigned num_slots = 1u << slot_bits;
+    static constexpr int level_bits = 3;
+
+    // Enough levels to hold any time (up to 2^63 nanoseconds):
+    static constexpr int num_levels = (63 - dprivate::log2_floor(Resolution) - slot_bits + level_bits - 1)
+            / level_bits + 1;
+
+    public:
+
+    // Handle to a timer; also contains the data associated with the timer.
+    struct handle_t
+    {
+        union hd_u_t {
+            // The data member is kept in a union so it doesn't get constructed/destructed
+            // automatically, and we can construct it lazily.
+            public:
+            hd_u_t() { }
+            ~hd_u_t() { }
+            T hd;
+        } hd_u;
+
+        handle_t *next;    // next/previous in slot list (circular)
+        handle_t *prev;
+        uint64_t expiry;   // expiry time (rounded) in ticks
+        int level;         // level in the wheel, or -1 if not queued
+        unsigned slot;
+
+        handle_t(const handle_t &) = delete;
+        void operator=(const handle_t &) = delete;
+
+        handle_t() { }
+    };
+
+    static void init_handle(handle_t &h) noexcept
+    {
+    }
+
+    private:
+
+    handle_t *slots[num_levels][num_slots];
+    uint64_t occupied[num_levels];  // bitmap of non-empty slots, for each level
+
+    uint64_t base = 0;       // base time, in ticks
+    size_t num_queued = 0;
+
+    handle_t *root = nullptr;  // earliest timer, or nullptr if not yet determined
+    P root_prio;               // expiry time of root
+
+    clockid_t clock_id = CLOCK_REALTIME;
+
+    static uint64_t to_ticks(const timespec &t, bool round_up) noexcept
+    {
+        if (t.tv_sec < 0) return 0;
+        uint64_t ns = uint64_t(t.tv_sec) * 1000000000u + t.tv_nsec;
+        return round_up ? (ns + Resolution - 1) / Resolution : ns / Resolution;
+    }
+
+    static P from_ticks(uint64_t ticks) noexcept
+    {
+        uint64_t ns = ticks * Resolution;
+        return P(ns / 1000000000u, ns % 1000000000u);
+    }
+
+    void link(handle_t &hnd, int level, unsigned slot) noexcept
+    {
+        hnd.level = level;
+        hnd.slot = slot;
+        handle_t *&head = slots[level][slot];
+        if (head == nullptr) {
+            hnd.next = &hnd;
+            hnd.prev = &hnd;
+            head = &hnd;
+            occupied[level] |= uint64_t(1) << slot;
+        }
+        else {
+            // add at tail, so that timers with the same expiry expire in order of insertion
+            hnd.next = head;
+            hnd.prev = head->prev;
+            head->prev->next = &hnd;
+            head->prev = &hnd;
+        }
+    }
+
+    void unlink(handle_t &hnd) noexcept
+    {
+        handle_t *&head = slots[hnd.level][hnd.slot];
+        if (hnd.next == &hnd) {
+            head = nullptr;
+            occupied[hnd.level] &= ~(uint64_t(1) << hnd.slot);
+        }
+        else {
+            hnd.prev->next = hnd.next;
+            hnd.next->prev = hnd.prev;
+            if (head == &hnd) {
+                head = hnd.next;
+            }
+        }
+        hnd.level = -1;
+    }
+
+    // Determine the earliest timer (queue must not be empty). At each level, the occupied slots
+    // correspond to consecutive times starting from the slot of the base time.
+    void find_root() noexcept
+    {
+        root = nullptr;
+        for (int level = 0; level < num_levels; level++) {
+            uint64_t occ = occupied[level];
+            if (occ == 0) continue;
+            unsigned pos = (base >> (level * level_bits)) & (num_slots - 1);
+            uint64_t rotated = (pos == 0) ? occ : ((occ >> pos) | (occ << (num_slots - pos)));
+            unsigned offs = __builtin_ctzll(rotated);
+            handle_t *first = slots[level][(pos + offs) & (num_slots - 1)];
+            if (root == nullptr || first->expiry < root->expiry) {
+                root = first;
+            }
+        }
+        root_prio = from_ticks(root->expiry);
+    }
+
+    // Bring the base time up to the current time, but no later than the earliest timer.
+    void update_base() noexcept
+    {
+        timespec now_ts;
+        clock_gettime(clock_id, &now_ts);
+        uint64_t now = to_ticks(now_ts, false);
+        if (num_queued == 0) {
+            base = now;
+        }
+        else if (now > base) {
+            if (root == nullptr) find_root();
+            base = (now < root->expiry) ? now : root->expiry;
+        }
+    }
+
+    public:
+
+    timer_wheel() noexcept
+    {
+        for (int level = 0; level < num_levels; level++) {
+            occupied[level] = 0;
+            for (unsigned slot = 0; slot < num_slots; slot++) {
+                slots[level][slot] = nullptr;
+            }
+        }
+    }
+
+    timer_wheel(const timer_wheel &) = delete;
+
+    // Set the clock used for timers in this queue. Must be called while the queue is empty.
+    void set_clock(clock_type clock) noexcept
+    {
+        // A "coarse" clock (if available) is sufficient, since the base time need only be no later
+        // than the current time:
+        if (clock == clock_type::MONOTONIC) {
+#if defined(CLOCK_MONOTONIC_COARSE)
+            clock_id = CLOCK_MONOTONIC_COARSE;
+#elif defined(CLOCK_MONOTONIC)
+            clock_id = CLOCK_MONOTONIC;
+#endif
+        }
+        else {
+#if defined(CLOCK_REALTIME_COARSE)
+            clock_id = CLOCK_REALTIME_COARSE;
+#else
+            clock_id = CLOCK_REALTIME;
+#endif
+        }
+    }
+
+    T & node_data(handle_t &hnd) noexcept
+    {
+        return hnd.hd_u.hd;
+    }
+
+    // Allocate a slot, but do not queue it:
+    //  u... : parameters for data constructor T::T(...)
+    template <typename ...U> void allocate(handle_t &hnd, U&&... u)
+    {
+        new (& hnd.hd_u.hd) T(std::forward<U>(u)...);
+        hnd.level = -1;
+    }
+
+    void deallocate(handle_t &hnd) noexcept
+    {
+        hnd.hd_u.hd.~T();
+    }
+
+    // Queue a timer to expire at (or after) the given time. Returns true if it becomes the earliest
+    // timer in the queue (i.e. the earliest expiry time is now earlier).
+    bool insert(handle_t &hnd, const P &pval) noexcept
+    {
+        update_base();
+
+        uint64_t t = to_ticks(pval, true);
+        if (t < base) t = base;
+
+        // Find the lowest level which can hold the timer, rounding up the expiry time to the slot
+        // granularity at that level:
+        int level = 0;
+        uint64_t e = t;
+        uint64_t b = base;
+        while (e - b >= num_slots) {
+            if (level == num_levels - 1) {
+                // Out of range (shouldn't be possible):
+                e = b + num_slots - 1;
+                break;
+            }
+            level++;
+            int shift = level * level_bits;
+            e = (t + (uint64_t(1) << shift) - 1) >> shift;
+            b = base >> shift;
+        }
+
+        hnd.expiry = e << (level * level_bits);
+        link(hnd, level, e & (num_slots - 1));
+        num_queued++;
+
+        if (root != nullptr) {
+            if (hnd.expiry < root->expiry) {
+                root = &hnd;
+                root_prio = from_ticks(hnd.expiry);
+                return true;
+            }
+            return false;
+        }
+
+        find_root();
+        return root == &hnd;
+    }
+
+    // Get the earliest timer (queue must not be empty).
+    handle_t & get_root() noexcept
+    {
+        if (root == nullptr) find_root();
+        return *root;
+    }
+
+    // Get the expiry time of the earliest timer (queue must not be empty).
+    P &get_root_priority() noexcept
+    {
+        if (root == nullptr) find_root();
+        return root_prio;
+    }
+
+    // Remove the earliest timer, which must have expired.
+    void pull_root() noexcept
+    {
+        if (root == nullptr) find_root();
+        base = root->expiry;
+        remove(*root);
+    }
+
+    void remove(handle_t &hnd) noexcept
+    {
+        unlink(hnd);
+        num_queued--;
+        if (root == &hnd) {
+            root = nullptr;
+        }
+    }
+
+    bool empty() noexcept
+    {
+        return num_queued == 0;
+    }
+
+    bool is_queued(handle_t &hnd) noexcept
+    {
+        return hnd.level != -1;
+    }
+
+    // Change the expiry time of a queued timer. Returns true if the earliest expiry time in the
+    // queue is now earlier (because of this timer).
+    bool set_priority(handle_t &hnd, const P &p) noexcept
+    {
+        bool was_root = (root == &hnd);
+        uint64_t old_expiry = hnd.expiry;
+        remove(hnd);
+        bool is_root = insert(hnd, p);
+        return is_root && !(was_root && hnd.expiry == old_expiry);
+    }
+};
+
+}
+
+#endif
@@ -4,6 +4,7 @@
 #include "dasynq-config.h"
 
 #include "dasynq-flags.h"
+#include "dasynq-stats.h"
 #include "dasynq-stableheap.h"
 #include "dasynq-interrupt.h"
 #include "dasynq-util.h"
@@ -430,6 +431,11 @@ namespace dprivate {
 
         // queue data structure/pointer
         prio_queue event_queue;
+
+#if DASYNQ_INSTRUMENT
+        // statistics (protected by the lock):
+        loop_stats stats;
+#endif
         
         using base_signal_watcher = dprivate::base_signal_watcher<typename traits_t::sigdata_t>;
         using base_child_watcher = dprivate::base_child_watcher;
@@ -444,6 +450,9 @@ namespace dprivate {
         
         void queue_watcher(base_watcher *bwatcher) noexcept
         {
+#if DASYNQ_INSTRUMENT
+            bwatcher->queued_time = stats_now();
+#endif
             event_queue.insert(bwatcher->heap_handle, bwatcher->priority);
         }
         
@@ -464,6 +473,15 @@ namespace dprivate {
         mutex_t lock;
 
         template <typename T> void init(T *loop) noexcept { }
+
+        // Record the number of events received from the backend mechanism in one go (for statistics).
+        // Call with lock held.
+        void record_batch(int num_events) noexcept
+        {
+#if DASYNQ_INSTRUMENT
+            stats.batch_size.record(num_events);
+#endif
+        }
         
         void sigmaskf(int how, const sigset_t *set, sigset_t *oset)
         {
@@ -1417,6 +1435,14 @@ class event_loop
         
             pqueue->active = true;
             active = true;
+
+#if DASYNQ_INSTRUMENT
+            // Note the watcher may be deleted during dispatch, so we can't access it afterwards:
+            unsigned stats_category = pqueue->stats_category;
+            if (stats_category >= STATS_CATEGORIES) stats_category = STATS_CATEGORIES - 1;
+            uint64_t dispatch_time = dprivate::stats_now();
+            loop_mech.stats.dispatch_latency[stats_category].record(dispatch_time - pqueue->queued_time);
+#endif
             
             base_bidi_fd_watcher *bbfw = nullptr;
             
@@ -1438,11 +1464,17 @@ class event_loop
 
                 // issue a secondary dispatch:
                 bbfw->dispatch_second(this);
+#if DASYNQ_INSTRUMENT
+                loop_mech.stats.callback_time[stats_category].record(dprivate::stats_now() - dispatch_time);
+#endif
                 pqueue = loop_mech.pull_event();
                 continue;
             }
 
             pqueue->dispatch(this);
+#if DASYNQ_INSTRUMENT
+            loop_mech.stats.callback_time[stats_category].record(dprivate::stats_now() - dispatch_time);
+#endif
             if (limit > 0) {
                 limit--;
                 if (limit == 0) break;
@@ -1514,6 +1546,23 @@ class event_loop
         loop_mech.get_time(tv, clock, force_update);
     }
 
+    // Retrieve the statistics recorded by the event loop (see dasynq-stats.h), optionally resetting
+    // them. Returns false (and does not modify 'stats') if instrumentation is not enabled (see
+    // DASYNQ_INSTRUMENT in dasynq-config.h).
+    bool get_stats(loop_stats &stats, bool reset = false) noexcept
+    {
+#if DASYNQ_INSTRUMENT
+        std::lock_guard<mutex_t> guard(loop_mech.lock);
+        stats = loop_mech.stats;
+        if (reset) {
+            loop_mech.stats = loop_stats();
+        }
+        return true;
+#else
+        return false;
+#endif
+    }
+
     event_loop() { }
     event_loop(const event_loop &other) = delete;
 };
@@ -1536,6 +1585,9 @@ class signal_watcher : private dprivate::base_signal_watcher<typename EventLoop:
     using event_loop_t = EventLoop;
     using siginfo_p = typename signal_watcher::siginfo_p;
 
+    // Set the category used for event loop statistics (see dasynq-stats.h).
+    using dprivate::base_watcher::set_stats_category;
+
     // Register this watcher to watch the specified signal.
     // If an attempt is made to register with more than one event loop at
     // a time, behaviour is undefined. The signal should be masked before
@@ -1637,6 +1689,9 @@ class fd_watcher : private dprivate::base_fd_watcher
     
     using event_loop_t = EventLoop;
 
+    // Set the category used for event loop statistics (see dasynq-stats.h).
+    using dprivate::base_watcher::set_stats_category;
+
     // Register a file descriptor watcher with an event loop. Flags
     // can be any combination of dasynq::IN_EVENTS / dasynq::OUT_EVENTS.
     // Exactly one of IN_EVENTS/OUT_EVENTS must be specified if the event
@@ -1823,6 +1878,14 @@ class bidi_fd_watcher : private dprivate::base_bidi_fd_watcher
 
     using event_loop_t = EventLoop;
 
+    // Set the category used for event loop statistics (see dasynq-stats.h), for both the input and
+    // output watchers.
+    void set_stats_category(unsigned category) noexcept
+    {
+        dprivate::base_watcher::set_stats_category(category);
+        this->out_watcher.set_stats_category(category);
+    }
+
     void set_in_watch_enabled(event_loop_t &eloop, bool b) noexcept
     {
         eloop.get_base_lock().lock();
@@ -2018,6 +2081,9 @@ class child_proc_watcher : private dprivate::base_child_watcher
 
     using event_loop_t = EventLoop;
 
+    // Set the category used for event loop statistics (see dasynq-stats.h).
+    using dprivate::base_watcher::set_stats_category;
+
     // send a signal to this process, if it is still running, in a race-free manner.
     // return is as for POSIX kill(); return is -1 with errno=ESRCH if process has
     // already terminated.
@@ -2175,6 +2241,65 @@ class child_proc_watcher : private dprivate::base_child_watcher
         }
     }
     
+    // Create a child process using vfork() (if supported by the backend; otherwise, fork()), run
+    // the given function in the child, and watch the child with this watcher. The function must
+    // not return; it should exec (or _exit). Since the child may share the address space of the
+    // parent, the function must restrict itself to async-signal-safe operations and must not modify
+    // memory belonging to the parent (other than memory set aside for that purpose). All signals
+    // are blocked in the parent across the vfork() call, so that no signal handler runs in the
+    // child; the function is responsible for setting the signal mask before it exec's.
+    // Exceptions are as for fork(). Returns the child pid (in the parent).
+    template <typename F>
+    pid_t vfork(event_loop_t &eloop, F child_func, bool from_reserved = false, int prio = DEFAULT_PRIORITY)
+    {
+        if (! EventLoop::loop_traits_t::supports_childwatch_reservation) {
+            pid_t child = fork(eloop, from_reserved, prio);
+            if (child == 0) {
+                child_func();
+                _exit(1);
+            }
+            return child;
+        }
+
+        base_watcher::init();
+        this->priority = prio;
+
+        if (! from_reserved) {
+            reserve_watch(eloop);
+        }
+
+        sigset_t all_signals;
+        sigset_t orig_mask;
+        sigfillset(&all_signals);
+        dprivate::sigmaskf<mutex_t>(SIG_SETMASK, &all_signals, &orig_mask);
+
+        auto &lock = eloop.get_base_lock();
+        lock.lock();
+
+        pid_t child = ::vfork();
+        if (child == 0) {
+            // I am the child. Note that the parent remains suspended (and the lock held) until
+            // the child exec's or exits.
+            child_func();
+            _exit(1);
+        }
+
+        if (child == -1) {
+            int vfork_errno = errno;
+            lock.unlock();
+            dprivate::sigmaskf<mutex_t>(SIG_SETMASK, &orig_mask, nullptr);
+            unreserve(eloop);
+            throw std::system_error(vfork_errno, std::system_category());
+        }
+
+        // Register this watcher.
+        this->watch_pid = child;
+        eloop.register_reserved_child_nolock(this, child);
+        lock.unlock();
+        dprivate::sigmaskf<mutex_t>(SIG_SETMASK, &orig_mask, nullptr);
+        return child;
+    }
+
     // virtual rearm child_status(EventLoop &eloop, pid_t child, int status) = 0;
 };
 
@@ -2215,6 +2340,9 @@ class timer : private base_timer_watcher
 
     public:
     using event_loop_t = EventLoop;
+
+    // Set the category used for event loop statistics (see dasynq-stats.h).
+    using dprivate::base_watcher::set_stats_category;
     
     void add_timer(event_loop_t &eloop, clock_type clock = clock_type::MONOTONIC, int prio = DEFAULT_PRIORITY)
     {
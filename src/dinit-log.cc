@@ -64,6 +64,11 @@ class buffered_log_stream : public eventloop_t::fd_watcher_impl<buffered_log_str
 
     int fd = -1;
 
+    buffered_log_stream() noexcept
+    {
+        set_stats_category(STATS_LOG);
+    }
+
     void init(int fd)
     {
         this->fd = fd;
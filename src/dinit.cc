@@ -4,6 +4,7 @@
 #include <cstring>
 #include <csignal>
 #include <cstddef>
+#include <climits>
 #include <cstdlib>
 
 #include <sys/types.h>
@@ -59,9 +60,12 @@ static void sigquit_cb(eventloop_t &eloop) noexcept;
 static void sigterm_cb(eventloop_t &eloop) noexcept;
 static void open_control_socket(bool report_ro_failure = true) noexcept;
 static void close_control_socket() noexcept;
+static void open_notify_socket() noexcept;
+static void close_notify_socket() noexcept;
 static void confirm_restart_boot() noexcept;
 
 static void control_socket_cb(eventloop_t *loop, int fd);
+static void notify_socket_cb(int fd) noexcept;
 
 
 // Variables
@@ -81,6 +85,11 @@ int active_control_conns = 0;
 static const char *control_socket_path = SYSCONTROLSOCKET;
 static std::string control_socket_str;
 
+// Notification socket path (the control socket path with ".notify" appended, unless specified)
+static const char *notify_socket_path = nullptr;
+static std::string notify_socket_str;
+static bool notify_socket_open = false;
+
 static const char *env_file_path = "/etc/dinit/environment";
 
 static const char *log_path = "/dev/log";
@@ -124,6 +133,11 @@ namespace {
         using rearm = dasynq::rearm;
 
         public:
+        control_socket_watcher() noexcept
+        {
+            set_stats_category(STATS_CONTROL);
+        }
+
         rearm fd_event(eventloop_t &loop, int fd, int flags) noexcept
         {
             control_socket_cb(&loop, fd);
@@ -131,6 +145,19 @@ namespace {
         }
     };
 
+    // Event-loop handler for messages received via the notification socket.
+    class notify_socket_watcher : public eventloop_t::fd_watcher_impl<notify_socket_watcher>
+    {
+        using rearm = dasynq::rearm;
+
+        public:
+        rearm fd_event(eventloop_t &loop, int fd, int flags) noexcept
+        {
+            notify_socket_cb(fd);
+            return rearm::REARM;
+        }
+    };
+
     // Watch for console input and set a flag when it is available.
     class console_input_watcher : public eventloop_t::fd_watcher_impl<console_input_watcher>
     {
@@ -170,6 +197,7 @@ namespace {
     };
 
     control_socket_watcher control_socket_io;
+    notify_socket_watcher notify_socket_io;
     console_input_watcher console_input_io;
     log_flush_timer_t log_flush_timer;
 
@@ -189,6 +217,10 @@ int dinit_main(int argc, char **argv)
     bool control_socket_path_set = false;
     bool env_file_set = false;
     bool log_specified = false;
+    unsigned max_starting = 0;
+    unsigned restart_budget = 0;
+    unsigned restart_budget_secs = 0;
+    const char *cgroup_path = nullptr;
 
     service_dir_opt service_dir_opts;
 
@@ -238,6 +270,15 @@ int dinit_main(int argc, char **argv)
                         return 1;
                     }
                 }
+                else if (strcmp(argv[i], "--notify-socket-path") == 0) {
+                    if (++i < argc) {
+                        notify_socket_path = argv[i];
+                    }
+                    else {
+                        cerr << "dinit: '--notify-socket-path' requires an argument" << endl;
+                        return 1;
+                    }
+                }
                 else if (strcmp(argv[i], "--log-file") == 0 || strcmp(argv[i], "-l") == 0) {
                     if (++i < argc) {
                         log_path = argv[i];
@@ -249,6 +290,71 @@ int dinit_main(int argc, char **argv)
                         return 1;
                     }
                 }
+                else if (strcmp(argv[i], "--control-buffer-limit") == 0) {
+                    if (++i < argc) {
+                        char *endp;
+                        unsigned long limit = strtoul(argv[i], &endp, 10);
+                        if (*endp != 0 || limit < control_inbuf::initial_size || limit > UINT_MAX) {
+                            cerr << "dinit: '--control-buffer-limit' requires a size in bytes (at least "
+                                    << control_inbuf::initial_size << ")" << endl;
+                            return 1;
+                        }
+                        control_conn_t::buffer_limit = limit;
+                    }
+                    else {
+                        cerr << "dinit: '--control-buffer-limit' requires an argument" << endl;
+                        return 1;
+                    }
+                }
+                else if (strcmp(argv[i], "--max-starting") == 0) {
+                    if (++i < argc) {
+                        char *endp;
+                        unsigned long max = strtoul(argv[i], &endp, 10);
+                        if (*endp != 0 || argv[i][0] == 0 || max > UINT_MAX) {
+                            cerr << "dinit: '--max-starting' requires a number of services (0 for "
+                                    "no limit)" << endl;
+                            return 1;
+                        }
+                        max_starting = max;
+                    }
+                    else {
+                        cerr << "dinit: '--max-starting' requires an argument" << endl;
+                        return 1;
+                    }
+                }
+                else if (strcmp(argv[i], "--restart-budget") == 0) {
+                    if (++i < argc) {
+                        char *endp;
+                        unsigned long count = strtoul(argv[i], &endp, 10);
+                        unsigned long secs = 0;
+                        bool valid = (endp != argv[i] && *endp == '/' && count <= UINT_MAX);
+                        if (valid) {
+                            char *secs_str = endp + 1;
+                            secs = strtoul(secs_str, &endp, 10);
+                            valid = (endp != secs_str && *endp == 0 && secs != 0 && secs <= UINT_MAX);
+                        }
+                        if (! valid) {
+                            cerr << "dinit: '--restart-budget' requires a number of restarts and an "
+                                    "interval in seconds (<count>/<seconds>)" << endl;
+                            return 1;
+                        }
+                        restart_budget = count;
+                        restart_budget_secs = secs;
+                    }
+                    else {
+                        cerr << "dinit: '--restart-budget' requires an argument" << endl;
+                        return 1;
+                    }
+                }
+                else if (strcmp(argv[i], "--cgroup-path") == 0) {
+                    if (++i < argc) {
+                        cgroup_path = argv[i];
+                    }
+                    else {
+                        cerr << "dinit: '--cgroup-path' requires an argument" << endl;
+                        return 1;
+                    }
+                }
                 else if (strcmp(argv[i], "--quiet") == 0 || strcmp(argv[i], "-q") == 0) {
                     console_service_status = false;
                     log_level[DLOG_CONS] = loglevel_t::ZERO;
@@ -265,8 +371,17 @@ int dinit_main(int argc, char **argv)
                             " --user, -u                   run as a user service manager\n"
                             " --socket-path <path>, -p <path>\n"
                             "                              path to control socket\n"
+                            " --notify-socket-path <path>  path to (readiness) notification socket\n"
                             " --log-file <file>, -l <file> log to the specified file\n"
                             " --quiet, -q                  disable output to standard output\n"
+                            " --control-buffer-limit <bytes>\n"
+                            "                              per-connection control buffer limit\n"
+                            " --max-starting <count>       maximum number of services concurrently\n"
+                            "                              starting a process\n"
+                            " --restart-budget <count>/<seconds>\n"
+                            "                              limit automatic restarts across all services\n"
+                            " --cgroup-path <dir>          parent cgroup for services with the 'cgroup'\n"
+                            "                              option\n"
                             " <service-name>               start service with name <service-name>\n";
                     return 0;
                 }
@@ -339,6 +454,12 @@ int dinit_main(int argc, char **argv)
         }
     }
     
+    if (notify_socket_path == nullptr) {
+        notify_socket_str = control_socket_path;
+        notify_socket_str += ".notify";
+        notify_socket_path = notify_socket_str.c_str();
+    }
+
     if (services_to_start.empty()) {
         services_to_start.push_back("boot");
     }
@@ -393,6 +514,22 @@ int dinit_main(int argc, char **argv)
 
     /* start requested services */
     services = new dirload_service_set(std::move(service_dir_opts.get_paths()));
+    services->set_max_starting(max_starting);
+    services->get_restart_budget().set_limit(restart_budget, time_val(restart_budget_secs, 0));
+    if (cgroup_path == nullptr && am_system_init) {
+        cgroup_path = "/sys/fs/cgroup/dinit";
+    }
+    if (cgroup_path != nullptr) {
+        services->set_cgroup_parent(cgroup_path);
+    }
+    if (! am_system_init) {
+        // (if we are system init, the root filesystem may be read-only until a service with the
+        // "starts-rwfs" option starts)
+        services->set_rootfs_rw();
+    }
+
+    // Try to open the notification socket (may fail due to readonly filesystem)
+    open_notify_socket();
 
     init_log(services, log_is_syslog);
     if (am_system_init) {
@@ -407,6 +544,23 @@ int dinit_main(int argc, char **argv)
         read_env_file(env_file);
     }
 
+    // Read the descriptions of the services to start, and their dependencies, in parallel:
+    services->preload_services(services_to_start);
+
+    // Load the services to start, and open the activation sockets of all (loaded) services before
+    // starting any service, so that clients of a socket need not wait for the service to start.
+    // (Any failure to load a service is reported when we try to start it, below). If we are system
+    // init, sockets which can't yet be opened (because the filesystem is not yet writable or
+    // mounted) are opened again once the root filesystem is writable.
+    for (auto svc : services_to_start) {
+        try {
+            services->load_service(svc);
+        }
+        catch (service_load_exc &sle) { }
+        catch (std::bad_alloc &badalloce) { }
+    }
+    services->open_activation_sockets();
+
     for (auto svc : services_to_start) {
         try {
             services->start_service(svc);
@@ -426,6 +580,8 @@ int dinit_main(int argc, char **argv)
             break;
         }
     }
+
+    services->discard_preloaded();
     
     run_event_loop:
     
@@ -460,6 +616,7 @@ int dinit_main(int argc, char **argv)
     }
     
     close_control_socket();
+    close_notify_socket();
     
     if (am_pid_one) {
         if (shutdown_type == shutdown_type_t::NONE) {
@@ -524,8 +681,9 @@ static void log_bad_env(int linenum)
     log(loglevel_t::ERROR, "invalid environment variable setting in environment file (line ", linenum, ")");
 }
 
-// Read and set environment variables from a file. May throw std::bad_alloc, std::system_error.
-void read_env_file(const char *env_file_path)
+// Read environment variable settings from a file, and append each (as "NAME=value") to the given
+// vector. May throw std::bad_alloc, std::system_error.
+void read_env_file(const char *env_file_path, std::vector<std::string> &env_vars)
 {
     // Note that we can't use the log in this function; it hasn't been initialised yet.
 
@@ -568,16 +726,30 @@ void read_env_file(const char *env_file_path)
                 while (lpos != lend && *lpos != '\n') ++lpos;
                 auto val_end = lpos;
 
-                std::string name = line.substr(name_begin - line.begin(), name_end - name_begin);
-                std::string value = line.substr(val_begin - line.begin(), val_end - val_begin);
-                if (setenv(name.c_str(), value.c_str(), true) == -1) {
-                    throw std::system_error(errno, std::system_category());
-                }
+                std::string setting = line.substr(name_begin - line.begin(), name_end - name_begin);
+                setting += '=';
+                setting.append(val_begin, val_end);
+                env_vars.push_back(std::move(setting));
             }
         }
     }
 }
 
+// Read and set environment variables from a file. May throw std::bad_alloc, std::system_error.
+void read_env_file(const char *env_file_path)
+{
+    std::vector<std::string> env_vars;
+    read_env_file(env_file_path, env_vars);
+
+    for (auto &setting : env_vars) {
+        auto eq_pos = setting.find('=');
+        setting[eq_pos] = 0;
+        if (setenv(setting.c_str(), setting.c_str() + eq_pos + 1, true) == -1) {
+            throw std::system_error(errno, std::system_category());
+        }
+    }
+}
+
 // Get user confirmation before proceeding with restarting boot sequence.
 // Returns after confirmation, possibly with shutdown type altered.
 static void confirm_restart_boot() noexcept
@@ -672,6 +844,8 @@ static void control_socket_cb(eventloop_t *loop, int sockfd)
 void rootfs_is_rw() noexcept
 {
     open_control_socket(true);
+    open_notify_socket();
+    services->set_rootfs_rw();
     if (! did_log_boot) {
         did_log_boot = log_boot();
     }
@@ -771,6 +945,146 @@ static void close_control_socket() noexcept
     }
 }
 
+// Open/create the notification socket, a datagram socket via which service processes (with
+// "ready-notification = socket") send readiness and status notifications and watchdog keep-alive
+// messages, in the format used by sd_notify. The sender of each message is identified by the
+// credentials attached by the kernel, which requires SO_PASSCRED; so this is supported on Linux
+// only. Once the socket has been successfully opened, further calls have no effect.
+static void open_notify_socket() noexcept
+{
+#ifdef __linux__
+    if (notify_socket_open) return;
+
+    const char * saddrname = notify_socket_path;
+    size_t saddrname_len = strlen(saddrname);
+    if (saddrname_len >= sizeof(sockaddr_un::sun_path)) {
+        log(loglevel_t::ERROR, "Notification socket path is too long");
+        return;
+    }
+
+    struct sockaddr_un name;
+    name.sun_family = AF_UNIX;
+    memcpy(name.sun_path, saddrname, saddrname_len + 1);
+    uint sockaddr_size = offsetof(struct sockaddr_un, sun_path) + saddrname_len + 1;
+
+    if (am_system_init) {
+        // Unlink any stale socket file (see open_control_socket()):
+        unlink(saddrname);
+    }
+
+    int sockfd = dinit_socket(AF_UNIX, SOCK_DGRAM, 0, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (sockfd == -1) {
+        log(loglevel_t::ERROR, "Error creating notification socket: ", strerror(errno));
+        return;
+    }
+
+    int passcred = 1;
+    if (setsockopt(sockfd, SOL_SOCKET, SO_PASSCRED, &passcred, sizeof(passcred)) == -1) {
+        log(loglevel_t::ERROR, "Error setting notification socket options: ", strerror(errno));
+        close(sockfd);
+        return;
+    }
+
+    if (bind(sockfd, (struct sockaddr *) &name, sockaddr_size) == -1) {
+        if (errno != EROFS) {
+            log(loglevel_t::ERROR, "Error binding notification socket: ", strerror(errno));
+        }
+        close(sockfd);
+        return;
+    }
+
+    // Service processes may run as any user. Messages are accepted only from registered service
+    // processes (see notify_socket_cb()).
+    if (chmod(saddrname, 0666) == -1) {
+        log(loglevel_t::ERROR, "Error setting notification socket permissions: ", strerror(errno));
+        close(sockfd);
+        unlink(saddrname);
+        return;
+    }
+
+    try {
+        std::string path_str = saddrname;
+        notify_socket_io.add_watch(event_loop, sockfd, dasynq::IN_EVENTS);
+        services->set_notify_socket_path(std::move(path_str));
+        notify_socket_open = true;
+    }
+    catch (std::exception &e) {
+        log(loglevel_t::ERROR, "Could not setup I/O on notification socket: ", e.what());
+        close(sockfd);
+        unlink(saddrname);
+    }
+#endif
+}
+
+static void close_notify_socket() noexcept
+{
+    if (notify_socket_open) {
+        int fd = notify_socket_io.get_watched_fd();
+        notify_socket_io.deregister(event_loop);
+        close(fd);
+        unlink(notify_socket_path);
+        services->set_notify_socket_path(std::string());
+        notify_socket_open = false;
+    }
+}
+
+// Receive messages from the notification socket, and pass each to the service whose process sent it
+static void notify_socket_cb(int sockfd) noexcept
+{
+#ifdef __linux__
+    // Process a limited number of messages at a time, so as not to starve other event handling:
+    for (int n = 0; n < 16; n++) {
+        char buf[4096];
+        union {
+            struct cmsghdr align;
+            char buf[CMSG_SPACE(sizeof(struct ucred)) + CMSG_SPACE(sizeof(int) * 16)];
+        } control;
+
+        struct iovec iov = { buf, sizeof(buf) };
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+
+        ssize_t r = recvmsg(sockfd, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+        if (r == -1) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        // Find the sender credentials, and close any file descriptors which were (unexpectedly)
+        // passed with the message:
+        struct ucred *cred = nullptr;
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level != SOL_SOCKET) continue;
+            if (cmsg->cmsg_type == SCM_CREDENTIALS && cmsg->cmsg_len == CMSG_LEN(sizeof(struct ucred))) {
+                cred = reinterpret_cast<struct ucred *>(CMSG_DATA(cmsg));
+            }
+            else if (cmsg->cmsg_type == SCM_RIGHTS) {
+                int num_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                for (int i = 0; i < num_fds; i++) {
+                    int fd;
+                    memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+                    close(fd);
+                }
+            }
+        }
+
+        if (cred == nullptr || (msg.msg_flags & MSG_TRUNC)) {
+            // No credentials, or message too long: ignore
+            continue;
+        }
+
+        service_record *service = services->find_notify_pid(cred->pid);
+        if (service != nullptr) {
+            service->notify_message(buf, r);
+        }
+    }
+#endif
+}
+
 void setup_external_log() noexcept
 {
     if (! external_log_open) {
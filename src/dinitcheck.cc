@@ -17,6 +17,7 @@
 #include "dinit-util.h"
 #include "service-constants.h"
 #include "load-service.h"
+#include "service-cache.h"
 #include "options-processing.h"
 
 // dinitcheck:  utility to check Dinit configuration for correctness/lint
@@ -30,22 +31,33 @@ class prelim_dep
     public:
     std::string name;
     dependency_type dep_type;
+    bool from_dep_dir; // found in a dependency directory (waits-for.d)
 
-    prelim_dep(const std::string &name_p, dependency_type dep_type_p)
-        : name(name_p), dep_type(dep_type_p) { }
-    prelim_dep(std::string &&name_p, dependency_type dep_type_p)
-        : name(std::move(name_p)), dep_type(dep_type_p) { }
+    prelim_dep(const std::string &name_p, dependency_type dep_type_p, bool from_dep_dir_p = false)
+        : name(name_p), dep_type(dep_type_p), from_dep_dir(from_dep_dir_p) { }
+    prelim_dep(std::string &&name_p, dependency_type dep_type_p, bool from_dep_dir_p = false)
+        : name(std::move(name_p)), dep_type(dep_type_p), from_dep_dir(from_dep_dir_p) { }
 };
 
+using dep_dir_list = std::vector<std::pair<std::string, dinit_load::file_stamp>>;
+
 class service_record
 {
 public:
-    service_record(std::string name_p, std::list<prelim_dep> dependencies_p)
-            : name(name_p), dependencies(dependencies_p) {}
+    service_record(std::string name_p, dinit_load::service_settings_wrapper<prelim_dep> &&settings_p)
+            : name(name_p), dependencies(settings_p.depends), settings(std::move(settings_p)) {}
 
     std::string name;
     std::list<prelim_dep> dependencies;
 
+    // Details retained for the compiled description cache:
+    dinit_load::service_settings_wrapper<prelim_dep> settings;
+    std::string filename;      // path of description file
+    size_t dir_index = 0;      // index of containing service directory
+    dinit_load::file_stamp desc_stamp;  // stamp of description file (before reading)
+    dep_dir_list dep_dirs;     // dependency directories read, with stamps (before reading)
+    bool has_errors = false;   // description has errors (not suitable for caching)
+
     bool visited = false;  // flag used to detect cyclic dependencies
     bool cycle_free = false;
 };
@@ -55,6 +67,9 @@ using service_set_t = std::map<std::string, service_record *>;
 service_record *load_service(service_set_t &services, const std::string &name,
         const service_dir_pathlist &service_dirs);
 
+static bool update_cache(const service_set_t &services, const service_dir_pathlist &service_dirs);
+static void verify_cache(const service_set_t &services, const service_dir_pathlist &service_dirs);
+
 // Add some missing standard library functionality...
 template <typename T> bool contains(std::vector<T> vec, const T& elem)
 {
@@ -71,6 +86,8 @@ int main(int argc, char **argv)
     bool am_system_init = (getuid() == 0);
 
     std::vector<std::string> services_to_check;
+    bool do_update_cache = false;
+    bool do_verify_cache = false;
 
     // Process command line
     if (argc > 1) {
@@ -86,12 +103,21 @@ int main(int argc, char **argv)
                         return 1;
                     }
                 }
+                else if (strcmp(argv[i], "--update-cache") == 0) {
+                    do_update_cache = true;
+                }
+                else if (strcmp(argv[i], "--verify-cache") == 0) {
+                    do_verify_cache = true;
+                }
                 else if (strcmp(argv[i], "--help") == 0) {
                     cout << "dinitcheck: check dinit service descriptions\n"
                             " --help                       display help\n"
                             " --services-dir <dir>, -d <dir>\n"
                             "                              set base directory for service description\n"
                             "                              files\n"
+                            " --update-cache               write compiled description cache for checked\n"
+                            "                              services\n"
+                            " --verify-cache               check compiled description cache is up-to-date\n"
                             " <service-name>               check service with name <service-name>\n";
                     return EXIT_SUCCESS;
                 }
@@ -205,6 +231,19 @@ int main(int argc, char **argv)
 
     // TODO additional: check chain-to, other lint
 
+    if (do_verify_cache) {
+        verify_cache(service_set, service_dir_opts.get_paths());
+    }
+
+    if (do_update_cache) {
+        if (errors_found) {
+            std::cerr << "Not updating compiled description cache, due to errors.\n";
+        }
+        else if (update_cache(service_set, service_dir_opts.get_paths())) {
+            std::cout << "Compiled description cache updated.\n";
+        }
+    }
+
     if (! errors_found) {
         std::cout << "No problems found.\n";
     }
@@ -247,10 +286,15 @@ static void report_dir_error(const char *service_name, const std::string &dirpat
 static void process_dep_dir(const char *servicename,
         const string &service_filename,
         std::list<prelim_dep> &deplist, const std::string &depdirpath,
-        dependency_type dep_type)
+        dependency_type dep_type, dep_dir_list &dep_dirs)
 {
     std::string depdir_fname = combine_paths(parent_path(service_filename), depdirpath.c_str());
 
+    // Record the directory stamp (before reading) for the compiled description cache
+    dinit_load::file_stamp depdir_stamp;
+    depdir_stamp.read(depdir_fname.c_str());
+    dep_dirs.emplace_back(depdir_fname, depdir_stamp);
+
     DIR *depdir = opendir(depdir_fname.c_str());
     if (depdir == nullptr) {
         report_dir_error(servicename, depdirpath);
@@ -262,7 +306,7 @@ static void process_dep_dir(const char *servicename,
     while (dent != nullptr) {
         char * name =  dent->d_name;
         if (name[0] != '.') {
-            deplist.emplace_back(name, dep_type);
+            deplist.emplace_back(name, dep_type, true);
         }
         dent = readdir(depdir);
     }
@@ -287,6 +331,7 @@ service_record *load_service(service_set_t &services, const std::string &name,
 
     string service_filename;
     ifstream service_file;
+    size_t dir_index = 0;
 
     // Couldn't find one. Have to load it.
     for (auto &service_dir : service_dirs) {
@@ -298,13 +343,20 @@ service_record *load_service(service_set_t &services, const std::string &name,
 
         service_file.open(service_filename.c_str(), ios::in);
         if (service_file) break;
+        dir_index++;
     }
 
     if (! service_file) {
         throw service_not_found(string(name));
     }
 
+    bool prev_errors_found = errors_found;
+    errors_found = false;
+
     service_settings_wrapper<prelim_dep> settings;
+    file_stamp desc_stamp;
+    desc_stamp.read(service_filename.c_str());
+    dep_dir_list dep_dirs;
 
     string line;
     service_file.exceptions(ios::badbit);
@@ -315,7 +367,7 @@ service_record *load_service(service_set_t &services, const std::string &name,
 
             auto process_dep_dir_n = [&](std::list<prelim_dep> &deplist, const std::string &waitsford,
                     dependency_type dep_type) -> void {
-                process_dep_dir(name.c_str(), service_filename, deplist, waitsford, dep_type);
+                process_dep_dir(name.c_str(), service_filename, deplist, waitsford, dep_type, dep_dirs);
             };
 
             auto load_service_n = [&](const string &dep_name) -> const string & {
@@ -340,5 +392,104 @@ service_record *load_service(service_set_t &services, const std::string &name,
         report_service_description_err(name, "Service command not specified.");
     }
 
-    return new service_record(name, settings.depends);
+    if (settings.log_type == log_type_id::LOGFILE && settings.logfile.empty()) {
+        report_service_description_err(name, "log-type is 'file' but no logfile specified.");
+    }
+
+    service_record *sr = new service_record(name, std::move(settings));
+    sr->filename = std::move(service_filename);
+    sr->dir_index = dir_index;
+    sr->desc_stamp = desc_stamp;
+    sr->dep_dirs = std::move(dep_dirs);
+    sr->has_errors = errors_found;
+
+    errors_found = errors_found || prev_errors_found;
+    return sr;
+}
+
+// Encode the cache entry for a service, not including the entry length.
+static void encode_cache_entry(dinit_load::cache_writer &writer, service_record *sr)
+{
+    dinit_load::write_cache_entry(writer, sr->name, sr->desc_stamp, sr->dep_dirs, sr->settings);
+}
+
+// Write the compiled description cache for each service directory, containing entries for the
+// (loaded) services found in that directory. Returns true if successful.
+static bool update_cache(const service_set_t &services, const service_dir_pathlist &service_dirs)
+{
+    using namespace dinit_load;
+
+    file_stamp passwd_stamp, group_stamp;
+    passwd_stamp.read("/etc/passwd");
+    group_stamp.read("/etc/group");
+
+    bool success = true;
+
+    size_t i = 0;
+    for (auto &service_dir : service_dirs) {
+        cache_writer writer;
+        size_t count_offs = write_cache_header(writer, passwd_stamp, group_stamp);
+        uint32_t count = 0;
+
+        for (auto &svc : services) {
+            service_record *sr = svc.second;
+            if (sr == nullptr || sr->dir_index != i || sr->has_errors) continue;
+            encode_cache_entry(writer, sr);
+            ++count;
+        }
+
+        string cache_path = combine_paths(service_dir.get_dir(), service_cache_name);
+        ++i;
+        if (count == 0) {
+            // No services from this directory; remove any existing (outdated) cache
+            if (unlink(cache_path.c_str()) == -1 && errno != ENOENT) {
+                std::cerr << "Unable to remove compiled description cache " << cache_path << ": "
+                        << strerror(errno) << "\n";
+                success = false;
+            }
+            continue;
+        }
+
+        writer.patch_u32(count_offs, count);
+        if (! writer.write_file(cache_path)) {
+            std::cerr << "Unable to write compiled description cache " << cache_path << ": "
+                    << strerror(errno) << "\n";
+            success = false;
+        }
+    }
+
+    if (! success) errors_found = true;
+    return success;
+}
+
+// Check that the compiled description cache has an up-to-date entry for each (loaded) service.
+static void verify_cache(const service_set_t &services, const service_dir_pathlist &service_dirs)
+{
+    using namespace dinit_load;
+
+    std::vector<service_cache_file> caches(service_dirs.size());
+    size_t i = 0;
+    for (auto &service_dir : service_dirs) {
+        caches[i++].open(service_dir.get_dir());
+    }
+
+    for (auto &svc : services) {
+        service_record *sr = svc.second;
+        if (sr == nullptr || sr->has_errors) continue;
+
+        service_cache_file &cache = caches[sr->dir_index];
+        service_cache_file::entry_info entry;
+        if (! cache.is_open() || ! cache.find_raw(sr->name, entry)) {
+            report_service_description_err(sr->name, "No entry in compiled description cache.");
+            continue;
+        }
+
+        cache_writer writer;
+        encode_cache_entry(writer, sr);
+        size_t entry_len = entry.end - entry.start;
+        if (writer.size() != entry_len + sizeof(uint32_t)
+                || memcmp(writer.data() + sizeof(uint32_t), entry.start, entry_len) != 0) {
+            report_service_description_err(sr->name, "Compiled description cache entry is out of date.");
+        }
+    }
 }
@@ -7,6 +7,8 @@
 #include <system_error>
 #include <memory>
 #include <algorithm>
+#include <vector>
+#include <map>
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -31,7 +33,7 @@
 // SYSCONTROLSOCKET, or $HOME/.dinitctl).
 
 static constexpr uint16_t min_cp_version = 1;
-static constexpr uint16_t max_cp_version = 1;
+static constexpr uint16_t max_cp_version = 8;
 
 enum class command_t;
 
@@ -39,6 +41,9 @@ static int issue_load_service(int socknum, const char *service_name, bool find_o
 static int check_load_reply(int socknum, cpbuffer_t &, handle_t *handle_p, service_state_t *state_p);
 static int start_stop_service(int socknum, cpbuffer_t &, const char *service_name, command_t command,
         bool do_pin, bool do_force, bool wait_for_service, bool verbose);
+static int start_stop_services(int socknum, cpbuffer_t &, std::vector<const char *> &service_names,
+        command_t command, bool do_pin, bool do_force, bool wait_for_service, bool verbose,
+        uint16_t daemon_cp_version);
 static int unpin_service(int socknum, cpbuffer_t &, const char *service_name, bool verbose);
 static int unload_service(int socknum, cpbuffer_t &, const char *service_name, bool verbose);
 static int reload_service(int socknum, cpbuffer_t &, const char *service_name, bool verbose);
@@ -48,6 +53,12 @@ static int add_remove_dependency(int socknum, cpbuffer_t &rbuffer, bool add, con
         const char *service_to, dependency_type dep_type);
 static int enable_disable_service(int socknum, cpbuffer_t &rbuffer, const char *from, const char *to,
         bool enable);
+static int analyze_boot(int socknum, cpbuffer_t &rbuffer, const char *service_name);
+static int cat_service_log(int socknum, cpbuffer_t &rbuffer, const char *service_name, bool do_clear,
+        bool follow);
+static int show_loop_stats(int socknum, cpbuffer_t &rbuffer, bool do_reset);
+static int show_status_text(int socknum, cpbuffer_t &rbuffer, const char *service_name);
+static int watch_services(int socknum, cpbuffer_t &rbuffer);
 
 static const char * describeState(bool stopped)
 {
@@ -74,7 +85,12 @@ enum class command_t {
     ADD_DEPENDENCY,
     RM_DEPENDENCY,
     ENABLE_SERVICE,
-    DISABLE_SERVICE
+    DISABLE_SERVICE,
+    ANALYZE_BOOT,
+    CAT_LOG,
+    LOOP_STATS,
+    STATUS_TEXT,
+    WATCH_SERVICES
 };
 
 
@@ -85,6 +101,7 @@ int main(int argc, char **argv)
     
     bool show_help = argc < 2;
     const char *service_name = nullptr;
+    std::vector<const char *> more_service_names; // for start/stop of multiple services
     const char *to_service_name = nullptr;
     dependency_type dep_type;
     bool dep_type_set = false;
@@ -97,6 +114,9 @@ int main(int argc, char **argv)
     bool wait_for_service = true;
     bool do_pin = false;
     bool do_force = false;
+    bool do_clear = false;
+    bool do_follow = false;
+    bool do_reset = false;
     
     command_t command = command_t::NONE;
         
@@ -142,6 +162,16 @@ int main(int argc, char **argv)
                     && (strcmp(argv[i], "--force") == 0 || strcmp(argv[i], "-f") == 0)) {
                 do_force = true;
             }
+            else if (command == command_t::CAT_LOG && strcmp(argv[i], "--clear") == 0) {
+                do_clear = true;
+            }
+            else if (command == command_t::CAT_LOG
+                    && (strcmp(argv[i], "--follow") == 0 || strcmp(argv[i], "-f") == 0)) {
+                do_follow = true;
+            }
+            else if (command == command_t::LOOP_STATS && strcmp(argv[i], "--reset") == 0) {
+                do_reset = true;
+            }
             else {
                 cerr << "dinitctl: unrecognized/invalid option: " << argv[i] << " (use --help for help)\n";
                 return 1;
@@ -190,6 +220,21 @@ int main(int argc, char **argv)
             else if (strcmp(argv[i], "disable") == 0) {
                 command = command_t::DISABLE_SERVICE;
             }
+            else if (strcmp(argv[i], "analyze-boot") == 0) {
+                command = command_t::ANALYZE_BOOT;
+            }
+            else if (strcmp(argv[i], "catlog") == 0) {
+                command = command_t::CAT_LOG;
+            }
+            else if (strcmp(argv[i], "loop-stats") == 0) {
+                command = command_t::LOOP_STATS;
+            }
+            else if (strcmp(argv[i], "status-text") == 0) {
+                command = command_t::STATUS_TEXT;
+            }
+            else if (strcmp(argv[i], "watch") == 0) {
+                command = command_t::WATCH_SERVICES;
+            }
             else {
                 cerr << "dinitctl: unrecognized command: " << argv[i] << " (use --help for help)\n";
                 return 1;
@@ -234,21 +279,26 @@ int main(int argc, char **argv)
             }
             else {
                 if (service_name != nullptr) {
+                    if (command == command_t::START_SERVICE || command == command_t::STOP_SERVICE) {
+                        more_service_names.push_back(argv[i]);
+                        continue;
+                    }
                     show_help = true;
                     break;
                 }
                 service_name = argv[i];
-                // TODO support multiple services
             }
         }
     }
     
-    bool no_service_cmd = (command == command_t::LIST_SERVICES || command == command_t::SHUTDOWN);
+    bool no_service_cmd = (command == command_t::LIST_SERVICES || command == command_t::SHUTDOWN
+            || command == command_t::LOOP_STATS || command == command_t::WATCH_SERVICES);
 
     if (command == command_t::ENABLE_SERVICE || command == command_t::DISABLE_SERVICE) {
         show_help |= (to_service_name == nullptr);
     }
-    else if ((service_name == nullptr && ! no_service_cmd) || command == command_t::NONE) {
+    else if ((service_name == nullptr && ! no_service_cmd && command != command_t::ANALYZE_BOOT)
+            || command == command_t::NONE) {
         show_help = true;
     }
 
@@ -265,8 +315,8 @@ int main(int argc, char **argv)
         cout << "dinitctl:   control Dinit services\n"
           "\n"
           "Usage:\n"
-          "    dinitctl [options] start [options] <service-name>\n"
-          "    dinitctl [options] stop [options] <service-name>\n"
+          "    dinitctl [options] start [options] <service-name>...\n"
+          "    dinitctl [options] stop [options] <service-name>...\n"
           "    dinitctl [options] restart [options] <service-name>\n"
           "    dinitctl [options] wake [options] <service-name>\n"
           "    dinitctl [options] release [options] <service-name>\n"
@@ -279,6 +329,11 @@ int main(int argc, char **argv)
           "    dinitctl [options] rm-dep <type> <from-service> <to-service>\n"
           "    dinitctl [options] enable [--from <from-service>] <to-service>\n"
           "    dinitctl [options] disable [--from <from-service>] <to-service>\n"
+          "    dinitctl [options] analyze-boot [<service-name>]\n"
+          "    dinitctl [options] catlog [--clear] [--follow] <service-name>\n"
+          "    dinitctl [options] loop-stats [--reset]\n"
+          "    dinitctl [options] status-text <service-name>\n"
+          "    dinitctl [options] watch\n"
           "\n"
           "Note: An activated service continues running when its dependents stop.\n"
           "\n"
@@ -293,7 +348,10 @@ int main(int argc, char **argv)
           "Command options:\n"
           "  --no-wait        : don't wait for service startup/shutdown to complete\n"
           "  --pin            : pin the service in the requested state\n"
-          "  --force          : force stop even if dependents will be affected\n";
+          "  --force          : force stop even if dependents will be affected\n"
+          "  --clear          : (catlog) clear the buffered output after displaying it\n"
+          "  -f, --follow     : (catlog) continue to display output as it is produced\n"
+          "  --reset          : (loop-stats) reset the statistics after displaying them\n";
         return 1;
     }
     
@@ -353,7 +411,8 @@ int main(int argc, char **argv)
     try {
         // Start by querying protocol version:
         cpbuffer_t rbuffer;
-        check_protocol_version(min_cp_version, max_cp_version, rbuffer, socknum);
+        uint16_t daemon_cp_version = check_protocol_version(min_cp_version, max_cp_version, rbuffer,
+                socknum);
 
         if (command == command_t::UNPIN_SERVICE) {
             return unpin_service(socknum, rbuffer, service_name, verbose);
@@ -382,6 +441,41 @@ int main(int argc, char **argv)
             return enable_disable_service(socknum, rbuffer, service_name, to_service_name,
                     command == command_t::ENABLE_SERVICE);
         }
+        else if (command == command_t::ANALYZE_BOOT) {
+            if (daemon_cp_version < 5) {
+                throw cp_old_server_exception();
+            }
+            return analyze_boot(socknum, rbuffer, service_name);
+        }
+        else if (command == command_t::CAT_LOG) {
+            if (daemon_cp_version < 6) {
+                throw cp_old_server_exception();
+            }
+            return cat_service_log(socknum, rbuffer, service_name, do_clear, do_follow);
+        }
+        else if (command == command_t::LOOP_STATS) {
+            if (daemon_cp_version < 7) {
+                throw cp_old_server_exception();
+            }
+            return show_loop_stats(socknum, rbuffer, do_reset);
+        }
+        else if (command == command_t::STATUS_TEXT) {
+            if (daemon_cp_version < 8) {
+                throw cp_old_server_exception();
+            }
+            return show_status_text(socknum, rbuffer, service_name);
+        }
+        else if (command == command_t::WATCH_SERVICES) {
+            if (daemon_cp_version < 4) {
+                throw cp_old_server_exception();
+            }
+            return watch_services(socknum, rbuffer);
+        }
+        else if (! more_service_names.empty()) {
+            more_service_names.insert(more_service_names.begin(), service_name);
+            return start_stop_services(socknum, rbuffer, more_service_names, command, do_pin, do_force,
+                    wait_for_service, verbose, daemon_cp_version);
+        }
         else {
             return start_stop_service(socknum, rbuffer, service_name, command, do_pin, do_force,
                     wait_for_service, verbose);
@@ -682,6 +776,197 @@ static int start_stop_service(int socknum, cpbuffer_t &rbuffer, const char *serv
     return 1;
 }
 
+// Start/stop multiple services. Services are loaded and started/stopped in batches, with a single
+// request (DINIT_CP_BATCHSTARTSTOP) per batch, if the daemon supports it; otherwise they are
+// started/stopped one at a time.
+static int start_stop_services(int socknum, cpbuffer_t &rbuffer, std::vector<const char *> &service_names,
+        command_t command, bool do_pin, bool do_force, bool wait_for_service, bool verbose,
+        uint16_t daemon_cp_version)
+{
+    using namespace std;
+
+    // Remove duplicates (keeping the original order):
+    std::vector<const char *> names;
+    for (const char *name : service_names) {
+        if (std::find_if(names.begin(), names.end(),
+                [name](const char *n) { return strcmp(n, name) == 0; }) == names.end()) {
+            names.push_back(name);
+        }
+    }
+
+    if (daemon_cp_version < 2) {
+        int r = 0;
+        for (const char *name : names) {
+            if (start_stop_service(socknum, rbuffer, name, command, do_pin, do_force, wait_for_service,
+                    verbose) != 0) {
+                r = 1;
+            }
+        }
+        return r;
+    }
+
+    bool do_stop = (command == command_t::STOP_SERVICE);
+    char pcommand = do_stop ? DINIT_CP_STOPSERVICE : DINIT_CP_STARTSERVICE;
+    char flags = (do_pin ? 1 : 0) | ((do_stop && !do_force) ? 2 : 0);
+
+    // The packet (header and name data) must fit in the daemon's receive buffer (1024 bytes):
+    constexpr unsigned hdr_size = 3 + 2 * sizeof(uint16_t);
+    constexpr unsigned max_data_len = 1024 - hdr_size;
+
+    int r = 0;
+    std::map<handle_t, const char *> waiting;  // services for which we await completion
+    std::vector<std::pair<handle_t, service_event_t>> early_events;  // events received before reply
+
+    size_t next = 0;
+    while (next < names.size()) {
+        // Build a batch of as many names as will fit:
+        std::vector<char> pkt(hdr_size);
+        pkt[0] = DINIT_CP_BATCHSTARTSTOP;
+        pkt[1] = pcommand;
+        pkt[2] = flags;
+        size_t first = next;
+        while (next < names.size()) {
+            uint16_t name_len = strlen(names[next]);
+            if (pkt.size() - hdr_size + sizeof(name_len) + name_len > max_data_len) break;
+            const char *name_len_cptr = reinterpret_cast<const char *>(&name_len);
+            pkt.insert(pkt.end(), name_len_cptr, name_len_cptr + sizeof(name_len));
+            pkt.insert(pkt.end(), names[next], names[next] + name_len);
+            ++next;
+        }
+        if (next == first) {
+            cerr << "dinitctl: service name too long: " << names[next] << endl;
+            return 1;
+        }
+        uint16_t num_services = next - first;
+        uint16_t data_len = pkt.size() - hdr_size;
+        memcpy(pkt.data() + 3, &num_services, sizeof(num_services));
+        memcpy(pkt.data() + 3 + sizeof(num_services), &data_len, sizeof(data_len));
+        write_all_x(socknum, pkt.data(), pkt.size());
+
+        // Wait for the reply, recording any service events received meanwhile:
+        fill_buffer_to(rbuffer, socknum, 1);
+        while (rbuffer[0] >= 100) {
+            fill_buffer_to(rbuffer, socknum, 2);
+            int pktlen = (unsigned char) rbuffer[1];
+            fill_buffer_to(rbuffer, socknum, pktlen);
+            if (rbuffer[0] == DINIT_IP_SERVICEEVENT) {
+                handle_t ev_handle;
+                rbuffer.extract((char *) &ev_handle, 2, sizeof(ev_handle));
+                service_event_t event = static_cast<service_event_t>(rbuffer[2 + sizeof(ev_handle)]);
+                early_events.emplace_back(ev_handle, event);
+            }
+            rbuffer.consume(pktlen);
+            fill_buffer_to(rbuffer, socknum, 1);
+        }
+
+        if (rbuffer[0] != DINIT_RP_BATCHRESULT) {
+            cerr << "dinitctl: protocol error." << endl;
+            return 1;
+        }
+
+        fill_buffer_to(rbuffer, socknum, 1 + sizeof(uint16_t));
+        uint16_t num_results;
+        rbuffer.extract((char *) &num_results, 1, sizeof(num_results));
+        rbuffer.consume(1 + sizeof(uint16_t));
+        if (num_results != num_services) {
+            cerr << "dinitctl: protocol error." << endl;
+            return 1;
+        }
+
+        // (1 byte) result, (handle_t) handle, (1 byte) state
+        constexpr int entry_size = 2 + sizeof(handle_t);
+        for (size_t i = first; i < next; i++) {
+            fill_buffer_to(rbuffer, socknum, entry_size);
+            int result = rbuffer[0];
+            handle_t handle;
+            rbuffer.extract((char *) &handle, 1, sizeof(handle));
+            rbuffer.consume(entry_size);
+
+            const char *name = names[i];
+            switch (result) {
+            case DINIT_RP_ALREADYSS:
+                if (verbose) {
+                    cout << "Service '" << name << "' " << describeState(do_stop) << "." << endl;
+                }
+                break;
+            case DINIT_RP_ACK:
+                if (wait_for_service) {
+                    waiting[handle] = name;
+                }
+                else if (verbose) {
+                    cout << "Issued " << describeVerb(do_stop) << " command for service '" << name
+                            << "' successfully." << endl;
+                }
+                break;
+            case DINIT_RP_NOSERVICE:
+                cerr << "dinitctl: failed to find/load service '" << name << "'." << endl;
+                r = 1;
+                break;
+            case DINIT_RP_NAK:
+                cerr << "dinitctl: cannot start service '" << name << "' (during shut down)." << endl;
+                r = 1;
+                break;
+            case DINIT_RP_DEPENDENTS:
+                cerr << "dinitctl: cannot stop service '" << name << "' due to dependents (stop it "
+                        "individually to list them)." << endl;
+                r = 1;
+                break;
+            default:
+                cerr << "dinitctl: protocol error." << endl;
+                return 1;
+            }
+        }
+    }
+
+    service_event_t completion_event = do_stop ? service_event_t::STOPPED : service_event_t::STARTED;
+    service_event_t cancelled_event = do_stop ? service_event_t::STOPCANCELLED
+            : service_event_t::STARTCANCELLED;
+
+    auto process_event = [&](handle_t ev_handle, service_event_t event) {
+        auto it = waiting.find(ev_handle);
+        if (it == waiting.end()) return;
+        if (event == completion_event) {
+            if (verbose) {
+                cout << "Service '" << it->second << "' " << describeState(do_stop) << "." << endl;
+            }
+        }
+        else if (event == cancelled_event) {
+            if (verbose) {
+                cout << "Service '" << it->second << "' " << describeVerb(do_stop) << " cancelled." << endl;
+            }
+            r = 1;
+        }
+        else if (! do_stop && event == service_event_t::FAILEDSTART) {
+            if (verbose) {
+                cout << "Service '" << it->second << "' failed to start." << endl;
+            }
+            r = 1;
+        }
+        else {
+            return;
+        }
+        waiting.erase(it);
+    };
+
+    for (auto &ev : early_events) {
+        process_event(ev.first, ev.second);
+    }
+
+    // Wait until all services have started/stopped:
+    while (! waiting.empty()) {
+        wait_for_info(rbuffer, socknum);
+        int pktlen = (unsigned char) rbuffer[1];
+        if (rbuffer[0] == DINIT_IP_SERVICEEVENT) {
+            handle_t ev_handle;
+            rbuffer.extract((char *) &ev_handle, 2, sizeof(ev_handle));
+            process_event(ev_handle, static_cast<service_event_t>(rbuffer[2 + sizeof(ev_handle)]));
+        }
+        rbuffer.consume(pktlen);
+    }
+
+    return r;
+}
+
 // Issue a "load service" command (DINIT_CP_LOADSERVICE), without waiting for
 // a response. Returns 1 on failure (with error logged), 0 on success.
 static int issue_load_service(int socknum, const char *service_name, bool find_only)
@@ -1221,3 +1506,555 @@ static int enable_disable_service(int socknum, cpbuffer_t &rbuffer, const char *
 
     return 0;
 }
+
+// Start timeline of a service, as reported by the daemon
+struct svc_timeline
+{
+    std::string name;
+    service_state_t state;
+    uint64_t times[NUM_TIMELINE_EVENTS];
+    std::vector<std::pair<uint32_t, dependency_type>> deps;
+
+    uint64_t get(timeline_event_t event) const
+    {
+        return times[(int)event];
+    }
+};
+
+// Format a duration (given in nanoseconds) as seconds, with millisecond precision
+static std::string format_secs(uint64_t ns)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%llu.%03us", (unsigned long long)(ns / 1000000000u),
+            (unsigned)((ns / 1000000u) % 1000u));
+    return buf;
+}
+
+// Read the start timeline of all services. Returns false (after reporting) on protocol error.
+static bool read_timeline(int socknum, cpbuffer_t &rbuffer, std::vector<svc_timeline> &timelines)
+{
+    using namespace std;
+
+    char cmdbuf[] = { (char)DINIT_CP_QUERYTIMELINE };
+    write_all_x(socknum, cmdbuf, 1);
+
+    wait_for_reply(rbuffer, socknum);
+    if (rbuffer[0] != DINIT_RP_TIMELINE) {
+        cerr << "dinitctl: protocol error." << endl;
+        return false;
+    }
+
+    constexpr int hdrsize = 1 + sizeof(uint32_t) + sizeof(uint64_t);
+    fill_buffer_to(rbuffer, socknum, hdrsize);
+    uint32_t count;
+    rbuffer.extract((char *)&count, 1, sizeof(count));
+    rbuffer.consume(hdrsize);
+
+    timelines.resize(count);
+    for (auto &svc : timelines) {
+        wait_for_reply(rbuffer, socknum);
+        if (rbuffer[0] != DINIT_RP_SVCTIMELINE) {
+            cerr << "dinitctl: protocol error." << endl;
+            return false;
+        }
+
+        uint16_t name_len;
+        uint32_t num_deps;
+        constexpr int svc_hdrsize = 2 + sizeof(name_len) + sizeof(num_deps)
+                + NUM_TIMELINE_EVENTS * sizeof(uint64_t);
+        fill_buffer_to(rbuffer, socknum, svc_hdrsize);
+        svc.state = static_cast<service_state_t>(rbuffer[1]);
+        rbuffer.extract((char *)&name_len, 2, sizeof(name_len));
+        rbuffer.extract((char *)&num_deps, 2 + sizeof(name_len), sizeof(num_deps));
+        rbuffer.extract((char *)svc.times, 2 + sizeof(name_len) + sizeof(num_deps), sizeof(svc.times));
+        rbuffer.consume(svc_hdrsize);
+
+        // The name may be longer than the buffer, so read it in parts
+        while (name_len > 0) {
+            int part_len = std::min((int)name_len, rbuffer.get_size());
+            fill_buffer_to(rbuffer, socknum, part_len);
+            svc.name += rbuffer.extract_string(0, part_len);
+            rbuffer.consume(part_len);
+            name_len -= part_len;
+        }
+
+        constexpr int dep_size = sizeof(uint32_t) + 1;
+        svc.deps.reserve(num_deps);
+        for (uint32_t i = 0; i < num_deps; i++) {
+            fill_buffer_to(rbuffer, socknum, dep_size);
+            uint32_t dep_index;
+            rbuffer.extract((char *)&dep_index, 0, sizeof(dep_index));
+            dependency_type dep_type = static_cast<dependency_type>(rbuffer[sizeof(dep_index)]);
+            rbuffer.consume(dep_size);
+            if (dep_index >= count) {
+                cerr << "dinitctl: protocol error." << endl;
+                return false;
+            }
+            svc.deps.emplace_back(dep_index, dep_type);
+        }
+    }
+
+    wait_for_reply(rbuffer, socknum);
+    if (rbuffer[0] != DINIT_RP_LISTDONE) {
+        cerr << "dinitctl: protocol error." << endl;
+        return false;
+    }
+    rbuffer.consume(1);
+    return true;
+}
+
+// Analyse the boot (service start) timeline: show the critical path (the chain of dependencies
+// which determined when the given service, or the last service to start, started), and the
+// services which spent the longest time waiting for their dependencies.
+static int analyze_boot(int socknum, cpbuffer_t &rbuffer, const char *service_name)
+{
+    using namespace std;
+
+    vector<svc_timeline> timelines;
+    if (! read_timeline(socknum, rbuffer, timelines)) {
+        return 1;
+    }
+
+    constexpr auto REQUIRED = timeline_event_t::REQUIRED;
+    constexpr auto DEPS_STARTED = timeline_event_t::DEPS_STARTED;
+    constexpr auto STARTED = timeline_event_t::STARTED;
+
+    // Times are reported relative to the earliest start request
+    uint64_t origin = 0;
+    for (auto &svc : timelines) {
+        uint64_t req = svc.get(REQUIRED);
+        if (req != 0 && (origin == 0 || req < origin)) {
+            origin = req;
+        }
+    }
+
+    // Find the target service: the named service, or else the service which started last
+    size_t target = timelines.size();
+    for (size_t i = 0; i < timelines.size(); i++) {
+        if (service_name != nullptr) {
+            if (timelines[i].name == service_name) {
+                target = i;
+                break;
+            }
+        }
+        else if (timelines[i].get(STARTED) != 0 && (target == timelines.size()
+                || timelines[i].get(STARTED) > timelines[target].get(STARTED))) {
+            target = i;
+        }
+    }
+
+    if (target == timelines.size()) {
+        if (service_name != nullptr) {
+            cerr << "dinitctl: service not loaded: " << service_name << endl;
+        }
+        else {
+            cerr << "dinitctl: no service has started" << endl;
+        }
+        return 1;
+    }
+    if (timelines[target].get(STARTED) == 0) {
+        cerr << "dinitctl: service has not started: " << timelines[target].name << endl;
+        return 1;
+    }
+
+    // Follow the path back from the target: at each step, the dependency which started last (but
+    // before the dependent started its own startup) is the one which held up the dependent. Soft
+    // dependencies are not waited for, and so are not considered.
+    vector<size_t> path;
+    path.push_back(target);
+    while (path.size() <= timelines.size()) {
+        auto &svc = timelines[path.back()];
+        uint64_t deps_started = svc.get(DEPS_STARTED);
+        size_t next = timelines.size();
+        for (auto &dep : svc.deps) {
+            if (dep.second == dependency_type::SOFT) continue;
+            uint64_t dep_started = timelines[dep.first].get(STARTED);
+            if (dep_started == 0 || (deps_started != 0 && dep_started > deps_started)) continue;
+            if (next == timelines.size() || dep_started > timelines[next].get(STARTED)) {
+                next = dep.first;
+            }
+        }
+        if (next == timelines.size()) break;
+        path.push_back(next);
+    }
+
+    char line[64];
+    cout << "Critical path to " << timelines[target].name << " (started at +"
+            << format_secs(timelines[target].get(STARTED) - origin) << "):\n";
+    cout << "    startup began  startup took  service\n";
+    for (auto i = path.rbegin(); i != path.rend(); ++i) {
+        auto &svc = timelines[*i];
+        uint64_t began = svc.get(DEPS_STARTED);
+        if (began == 0) began = svc.get(REQUIRED);
+        snprintf(line, sizeof(line), "    %13s  %12s  ", ("+" + format_secs(began - origin)).c_str(),
+                format_secs(svc.get(STARTED) - began).c_str());
+        cout << line << svc.name << "\n";
+    }
+
+    // Services which waited longest for dependencies
+    vector<pair<uint64_t, size_t>> blocked;
+    for (size_t i = 0; i < timelines.size(); i++) {
+        uint64_t req = timelines[i].get(REQUIRED);
+        uint64_t deps_started = timelines[i].get(DEPS_STARTED);
+        if (req != 0 && deps_started > req) {
+            blocked.emplace_back(deps_started - req, i);
+        }
+    }
+
+    constexpr size_t max_blocked = 10;
+    size_t num_blocked = std::min(blocked.size(), max_blocked);
+    std::partial_sort(blocked.begin(), blocked.begin() + num_blocked, blocked.end(),
+            [](const pair<uint64_t, size_t> &a, const pair<uint64_t, size_t> &b) {
+                return a.first > b.first;
+            });
+
+    if (num_blocked != 0) {
+        cout << "\nLongest waits for dependencies:\n";
+        for (size_t i = 0; i < num_blocked; i++) {
+            snprintf(line, sizeof(line), "    %13s  ", format_secs(blocked[i].first).c_str());
+            cout << line << timelines[blocked[i].second].name << "\n";
+        }
+    }
+
+    cout << flush;
+    return 0;
+}
+
+// Display the buffered output of a service (with log-type = buffer), optionally continuing to display
+// further output as it is produced.
+static int cat_service_log(int socknum, cpbuffer_t &rbuffer, const char *service_name, bool do_clear,
+        bool follow)
+{
+    using namespace std;
+
+    if (issue_load_service(socknum, service_name, true) == 1) {
+        return 1;
+    }
+
+    wait_for_reply(rbuffer, socknum);
+
+    handle_t handle;
+
+    if (rbuffer[0] == DINIT_RP_NOSERVICE) {
+        cerr << "dinitctl: service not loaded." << endl;
+        return 1;
+    }
+
+    if (check_load_reply(socknum, rbuffer, &handle, nullptr) != 0) {
+        return 1;
+    }
+
+    // Request output from successive positions; once all buffered output has been displayed, (if
+    // following) ask the daemon to wait for more before replying.
+    uint64_t pos = 0;
+    bool wait = false;
+    while (true) {
+        char flags = (do_clear ? 1 : 0) | (wait ? 2 : 0);
+        auto m = membuf()
+                .append<char>(DINIT_CP_CATLOG)
+                .append<char>(flags)
+                .append(handle)
+                .append(pos);
+        write_all_x(socknum, m);
+
+        wait_for_reply(rbuffer, socknum);
+        if (rbuffer[0] == DINIT_RP_NAK) {
+            cerr << "dinitctl: service output is not buffered (log-type is not 'buffer')." << endl;
+            return 1;
+        }
+        if (rbuffer[0] != DINIT_RP_SERVICELOG) {
+            cerr << "dinitctl: protocol error." << endl;
+            return 1;
+        }
+
+        constexpr int hdrsize = 2 + 2 * sizeof(uint64_t) + sizeof(uint32_t);
+        fill_buffer_to(rbuffer, socknum, hdrsize);
+        uint64_t out_pos, end_pos;
+        uint32_t length;
+        rbuffer.extract((char *)&out_pos, 2, sizeof(out_pos));
+        rbuffer.extract((char *)&end_pos, 2 + sizeof(uint64_t), sizeof(end_pos));
+        rbuffer.extract((char *)&length, 2 + 2 * sizeof(uint64_t), sizeof(length));
+        rbuffer.consume(hdrsize);
+
+        if (pos != 0 && out_pos > pos) {
+            cout.flush();
+            cerr << "dinitctl: (" << (out_pos - pos) << " bytes of output lost)" << endl;
+        }
+
+        // The output may be larger than the buffer, so display it in parts
+        pos = out_pos + length;
+        while (length > 0) {
+            if (rbuffer.get_length() == 0) {
+                fill_buffer_to(rbuffer, socknum, 1);
+            }
+            char *ptr = rbuffer.get_ptr(0);
+            int part_len = std::min(rbuffer.get_contiguous_length(ptr), rbuffer.get_length());
+            if ((uint32_t)part_len > length) part_len = length;
+            cout.write(ptr, part_len);
+            rbuffer.consume(part_len);
+            length -= part_len;
+        }
+
+        if (pos < end_pos) {
+            // more buffered output
+            wait = false;
+            continue;
+        }
+
+        if (! follow) break;
+        cout.flush();
+        wait = true;
+    }
+
+    cout.flush();
+    return 0;
+}
+
+// A histogram (with logarithmic buckets) as reported in a LOOPSTATS reply
+struct loop_stats_histogram
+{
+    uint64_t count;
+    uint64_t total;
+    uint64_t max;
+    std::vector<uint64_t> buckets;
+
+    // Get the (approximate) value at the given percentile: the upper limit of the bucket containing it
+    uint64_t percentile(unsigned pct) const
+    {
+        if (count == 0) return 0;
+        uint64_t target = (count * pct + 99) / 100;
+        uint64_t seen = 0;
+        for (unsigned i = 0; i < buckets.size(); i++) {
+            seen += buckets[i];
+            if (seen >= target) {
+                uint64_t limit = (i == 0) ? 1 : ((uint64_t(2) << i) - 1);
+                return std::min(limit, max);
+            }
+        }
+        return max;
+    }
+
+    uint64_t mean() const
+    {
+        return (count == 0) ? 0 : total / count;
+    }
+};
+
+// Format a duration (given in nanoseconds) in microseconds
+static std::string format_usecs(uint64_t ns)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%llu.%01uus", (unsigned long long)(ns / 1000u),
+            (unsigned)((ns / 100u) % 10u));
+    return buf;
+}
+
+static int show_loop_stats(int socknum, cpbuffer_t &rbuffer, bool do_reset)
+{
+    using namespace std;
+
+    char cmdbuf[] = { (char)DINIT_CP_QUERYLOOPSTATS, (char)(do_reset ? 1 : 0) };
+    write_all_x(socknum, cmdbuf, 2);
+
+    wait_for_reply(rbuffer, socknum);
+    if (rbuffer[0] == DINIT_RP_NAK) {
+        cerr << "dinitctl: event loop statistics are not available (dinit was not built with "
+                "instrumentation)." << endl;
+        return 1;
+    }
+    if (rbuffer[0] != DINIT_RP_LOOPSTATS) {
+        cerr << "dinitctl: protocol error." << endl;
+        return 1;
+    }
+
+    fill_buffer_to(rbuffer, socknum, 3);
+    unsigned num_cats = (unsigned char)rbuffer[1];
+    unsigned num_buckets = (unsigned char)rbuffer[2];
+    rbuffer.consume(3);
+
+    auto read_histogram = [&](loop_stats_histogram &hist) {
+        fill_buffer_to(rbuffer, socknum, 3 * sizeof(uint64_t));
+        rbuffer.extract((char *)&hist.count, 0, sizeof(uint64_t));
+        rbuffer.extract((char *)&hist.total, sizeof(uint64_t), sizeof(uint64_t));
+        rbuffer.extract((char *)&hist.max, 2 * sizeof(uint64_t), sizeof(uint64_t));
+        rbuffer.consume(3 * sizeof(uint64_t));
+        hist.buckets.resize(num_buckets);
+        for (auto &bucket : hist.buckets) {
+            fill_buffer_to(rbuffer, socknum, sizeof(uint64_t));
+            rbuffer.extract((char *)&bucket, 0, sizeof(uint64_t));
+            rbuffer.consume(sizeof(uint64_t));
+        }
+    };
+
+    loop_stats_histogram batch_size;
+    std::vector<loop_stats_histogram> latency(num_cats);
+    std::vector<loop_stats_histogram> callback(num_cats);
+    read_histogram(batch_size);
+    for (auto &hist : latency) read_histogram(hist);
+    for (auto &hist : callback) read_histogram(hist);
+
+    cout << "Event batch size: " << batch_size.count << " batches, mean " << batch_size.mean()
+            << ", p99 " << batch_size.percentile(99) << ", max " << batch_size.max << "\n\n";
+
+    static const char * const cat_names[] = { "signal", "fd", "child", "timer", "control", "log" };
+
+    cout << "category      events   latency: mean        p99        max"
+            "  callback: mean        p99        max\n";
+    for (unsigned i = 0; i < num_cats; i++) {
+        if (latency[i].count == 0 && callback[i].count == 0) continue;
+        std::string name = (i < sizeof(cat_names) / sizeof(cat_names[0])) ? cat_names[i]
+                : ("other-" + std::to_string(i));
+        char line[160];
+        snprintf(line, sizeof(line), "%-10s %9llu %19s %10s %10s %16s %10s %10s\n", name.c_str(),
+                (unsigned long long)latency[i].count,
+                format_usecs(latency[i].mean()).c_str(),
+                format_usecs(latency[i].percentile(99)).c_str(),
+                format_usecs(latency[i].max).c_str(),
+                format_usecs(callback[i].mean()).c_str(),
+                format_usecs(callback[i].percentile(99)).c_str(),
+                format_usecs(callback[i].max).c_str());
+        cout << line;
+    }
+
+    return 0;
+}
+
+// Display the status text most recently reported by a service via the notification socket.
+static int show_status_text(int socknum, cpbuffer_t &rbuffer, const char *service_name)
+{
+    using namespace std;
+
+    if (issue_load_service(socknum, service_name, true) == 1) {
+        return 1;
+    }
+
+    wait_for_reply(rbuffer, socknum);
+
+    handle_t handle;
+
+    if (rbuffer[0] == DINIT_RP_NOSERVICE) {
+        cerr << "dinitctl: service not loaded." << endl;
+        return 1;
+    }
+
+    if (check_load_reply(socknum, rbuffer, &handle, nullptr) != 0) {
+        return 1;
+    }
+
+    auto m = membuf()
+            .append<char>(DINIT_CP_QUERYSTATUSTEXT)
+            .append(handle);
+    write_all_x(socknum, m);
+
+    wait_for_reply(rbuffer, socknum);
+    if (rbuffer[0] != DINIT_RP_STATUSTEXT) {
+        cerr << "dinitctl: protocol error." << endl;
+        return 1;
+    }
+
+    constexpr int hdrsize = 2 + sizeof(uint32_t);
+    fill_buffer_to(rbuffer, socknum, hdrsize);
+    uint32_t length;
+    rbuffer.extract((char *)&length, 2, sizeof(length));
+    rbuffer.consume(hdrsize);
+
+    while (length > 0) {
+        if (rbuffer.get_length() == 0) {
+            fill_buffer_to(rbuffer, socknum, 1);
+        }
+        char *ptr = rbuffer.get_ptr(0);
+        int part_len = std::min(rbuffer.get_contiguous_length(ptr), rbuffer.get_length());
+        if ((uint32_t)part_len > length) part_len = length;
+        cout.write(ptr, part_len);
+        rbuffer.consume(part_len);
+        length -= part_len;
+    }
+
+    cout << endl;
+    return 0;
+}
+
+static const char *describe_state(int state)
+{
+    switch (static_cast<service_state_t>(state)) {
+    case service_state_t::STOPPED:
+        return "stopped";
+    case service_state_t::STARTING:
+        return "starting";
+    case service_state_t::STARTED:
+        return "started";
+    case service_state_t::STOPPING:
+        return "stopping";
+    }
+    return "(unknown)";
+}
+
+// Subscribe to state changes of all services, and display them as they occur (until the connection
+// is closed).
+static int watch_services(int socknum, cpbuffer_t &rbuffer)
+{
+    using namespace std;
+
+    char cmdbuf[] = { (char)DINIT_CP_SUBSCRIBEALL, 1 };
+    write_all_x(socknum, cmdbuf, 2);
+
+    wait_for_reply(rbuffer, socknum);
+    if (rbuffer[0] != DINIT_RP_ACK) {
+        cerr << "dinitctl: protocol error." << endl;
+        return 1;
+    }
+    rbuffer.consume(1);
+
+    std::map<uint32_t, std::string> names;
+
+    try {
+        while (true) {
+            wait_for_info(rbuffer, socknum);
+            int pktlen = (unsigned char)rbuffer[1];
+            uint32_t id;
+
+            if (rbuffer[0] == DINIT_IP_SERVICENAMEID && pktlen >= (int)(2 + sizeof(id))) {
+                rbuffer.extract((char *)&id, 2, sizeof(id));
+                std::string name(pktlen - 2 - sizeof(id), '\0');
+                rbuffer.extract(&name[0], 2 + sizeof(id), name.length());
+                names[id] = std::move(name);
+            }
+            else if (rbuffer[0] == DINIT_IP_SERVICESTATE) {
+                // id, old state, new state, flags, pid, timestamp:
+                if (pktlen < (int)(5 + sizeof(id) + sizeof(pid_t) + sizeof(uint64_t))) {
+                    cerr << "dinitctl: protocol error." << endl;
+                    return 1;
+                }
+                pid_t pid;
+                rbuffer.extract((char *)&id, 2, sizeof(id));
+                int old_state = rbuffer[2 + sizeof(id)];
+                int new_state = rbuffer[3 + sizeof(id)];
+                bool coalesced = (rbuffer[4 + sizeof(id)] & 1) != 0;
+                rbuffer.extract((char *)&pid, 5 + sizeof(id), sizeof(pid));
+
+                auto name_it = names.find(id);
+                if (name_it != names.end()) {
+                    cout << name_it->second;
+                }
+                else {
+                    cout << "(service " << id << ")";
+                }
+                cout << ": " << describe_state(old_state) << " -> " << describe_state(new_state);
+                if (pid != -1) {
+                    cout << " (pid " << pid << ")";
+                }
+                if (coalesced) {
+                    cout << " (intermediate states not shown)";
+                }
+                cout << endl;
+            }
+
+            rbuffer.consume(pktlen);
+        }
+    }
+    catch (cp_read_exception &exc) {
+        // Assume that the connection closed.
+    }
+
+    return 0;
+}
@@ -11,8 +11,23 @@
 #include "dasynq.h" // for pipe2
 
 #include <sys/uio.h> // writev
+#include <sys/stat.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <signal.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <sys/inotify.h>
+#include <sys/statfs.h>
+#include <linux/magic.h>
+#ifndef CGROUP2_SUPER_MAGIC
+#define CGROUP2_SUPER_MAGIC 0x63677270
+#endif
+#endif
 
 namespace bp_sys {
 
@@ -75,6 +90,173 @@ inline pid_t waitpid(pid_t p, exit_status *statusp, int flags)
     return ::waitpid(p, &statusp->status, flags);
 }
 
+// Open a file descriptor referring to a process (a "pidfd"), which becomes readable when the process
+// terminates. Unlike the process ID, this is not subject to re-use. Unlike a child watch, it works for
+// processes which are not children of this process. Fails with ENOSYS if not supported.
+inline int pidfd_open(pid_t pid, unsigned flags)
+{
+#if defined(__linux__) && defined(SYS_pidfd_open)
+    return syscall(SYS_pidfd_open, pid, flags);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+// cgroup (v2) support, for placing the processes of a service in a cgroup of their own, so that they
+// can be found (and killed) even if they leave the process group. The functions below fail with
+// ENOSYS if cgroups are not supported.
+
+// Create (if it does not exist) and open the cgroup with the given name within the given parent
+// cgroup directory, which is also created if it does not exist. Returns a directory fd (close-on-
+// exec), or -1 on failure. Fails with EOPNOTSUPP if the parent directory is not within a cgroup v2
+// filesystem (for example, on a host using cgroups v1), in which case any directory created is
+// removed.
+inline int cgroup_open(const char *parent, const char *name)
+{
+#ifdef __linux__
+    bool created_parent = (mkdir(parent, 0755) == 0);
+    if (! created_parent && errno != EEXIST) {
+        return -1;
+    }
+    int parent_fd = open(parent, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (parent_fd == -1) {
+        return -1;
+    }
+    struct statfs parent_fs;
+    if (fstatfs(parent_fd, &parent_fs) == -1 || parent_fs.f_type != CGROUP2_SUPER_MAGIC) {
+        ::close(parent_fd);
+        if (created_parent) {
+            rmdir(parent);
+        }
+        errno = EOPNOTSUPP;
+        return -1;
+    }
+    int fd = -1;
+    if (mkdirat(parent_fd, name, 0755) == 0 || errno == EEXIST) {
+        fd = openat(parent_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    }
+    int open_errno = errno;
+    ::close(parent_fd);
+    errno = open_errno;
+    return fd;
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+// Remove the (empty) cgroup with the given name within the given parent directory.
+inline int cgroup_remove(const char *parent, const char *name)
+{
+#ifdef __linux__
+    int parent_fd = open(parent, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (parent_fd == -1) {
+        return -1;
+    }
+    int r = unlinkat(parent_fd, name, AT_REMOVEDIR);
+    int rm_errno = errno;
+    ::close(parent_fd);
+    errno = rm_errno;
+    return r;
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+// Check whether the cgroup contains any processes. Returns 1 if so, 0 if not, or -1 on error.
+inline int cgroup_populated(int cgroup_fd)
+{
+#ifdef __linux__
+    int fd = openat(cgroup_fd, "cgroup.events", O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    char buf[128];
+    ssize_t r = ::read(fd, buf, sizeof(buf) - 1);
+    ::close(fd);
+    if (r <= 0) {
+        return -1;
+    }
+    buf[r] = 0;
+    const char *populated = strstr(buf, "populated ");
+    if (populated == nullptr) {
+        return -1;
+    }
+    return (populated[10] == '1') ? 1 : 0;
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+// Kill (with SIGKILL) all processes in the cgroup. This uses "cgroup.kill" if available (Linux 5.14
+// and later), and otherwise signals each process listed in "cgroup.procs".
+inline int cgroup_kill(int cgroup_fd)
+{
+#ifdef __linux__
+    int fd = openat(cgroup_fd, "cgroup.kill", O_WRONLY | O_CLOEXEC);
+    if (fd != -1) {
+        ssize_t r = ::write(fd, "1", 1);
+        ::close(fd);
+        if (r == 1) {
+            return 0;
+        }
+    }
+
+    fd = openat(cgroup_fd, "cgroup.procs", O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    char buf[256];
+    pid_t pid = 0;
+    ssize_t r;
+    while ((r = ::read(fd, buf, sizeof(buf))) > 0) {
+        for (ssize_t i = 0; i < r; i++) {
+            if (buf[i] >= '0' && buf[i] <= '9') {
+                pid = pid * 10 + (buf[i] - '0');
+            }
+            else {
+                if (pid != 0) ::kill(pid, SIGKILL);
+                pid = 0;
+            }
+        }
+    }
+    if (pid != 0) ::kill(pid, SIGKILL);
+    ::close(fd);
+    return 0;
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+// Open a file descriptor (non-blocking, close-on-exec) which becomes readable whenever the events file
+// of the cgroup, which reports whether it is populated, is modified. Any data available from the
+// file descriptor should be read (and discarded) before checking the cgroup state.
+inline int cgroup_watch_events(int cgroup_fd)
+{
+#ifdef __linux__
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/self/fd/%d/cgroup.events", cgroup_fd);
+    if (inotify_add_watch(fd, path, IN_MODIFY) == -1) {
+        int watch_errno = errno;
+        ::close(fd);
+        errno = watch_errno;
+        return -1;
+    }
+    return fd;
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
 }
 
 #endif  // BPSYS_INCLUDED
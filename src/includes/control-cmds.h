@@ -45,6 +45,33 @@ constexpr static int DINIT_CP_QUERYSERVICENAME = 15;
 // Reload a service:
 constexpr static int DINIT_CP_RELOADSERVICE = 16;
 
+// Find or load, and then start or stop, a batch of services (by name):
+constexpr static int DINIT_CP_BATCHSTARTSTOP = 17;
+
+// List services which have changed since a given state generation:
+constexpr static int DINIT_CP_LISTSERVICESSINCE = 18;
+
+// Subscribe to (or unsubscribe from) state changes of all services:
+constexpr static int DINIT_CP_SUBSCRIBEALL = 19;
+ // followed by 1-byte: 1 = subscribe, 0 = unsubscribe
+
+// Query the start timeline of all services (for boot analysis):
+constexpr static int DINIT_CP_QUERYTIMELINE = 20;
+
+// Read the buffered output of a service (with log-type = buffer):
+constexpr static int DINIT_CP_CATLOG = 21;
+ // followed by 1-byte flags (1 = discard the returned output from the buffer, 2 = if no output is
+ // available from the given position, wait until there is), 4-byte service handle, and uint64_t
+ // stream position from which to read
+
+// Query event loop statistics (only available if dinit was built with DASYNQ_INSTRUMENT):
+constexpr static int DINIT_CP_QUERYLOOPSTATS = 22;
+ // followed by 1-byte flags (1 = reset the statistics after returning them)
+
+// Query the status text of a service, as reported via the notification socket (STATUS=...):
+constexpr static int DINIT_CP_QUERYSTATUSTEXT = 23;
+ // followed by 4-byte service handle
+
 // Replies:
 
 // Reply: ACK/NAK to request
@@ -90,7 +117,60 @@ constexpr static int DINIT_RP_DEPENDENTS = 65;
 // Service name:
 constexpr static int DINIT_RP_SERVICENAME = 66;
 
+// Result of batch start/stop. Includes uint16_t count, and for each service: 1-byte result,
+// handle_t handle, 1-byte service state.
+constexpr static int DINIT_RP_BATCHRESULT = 67;
+
+// Start of incremental service list. Includes 1-byte flags (1 = full list: the client should
+// discard any previous list) and uint64_t current state generation.
+constexpr static int DINIT_RP_LISTGENERATION = 68;
+
+// Start of service timeline list. Includes uint32_t number of services and uint64_t current time
+// (monotonic clock, nanoseconds). Followed by SVCTIMELINE for each service, then LISTDONE.
+constexpr static int DINIT_RP_TIMELINE = 69;
+
+// Timeline of a service: 1-byte service state, uint16_t name length, uint32_t number of
+// dependencies, uint64_t time (monotonic clock, nanoseconds; 0 if not recorded) of each timeline
+// event (see timeline_event_t), the service name, and for each dependency: uint32_t index (in the
+// list) of the dependency service and 1-byte dependency type.
+constexpr static int DINIT_RP_SVCTIMELINE = 70;
+
+// Service output (reply to CATLOG): 1-byte reserved, uint64_t stream position of the returned output,
+// uint64_t stream position following the most recent output in the buffer, uint32_t length, and the
+// output itself. If the returned output begins at a later position than was requested, output has
+// been lost (overwritten or discarded) in between.
+constexpr static int DINIT_RP_SERVICELOG = 71;
+
+// Event loop statistics (reply to QUERYLOOPSTATS): 1-byte number of watcher categories (N), 1-byte
+// number of histogram buckets (B), followed by 1 + 2 * N histograms: the event batch size, then the
+// dispatch latency for each category, then the callback time for each category (times in
+// nanoseconds). Each histogram is: uint64_t count, uint64_t total, uint64_t max, and B * uint64_t
+// bucket counts (see dasynq::stats_histogram). The categories are as given by the DINIT_LS_*
+// constants below; a category number beyond those is not (currently) used.
+constexpr static int DINIT_RP_LOOPSTATS = 72;
+
+// Service status text (reply to QUERYSTATUSTEXT): 1-byte reserved, uint32_t length, and the text
+// (empty if the service has not reported any).
+constexpr static int DINIT_RP_STATUSTEXT = 73;
+
 // Information:
 
 // Service event occurred (4-byte service handle, 1 byte event code)
 constexpr static int DINIT_IP_SERVICEEVENT = 100;
+
+// Service identifier (for service state change subscription): 4-byte service id, followed by
+// the service name. Sent before the first state change for a service.
+constexpr static int DINIT_IP_SERVICENAMEID = 101;
+
+// Service state change (for service state change subscription): 4-byte service id, 1-byte old
+// state, 1-byte new state, 1-byte flags (1 = coalesced: intermediate states were not reported),
+// pid_t process id, 8-byte timestamp (monotonic clock, nanoseconds).
+constexpr static int DINIT_IP_SERVICESTATE = 102;
+
+// Event loop statistics categories (see DINIT_RP_LOOPSTATS):
+constexpr static int DINIT_LS_SIGNAL = 0;   // signal watchers
+constexpr static int DINIT_LS_FD = 1;       // other file descriptor watchers
+constexpr static int DINIT_LS_CHILD = 2;    // child process watchers
+constexpr static int DINIT_LS_TIMER = 3;    // timers
+constexpr static int DINIT_LS_CONTROL = 4;  // control socket and connections
+constexpr static int DINIT_LS_LOG = 5;      // log output (dinit's and services')
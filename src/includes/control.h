@@ -3,6 +3,7 @@
 
 #include <list>
 #include <vector>
+#include <string>
 #include <unordered_map>
 #include <map>
 #include <limits>
@@ -15,6 +16,10 @@
 #include "control-cmds.h"
 #include "service-listener.h"
 #include "cpbuffer.h"
+#include "control-inbuf.h"
+#include "control-outbuf.h"
+#include "control-handles.h"
+#include "log-buffer.h"
 
 // Control connection for dinit
 
@@ -36,6 +41,30 @@ extern int active_control_conns;
 //      (2 bytes) service name length
 //      (M bytes) service name (without nul terminator)
 
+//   for BATCHSTARTSTOP:
+//      (1 byte) command: DINIT_CP_STARTSERVICE or DINIT_CP_STOPSERVICE
+//      (1 byte) flags: 1 = pin in requested state, 2 = gentle stop (fail if dependents)
+//      (2 bytes) number of services
+//      (2 bytes) length of following name data
+//      for each service: (2 bytes) service name length, (M bytes) service name
+
+//   for LISTSERVICESSINCE:
+//      (8 bytes) state generation (as returned by a previous LISTSERVICESSINCE, or 0)
+
+//   for SUBSCRIBEALL:
+//      (1 byte) 1 = subscribe, 0 = unsubscribe
+
+//   for CATLOG:
+//      (1 byte) flags: 1 = discard returned output, 2 = wait for output
+//      (4 bytes) service handle
+//      (8 bytes) stream position from which to read
+
+//   for QUERYLOOPSTATS:
+//      (1 byte) flags: 1 = reset statistics
+
+//   for QUERYSTATUSTEXT:
+//      (4 bytes) service handle
+
 // Information packet:
 // (1 byte) packet type, >= 100
 // (1 byte) packet length (including all fields)
@@ -56,7 +85,7 @@ class control_conn_watcher : public eventloop_t::bidi_fd_watcher_impl<control_co
     public:
     control_conn_watcher(eventloop_t & event_loop_p) : event_loop(&event_loop_p)
     {
-        // constructor
+        set_stats_category(STATS_CONTROL);
     }
 
     control_conn_watcher(const control_conn_watcher &) = delete;
@@ -78,7 +107,7 @@ class control_conn_watcher : public eventloop_t::bidi_fd_watcher_impl<control_co
     }
 };
 
-class control_conn_t : private service_listener
+class control_conn_t : private service_listener, private service_set_listener
 {
     friend rearm control_conn_cb(eventloop_t *loop, control_conn_watcher *watcher, int revents);
     friend class control_conn_t_test;
@@ -86,7 +115,12 @@ class control_conn_t : private service_listener
     public:
     // A mapping between service records and their associated numerical identifier used
     // in communction
-    using handle_t = uint32_t;
+    using handle_t = control_handle_table::handle_t;
+
+    // Per-connection buffer limit. The receive buffer will not grow beyond this size (so it
+    // limits the size of a request); no further requests are processed while the amount of
+    // output waiting to be sent exceeds it. (Must be set before connections are created).
+    static unsigned buffer_limit;
 
     private:
     control_conn_watcher iob;
@@ -101,19 +135,55 @@ class control_conn_t : private service_listener
     int chklen;
     
     // Receive buffer
-    cpbuffer<1024> rbuf;
+    control_inbuf rbuf;
     
     template <typename T> using list = std::list<T>;
     template <typename T> using vector = std::vector<T>;
     
-    std::unordered_multimap<service_record *, handle_t> service_key_map;
-    std::map<handle_t, service_record *> key_service_map;
-    
-    // Buffer for outgoing packets. Each outgoing back is represented as a vector<char>.
-    list<vector<char>> outbuf;
-    // Current index within the first outgoing packet (all previous bytes have been sent).
-    unsigned outpkt_index = 0;
+    // Service handles allocated to this connection
+    control_handle_table handles;
     
+    // Buffer for outgoing packets.
+    control_outbuf outbuf;
+
+    // A service state change, not yet sent to a subscribed client
+    struct state_event
+    {
+        uint32_t service_id;
+        service_state_t old_state;
+        service_state_t new_state;
+        bool coalesced;         // whether intermediate state changes were dropped
+        pid_t pid;
+        uint64_t timestamp;
+        std::string name;       // service name, if not yet sent to the client
+    };
+
+    // Whether subscribed to state changes for all services
+    bool subscribed_all = false;
+
+    // Service identifiers for which the service name has been sent (to a subscribed client)
+    std::vector<bool> announced_ids;
+
+    // State changes waiting to be sent, in order (from pending_head), with an index by service
+    // identifier. When the client is slow to read and output has reached the buffer limit, state
+    // changes are queued here, with further changes for a service which already has a pending
+    // state change being merged into it; the queue therefore holds at most one change per service.
+    // Sent changes (before pending_head) are discarded once they make up half the queue.
+    std::vector<state_event> pending_events;
+    size_t pending_head = 0;
+    std::unordered_map<uint32_t, size_t> pending_index;
+
+    // A CATLOG request waiting for output from a service (log_wait_service is nullptr if none).
+    // While a request is waiting, no further requests are processed.
+    service_record *log_wait_service = nullptr;
+    uint64_t log_wait_pos;
+    char log_wait_flags;
+
+    // Whether output is being deferred (while processing received packets). When deferred,
+    // queued packets are not written immediately but are written together (via writev) once
+    // processing is complete.
+    bool defer_output = false;
+
     // Queue a packet to be sent
     //  Returns:  false if the packet could not be queued and a suitable error packet
     //              could not be sent/queued (the connection should be closed);
@@ -124,6 +194,19 @@ class control_conn_t : private service_listener
     // The in/out watch enabled state will also be set appropriately.
     bool queue_packet(vector<char> &&v) noexcept;
     bool queue_packet(const char *pkt, unsigned size) noexcept;
+    bool queue_packet(std::initializer_list<control_outbuf::part> parts) noexcept;
+
+    // Write as much buffered output as possible. Returns false if a write error occurred (the
+    // connection should be closed).
+    bool write_output() noexcept;
+
+    // Process all complete packets in the receive buffer (while the output buffer is below the
+    // limit), write the resulting output, and set watches appropriately. Returns true if the
+    // connection should be closed.
+    bool process_packets() noexcept;
+
+    // Set the in/out watches according to connection state and buffer contents.
+    void set_io_watches() noexcept;
 
     // Process a packet.
     //  Returns:  true (with bad_conn_close == false) if successful
@@ -140,6 +223,9 @@ class control_conn_t : private service_listener
     // Process a FINDSERVICE/LOADSERVICE packet. May throw std::bad_alloc.
     bool process_find_load(int pktType);
 
+    // Process a BATCHSTARTSTOP packet. May throw std::bad_alloc.
+    bool process_batch_start_stop();
+
     // Process an UNPINSERVICE packet. May throw std::bad_alloc.
     bool process_unpin_service();
     
@@ -155,6 +241,46 @@ class control_conn_t : private service_listener
     // List all loaded services and their state.
     bool list_services();
 
+    // List services which have changed state since a given state generation.
+    bool list_services_since();
+
+    // Queue a SVCINFO packet for a service. Returns false if the connection should be closed.
+    bool queue_svc_info(service_record *sptr);
+
+    // List the start timeline (and dependencies) of all services.
+    bool list_timeline();
+
+    // Process a SUBSCRIBEALL packet.
+    bool process_subscribe_all();
+
+    // Process a CATLOG packet. May throw std::bad_alloc.
+    bool process_catlog();
+
+    // Process a QUERYLOOPSTATS packet.
+    bool process_query_loop_stats();
+
+    // Process a QUERYSTATUSTEXT packet.
+    bool process_query_status_text();
+
+    // Queue a SERVICELOG reply with buffered output from the given position. May throw
+    // std::bad_alloc.
+    bool queue_log_output(service_log_buffer *log_buf, uint64_t from_pos, char flags);
+
+    // Queue a state change packet (preceded by the service name, if not yet sent). May throw
+    // std::bad_alloc.
+    void queue_state_event(state_event &event);
+
+    // Queue pending state changes, while the output buffer is below the limit.
+    void flush_state_events() noexcept;
+
+    // Discard pending state changes.
+    void clear_state_events() noexcept
+    {
+        pending_events.clear();
+        pending_index.clear();
+        pending_head = 0;
+    }
+
     // Add a dependency between two services.
     bool add_service_dep(bool do_start = false);
 
@@ -181,12 +307,7 @@ class control_conn_t : private service_listener
     // Find the service corresponding to a service handle; returns nullptr if not found.
     service_record *find_service_for_key(handle_t key) noexcept
     {
-        try {
-            return key_service_map.at(key);
-        }
-        catch (std::out_of_range &exc) {
-            return nullptr;
-        }
+        return handles.find(key);
     }
     
     // Close connection due to out-of-memory condition.
@@ -203,34 +324,26 @@ class control_conn_t : private service_listener
     void service_event(service_record * service, service_event_t event) noexcept final override
     {
         // For each service handle corresponding to the event, send an information packet.
-        auto range = service_key_map.equal_range(service);
-        auto & i = range.first;
-        auto & end = range.second;
-        try {
-            while (i != end) {
-                uint32_t key = i->second;
-                std::vector<char> pkt;
-                constexpr int pktsize = 3 + sizeof(key);
-                pkt.reserve(pktsize);
-                pkt.push_back(DINIT_IP_SERVICEEVENT);
-                pkt.push_back(pktsize);
-                char * p = (char *) &key;
-                for (int j = 0; j < (int)sizeof(key); j++) {
-                    pkt.push_back(*p++);
-                }
-                pkt.push_back(static_cast<char>(event));
-                queue_packet(std::move(pkt));
-                ++i;
-            }
-        }
-        catch (std::bad_alloc &exc) {
-            do_oom_close();
-        }
+        handles.for_each_handle(service, [&](handle_t key) {
+            constexpr int pktsize = 3 + sizeof(key);
+            char pkt[pktsize];
+            pkt[0] = DINIT_IP_SERVICEEVENT;
+            pkt[1] = pktsize;
+            memcpy(pkt + 2, &key, sizeof(key));
+            pkt[2 + sizeof(key)] = static_cast<char>(event);
+            queue_packet(pkt, pktsize);
+        });
     }
+
+    // Output from a service was added to its log buffer.
+    void service_log_output(service_record *service) noexcept final override;
+
+    // Process a state change of any service (when subscribed to all services).
+    void service_state_change(service_record *service, service_state_t old_state) noexcept final override;
     
     public:
     control_conn_t(eventloop_t &loop, service_set * services_p, int fd)
-            : iob(loop), loop(loop), services(services_p), chklen(0)
+            : iob(loop), loop(loop), services(services_p), chklen(0), rbuf(buffer_limit)
     {
         iob.add_watch(loop, fd, dasynq::IN_EVENTS);
         active_control_conns++;
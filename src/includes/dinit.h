@@ -1,6 +1,9 @@
 #ifndef DINIT_H_INCLUDED
 #define DINIT_H_INCLUDED 1
 
+#include <string>
+#include <vector>
+
 #include "dasynq.h"
 
 /*
@@ -13,9 +16,15 @@ using clock_type = dasynq::clock_type;
 using rearm = dasynq::rearm;
 using time_val = dasynq::time_val;
 
+// Event loop statistics categories (in addition to dasynq's standard categories, i.e. signal, fd,
+// child and timer watchers). These are reported as part of the control protocol.
+constexpr unsigned STATS_CONTROL = dasynq::STATS_USER;       // control socket/connections
+constexpr unsigned STATS_LOG = dasynq::STATS_USER + 1;       // log output (dinit's own and services')
+
 void rootfs_is_rw() noexcept;
 void setup_external_log() noexcept;
 void read_env_file(const char *);
+void read_env_file(const char *, std::vector<std::string> &);
 
 extern eventloop_t event_loop;
 
@@ -1,3 +1,6 @@
+#ifndef LOAD_SERVICE_H_INCLUDED
+#define LOAD_SERVICE_H_INCLUDED 1
+
 #include <iostream>
 #include <list>
 #include <limits>
@@ -29,10 +32,14 @@ struct service_flags_t
     bool start_interruptible : 1; // the startup of this service process is ok to interrupt with SIGINT
     bool skippable : 1;   // if interrupted the service is skipped (scripted services)
     bool signal_process_only : 1;  // signal the session process, not the whole group
+    bool use_cgroup : 1;  // run the process in a cgroup of its own (process services, Linux only)
+    bool ready_on_socket : 1;  // dependents need not wait for start, only for the activation socket
+    bool on_demand : 1;   // start when a connection to the activation socket is pending
 
     service_flags_t() noexcept : rw_ready(false), log_ready(false), no_sigterm(false),
             runs_on_console(false), starts_on_console(false), shares_console(false),
-            pass_cs_fd(false), start_interruptible(false), skippable(false), signal_process_only(false)
+            pass_cs_fd(false), start_interruptible(false), skippable(false), signal_process_only(false),
+            use_cgroup(false), ready_on_socket(false), on_demand(false)
     {
     }
 };
@@ -581,6 +588,9 @@ class service_settings_wrapper
     service_type_t service_type = service_type_t::PROCESS;
     std::list<dep_type> depends;
     string logfile;
+    log_type_id log_type = log_type_id::NONE;
+    bool log_type_set = false;  // whether log-type was explicitly specified (else implied by logfile)
+    unsigned log_buf_max = 4096;
     service_flags_t onstart_flags;
     int term_signal = -1;  // additional termination signal
     bool auto_restart = false;
@@ -595,12 +605,18 @@ class service_settings_wrapper
     timespec restart_interval = { .tv_sec = 10, .tv_nsec = 0 };
     int max_restarts = 3;
     timespec restart_delay = { .tv_sec = 0, .tv_nsec = 200000000 };
+    timespec restart_delay_max = { .tv_sec = 0, .tv_nsec = 0 };
+    timespec restart_jitter = { .tv_sec = 0, .tv_nsec = 0 };
     timespec stop_timeout = { .tv_sec = 10, .tv_nsec = 0 };
     timespec start_timeout = { .tv_sec = 60, .tv_nsec = 0 };
+    timespec activation_lifetime = { .tv_sec = 0, .tv_nsec = 0 };
+    int start_priority = 0;
     std::vector<service_rlimits> rlimits;
 
     int readiness_fd = -1;      // readiness fd in service process
     std::string readiness_var;  // environment var to hold readiness fd
+    bool readiness_socket = false;  // readiness notification via the (shared) notification socket
+    timespec watchdog_timeout = { .tv_sec = 0, .tv_nsec = 0 };
 
     uid_t run_as_uid = -1;
     gid_t run_as_gid = -1;
@@ -701,6 +717,32 @@ void process_service_line(settings_wrapper &settings, const char *name, string &
     }
     else if (setting == "logfile") {
         settings.logfile = read_setting_value(i, end);
+        if (! settings.log_type_set) {
+            settings.log_type = settings.logfile.empty() ? log_type_id::NONE : log_type_id::LOGFILE;
+        }
+    }
+    else if (setting == "log-type") {
+        string log_type_str = read_setting_value(i, end);
+        if (log_type_str == "file") {
+            settings.log_type = log_type_id::LOGFILE;
+        }
+        else if (log_type_str == "buffer") {
+            settings.log_type = log_type_id::BUFFER;
+        }
+        else if (log_type_str == "none") {
+            settings.log_type = log_type_id::NONE;
+        }
+        else {
+            throw service_description_exc(name, "log-type must be one of: \"file\", \"buffer\" or \"none\"");
+        }
+        settings.log_type_set = true;
+    }
+    else if (setting == "log-buffer-size") {
+        string size_str = read_setting_value(i, end);
+        settings.log_buf_max = parse_unum_param(size_str, name, std::numeric_limits<int>::max());
+        if (settings.log_buf_max == 0) {
+            throw service_description_exc(name, "log-buffer-size must be greater than zero");
+        }
     }
     else if (setting == "restart") {
         string restart = read_setting_value(i, end);
@@ -771,6 +813,15 @@ void process_service_line(settings_wrapper &settings, const char *name, string &
             else if (option_txt == "signal-process-only") {
                 settings.onstart_flags.signal_process_only = true;
             }
+            else if (option_txt == "cgroup") {
+                settings.onstart_flags.use_cgroup = true;
+            }
+            else if (option_txt == "ready-on-socket") {
+                settings.onstart_flags.ready_on_socket = true;
+            }
+            else if (option_txt == "on-demand") {
+                settings.onstart_flags.on_demand = true;
+            }
             else {
                 throw service_description_exc(name, "Unknown option: " + option_txt);
             }
@@ -814,6 +865,14 @@ void process_service_line(settings_wrapper &settings, const char *name, string &
         string rsdelay_str = read_setting_value(i, end, nullptr);
         parse_timespec(rsdelay_str, name, "restart-delay", settings.restart_delay);
     }
+    else if (setting == "restart-delay-max") {
+        string rsdelay_str = read_setting_value(i, end, nullptr);
+        parse_timespec(rsdelay_str, name, "restart-delay-max", settings.restart_delay_max);
+    }
+    else if (setting == "restart-jitter") {
+        string jitter_str = read_setting_value(i, end, nullptr);
+        parse_timespec(jitter_str, name, "restart-jitter", settings.restart_jitter);
+    }
     else if (setting == "restart-limit-count") {
         string limit_str = read_setting_value(i, end, nullptr);
         settings.max_restarts = parse_unum_param(limit_str, name, std::numeric_limits<int>::max());
@@ -826,6 +885,21 @@ void process_service_line(settings_wrapper &settings, const char *name, string &
         string starttimeout_str = read_setting_value(i, end, nullptr);
         parse_timespec(starttimeout_str, name, "start-timeout", settings.start_timeout);
     }
+    else if (setting == "watchdog-timeout") {
+        string watchdog_str = read_setting_value(i, end, nullptr);
+        parse_timespec(watchdog_str, name, "watchdog-timeout", settings.watchdog_timeout);
+    }
+    else if (setting == "activation-lifetime") {
+        string lifetime_str = read_setting_value(i, end, nullptr);
+        parse_timespec(lifetime_str, name, "activation-lifetime", settings.activation_lifetime);
+    }
+    else if (setting == "start-priority") {
+        string priority_str = read_setting_value(i, end, nullptr);
+        bool negative = ! priority_str.empty() && priority_str[0] == '-';
+        int priority = parse_unum_param(negative ? priority_str.substr(1) : priority_str, name,
+                std::numeric_limits<int>::max());
+        settings.start_priority = negative ? -priority : priority;
+    }
     else if (setting == "run-as") {
         string run_as_str = read_setting_value(i, end, nullptr);
         settings.run_as_uid = parse_uid_param(run_as_str, name, "run-as", &settings.run_as_gid);
@@ -846,6 +920,9 @@ void process_service_line(settings_wrapper &settings, const char *name, string &
                         "in ready-notification");
             }
         }
+        else if (notify_setting == "socket") {
+            settings.readiness_socket = true;
+        }
         else {
             throw service_description_exc(name, "Unknown ready-notification setting: "
                     + notify_setting);
@@ -899,3 +976,5 @@ void process_service_line(settings_wrapper &settings, const char *name, string &
 } // namespace dinit_load
 
 using dinit_load::process_service_file;
+
+#endif
@@ -30,6 +30,24 @@ enum class service_event_t {
     STOPCANCELLED      // Service was set to be stopped but a start was requested
 };
 
+/* Events in the start of a service, for which the time is recorded (for boot analysis) */
+enum class timeline_event_t {
+    REQUIRED,       // service was marked for start
+    DEPS_STARTED,   // all dependencies of the service had started
+    FORKED,         // service process was forked (process-based services)
+    EXEC_SUCCEEDED, // service process successfully executed its command (process-based services)
+    STARTED         // service reached STARTED state
+};
+
+constexpr int NUM_TIMELINE_EVENTS = 5;
+
+/* Destination of service process output (stdout/stderr) */
+enum class log_type_id {
+    NONE,       // discard output (/dev/null)
+    LOGFILE,    // append to a log file
+    BUFFER      // capture in a memory buffer, readable via the control protocol
+};
+
 /* Shutdown types */
 enum class shutdown_type_t {
     NONE,              // No explicit shutdown
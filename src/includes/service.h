@@ -6,7 +6,11 @@
 #include <vector>
 #include <csignal>
 #include <unordered_set>
+#include <unordered_map>
 #include <algorithm>
+#include <iterator>
+#include <cstring>
+#include <new>
 
 #include "dasynq.h"
 
@@ -15,6 +19,7 @@
 #include "service-listener.h"
 #include "service-constants.h"
 #include "load-service.h"
+#include "service-cache.h"
 #include "dinit-ll.h"
 #include "dinit-log.h"
 #include "options-processing.h" // TODO maybe remove, service_dir_pathlist can be moved?
@@ -115,6 +120,7 @@
 class service_record;
 class service_set;
 class base_process_service;
+class service_log_buffer;
 
 /* Service dependency record */
 class service_dep
@@ -160,6 +166,115 @@ class service_dep
     }
 };
 
+/*
+ * Pool allocator for service dependency records (the edges of the dependency graph). Records are
+ * allocated from large chunks, so that allocating a record normally requires only a pointer
+ * increment, and so that the records for the dependencies of a service (which are allocated
+ * together, when the service is loaded) are contiguous in memory. Released records are kept in a
+ * free list for re-use. The pool belongs to the service_set; it must outlive all records allocated
+ * from it.
+ */
+class service_dep_pool
+{
+    static constexpr size_t chunk_size = 256;  // records per chunk
+
+    union slot
+    {
+        slot *next_free;
+        alignas(service_dep) char storage[sizeof(service_dep)];
+    };
+
+    std::vector<slot *> chunks;
+    slot *free_list = nullptr;
+    size_t chunk_used = chunk_size;  // number of slots used from the last chunk
+
+    public:
+    service_dep_pool() noexcept
+    {
+    }
+
+    service_dep_pool(const service_dep_pool &) = delete;
+    void operator=(const service_dep_pool &) = delete;
+
+    ~service_dep_pool()
+    {
+        for (slot *chunk : chunks) {
+            delete[] chunk;
+        }
+    }
+
+    // Allocate (and construct) a dependency record. May throw std::bad_alloc.
+    service_dep *allocate(service_record *from, service_record *to, dependency_type dep_type)
+    {
+        slot *s;
+        if (free_list != nullptr) {
+            s = free_list;
+            free_list = s->next_free;
+        }
+        else {
+            if (chunk_used == chunk_size) {
+                chunks.reserve(chunks.size() + 1);
+                chunks.push_back(new slot[chunk_size]);
+                chunk_used = 0;
+            }
+            s = &chunks.back()[chunk_used++];
+        }
+        return new (s->storage) service_dep(from, to, dep_type);
+    }
+
+    // Release (destroy) a dependency record.
+    void release(service_dep *dep) noexcept
+    {
+        dep->~service_dep();
+        slot *s = reinterpret_cast<slot *>(dep);
+        s->next_free = free_list;
+        free_list = s;
+    }
+};
+
+/*
+ * The dependencies of a service: a contiguous array of (pointers to) dependency records. Iteration
+ * yields references to the dependency records. The records themselves are allocated from the
+ * service set's service_dep_pool; their addresses remain stable (dependents refer to them by
+ * pointer). Modification is performed via service_record.
+ */
+class service_dep_list
+{
+    friend class service_record;
+
+    using vec_type = std::vector<service_dep *>;
+    vec_type deps;
+
+    public:
+    class iterator
+    {
+        vec_type::const_iterator i;
+
+        public:
+        iterator(vec_type::const_iterator i_p) noexcept : i(i_p) { }
+
+        service_dep &operator*() const noexcept { return **i; }
+        service_dep *operator->() const noexcept { return *i; }
+
+        iterator &operator++() noexcept
+        {
+            ++i;
+            return *this;
+        }
+
+        bool operator==(const iterator &other) const noexcept { return i == other.i; }
+        bool operator!=(const iterator &other) const noexcept { return i != other.i; }
+    };
+
+    iterator begin() const noexcept { return iterator(deps.begin()); }
+    iterator end() const noexcept { return iterator(deps.end()); }
+
+    size_t size() const noexcept { return deps.size(); }
+    bool empty() const noexcept { return deps.empty(); }
+
+    service_dep &operator[](size_t n) const noexcept { return *deps[n]; }
+};
+
 /* preliminary service dependency information */
 class prelim_dep
 {
@@ -173,6 +288,45 @@ class prelim_dep
     }
 };
 
+// Times (monotonic clock) at which the events in the most recent start of a service occurred. A
+// zero time means that the event has not been recorded.
+class service_timeline
+{
+    using time_val = dasynq::time_val;
+
+    time_val times[NUM_TIMELINE_EVENTS];
+
+    public:
+    service_timeline() noexcept
+    {
+        reset();
+    }
+
+    void reset() noexcept
+    {
+        for (auto &t : times) {
+            t = time_val(0, 0);
+        }
+    }
+
+    // Record the current time for the given event.
+    void record(timeline_event_t event) noexcept
+    {
+        event_loop.get_time(times[(int)event], dasynq::clock_type::MONOTONIC);
+    }
+
+    bool is_recorded(timeline_event_t event) const noexcept
+    {
+        const time_val &t = times[(int)event];
+        return t.seconds() != 0 || t.nseconds() != 0;
+    }
+
+    const time_val &get(timeline_event_t event) const noexcept
+    {
+        return times[(int)event];
+    }
+};
+
 // service_record: base class for service record containing static information
 // and current state of each service.
 //
@@ -198,7 +352,9 @@ class service_record
     protected:
     service_flags_t onstart_flags;
 
+    log_type_id log_type = log_type_id::LOGFILE;  // where process output goes
     string logfile;           // log file name, empty string specifies /dev/null
+    unsigned log_buf_max = 0; // maximum size of log buffer (if log_type is BUFFER)
     
     bool auto_restart : 1;    // whether to restart this (process) if it dies unexpectedly
     bool smooth_recovery : 1; // whether the service process can restart without bringing down service
@@ -209,6 +365,8 @@ class service_record
                                 // if STOPPING, whether we are waiting for dependents to stop
     bool waiting_for_console : 1;   // waiting for exclusive console access (while STARTING)
     bool have_console : 1;      // whether we have exclusive console access (STARTING/STARTED)
+    bool waiting_for_start_slot : 1;  // waiting for a start slot (while STARTING; see service_set)
+    bool have_start_slot : 1;   // whether we hold a start slot (while STARTING)
     bool waiting_for_execstat : 1;  // if we are waiting for exec status after fork()
     bool start_explicit : 1;    // whether we are are explicitly required to be started
 
@@ -224,11 +382,13 @@ class service_record
     
     int required_by = 0;        // number of dependents wanting this service to be started
 
+    int start_priority = 0;     // priority for allocation of start slots (higher is sooner)
+
     // list of dependencies
-    typedef std::list<service_dep> dep_list;
+    typedef service_dep_list dep_list;
     
     // list of dependents
-    typedef std::list<service_dep *> dpt_list;
+    typedef std::vector<service_dep *> dpt_list;
     
     dep_list depends_on;  // services this one depends on
     dpt_list dependents;  // services depending on this one
@@ -258,13 +418,35 @@ class service_record
     
     // Console queue.
     lld_node<service_record> console_queue_node;
+
+    // Start slot queue, and the length of the chain of starting services waiting on this service
+    // (as most recently calculated, when the chain stamp was assigned)
+    lld_node<service_record> start_queue_node;
+    unsigned start_chain_len = 0;
+    uint32_t start_chain_stamp = 0;
     
     // Propagation and start/stop queues
     lls_node<service_record> prop_queue_node;
     lls_node<service_record> stop_queue_node;
+
+    // List of services in order of change, and the state generation at which this service last
+    // changed
+    lld_node<service_record> change_list_node;
+    uint64_t change_generation = 0;
+
+    // Identifier of the service, unique (within the set) across all services ever added; 0 if not
+    // yet added
+    uint32_t service_id = 0;
+
+    // Times of events during the most recent start
+    service_timeline start_timeline;
     
     protected:
 
+    // Allocate a dependency record and link it into the dependencies list (of this service) and the
+    // dependents list (of the dependency). May throw std::bad_alloc.
+    service_dep &add_dep_record(service_record *to, dependency_type dep_type);
+
     // Service has actually stopped (includes having all dependents
     // reaching STOPPED state).
     void stopped() noexcept;
@@ -320,6 +502,14 @@ class service_record
             l->service_event(this, event);
         }
     }
+
+    // Notify listeners that output has been added to the log buffer.
+    void notify_log_output() noexcept
+    {
+        for (auto l : listeners) {
+            l->service_log_output(this);
+        }
+    }
     
     // Queue to run on the console. 'acquired_console()' will be called when the console is available.
     // Has no effect if the service has already queued for console.
@@ -327,6 +517,17 @@ class service_record
     
     // Release console (console must be currently held by this service)
     void release_console() noexcept;
+
+    // Whether a start slot must be held to bring this service up (see service_set::set_max_starting).
+    // Only services which start a process, and only in STARTING state, need a slot.
+    bool needs_start_slot() noexcept
+    {
+        return service_state == service_state_t::STARTING && (record_type == service_type_t::PROCESS
+                || record_type == service_type_t::BGPROCESS || record_type == service_type_t::SCRIPTED);
+    }
+
+    // Release the start slot, if held
+    void release_start_slot() noexcept;
     
     // Started state reached
     bool process_started() noexcept;
@@ -337,10 +538,31 @@ class service_record
     // Begin stopping, release activation.
     void do_stop() noexcept;
 
+    // Record that the externally visible state of the service (state, target state, process ID or
+    // exit status) has changed.
+    void mark_changed() noexcept;
+
+    // Record a change of state (including marking the service as changed), and notify service set
+    // listeners.
+    void state_changed(service_state_t old_state) noexcept;
+
     // Set the service state
     void set_state(service_state_t new_state) noexcept
     {
-        service_state = new_state;
+        if (service_state != new_state) {
+            service_state_t old_state = service_state;
+            service_state = new_state;
+            state_changed(old_state);
+        }
+    }
+
+    // Set the desired (target) state
+    void set_target_state(service_state_t new_state) noexcept
+    {
+        if (desired_state != new_state) {
+            desired_state = new_state;
+            mark_changed();
+        }
     }
 
     // Virtual functions, to be implemented by service implementations:
@@ -373,13 +595,21 @@ class service_record
     // any appropriate cleanup.
     virtual void becoming_inactive() noexcept { }
 
+    // Whether dependents may start without waiting for this service to start (because they need only
+    // its activation socket, which is already open).
+    virtual bool dependents_need_not_wait() noexcept
+    {
+        return false;
+    }
+
     public:
 
     service_record(service_set *set, const string &name)
         : service_name(name), service_state(service_state_t::STOPPED),
             desired_state(service_state_t::STOPPED), auto_restart(false), smooth_recovery(false),
             pinned_stopped(false), pinned_started(false), waiting_for_deps(false),
-            waiting_for_console(false), have_console(false), waiting_for_execstat(false),
+            waiting_for_console(false), have_console(false), waiting_for_start_slot(false),
+            have_start_slot(false), waiting_for_execstat(false),
             start_explicit(false), prop_require(false), prop_release(false), prop_failure(false),
             prop_start(false), prop_stop(false), restarting(false), start_failed(false),
             start_skipped(false), force_stop(false)
@@ -397,23 +627,14 @@ class service_record
         service_name = name;
         this->record_type = record_type_p;
 
+        depends_on.deps.reserve(deplist_p.size());
         try {
             for (auto & pdep : deplist_p) {
-                auto b = depends_on.emplace(depends_on.end(), this, pdep.to, pdep.dep_type);
-                try {
-                    pdep.to->dependents.push_back(&(*b));
-                }
-                catch (...) {
-                    // we'll roll back one now and re-throw:
-                    depends_on.pop_back();
-                    throw;
-                }
+                add_dep_record(pdep.to, pdep.dep_type);
             }
         }
         catch (...) {
-            for (auto & dep : depends_on) {
-                dep.get_to()->dependents.pop_back();
-            }
+            rm_deps(0, depends_on.size());
             throw;
         }
     }
@@ -421,9 +642,7 @@ class service_record
     service_record(const service_record &) = delete;
     void operator=(const service_record &) = delete;
 
-    virtual ~service_record() noexcept
-    {
-    }
+    virtual ~service_record() noexcept;
     
     // Get the type of this service record
     service_type_t get_type() noexcept
@@ -438,6 +657,9 @@ class service_record
 
     // Console is available.
     void acquired_console() noexcept;
+
+    // A start slot has been assigned to this service.
+    void acquired_start_slot() noexcept;
     
     // Get the target (aka desired) state.
     service_state_t get_target_state() noexcept
@@ -462,6 +684,30 @@ class service_record
         this->logfile = std::move(logfile);
     }
 
+    // Set the log type (destination of process output), and the size of the log buffer for
+    // log_type_id::BUFFER.
+    void set_log_mode(log_type_id log_type, unsigned log_buf_max) noexcept
+    {
+        this->log_type = log_type;
+        this->log_buf_max = log_buf_max;
+    }
+
+    log_type_id get_log_type() noexcept
+    {
+        return log_type;
+    }
+
+    // Set the priority for allocation of start slots (see service_set::set_max_starting).
+    void set_start_priority(int priority) noexcept
+    {
+        start_priority = priority;
+    }
+
+    int get_start_priority() noexcept
+    {
+        return start_priority;
+    }
+
     // Set whether this service should automatically restart when it dies
     void set_auto_restart(bool auto_restart) noexcept
     {
@@ -500,6 +746,8 @@ class service_record
     }
 
     const std::string &get_name() const noexcept { return service_name; }
+    uint32_t get_id() const noexcept { return service_id; }
+    const service_timeline &get_start_timeline() const noexcept { return start_timeline; }
     service_state_t get_state() const noexcept { return service_state; }
     
     void start(bool activate = true) noexcept;  // start the service
@@ -563,15 +811,7 @@ class service_record
     }
 
     // Prepare this service to be unloaded.
-    void prepare_for_unload() noexcept
-    {
-        // Remove all dependencies:
-        for (auto &dep : depends_on) {
-            auto &dep_dpts = dep.get_to()->dependents;
-            dep_dpts.erase(std::find(dep_dpts.begin(), dep_dpts.end(), &dep));
-        }
-        depends_on.clear();
-    }
+    void prepare_for_unload() noexcept;
 
     // Why did the service stop?
     stopped_reason_t get_stop_reason()
@@ -594,11 +834,49 @@ class service_record
         return -1;
     }
 
+    // Open the activation socket of the service (if it has one, and it is not already open) ahead
+    // of starting the service. If the socket is open, but its file has disappeared (eg because a
+    // filesystem has since been mounted over its directory) and the service is stopped, it is
+    // re-created. Failure is logged (unless it may be due to the filesystem not yet being
+    // writable or mounted, and report_ro_failure is false), and the socket will be opened again
+    // when the service starts.
+    virtual void open_activation_socket(bool report_ro_failure) noexcept
+    {
+    }
+
+    // The service is no longer on-demand (after its settings were reloaded): stop listening for
+    // connections on its activation socket, and close the socket unless the service is active.
+    virtual void close_activation_socket() noexcept
+    {
+    }
+
     virtual int get_exit_status()
     {
         return 0;
     }
 
+    // Handle a message received via the notification socket from the service process (see
+    // service_set::find_notify_pid()). The message consists of newline-separated assignments
+    // (as for sd_notify), and is not nul-terminated.
+    virtual void notify_message(const char *msg, size_t len) noexcept
+    {
+    }
+
+    // Get the status text most recently reported by the service process via the notification
+    // socket (STATUS=...); empty if none.
+    virtual const std::string &get_status_text() noexcept
+    {
+        static const std::string empty;
+        return empty;
+    }
+
+    // Get the buffer holding the process output, if output is captured (log-type = buffer) and
+    // any has yet been captured; otherwise returns nullptr.
+    virtual service_log_buffer *get_log_buffer() noexcept
+    {
+        return nullptr;
+    }
+
     dep_list & get_dependencies()
     {
         return depends_on;
@@ -614,65 +892,46 @@ class service_record
     // calling this. May throw std::bad_alloc.
     service_dep & add_dep(service_record *to, dependency_type dep_type)
     {
-        return add_dep(to, dep_type, depends_on.end(), false);
+        return add_dep(to, dep_type, false);
     }
 
-    // Add a dependency. Caller must ensure that the services are in an appropriate state and that
-    // a circular dependency chain is not created. Propagation queues should be processed after
-    // calling this. May throw std::bad_alloc.
-    //   i - where to insert the dependency (in dependencies list)
+    // Add a dependency (at the end of the dependencies list). Caller must ensure that the services
+    // are in an appropriate state and that a circular dependency chain is not created. Propagation
+    // queues should be processed after calling this. May throw std::bad_alloc.
     //   reattach - whether to acquire the required service if it and the dependent are started.
     //             (if false, only REGULAR dependencies will cause acquire if the dependent is started,
     //              doing so regardless of required service's state).
-    service_dep & add_dep(service_record *to, dependency_type dep_type, dep_list::iterator i, bool reattach)
+    service_dep & add_dep(service_record *to, dependency_type dep_type, bool reattach)
     {
-        auto pre_i = depends_on.emplace(i, this, to, dep_type);
-        try {
-            to->dependents.push_back(&(*pre_i));
-        }
-        catch (...) {
-            depends_on.erase(i);
-            throw;
-        }
+        service_dep &dep = add_dep_record(to, dep_type);
 
         if (dep_type == dependency_type::REGULAR
                 || (reattach && to->get_state() == service_state_t::STARTED)) {
             if (service_state == service_state_t::STARTING || service_state == service_state_t::STARTED) {
                 to->require();
-                pre_i->holding_acq = true;
+                dep.holding_acq = true;
             }
         }
 
-        return *pre_i;
+        return dep;
     }
 
     // Remove a dependency, of the given type, to the given service. Propagation queues should be processed
     // after calling.
     void rm_dep(service_record *to, dependency_type dep_type) noexcept
     {
-        for (auto i = depends_on.begin(); i != depends_on.end(); i++) {
-            auto & dep = *i;
+        for (size_t i = 0; i < depends_on.size(); i++) {
+            auto & dep = depends_on[i];
             if (dep.get_to() == to && dep.dep_type == dep_type) {
-                rm_dep(i);
+                rm_deps(i, i + 1);
                 break;
             }
         }
     }
 
-    dep_list::iterator rm_dep(dep_list::iterator i) noexcept
-    {
-        auto to = i->get_to();
-        for (auto j = to->dependents.begin(); ; j++) {
-            if (*j == &(*i)) {
-                to->dependents.erase(j);
-                break;
-            }
-        }
-        if (i->holding_acq) {
-            to->release();
-        }
-        return depends_on.erase(i);
-    }
+    // Remove the dependencies in the given range (of indexes into the dependencies list), releasing
+    // any acquisition they hold. Propagation queues should be processed after calling.
+    void rm_deps(size_t first, size_t last) noexcept;
 
     // Start a speficic dependency of this service. Should only be called if this service is in an
     // appropriate state (started, starting). The dependency is marked as holding acquired; when
@@ -701,6 +960,134 @@ inline auto extract_console_queue(service_record *sr) -> decltype(sr->console_qu
     return sr->console_queue_node;
 }
 
+inline auto extract_start_queue(service_record *sr) -> decltype(sr->start_queue_node) &
+{
+    return sr->start_queue_node;
+}
+
+inline auto extract_change_list(service_record *sr) -> decltype(sr->change_list_node) &
+{
+    return sr->change_list_node;
+}
+
+// A budget for automatic restarts across all services of a set, which limits the rate of restarts
+// during a "restart storm" (for example when a dependency shared by many services fails). This is a
+// token bucket (implemented as the equivalent "generic cell rate" algorithm): a burst of up to a
+// certain number of restarts is allowed, beyond which restarts are spread out at a fixed rate. A
+// restart beyond the budget is not refused, but deferred until the time when a token will be
+// available.
+class restart_budget_t
+{
+    using time_val = dasynq::time_val;
+
+    unsigned burst = 0;         // maximum burst of restarts; 0 for no limit
+    time_val token_interval;    // interval at which tokens are replenished
+    time_val burst_span;        // token_interval * (burst - 1)
+    time_val next_time = {0, 0};  // time of the next token if tokens are taken at the maximum rate
+
+    static time_val from_nsecs(uint64_t nsecs) noexcept
+    {
+        return time_val(nsecs / 1000000000u, nsecs % 1000000000u);
+    }
+
+    public:
+    // Allow 'count' restarts (in a burst) per 'interval'; 0 count for no limit.
+    void set_limit(unsigned count, time_val interval) noexcept
+    {
+        burst = count;
+        if (count != 0) {
+            uint64_t interval_ns = uint64_t(interval.seconds()) * 1000000000u + interval.nseconds();
+            token_interval = from_nsecs(interval_ns / count);
+            burst_span = from_nsecs(interval_ns / count * (count - 1));
+        }
+    }
+
+    unsigned get_limit() noexcept
+    {
+        return burst;
+    }
+
+    // Take a token for a restart at (or after) the given time. Returns the time at which the restart
+    // can proceed.
+    time_val reserve(const time_val &at) noexcept
+    {
+        if (burst == 0) return at;
+        time_val proceed_time = (next_time > at + burst_span) ? next_time - burst_span : at;
+        next_time = ((next_time > at) ? next_time : at) + token_interval;
+        return proceed_time;
+    }
+
+    // Return a token taken by reserve(), for a restart which was cancelled before it proceeded.
+    void release() noexcept
+    {
+        if (burst == 0) return;
+        next_time = (next_time > token_interval) ? next_time - token_interval : time_val(0, 0);
+    }
+};
+
+/*
+ * An index of service records by name, used by service_set to find services without scanning
+ * the full record list. This is an open-addressing hash table (with linear probing); each entry
+ * refers to the position of the record in the record list, so that a record can also be removed
+ * or replaced without a list scan. The service name must not change while a record is indexed.
+ */
+class service_name_index
+{
+    public:
+    using record_list = std::list<service_record *>;
+    using record_iter = record_list::iterator;
+
+    private:
+    enum class slot_state : char
+    {
+        FREE, USED, REMOVED
+    };
+
+    struct slot
+    {
+        slot_state state = slot_state::FREE;
+        size_t hash = 0;
+        record_iter pos;
+    };
+
+    std::vector<slot> slots;  // size is either 0 or a power of 2
+    size_t used = 0;          // number of USED slots
+    size_t filled = 0;        // number of USED or REMOVED slots
+
+    static size_t hash_name(const char *name, size_t len) noexcept;
+
+    // Find the slot holding the given record (if svc is not null) or the first record with the
+    // given name (if svc is null). Returns nullptr if there is no such slot.
+    slot *find_slot(const char *name, size_t len, const service_record *svc) noexcept;
+
+    // Re-build the table with the given number of slots (must be a power of 2). May throw
+    // std::bad_alloc.
+    void rehash(size_t new_size);
+
+    public:
+    // Find the record list position of the service with the given name; returns nullptr if not found.
+    record_iter *find(const char *name, size_t len) noexcept
+    {
+        slot *s = find_slot(name, len, nullptr);
+        return (s == nullptr) ? nullptr : &s->pos;
+    }
+
+    // Find the record list position of the given service; returns nullptr if not found.
+    record_iter *find(const service_record *svc) noexcept;
+
+    // Add the record at the given list position to the index. May throw std::bad_alloc (in which
+    // case the index is unchanged).
+    void insert(record_iter pos);
+
+    // Remove the given record from the index. Returns false if it was not present.
+    bool remove(const service_record *svc) noexcept;
+
+    size_t size() noexcept
+    {
+        return used;
+    }
+};
+
 /*
  * A service_set, as the name suggests, manages a set of services.
  *
@@ -724,6 +1111,7 @@ class service_set
     protected:
     int active_services;
     std::list<service_record *> records;
+    service_name_index records_by_name;  // index into 'records', by service name
     bool restart_enabled; // whether automatic restart is enabled (allowed)
     
     shutdown_type_t shutdown_type = shutdown_type_t::NONE;  // Shutdown type, if stopping
@@ -731,10 +1119,55 @@ class service_set
     // Services waiting for exclusive access to the console
     dlist<service_record, extract_console_queue> console_queue;
 
+    // Services waiting for a start slot, the maximum number of slots (0 = unlimited), and the
+    // number of slots currently held
+    dlist<service_record, extract_start_queue> start_queue;
+    unsigned max_starting = 0;
+    unsigned num_starting = 0;
+
+    // Stamp identifying the most recent calculation of start chain lengths
+    uint32_t start_chain_stamp = 0;
+
+    unsigned start_chain_length(service_record *svc) noexcept;
+
     // Propagation and start/stop "queues" - list of services waiting for processing
     slist<service_record, extract_prop_queue> prop_queue;
     slist<service_record, extract_stop_queue> stop_queue;
-    
+
+    // The state generation: incremented each time a service changes state (or is added to or
+    // removed from the set)
+    uint64_t state_generation = 0;
+
+    // The state generation at which a service was last removed from the set
+    uint64_t removal_generation = 0;
+
+    // Storage for service dependency records
+    service_dep_pool dep_pool;
+
+    // All services, ordered by the state generation at which they last changed
+    dlist<service_record, extract_change_list> change_list;
+
+    // The most recently assigned service identifier
+    uint32_t last_service_id = 0;
+
+    // Listeners for state changes of all services
+    std::vector<service_set_listener *> set_listeners;
+
+    // Budget for automatic restarts of (process-based) services
+    restart_budget_t restart_budget;
+
+    // Parent cgroup (directory) for the cgroups of services with the "cgroup" option; empty if
+    // cgroups are not to be used
+    std::string cgroup_parent;
+
+    // Path of the (shared) notification socket, empty if it is not open; and the service processes
+    // which may send messages via the socket (identified by pid)
+    std::string notify_socket_path;
+    std::unordered_map<pid_t, service_record *> notify_pids;
+
+    // Whether the root filesystem is known to be writable (see set_rootfs_rw())
+    bool rootfs_rw = false;
+
     public:
     service_set()
     {
@@ -764,7 +1197,21 @@ class service_set
     }
 
     // Locate an existing service record.
-    service_record *find_service(const std::string &name) noexcept;
+    service_record *find_service(const std::string &name) noexcept
+    {
+        return find_service(name.c_str(), name.length());
+    }
+
+    service_record *find_service(const char *name) noexcept
+    {
+        return find_service(name, strlen(name));
+    }
+
+    service_record *find_service(const char *name, size_t len) noexcept
+    {
+        auto *pos = records_by_name.find(name, len);
+        return (pos == nullptr) ? nullptr : **pos;
+    }
 
     // Load a service description, and dependencies, if there is no existing
     // record for the given name.
@@ -803,20 +1250,127 @@ class service_set
         service_set::start_service(record);
     }
     
+    // Add a service record to the set. May throw std::bad_alloc.
     void add_service(service_record *svc)
     {
         records.push_back(svc);
+        try {
+            records_by_name.insert(std::prev(records.end()));
+        }
+        catch (...) {
+            records.pop_back();
+            throw;
+        }
+        svc->service_id = ++last_service_id;
+        svc->change_generation = ++state_generation;
+        change_list.append(svc);
     }
-    
-    void remove_service(service_record *svc)
+
+    // Remove a service record from the set (the record must be in the set).
+    void remove_service(service_record *svc) noexcept
+    {
+        auto *pos = records_by_name.find(svc);
+        auto i = *pos;
+        records_by_name.remove(svc);
+        records.erase(i);
+        if (change_list.is_queued(svc)) {
+            change_list.unlink(svc);
+        }
+        removal_generation = ++state_generation;
+    }
+
+    // Replace a service record in the set with another, with the same name (the original must be in
+    // the set).
+    void replace_service(service_record *orig, service_record *replacement) noexcept
+    {
+        // The index refers to the record list position, which remains valid:
+        auto *pos = records_by_name.find(orig);
+        **pos = replacement;
+        if (change_list.is_queued(orig)) {
+            change_list.unlink(orig);
+        }
+        replacement->service_id = ++last_service_id;
+        replacement->change_generation = ++state_generation;
+        change_list.append(replacement);
+    }
+
+    // Record a change in the state of a service, by assigning it a new state generation. Has no
+    // effect if the service is not in the set.
+    void mark_changed(service_record *svc) noexcept
+    {
+        if (change_list.is_queued(svc)) {
+            change_list.unlink(svc);
+            svc->change_generation = ++state_generation;
+            change_list.append(svc);
+        }
+    }
+
+    // Notify listeners of a state change of a service. Has no effect if the service is not in the
+    // set.
+    void notify_state_change(service_record *svc, service_state_t old_state) noexcept
+    {
+        if (change_list.is_queued(svc)) {
+            for (auto l : set_listeners) {
+                l->service_state_change(svc, old_state);
+            }
+        }
+    }
+
+    // Add a listener for state changes of all services. May throw std::bad_alloc.
+    void add_listener(service_set_listener *listener)
     {
-        records.erase(std::find(records.begin(), records.end(), svc));
+        set_listeners.push_back(listener);
     }
 
-    void replace_service(service_record *orig, service_record *replacement)
+    // Remove a listener for state changes of all services.
+    void remove_listener(service_set_listener *listener) noexcept
     {
-        auto i = std::find(records.begin(), records.end(), orig);
-        *i = replacement;
+        set_listeners.erase(std::remove(set_listeners.begin(), set_listeners.end(), listener),
+                set_listeners.end());
+    }
+
+    // Get the pool from which dependency records are allocated
+    service_dep_pool &get_dep_pool() noexcept
+    {
+        return dep_pool;
+    }
+
+    // Get the current state generation
+    uint64_t get_state_generation() noexcept
+    {
+        return state_generation;
+    }
+
+    // Get the state generation at which a service was last removed
+    uint64_t get_removal_generation() noexcept
+    {
+        return removal_generation;
+    }
+
+    // Find the first (least recently changed) service which has changed since the given state
+    // generation. Returns nullptr if there is none. Subsequent changed services can be found using
+    // next_changed(). The cost is proportional to the number of changed services.
+    service_record *first_changed_since(uint64_t generation) noexcept
+    {
+        service_record *sr = change_list.tail();
+        if (sr == nullptr || sr->change_generation <= generation) {
+            return nullptr;
+        }
+        service_record *first = change_list.front();
+        while (sr != first) {
+            service_record *prev = sr->change_list_node.prev;
+            if (prev->change_generation <= generation) break;
+            sr = prev;
+        }
+        return sr;
+    }
+
+    // Find the next (more recently changed) service following the given service in change order.
+    // Returns nullptr if there is none.
+    service_record *next_changed(service_record *svc) noexcept
+    {
+        service_record *next = svc->change_list_node.next;
+        return (next == change_list.front()) ? nullptr : next;
     }
 
     // Get the list of all loaded services.
@@ -904,6 +1458,120 @@ class service_set
         return console_queue.is_queued(service);
     }
 
+    // Set the maximum number of services which can concurrently be starting a process (i.e. hold a
+    // start slot); 0 for no limit. Services waiting for a slot are given one in order of their start
+    // priority, and then of the length of the chain of (starting) services which depend on them, so
+    // that the longest chains are started first. A subsequent process_queues() is required.
+    void set_max_starting(unsigned max) noexcept;
+
+    unsigned get_max_starting() noexcept
+    {
+        return max_starting;
+    }
+
+    // Get the budget for automatic restarts (see restart_budget_t)
+    restart_budget_t &get_restart_budget() noexcept
+    {
+        return restart_budget;
+    }
+
+    // Open the activation sockets of all services which have one (see
+    // service_record::open_activation_socket()). Until the root filesystem is known to be writable,
+    // failures which may be due to it not being writable (or not yet fully mounted) are not
+    // reported.
+    void open_activation_sockets() noexcept
+    {
+        for (auto *s : records) {
+            s->open_activation_socket(rootfs_rw);
+        }
+    }
+
+    // Note that the root filesystem is writable (and filesystems have been mounted); activation
+    // sockets are (re-)opened.
+    void set_rootfs_rw() noexcept
+    {
+        rootfs_rw = true;
+        open_activation_sockets();
+    }
+
+    bool is_rootfs_rw() noexcept
+    {
+        return rootfs_rw;
+    }
+
+    // Set the parent cgroup directory for per-service cgroups (empty to disable use of cgroups)
+    void set_cgroup_parent(std::string &&parent) noexcept
+    {
+        cgroup_parent = std::move(parent);
+    }
+
+    const std::string &get_cgroup_parent() noexcept
+    {
+        return cgroup_parent;
+    }
+
+    // Set the path of the notification socket (empty if it is not open)
+    void set_notify_socket_path(std::string &&path) noexcept
+    {
+        notify_socket_path = std::move(path);
+    }
+
+    const std::string &get_notify_socket_path() noexcept
+    {
+        return notify_socket_path;
+    }
+
+    // Register a service process which may send messages via the notification socket. May throw
+    // std::bad_alloc.
+    void add_notify_pid(pid_t pid, service_record *service)
+    {
+        notify_pids[pid] = service;
+    }
+
+    void remove_notify_pid(pid_t pid) noexcept
+    {
+        notify_pids.erase(pid);
+    }
+
+    // Find the service with the given (registered) process; returns nullptr if none.
+    service_record *find_notify_pid(pid_t pid) noexcept
+    {
+        auto i = notify_pids.find(pid);
+        return (i == notify_pids.end()) ? nullptr : i->second;
+    }
+
+    // Acquire a start slot for the given service, if one is available; otherwise queue the service
+    // (it will be notified via acquired_start_slot()). Returns true if a slot was acquired.
+    bool acquire_start_slot(service_record *service) noexcept;
+
+    // Release a start slot, assigning it to a waiting service if there is one. A subsequent
+    // process_queues() is required.
+    void release_start_slot() noexcept
+    {
+        num_starting--;
+        pull_start_queue();
+    }
+
+    // Assign free start slots to waiting services.
+    void pull_start_queue() noexcept;
+
+    void unqueue_start_slot(service_record *service) noexcept
+    {
+        if (start_queue.is_queued(service)) {
+            start_queue.unlink(service);
+        }
+    }
+
+    bool is_queued_for_start_slot(service_record *service) noexcept
+    {
+        return start_queue.is_queued(service);
+    }
+
+    unsigned get_num_starting() noexcept
+    {
+        return num_starting;
+    }
+
     // Notification from service that it is active (state != STOPPED)
     // Only to be called on the transition from inactive to active.
     void service_active(service_record *) noexcept;
@@ -953,6 +1621,25 @@ class dirload_service_set : public service_set
 {
     service_dir_pathlist service_dirs;
 
+    // A service description which has been read into memory ahead of loading
+    struct preloaded_desc
+    {
+        std::string filename;
+        std::string contents;
+    };
+
+    // Preloaded service descriptions (see preload_services()), by service name
+    std::unordered_map<std::string, preloaded_desc> preloaded;
+
+    // Compiled service description caches, one per service directory (see service-cache.h).
+    // Opened on first use, and not used at all once discard_preloaded() has been called.
+    std::vector<dinit_load::service_cache_file> caches;
+    bool caches_opened = false;
+    bool caches_discarded = false;
+
+    // Open the description caches (if not already open, and not discarded).
+    void open_caches() noexcept;
+
     // Implementation of service load/reload.
     // Find a service record, or load it from file. If the service has dependencies, load those also.
     //
@@ -1004,6 +1691,24 @@ class dirload_service_set : public service_set
 
     service_record *reload_service(service_record *service) override;
 
+    // Read the descriptions of the named services, and (transitively) of their dependencies, into
+    // memory using a small pool of worker threads, so that subsequently loading those services
+    // does not require (serialised) file I/O. The descriptions are only scanned for dependencies
+    // here; they are fully parsed when loaded. This is an optimisation only: any failure is
+    // ignored, and will instead be reported when the service is loaded.
+    void preload_services(const std::list<const char *> &names) noexcept;
+
+    // Discard any preloaded service descriptions which have not (yet) been used, and close the
+    // compiled description caches. This should be done once the initial set of services has been
+    // loaded, so that a later load does not see a stale description (the caches, in particular,
+    // are only checked against the user/group databases when they are opened).
+    void discard_preloaded() noexcept
+    {
+        preloaded.clear();
+        caches.clear();
+        caches_discarded = true;
+    }
+
     int get_set_type_id() override
     {
         return SSET_TYPE_DIRLOAD;
@@ -1,18 +1,26 @@
 #include <algorithm>
 #include <string>
 #include <fstream>
+#include <sstream>
+#include <iterator>
 #include <locale>
 #include <limits>
 #include <list>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 #include <cstring>
 #include <cstdlib>
+#include <csignal>
 
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <pwd.h>
 #include <grp.h>
 #include <dirent.h>
+#include <pthread.h>
 
 #include "proc-service.h"
 #include "dinit-log.h"
@@ -113,6 +121,274 @@ static void process_dep_dir(dirload_service_set &sset,
     closedir(depdir);
 }
 
+// Open the description file for the named service, trying each service directory in turn. Returns
+// true if found, with service_filename set to the path of the opened file.
+static bool open_service_file(const service_dir_pathlist &service_dirs, const char *name,
+        std::ifstream &service_file, string &service_filename)
+{
+    for (auto &service_dir : service_dirs) {
+        service_filename = service_dir.get_dir();
+        if (*(service_filename.rbegin()) != '/') {
+            service_filename += '/';
+        }
+        service_filename += name;
+
+        service_file.open(service_filename.c_str(), std::ios::in);
+        if (service_file) return true;
+    }
+
+    return false;
+}
+
+// Find a valid compiled description cache entry for the named service. The service directories are
+// searched in order; the search ends at the first directory with either a valid cache entry or a
+// description file for the service. Returns true if a valid entry was found (with service_filename
+// set to the path of the corresponding description file).
+static bool find_cache_entry(const service_dir_pathlist &service_dirs,
+        const std::vector<dinit_load::service_cache_file> &caches, const char *name,
+        dinit_load::service_cache_file::entry_info &entry, string &service_filename)
+{
+    if (caches.empty()) return false;
+
+    string name_str = name;
+    size_t dir_num = 0;
+    for (auto &service_dir : service_dirs) {
+        service_filename = combine_paths(service_dir.get_dir(), name);
+        auto &cache = caches[dir_num++];
+        if (cache.is_open() && cache.find_valid(name_str, service_filename.c_str(), entry)) {
+            return true;
+        }
+        dinit_load::file_stamp desc_stamp;
+        if (desc_stamp.read(service_filename.c_str())) {
+            return false;
+        }
+    }
+
+    return false;
+}
+
+void dirload_service_set::open_caches() noexcept
+{
+    if (caches_opened || caches_discarded) return;
+    caches_opened = true;
+
+    try {
+        caches.resize(service_dirs.size());
+        bool any_open = false;
+        for (size_t i = 0; i < caches.size(); i++) {
+            if (caches[i].open(service_dirs[i].get_dir())) {
+                any_open = true;
+            }
+        }
+        if (! any_open) {
+            caches.clear();
+        }
+    }
+    catch (std::bad_alloc &) {
+        // Don't use the caches
+        caches.clear();
+    }
+}
+
+namespace {
+
+// State shared between the worker threads which preload service descriptions.
+class preload_state
+{
+    public:
+    const service_dir_pathlist &service_dirs;
+    const std::vector<dinit_load::service_cache_file> &caches;
+
+    std::mutex lock;
+    std::condition_variable cond;
+
+    std::vector<string> pending;  // names of services waiting to be read
+    std::unordered_set<string> seen;  // names of all services queued so far
+    unsigned busy = 0;  // number of workers currently reading a description
+    bool failed = false;  // a worker could not continue (allocation failure)
+
+    std::vector<std::pair<string, string>> results; // (name, filename) of each description read
+    std::vector<string> contents;  // contents corresponding to each of results
+
+    preload_state(const service_dir_pathlist &service_dirs_p,
+            const std::vector<dinit_load::service_cache_file> &caches_p)
+        : service_dirs(service_dirs_p), caches(caches_p)
+    {
+    }
+};
+
+// Dependency type used when reading only the dependencies of a service from a cache entry
+class cached_dep_name
+{
+};
+
+// Scan an (unparsed) service description for the names of its dependencies. Errors in the
+// description are ignored; they will be reported when the service is actually loaded.
+void scan_dependencies(const char *name, const string &service_filename, const string &contents,
+        std::vector<string> &deps)
+{
+    using namespace dinit_load;
+
+    std::istringstream service_input(contents);
+    try {
+        process_service_file(name, service_input,
+                [&](string &line, string &setting, string_iterator &i, string_iterator &end) -> void {
+            if (setting == "depends-on" || setting == "depends-ms" || setting == "waits-for") {
+                deps.push_back(read_setting_value(i, end));
+            }
+            else if (setting == "waits-for.d") {
+                string depdirpath = read_setting_value(i, end);
+                string depdir_fname = combine_paths(parent_path(service_filename), depdirpath.c_str());
+                DIR *depdir = opendir(depdir_fname.c_str());
+                if (depdir == nullptr) return;
+                dirent * dent = readdir(depdir);
+                while (dent != nullptr) {
+                    if (dent->d_name[0] != '.') {
+                        deps.emplace_back(dent->d_name);
+                    }
+                    dent = readdir(depdir);
+                }
+                closedir(depdir);
+            }
+        });
+    }
+    catch (service_load_exc &) { }
+    catch (setting_exception &) { }
+}
+
+// Preload worker: repeatedly take a service name from the pending queue, read its description and
+// queue its dependencies, until there is no more work (queue empty and no worker busy).
+void preload_worker(preload_state &state) noexcept
+{
+    std::unique_lock<std::mutex> guard(state.lock);
+
+    while (true) {
+        while (state.pending.empty() && state.busy != 0 && ! state.failed) {
+            state.cond.wait(guard);
+        }
+        if (state.pending.empty() || state.failed) {
+            break;
+        }
+
+        string name = std::move(state.pending.back());
+        state.pending.pop_back();
+        state.busy++;
+        guard.unlock();
+
+        bool read_ok = false;
+        string service_filename;
+        string contents;
+        std::vector<string> deps;
+
+        try {
+            dinit_load::service_cache_file::entry_info cache_entry;
+            std::ifstream service_file;
+            if (find_cache_entry(state.service_dirs, state.caches, name.c_str(), cache_entry,
+                    service_filename)) {
+                // The service will be loaded from the cache, but we still want its dependencies:
+                dinit_load::cache_reader reader(cache_entry.start, cache_entry.end);
+                dinit_load::service_settings_wrapper<cached_dep_name> settings;
+                read_cached_settings(reader, settings, [&](std::list<cached_dep_name> &, const string &dep,
+                        dependency_type, bool) -> void {
+                    deps.push_back(dep);
+                });
+            }
+            else if (open_service_file(state.service_dirs, name.c_str(), service_file, service_filename)) {
+                contents.assign(std::istreambuf_iterator<char>(service_file),
+                        std::istreambuf_iterator<char>());
+                read_ok = ! service_file.bad();
+                if (read_ok) {
+                    scan_dependencies(name.c_str(), service_filename, contents, deps);
+                }
+            }
+        }
+        catch (...) {
+            read_ok = false;
+        }
+
+        guard.lock();
+        state.busy--;
+
+        try {
+            if (read_ok) {
+                state.results.emplace_back(std::move(name), std::move(service_filename));
+                state.contents.emplace_back(std::move(contents));
+            }
+            for (auto &dep : deps) {
+                if (state.seen.insert(dep).second) {
+                    state.pending.emplace_back(std::move(dep));
+                }
+            }
+        }
+        catch (std::bad_alloc &) {
+            state.failed = true;
+        }
+
+        state.cond.notify_all();
+    }
+
+    state.cond.notify_all();
+}
+
+} // anonymous namespace
+
+void dirload_service_set::preload_services(const std::list<const char *> &names) noexcept
+{
+    // Use as many threads as there are processors, to a limit; the current thread also serves as a
+    // worker. With only a single processor there's no benefit in preloading.
+    const unsigned max_workers = 8;
+    unsigned num_workers = std::min(std::thread::hardware_concurrency(), max_workers);
+    if (num_workers <= 1) return;
+
+    // Open the description caches now, so that the worker threads can use them:
+    open_caches();
+
+    preload_state state(service_dirs, caches);
+    std::vector<std::thread> threads;
+
+    // Worker threads must not receive signals; block all signals while creating the threads (they
+    // inherit the signal mask) and restore afterwards:
+    sigset_t all_sigs, orig_sigs;
+    sigfillset(&all_sigs);
+    pthread_sigmask(SIG_BLOCK, &all_sigs, &orig_sigs);
+
+    try {
+        for (const char *name : names) {
+            if (state.seen.insert(name).second) {
+                state.pending.emplace_back(name);
+            }
+        }
+
+        threads.reserve(num_workers - 1);
+        for (unsigned i = 1; i < num_workers; i++) {
+            threads.emplace_back(preload_worker, std::ref(state));
+        }
+    }
+    catch (...) {
+        // Couldn't create (all) threads; continue with those we have (and the current thread).
+    }
+
+    pthread_sigmask(SIG_SETMASK, &orig_sigs, nullptr);
+
+    preload_worker(state);
+
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    try {
+        for (size_t i = 0; i < state.results.size(); i++) {
+            auto &result = state.results[i];
+            preloaded_desc &desc = preloaded[result.first];
+            desc.filename = std::move(result.second);
+            desc.contents = std::move(state.contents[i]);
+        }
+    }
+    catch (std::bad_alloc &) {
+        // Not fatal; those services not preloaded will be read when loaded.
+    }
+}
+
 service_record * dirload_service_set::load_service(const char * name, const service_record *avoid_circular)
 {
     return load_reload_service(name, nullptr, avoid_circular);
@@ -127,38 +403,34 @@ service_record * dirload_service_set::reload_service(service_record * service)
 static void update_depenencies(service_record *service,
         dinit_load::service_settings_wrapper<prelim_dep> &settings)
 {
-    std::list<service_dep> &deps = service->get_dependencies();
-    auto first_preexisting = deps.begin();
+    auto &deps = service->get_dependencies();
+    size_t num_preexisting = deps.size();
 
     // build a set of services currently issuing acquisition
     std::unordered_set<service_record *> deps_with_acqs;
-    for (auto i = deps.begin(), e = deps.end(); i != e; ++i) {
-        if (i->holding_acq) {
-            deps_with_acqs.insert(i->get_to());
+    for (auto &dep : deps) {
+        if (dep.holding_acq) {
+            deps_with_acqs.insert(dep.get_to());
         }
     }
 
     try {
-        // Insert all the new dependencies before the first pre-existing dependency
+        // Add all the new dependencies after the pre-existing dependencies
         for (auto &new_dep : settings.depends) {
             bool has_acq = deps_with_acqs.count(new_dep.to);
-            service->add_dep(new_dep.to, new_dep.dep_type, first_preexisting, has_acq);
+            service->add_dep(new_dep.to, new_dep.dep_type, has_acq);
         }
     }
     catch (...) {
-        // remove the inserted dependencies
-        for (auto i = deps.begin(); i != first_preexisting; ++i) {
-            i = service->rm_dep(i);
-        }
+        // remove the added dependencies
+        service->rm_deps(num_preexisting, deps.size());
 
         // re-throw the exception
         throw;
     }
 
     // Now remove all pre-existing dependencies (no exceptions possible from here).
-    for( ; first_preexisting != deps.end(); ) {
-        first_preexisting = service->rm_dep(first_preexisting);
-    }
+    service->rm_deps(0, num_preexisting);
 }
 
 // Update the command, and dependencies, of the specified service atomically. May fail with bad_alloc.
@@ -238,7 +510,7 @@ service_record * dirload_service_set::load_reload_service(const char *name, serv
 
     if (reload_svc == nullptr) {
         // First try and find an existing record...
-        service_record * rval = find_service(string(name));
+        service_record * rval = find_service(name);
         if (rval != nullptr) {
             if (rval == avoid_circular || rval->is_dummy()) {
                 throw service_cyclic_dependency(name);
@@ -251,22 +523,39 @@ service_record * dirload_service_set::load_reload_service(const char *name, serv
     service_record *dummy = nullptr;
 
     ifstream service_file;
+    std::istringstream preloaded_file;
+    std::istream *service_input = &service_file;
     string service_filename;
+    service_cache_file::entry_info cache_entry;
+    bool use_cache = false;
 
-    // Couldn't find one. Have to load it.
-    for (auto &service_dir : service_dirs) {
-        service_filename = service_dir.get_dir();
-        if (*(service_filename.rbegin()) != '/') {
-            service_filename += '/';
-        }
-        service_filename += name;
-
-        service_file.open(service_filename.c_str(), ios::in);
-        if (service_file) break;
+    // Couldn't find one. Have to load it, either from the compiled description cache, a preloaded
+    // description, or from file. (For a reload, we always read the file).
+    if (reload_svc == nullptr) {
+        open_caches();
+        use_cache = find_cache_entry(service_dirs, caches, name, cache_entry, service_filename);
     }
 
-    if (! service_file) {
-        throw service_not_found(string(name));
+    auto preload_it = preloaded.find(name);
+    if (use_cache) {
+        if (preload_it != preloaded.end()) {
+            preloaded.erase(preload_it);
+        }
+    }
+    else if (preload_it != preloaded.end() && reload_svc == nullptr) {
+        service_filename = std::move(preload_it->second.filename);
+        preloaded_file.str(std::move(preload_it->second.contents));
+        preloaded.erase(preload_it);
+        service_input = &preloaded_file;
+    }
+    else {
+        if (preload_it != preloaded.end()) {
+            // We are reloading; the preloaded description may be stale.
+            preloaded.erase(preload_it);
+        }
+        if (! open_service_file(service_dirs, name, service_file, service_filename)) {
+            throw service_not_found(string(name));
+        }
     }
 
     service_settings_wrapper<prelim_dep> settings;
@@ -274,7 +563,7 @@ service_record * dirload_service_set::load_reload_service(const char *name, serv
     string line;
     // getline can set failbit if it reaches end-of-file, we don't want an exception in that case. There's
     // no good way to handle an I/O error however, so we'll have exceptions thrown on badbit:
-    service_file.exceptions(ios::badbit);
+    service_input->exceptions(ios::badbit);
 
     bool create_new_record = true;
 
@@ -286,22 +575,47 @@ service_record * dirload_service_set::load_reload_service(const char *name, serv
             add_service(dummy);
         }
 
-        process_service_file(name, service_file,
-                [&](string &line, string &setting, string_iterator &i, string_iterator &end) -> void {
-
-            auto process_dep_dir_n = [&](std::list<prelim_dep> &deplist, const std::string &waitsford,
-                    dependency_type dep_type) -> void {
-                process_dep_dir(*this, name, service_filename, deplist, waitsford, dep_type, reload_svc);
+        if (use_cache) {
+            auto add_dep = [&](std::list<prelim_dep> &deplist, const string &dep_name, dependency_type dep_type,
+                    bool from_dep_dir) -> void {
+                if (! from_dep_dir) {
+                    deplist.emplace_back(load_service(dep_name.c_str(), reload_svc), dep_type);
+                    return;
+                }
+                // As per process_dep_dir(), an unresolved dependency from a directory is not an error
+                try {
+                    deplist.emplace_back(load_service(dep_name.c_str(), reload_svc), dep_type);
+                }
+                catch (service_not_found &) {
+                    log(loglevel_t::WARN, "Ignoring unresolved dependency '", dep_name,
+                            "' in dependency directory for ", name, " service.");
+                }
             };
 
-            auto load_service_n = [&](const string &dep_name) -> service_record * {
-                return load_service(dep_name.c_str(), reload_svc);
-            };
+            cache_reader reader(cache_entry.start, cache_entry.end);
+            if (! read_cached_settings(reader, settings, add_dep)) {
+                throw service_description_exc(name, "Malformed entry in compiled description cache "
+                        "(rebuild or remove the cache).");
+            }
+        }
+        else {
+            process_service_file(name, *service_input,
+                    [&](string &line, string &setting, string_iterator &i, string_iterator &end) -> void {
 
-            process_service_line(settings, name, line, setting, i, end, load_service_n, process_dep_dir_n);
-        });
+                auto process_dep_dir_n = [&](std::list<prelim_dep> &deplist, const std::string &waitsford,
+                        dependency_type dep_type) -> void {
+                    process_dep_dir(*this, name, service_filename, deplist, waitsford, dep_type, reload_svc);
+                };
 
-        service_file.close();
+                auto load_service_n = [&](const string &dep_name) -> service_record * {
+                    return load_service(dep_name.c_str(), reload_svc);
+                };
+
+                process_service_line(settings, name, line, setting, i, end, load_service_n, process_dep_dir_n);
+            });
+
+            service_file.close();
+        }
 
         auto service_type = settings.service_type;
 
@@ -312,6 +626,38 @@ service_record * dirload_service_set::load_reload_service(const char *name, serv
             }
         }
 
+        if (settings.onstart_flags.use_cgroup && service_type != service_type_t::PROCESS) {
+            throw service_description_exc(name, "The 'cgroup' option is only supported for process "
+                    "services.");
+        }
+
+        if (settings.onstart_flags.ready_on_socket && settings.socket_path.empty()) {
+            throw service_description_exc(name, "The 'ready-on-socket' option requires an activation "
+                    "socket ('socket-listen').");
+        }
+
+        if (settings.readiness_socket && service_type != service_type_t::PROCESS) {
+            throw service_description_exc(name, "Readiness notification via the notification socket "
+                    "is only supported for process services.");
+        }
+
+        if ((settings.watchdog_timeout.tv_sec != 0 || settings.watchdog_timeout.tv_nsec != 0)
+                && ! settings.readiness_socket) {
+            throw service_description_exc(name, "The 'watchdog-timeout' setting requires readiness "
+                    "notification via the notification socket ('ready-notification = socket').");
+        }
+
+        if (settings.onstart_flags.on_demand && settings.socket_path.empty()) {
+            throw service_description_exc(name, "The 'on-demand' option requires an activation "
+                    "socket ('socket-listen').");
+        }
+
+        if ((settings.activation_lifetime.tv_sec != 0 || settings.activation_lifetime.tv_nsec != 0)
+                && ! settings.onstart_flags.on_demand) {
+            throw service_description_exc(name, "The 'activation-lifetime' setting requires the 'on-demand' "
+                    "option.");
+        }
+
         if (reload_svc != nullptr) {
             // Make sure settings are able to be changed/are compatible
             service_record *service = reload_svc;
@@ -394,12 +740,16 @@ service_record * dirload_service_set::load_reload_service(const char *name, serv
             rvalps->set_rlimits(std::move(settings.rlimits));
             rvalps->set_restart_interval(settings.restart_interval, settings.max_restarts);
             rvalps->set_restart_delay(settings.restart_delay);
+            rvalps->set_restart_backoff(settings.restart_delay_max, settings.restart_jitter);
             rvalps->set_stop_timeout(settings.stop_timeout);
             rvalps->set_start_timeout(settings.start_timeout);
+            rvalps->set_activation_lifetime(settings.activation_lifetime);
             rvalps->set_extra_termination_signal(settings.term_signal);
             rvalps->set_run_as_uid_gid(settings.run_as_uid, settings.run_as_gid);
             rvalps->set_notification_fd(settings.readiness_fd);
             rvalps->set_notification_var(std::move(settings.readiness_var));
+            rvalps->set_notification_socket(settings.readiness_socket);
+            rvalps->set_watchdog_timeout(settings.watchdog_timeout);
             #if USE_UTMPX
             rvalps->set_utmp_id(settings.inittab_id);
             rvalps->set_utmp_line(settings.inittab_line);
@@ -424,8 +774,10 @@ service_record * dirload_service_set::load_reload_service(const char *name, serv
             rvalps->set_pid_file(std::move(settings.pid_file));
             rvalps->set_restart_interval(settings.restart_interval, settings.max_restarts);
             rvalps->set_restart_delay(settings.restart_delay);
+            rvalps->set_restart_backoff(settings.restart_delay_max, settings.restart_jitter);
             rvalps->set_stop_timeout(settings.stop_timeout);
             rvalps->set_start_timeout(settings.start_timeout);
+            rvalps->set_activation_lifetime(settings.activation_lifetime);
             rvalps->set_extra_termination_signal(settings.term_signal);
             rvalps->set_run_as_uid_gid(settings.run_as_uid, settings.run_as_gid);
             settings.onstart_flags.runs_on_console = false;
@@ -450,6 +802,7 @@ service_record * dirload_service_set::load_reload_service(const char *name, serv
             rvalps->set_rlimits(std::move(settings.rlimits));
             rvalps->set_stop_timeout(settings.stop_timeout);
             rvalps->set_start_timeout(settings.start_timeout);
+            rvalps->set_activation_lifetime(settings.activation_lifetime);
             rvalps->set_extra_termination_signal(settings.term_signal);
             rvalps->set_run_as_uid_gid(settings.run_as_uid, settings.run_as_gid);
         }
@@ -464,6 +817,8 @@ service_record * dirload_service_set::load_reload_service(const char *name, serv
         }
 
         rval->set_log_file(std::move(settings.logfile));
+        rval->set_log_mode(settings.log_type, settings.log_buf_max);
+        rval->set_start_priority(settings.start_priority);
         rval->set_auto_restart(settings.auto_restart);
         rval->set_smooth_recovery(settings.smooth_recovery);
         rval->set_flags(settings.onstart_flags);
@@ -502,18 +857,26 @@ service_record * dirload_service_set::load_reload_service(const char *name, serv
         }
 
         if (dummy != nullptr) {
-            auto iter = std::find(records.begin(), records.end(), dummy);
-            *iter = rval;
+            replace_service(dummy, rval);
             delete dummy;
         }
 
+        if (settings.onstart_flags.on_demand) {
+            // Begin listening for connections, which will start the service
+            rval->open_activation_socket(is_rootfs_rw());
+        }
+        else if (! create_new_record) {
+            // The service may have been on-demand before it was reloaded
+            rval->close_activation_socket();
+        }
+
         return rval;
     }
     catch (setting_exception &setting_exc)
     {
         // Must remove the dummy service record.
         if (dummy != nullptr) {
-            records.erase(std::find(records.begin(), records.end(), dummy));
+            remove_service(dummy);
             delete dummy;
         }
         if (create_new_record) delete rval;
@@ -522,7 +885,7 @@ service_record * dirload_service_set::load_reload_service(const char *name, serv
     catch (std::system_error &sys_err)
     {
         if (dummy != nullptr) {
-            records.erase(std::find(records.begin(), records.end(), dummy));
+            remove_service(dummy);
             delete dummy;
         }
         if (create_new_record) delete rval;
@@ -531,7 +894,7 @@ service_record * dirload_service_set::load_reload_service(const char *name, serv
     catch (...) // (should only be std::bad_alloc / service_description_exc)
     {
         if (dummy != nullptr) {
-            records.erase(std::find(records.begin(), records.end(), dummy));
+            remove_service(dummy);
             delete dummy;
         }
         if (create_new_record) delete rval;
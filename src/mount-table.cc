@@ -0,0 +1,152 @@
+#include <string>
+#include <vector>
+#include <istream>
+#include <unordered_map>
+
+#include <cstdlib>
+#include <cerrno>
+#include <climits>
+
+#include "mount-table.h"
+
+std::string unescape_octal(const std::string &s)
+{
+    std::string r;
+    r.reserve(s.length());
+    for (size_t i = 0; i < s.length(); ++i) {
+        if (s[i] == '\\' && i + 3 < s.length() && s[i+1] >= '0' && s[i+1] <= '3'
+                && s[i+2] >= '0' && s[i+2] <= '7' && s[i+3] >= '0' && s[i+3] <= '7') {
+            r += (char)(((s[i+1] - '0') << 6) | ((s[i+2] - '0') << 3) | (s[i+3] - '0'));
+            i += 3;
+        }
+        else {
+            r += s[i];
+        }
+    }
+    return r;
+}
+
+std::vector<std::string> split_fields(const std::string &line)
+{
+    std::vector<std::string> fields;
+    size_t pos = 0;
+    while (pos < line.length()) {
+        size_t end = line.find_first_of(" \t", pos);
+        if (end == std::string::npos) end = line.length();
+        if (end != pos) {
+            fields.emplace_back(line, pos, end - pos);
+        }
+        pos = end + 1;
+    }
+    return fields;
+}
+
+// Parse a (non-negative, decimal) mount id. Returns false if the field is not a valid id.
+static bool parse_mount_id(const std::string &field, int &id)
+{
+    if (field.empty() || field[0] < '0' || field[0] > '9') {
+        return false;
+    }
+    char *end;
+    errno = 0;
+    long val = strtol(field.c_str(), &end, 10);
+    if (*end != '\0' || errno == ERANGE || val > INT_MAX) {
+        return false;
+    }
+    id = (int)val;
+    return true;
+}
+
+bool read_mount_tree(std::istream &mountinfo, std::vector<mount_node> &nodes)
+{
+    std::vector<int> parent_ids;
+    std::unordered_map<int, int> id_to_index;
+
+    // Format: mount-id parent-id major:minor root mount-point options [optional-fields...] - fstype ...
+    std::string line;
+    while (std::getline(mountinfo, line)) {
+        std::vector<std::string> fields = split_fields(line);
+        if (fields.size() < 7) {
+            return false;
+        }
+
+        size_t sep = 6;
+        while (sep < fields.size() && fields[sep] != "-") {
+            ++sep;
+        }
+        if (sep + 1 >= fields.size()) {
+            return false;
+        }
+
+        int mount_id, parent_id;
+        if (! parse_mount_id(fields[0], mount_id) || ! parse_mount_id(fields[1], parent_id)) {
+            return false;
+        }
+        if (! id_to_index.emplace(mount_id, nodes.size()).second) {
+            // duplicate id
+            return false;
+        }
+
+        mount_node node;
+        node.mount_point = unescape_octal(fields[4]);
+        node.fs_type = fields[sep + 1];
+
+        parent_ids.push_back(parent_id);
+        nodes.push_back(std::move(node));
+    }
+
+    if (mountinfo.bad() || nodes.empty()) {
+        return false;
+    }
+
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        auto parent_it = id_to_index.find(parent_ids[i]);
+        if (parent_it != id_to_index.end() && parent_it->second != (int)i) {
+            nodes[i].parent = parent_it->second;
+            nodes[parent_it->second].pending_children++;
+        }
+    }
+
+    return true;
+}
+
+bool read_swap_list(std::istream &swaps, std::vector<std::string> &paths)
+{
+    // First line is a header; each following line lists a swap device/file
+    std::string line;
+    if (! std::getline(swaps, line)) {
+        return false;
+    }
+    while (std::getline(swaps, line)) {
+        std::vector<std::string> fields = split_fields(line);
+        if (fields.empty()) continue;
+        paths.push_back(unescape_octal(fields[0]));
+    }
+
+    return ! swaps.bad();
+}
+
+bool is_unmount_exempt(const std::string &fs_type)
+{
+    return fs_type == "proc" || fs_type == "devfs" || fs_type == "devpts" || fs_type == "sysfs"
+            || fs_type == "rpc_pipefs" || fs_type == "nfsd";
+}
+
+unmount_order::unmount_order(std::vector<mount_node> &nodes_p) : nodes(nodes_p)
+{
+    // Each mount is readied only once, so complete() never needs to allocate:
+    ready.reserve(nodes.size());
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        if (nodes[i].pending_children == 0) {
+            ready.push_back(i);
+        }
+    }
+}
+
+void unmount_order::complete(int node) noexcept
+{
+    int parent = nodes[node].parent;
+    if (parent != -1 && --nodes[parent].pending_children == 0) {
+        ready.push_back(parent);
+    }
+}
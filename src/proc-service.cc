@@ -18,6 +18,7 @@
 
 // Strings describing the execution stages (failure points).
 const char * const exec_stage_descriptions[static_cast<int>(exec_stage::DO_EXEC) + 1] = {
+        "entering cgroup",              // ENTER_CGROUP
         "arranging file descriptors",   // ARRANGE_FDS
         "reading environment file",     // READ_ENV_FILE
         "setting environment variable", // SET_NOTIFYFD_VAR
@@ -62,7 +63,14 @@ void process_service::exec_succeeded() noexcept
     // might be stopped (and killed via a signal) during smooth recovery.  We don't to
     // process startup again in either case, so we check for state STARTING:
     if (get_state() == service_state_t::STARTING) {
-        if (force_notification_fd != -1 || !notification_var.empty()) {
+        if (use_notify_socket) {
+            // Wait for readiness notification via the notification socket (unless it has already
+            // been received):
+            if (notify_ready_received) {
+                notify_ready();
+            }
+        }
+        else if (force_notification_fd != -1 || !notification_var.empty()) {
             // Wait for readiness notification:
             readiness_watcher.set_enabled(event_loop, true);
         }
@@ -70,6 +78,12 @@ void process_service::exec_succeeded() noexcept
             started();
         }
     }
+    else if (get_state() == service_state_t::STARTED) {
+        // Smooth recovery; readiness (via the notification socket) may already have been received
+        if (use_notify_socket && notify_ready_received) {
+            notify_ready();
+        }
+    }
     else if (get_state() == service_state_t::STOPPING) {
         // stopping, but smooth recovery was in process. That's now over so we can
         // commence normal stop. Note that if pid == -1 the process already stopped(!),
@@ -80,6 +94,63 @@ void process_service::exec_succeeded() noexcept
     }
 }
 
+void process_service::notify_ready() noexcept
+{
+    notify_ready_received = true;
+    if (waiting_for_execstat) {
+        // We'll process readiness once the exec status is known (see exec_succeeded())
+        return;
+    }
+
+    auto state = get_state();
+    if (state == service_state_t::STARTING) {
+        arm_watchdog();
+        started();
+    }
+    else if (state == service_state_t::STARTED) {
+        // (process restarted via smooth recovery)
+        arm_watchdog();
+    }
+}
+
+void process_service::notify_message(const char *msg, size_t len) noexcept
+{
+    // Process each assignment (line) in the message. Unrecognised assignments are ignored.
+    const char *end = msg + len;
+    while (msg < end) {
+        const char *eol = std::find(msg, end, '\n');
+        size_t line_len = eol - msg;
+
+        // Check whether the line begins with the given text:
+        auto begins = [&](const char *text) -> bool {
+            size_t text_len = strlen(text);
+            return line_len >= text_len && memcmp(msg, text, text_len) == 0;
+        };
+
+        if (line_len == 7 && begins("READY=1")) {
+            notify_ready();
+        }
+        else if (line_len == 10 && begins("WATCHDOG=1")) {
+            // Keep-alive; re-arm the watchdog (if it is armed, i.e. the process is ready)
+            if (watchdog_armed) {
+                arm_watchdog();
+            }
+        }
+        else if (begins("STATUS=")) {
+            try {
+                status_text.assign(msg + 7, line_len - 7);
+            }
+            catch (std::bad_alloc &exc) {
+                status_text.clear();
+            }
+        }
+
+        msg = eol + 1;
+    }
+
+    services->process_queues();
+}
+
 void scripted_service::exec_succeeded() noexcept
 {
 	// For a scripted service, this means nothing other than that the start/stop
@@ -107,9 +178,13 @@ rearm exec_status_pipe_watcher::fd_event(eventloop_t &loop, int fd, int flags) n
             }
         }
         sr->pid = -1;
+        sr->mark_changed();
         sr->exec_failed(exec_status);
     }
     else {
+        if (sr->get_state() == service_state_t::STARTING) {
+            sr->start_timeline.record(timeline_event_t::EXEC_SUCCEEDED);
+        }
         sr->exec_succeeded();
 
         if (sr->pid == -1) {
@@ -153,12 +228,59 @@ rearm ready_notify_watcher::fd_event(eventloop_t &, int fd, int flags) noexcept
     return rearm::REARM;
 }
 
+rearm log_output_watcher::fd_event(eventloop_t &, int fd, int flags) noexcept
+{
+    return service->read_log_output(fd);
+}
+
+rearm cgroup_events_watcher::fd_event(eventloop_t &loop, int fd, int flags) noexcept
+{
+    // Discard the event data; we need only re-check the state of the cgroup:
+    char buf[256];
+    while (bp_sys::read(fd, buf, sizeof(buf)) > 0) { }
+
+    base_process_service *sr = service;
+    if (bp_sys::cgroup_populated(sr->cgroup_fd) == 1) {
+        return rearm::REARM;
+    }
+
+    // The cgroup is empty: we can now process the termination of the service process.
+    deregister(loop);
+    bp_sys::close(fd);
+    sr->waiting_cgroup_empty = false;
+    sr->handle_exit_status(sr->exit_status);
+    return rearm::REMOVED;
+}
+
+rearm activation_socket_watcher::fd_event(eventloop_t &loop, int fd, int flags) noexcept
+{
+    // A connection is pending: start the service, which will accept it. (The watcher is registered
+    // again once the service has stopped).
+    base_process_service *sr = service;
+    deregister(loop);
+    sr->watching_activation = false;
+
+    if (sr->services->is_shutting_down() || ! sr->onstart_flags.on_demand) {
+        return rearm::REMOVED;
+    }
+
+    log(loglevel_t::INFO, sr->get_name(), ": activated by connection to socket.");
+    sr->start();
+    if (sr->activation_lifetime != time_val(0,0) && ! sr->lifetime_timer_armed) {
+        sr->lifetime_timer.arm_timer_rel(loop, sr->activation_lifetime);
+        sr->lifetime_timer_armed = true;
+    }
+    sr->services->process_queues();
+    return rearm::REMOVED;
+}
+
 dasynq::rearm service_child_watcher::status_change(eventloop_t &loop, pid_t child, int status) noexcept
 {
     base_process_service *sr = service;
 
     sr->pid = -1;
     sr->exit_status = bp_sys::exit_status(status);
+    sr->mark_changed();
 
     // Ok, for a process service, any process death which we didn't rig ourselves is a bit... unexpected.
     // Probably, the child died because we asked it to (sr->service_state == STOPPING). But even if we
@@ -185,6 +307,14 @@ dasynq::rearm service_child_watcher::status_change(eventloop_t &loop, pid_t chil
 
 void process_service::handle_exit_status(bp_sys::exit_status exit_status) noexcept
 {
+    release_notify();
+
+    if (wait_cgroup_empty()) {
+        // Other processes remain in the cgroup, and are being killed; we'll be called again once
+        // they have terminated.
+        return;
+    }
+
     bool did_exit = exit_status.did_exit();
     bool was_signalled = exit_status.was_signalled();
     auto service_state = get_state();
@@ -243,6 +373,8 @@ void process_service::exec_failed(run_proc_err errcode) noexcept
     log(loglevel_t::ERROR, get_name(), ": execution failed - ",
             exec_stage_descriptions[static_cast<int>(errcode.stage)], ": ", strerror(errcode.st_errno));
 
+    release_notify();
+
     if (notification_fd != -1) {
         readiness_watcher.deregister(event_loop);
         bp_sys::close(notification_fd);
@@ -502,6 +634,7 @@ bgproc_service::read_pid_file(bp_sys::exit_status *exit_status) noexcept
         if (v <= make_unsigned_val(std::numeric_limits<pid_t>::max())) {
             pid = (pid_t) v;
             valid_pid = true;
+            mark_changed();
         }
     }
     catch (std::out_of_range &exc) {
@@ -514,19 +647,27 @@ bgproc_service::read_pid_file(bp_sys::exit_status *exit_status) noexcept
     if (valid_pid) {
         pid_t wait_r = waitpid(pid, exit_status, WNOHANG);
         if (wait_r == -1 && errno == ECHILD) {
-            // We can't track this child - check process exists:
-            if (kill(pid, 0) == 0 || errno != ESRCH) {
+            // We can't track this child. If possible, watch for its termination via a pidfd;
+            // otherwise, just check that the process exists:
+            unwatch_daemon_pidfd();
+            bool exists = watch_daemon_pidfd();
+            if (! exists && errno != ESRCH) {
+                exists = (kill(pid, 0) == 0 || errno != ESRCH);
+            }
+            if (exists) {
                 tracking_child = false;
                 return pid_result_t::OK;
             }
             else {
                 log(loglevel_t::ERROR, get_name(), ": pid read from pidfile (", pid, ") is not valid");
                 pid = -1;
+                mark_changed();
                 return pid_result_t::FAILED;
             }
         }
         else if (wait_r == pid) {
             pid = -1;
+            mark_changed();
             return pid_result_t::TERMINATED;
         }
         else if (wait_r == 0) {
@@ -540,9 +681,53 @@ bgproc_service::read_pid_file(bp_sys::exit_status *exit_status) noexcept
 
     log(loglevel_t::ERROR, get_name(), ": pid read from pidfile (", pid, ") is not valid");
     pid = -1;
+    mark_changed();
     return pid_result_t::FAILED;
 }
 
+bool bgproc_service::watch_daemon_pidfd() noexcept
+{
+    int fd = bp_sys::pidfd_open(pid, 0);
+    if (fd == -1) {
+        return false;
+    }
+
+    try {
+        daemon_watcher.add_watch(event_loop, fd, dasynq::IN_EVENTS);
+    }
+    catch (std::exception &exc) {
+        log(loglevel_t::WARN, get_name(), ": can't watch daemon process (", pid, "): ", exc.what());
+        bp_sys::close(fd);
+        errno = ENOMEM;
+        return false;
+    }
+
+    daemon_pidfd = fd;
+    return true;
+}
+
+rearm daemon_pidfd_watcher::fd_event(eventloop_t &loop, int fd, int flags) noexcept
+{
+    // The daemon process has terminated. Since it isn't our child, we can't get its exit status;
+    // treat it as having exited cleanly.
+    bgproc_service *sr = service;
+    deregister(loop);
+    bp_sys::close(fd);
+    sr->daemon_pidfd = -1;
+
+    sr->pid = -1;
+    sr->exit_status = bp_sys::exit_status();
+    sr->mark_changed();
+
+    if (sr->stop_timer_armed) {
+        sr->restart_timer.stop_timer(loop);
+        sr->stop_timer_armed = false;
+    }
+
+    sr->handle_exit_status(sr->exit_status);
+    return rearm::REMOVED;
+}
+
 void process_service::bring_down() noexcept
 {
     if (waiting_for_execstat) {
@@ -570,8 +755,13 @@ void process_service::bring_down() noexcept
 
         // The rest is done in handle_exit_status.
     }
+    else if (waiting_cgroup_empty) {
+        // The process is dead, but others in its cgroup are still being killed. The rest is done
+        // in handle_exit_status (once they have terminated).
+    }
     else {
-        // The process is already dead.
+        // The process is already dead (and may be waiting to be restarted, for smooth recovery).
+        cancel_restart();
         stopped();
     }
 }
@@ -589,10 +779,10 @@ void bgproc_service::bring_down() noexcept
             kill_pg(term_signal);
         }
 
-        // In most cases, the rest is done in handle_exit_status.
-        // If we are a BGPROCESS and the process is not our immediate child, however, that
-        // won't work - check for this now:
-        if (! tracking_child) {
+        // In most cases, the rest is done in handle_exit_status (including when the process
+        // is not our immediate child, but we are watching it via a pidfd). Otherwise, we can't
+        // tell when the process terminates - consider it stopped now:
+        if (! tracking_child && daemon_pidfd == -1) {
             stopped();
         }
         else if (stop_timeout != time_val(0,0)) {
@@ -601,7 +791,8 @@ void bgproc_service::bring_down() noexcept
         }
     }
     else {
-        // The process is already dead.
+        // The process is already dead (and may be waiting to be restarted, for smooth recovery).
+        cancel_restart();
         stopped();
     }
 }
@@ -636,3 +827,15 @@ dasynq::rearm process_restart_timer::timer_expiry(eventloop_t &, int expiry_coun
     // Leave the timer disabled, or, if it has been reset by any processing above, leave it armed:
     return dasynq::rearm::NOOP;
 }
+
+dasynq::rearm watchdog_timer::timer_expiry(eventloop_t &, int expiry_count) noexcept
+{
+    service->watchdog_expired();
+    return dasynq::rearm::NOOP;
+}
+
+dasynq::rearm lifetime_stop_timer::timer_expiry(eventloop_t &, int expiry_count) noexcept
+{
+    service->lifetime_expired();
+    return dasynq::rearm::NOOP;
+}
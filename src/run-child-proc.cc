@@ -1,5 +1,8 @@
 #include <cstdlib>
 #include <cstring>
+#include <climits>
+#include <csignal>
+#include <system_error>
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -13,6 +16,15 @@
 #include "service.h"
 #include "proc-service.h"
 
+extern char **environ;
+
+// Size of a buffer sufficient for the decimal representation of a (non-negative) pid_t or int,
+// including nul terminator (one decimal digit is worth just over 3 bits).
+constexpr static int num_buf_size = ((CHAR_BIT * sizeof(intmax_t) + 2) / 3) + 1;
+
+// Default search path, if PATH is not set
+constexpr static char default_path[] = "/bin:/usr/bin";
+
 // Move an fd, if necessary, to another fd. The destination fd must be available (not open).
 // if fd is specified as -1, returns -1 immediately. Returns 0 on success.
 static int move_fd(int fd, int dest)
@@ -40,53 +52,298 @@ static int move_reserved_fd(int *fd, int min_fd)
     return new_fd;
 }
 
-void base_process_service::run_child_proc(run_proc_params params) noexcept
+// Open the output (stdout/stderr) for the process as the given fd: either duplicate the given output
+// fd, or (if it is -1) open the log file. Returns 0 on success.
+static int open_output(const char *logfile, int output_fd, int dest)
+{
+    if (output_fd != -1) {
+        return (dup2(output_fd, dest) == dest) ? 0 : -1;
+    }
+    return move_fd(open(logfile, O_WRONLY | O_CREAT | O_APPEND, S_IRUSR | S_IWUSR), dest);
+}
+
+// Set an environment variable for the process, replacing any existing setting of the same variable.
+// Returns the index of the setting (in env_storage).
+static size_t set_proc_env(run_proc_env &env, std::string &&setting)
+{
+    size_t name_len = setting.find('=') + 1;  // including '='
+    for (size_t i = 0; i < env.env_storage.size(); i++) {
+        std::string &existing = env.env_storage[i];
+        if (existing.compare(0, name_len, setting, 0, name_len) == 0) {
+            existing = std::move(setting);
+            return i;
+        }
+    }
+    env.env_storage.push_back(std::move(setting));
+    return env.env_storage.size() - 1;
+}
+
+// Reserve an environment variable for the process, with a value to be filled in (as a decimal
+// number) by the child. Returns the index of the setting.
+static size_t reserve_proc_env(run_proc_env &env, const char *name)
+{
+    std::string setting = name;
+    setting += '=';
+    setting.append(num_buf_size - 1, '0');
+    return set_proc_env(env, std::move(setting));
+}
+
+// Get a pointer to the value part of a (reserved) environment setting.
+static char *proc_env_value(run_proc_env &env, size_t index)
+{
+    std::string &setting = env.env_storage[index];
+    return &setting[setting.find('=') + 1];
+}
+
+// Check whether two timestamps (from stat results) are the same.
+static bool same_time(const struct timespec &a, const struct timespec &b) noexcept
+{
+    return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+}
+
+// Check whether two stat results are for the same file, in the same state. The timestamps are
+// compared to the nanosecond, since a file may be modified more than once within a second.
+static bool same_file_state(const struct stat &a, const struct stat &b) noexcept
+{
+    if (a.st_ino != b.st_ino || a.st_dev != b.st_dev || a.st_size != b.st_size) {
+        return false;
+    }
+    #if defined(__APPLE__)
+    return same_time(a.st_mtimespec, b.st_mtimespec) && same_time(a.st_ctimespec, b.st_ctimespec);
+    #else
+    return same_time(a.st_mtim, b.st_mtim) && same_time(a.st_ctim, b.st_ctim);
+    #endif
+}
+
+// Build the process environment: our own environment, with settings from the environment file (if
+// any) and then the variables which are set for the service process applied on top.
+static void build_proc_env(const run_proc_params &params, run_proc_env &env)
+{
+    env.env_storage.clear();
+    env.envp.clear();
+    env.notify_fd_val = nullptr;
+    env.listen_pid_val = nullptr;
+    env.cs_fd_val = nullptr;
+
+    for (char **envv = environ; *envv != nullptr; ++envv) {
+        env.env_storage.emplace_back(*envv);
+    }
+
+    if (env.env_file_stat.st_ino != 0) {
+        std::vector<std::string> env_vars;
+        try {
+            read_env_file(params.env_file, env_vars);
+        }
+        catch (std::system_error &sys_err) {
+            // Use any settings read before the error
+        }
+        for (auto &setting : env_vars) {
+            set_proc_env(env, std::move(setting));
+        }
+    }
+
+    const size_t none = size_t(-1);
+    size_t notify_var_idx = none;
+    size_t listen_pid_idx = none;
+    size_t cs_fd_idx = none;
+
+    if (env.notify_var.length() != 0) {
+        notify_var_idx = reserve_proc_env(env, env.notify_var.c_str());
+    }
+
+    if (env.notify_socket.length() != 0) {
+        set_proc_env(env, "NOTIFY_SOCKET=" + env.notify_socket);
+    }
+
+    if (env.watchdog_usec != 0) {
+        set_proc_env(env, "WATCHDOG_USEC=" + std::to_string(env.watchdog_usec));
+    }
+
+    if (env.with_socket) {
+        set_proc_env(env, "LISTEN_FDS=1");
+        listen_pid_idx = reserve_proc_env(env, "LISTEN_PID");
+    }
+
+    if (env.with_csfd) {
+        cs_fd_idx = reserve_proc_env(env, "DINIT_CS_FD");
+    }
+
+    // (env_storage is now complete, so pointers to its contents will remain valid)
+    if (notify_var_idx != none) env.notify_fd_val = proc_env_value(env, notify_var_idx);
+    if (listen_pid_idx != none) env.listen_pid_val = proc_env_value(env, listen_pid_idx);
+    if (cs_fd_idx != none) env.cs_fd_val = proc_env_value(env, cs_fd_idx);
+
+    env.envp.reserve(env.env_storage.size() + 1);
+    for (auto &setting : env.env_storage) {
+        env.envp.push_back(&setting[0]);
+    }
+    env.envp.push_back(nullptr);
+}
+
+void prepare_child_proc(const run_proc_params &params, run_proc_env &env, run_proc_plan &plan)
+{
+    // Re-use the previously built environment, unless the settings it was built from (including
+    // the environment file) have changed:
+    const char *env_file = (params.env_file != nullptr) ? params.env_file : "";
+    const char *notify_var = (params.notify_var != nullptr) ? params.notify_var : "";
+    const char *notify_socket = (params.notify_socket != nullptr) ? params.notify_socket : "";
+    bool with_socket = (params.socket_fd != -1);
+    bool with_csfd = (params.csfd != -1);
+
+    struct stat env_file_stat;
+    if (*env_file == 0 || stat(env_file, &env_file_stat) == -1) {
+        memset(&env_file_stat, 0, sizeof(env_file_stat));
+    }
+
+    if (! env.valid || env.env_file != env_file || ! same_file_state(env.env_file_stat, env_file_stat)
+            || env.notify_var != notify_var || env.notify_socket != notify_socket
+            || env.watchdog_usec != params.watchdog_usec || env.with_socket != with_socket
+            || env.with_csfd != with_csfd) {
+        env.valid = false;
+        env.env_file = env_file;
+        env.env_file_stat = env_file_stat;
+        env.notify_var = notify_var;
+        env.notify_socket = notify_socket;
+        env.watchdog_usec = params.watchdog_usec;
+        env.with_socket = with_socket;
+        env.with_csfd = with_csfd;
+        build_proc_env(params, env);
+        env.valid = true;
+    }
+
+    plan.env = &env;
+
+    // Executable: if the command does not contain a slash, search for it in the PATH (from the
+    // process environment), as execvp() would.
+    const char *file = params.args[0];
+    if (strchr(file, '/') != nullptr) {
+        plan.exec_paths.emplace_back(file);
+    }
+    else if (*file != 0) {
+        const char *path = default_path;
+        for (auto &setting : env.env_storage) {
+            if (setting.compare(0, 5, "PATH=") == 0) {
+                path = setting.c_str() + 5;
+                break;
+            }
+        }
+
+        while (true) {
+            const char *path_end = strchr(path, ':');
+            size_t dir_len = (path_end != nullptr) ? (path_end - path) : strlen(path);
+            // An empty path element means the current directory
+            std::string exec_path = (dir_len == 0) ? std::string(".") : std::string(path, dir_len);
+            exec_path += '/';
+            exec_path += file;
+            plan.exec_paths.push_back(std::move(exec_path));
+            if (path_end == nullptr) break;
+            path = path_end + 1;
+        }
+    }
+
+    // Arguments for running the executable as a shell script, if it is not in a recognised
+    // format; the script path (sh_args[1]) is filled in by the child.
+    plan.sh_args.push_back("/bin/sh");
+    plan.sh_args.push_back(nullptr);
+    for (const char * const *arg = params.args + 1; *arg != nullptr; ++arg) {
+        plan.sh_args.push_back(*arg);
+    }
+    plan.sh_args.push_back(nullptr);
+
+    // Resource limits: if either the hard or soft limit is not set, use the current value.
+    for (auto &limit : params.rlimits) {
+        struct rlimit setlimits;
+        if (!limit.hard_set || !limit.soft_set) {
+            if (getrlimit(limit.resource_id, &setlimits) != 0) {
+                throw std::system_error(errno, std::system_category());
+            }
+        }
+        if (limit.hard_set) setlimits.rlim_max = limit.limits.rlim_max;
+        if (limit.soft_set) setlimits.rlim_cur = limit.limits.rlim_cur;
+        plan.rlimits.emplace_back(limit.resource_id, setlimits);
+    }
+
+    // Copy signal mask, but unmask signals that we masked on startup.
+    sigprocmask(SIG_SETMASK, nullptr, &plan.sigmask);
+    sigdelset(&plan.sigmask, SIGCHLD);
+    sigdelset(&plan.sigmask, SIGINT);
+    sigdelset(&plan.sigmask, SIGTERM);
+    sigdelset(&plan.sigmask, SIGQUIT);
+
+    // If the console already has a session leader, presumably it is us. On the other hand
+    // if it has no session leader, and we don't create one, then control inputs such as
+    // ^C will have no effect.
+    plan.do_set_ctty = (tcgetsid(0) == -1);
+}
+
+// Write a non-negative number, in decimal, to a buffer of (at least) num_buf_size bytes. Unlike
+// snprintf(), this is async-signal-safe.
+static void write_decimal(char *buf, intmax_t val) noexcept
 {
-    // Child process. Must not risk throwing any uncaught exception from here until exit().
+    char digits[num_buf_size];
+    int n = 0;
+    do {
+        digits[n++] = '0' + (val % 10);
+        val /= 10;
+    } while (val != 0);
+
+    while (n > 0) {
+        *buf++ = digits[--n];
+    }
+    *buf = 0;
+}
+
+void run_child_proc(const run_proc_params &params, run_proc_plan &plan) noexcept
+{
+    // Child process. This may be running after vfork(), sharing memory with the parent: only
+    // async-signal-safe functions may be used, and nothing other than local variables and the
+    // reserved parts of the plan may be modified.
     const char * const *args = params.args;
     const char *working_dir = params.working_dir;
     const char *logfile = params.logfile;
+    int output_fd = params.output_fd;
     bool on_console = params.on_console;
     int wpipefd = params.wpipefd;
     int csfd = params.csfd;
+    int socket_fd = params.socket_fd;
     int notify_fd = params.notify_fd;
     int force_notify_fd = params.force_notify_fd;
-    const char *notify_var = params.notify_var;
     uid_t uid = params.uid;
     gid_t gid = params.gid;
-    const std::vector<service_rlimits> &rlimits = params.rlimits;
-
-    // If the console already has a session leader, presumably it is us. On the other hand
-    // if it has no session leader, and we don't create one, then control inputs such as
-    // ^C will have no effect.
-    bool do_set_ctty = (tcgetsid(0) == -1);
 
-    // Copy signal mask, but unmask signals that we masked on startup. For the moment, we'll
-    // also block all signals, since apparently dup() can be interrupted (!!! really, POSIX??).
-    sigset_t sigwait_set;
+    // Block all signals, since apparently dup() can be interrupted (!!! really, POSIX??). (If we were
+    // created via vfork(), they are already blocked). Signals which have a handler installed are
+    // reset to the default disposition: a handler running in the child could otherwise modify the
+    // parent's memory.
     sigset_t sigall_set;
     sigfillset(&sigall_set);
-    sigprocmask(SIG_SETMASK, &sigall_set, &sigwait_set);
-    sigdelset(&sigwait_set, SIGCHLD);
-    sigdelset(&sigwait_set, SIGINT);
-    sigdelset(&sigwait_set, SIGTERM);
-    sigdelset(&sigwait_set, SIGQUIT);
-
-    constexpr int bufsz = 11 + ((CHAR_BIT * sizeof(pid_t) + 2) / 3) + 1;
-    // "LISTEN_PID=" - 11 characters; the expression above gives a conservative estimate
-    // on the maxiumum number of bytes required for LISTEN=nnn, including nul terminator,
-    // where nnn is a pid_t in decimal (i.e. one decimal digit is worth just over 3 bits).
-    char nbuf[bufsz];
-
-    // "DINIT_CS_FD=" - 12 bytes. (we -1 from sizeof(int) in account of sign bit).
-    constexpr int csenvbufsz = 12 + ((CHAR_BIT * sizeof(int) - 1 + 2) / 3) + 1;
-    char csenvbuf[csenvbufsz];
+    sigprocmask(SIG_SETMASK, &sigall_set, nullptr);
+
+    for (int sig = 1; sig < NSIG; sig++) {
+        struct sigaction sa;
+        if (sigaction(sig, nullptr, &sa) == 0 && sa.sa_handler != SIG_DFL && sa.sa_handler != SIG_IGN) {
+            sa.sa_handler = SIG_DFL;
+            sa.sa_flags = 0;
+            sigaction(sig, &sa, nullptr);
+        }
+    }
 
     run_proc_err err;
     err.stage = exec_stage::ARRANGE_FDS;
 
     int minfd = (socket_fd == -1) ? 3 : 4;
 
+    if (params.cgroup_fd != -1) {
+        // Move into the service cgroup first, so that any processes we create are also in it. (The
+        // cgroup fd is close-on-exec; it might be clobbered by arranging fds, so must be used now).
+        err.stage = exec_stage::ENTER_CGROUP;
+        int procs_fd = openat(params.cgroup_fd, "cgroup.procs", O_WRONLY | O_CLOEXEC);
+        if (procs_fd == -1) goto failure_out;
+        if (write(procs_fd, "0", 1) != 1) goto failure_out;
+        close(procs_fd);
+        err.stage = exec_stage::ARRANGE_FDS;
+    }
+
     if (force_notify_fd != -1) {
         // Move wpipefd/csfd/socket_fd to another fd if necessary:
         if (wpipefd == force_notify_fd) {
@@ -99,6 +356,11 @@ void base_process_service::run_child_proc(run_proc_params params) noexcept
                 goto failure_out;
             }
         }
+        if (output_fd == force_notify_fd) {
+            if (move_reserved_fd(&output_fd, minfd) == -1) {
+                goto failure_out;
+            }
+        }
         if (socket_fd == force_notify_fd) {
             // Note that we might move this again later
             if (move_reserved_fd(&socket_fd, 0) == -1) {
@@ -127,37 +389,19 @@ void base_process_service::run_child_proc(run_proc_params params) noexcept
         if (csfd == -1) goto failure_out;
     }
 
+    if (output_fd != -1 && output_fd < minfd) {
+        output_fd = fcntl(output_fd, F_DUPFD_CLOEXEC, minfd);
+        if (output_fd == -1) goto failure_out;
+    }
+
     if (notify_fd < minfd && notify_fd != force_notify_fd) {
         notify_fd = fcntl(notify_fd, F_DUPFD, minfd);
         if (notify_fd == -1) goto failure_out;
     }
 
-    err.stage = exec_stage::READ_ENV_FILE;
-
-    // Read environment from file
-    if (params.env_file != nullptr) {
-        try {
-            read_env_file(params.env_file);
-        }
-        catch (std::system_error &sys_err) {
-            errno = sys_err.code().value();
-        }
-        catch (std::bad_alloc &alloc_err) {
-            errno = ENOMEM; goto failure_out;
-        }
-    }
-
     // Set up notify-fd variable:
-    if (notify_var != nullptr && *notify_var != 0) {
-        err.stage = exec_stage::SET_NOTIFYFD_VAR;
-        // We need to do an allocation: the variable name length, '=', and space for the value,
-        // and nul terminator:
-        int notify_var_len = strlen(notify_var);
-        int req_sz = notify_var_len + ((CHAR_BIT * sizeof(int) - 1 + 2) / 3) + 1;
-        char * var_str = (char *) malloc(req_sz);
-        if (var_str == nullptr) goto failure_out;
-        snprintf(var_str, req_sz, "%s=%d", notify_var, notify_fd);
-        if (putenv(var_str)) goto failure_out;
+    if (plan.env->notify_fd_val != nullptr) {
+        write_decimal(plan.env->notify_fd_val, notify_fd);
     }
 
     // Set up Systemd-style socket activation:
@@ -168,15 +412,11 @@ void base_process_service::run_child_proc(run_proc_params params) noexcept
         if (dup2(socket_fd, 3) == -1) goto failure_out;
         if (socket_fd != 3) close(socket_fd);
 
-        if (putenv(const_cast<char *>("LISTEN_FDS=1"))) goto failure_out;
-        snprintf(nbuf, bufsz, "LISTEN_PID=%jd", static_cast<intmax_t>(getpid()));
-        if (putenv(nbuf)) goto failure_out;
+        write_decimal(plan.env->listen_pid_val, getpid());
     }
 
     if (csfd != -1) {
-        err.stage = exec_stage::SETUP_CONTROL_SOCKET;
-        snprintf(csenvbuf, csenvbufsz, "DINIT_CS_FD=%d", csfd);
-        if (putenv(csenvbuf)) goto failure_out;
+        write_decimal(plan.env->cs_fd_val, csfd);
     }
 
     if (working_dir != nullptr && *working_dir != 0) {
@@ -197,14 +437,14 @@ void base_process_service::run_child_proc(run_proc_params params) noexcept
             // stdin = 0. That's what we should have; proceed with opening stdout and stderr. We have to
             // take care not to clobber the notify_fd.
             if (notify_fd != 1) {
-                if (move_fd(open(logfile, O_WRONLY | O_CREAT | O_APPEND, S_IRUSR | S_IWUSR), 1) != 0) {
+                if (open_output(logfile, output_fd, 1) != 0) {
                     goto failure_out;
                 }
                 if (notify_fd != 2 && dup2(1, 2) != 2) {
                     goto failure_out;
                 }
             }
-            else if (move_fd(open(logfile, O_WRONLY | O_CREAT | O_APPEND, S_IRUSR | S_IWUSR), 2) != 0) {
+            else if (open_output(logfile, output_fd, 2) != 0) {
                 goto failure_out;
             }
         }
@@ -229,7 +469,7 @@ void base_process_service::run_child_proc(run_proc_params params) noexcept
         // terminal as a controlling terminal (it is already claimed), meaning that it
         // will not see control signals from ^C etc.
 
-        if (do_set_ctty) {
+        if (plan.do_set_ctty) {
             // Disable suspend (^Z) (and on some systems, delayed suspend / ^Y)
             signal(SIGTSTP, SIG_IGN);
 
@@ -245,15 +485,8 @@ void base_process_service::run_child_proc(run_proc_params params) noexcept
 
     // Resource limits
     err.stage = exec_stage::SET_RLIMITS;
-    for (auto &limit : rlimits) {
-        rlimit setlimits;
-        if (!limit.hard_set || !limit.soft_set) {
-            // if either hard or soft limit is not set, use current:
-            if (getrlimit(limit.resource_id, &setlimits) != 0) goto failure_out;
-        }
-        if (limit.hard_set) setlimits.rlim_max = limit.limits.rlim_max;
-        if (limit.soft_set) setlimits.rlim_cur = limit.limits.rlim_cur;
-        if (setrlimit(limit.resource_id, &setlimits) != 0) goto failure_out;
+    for (auto &limit : plan.rlimits) {
+        if (setrlimit(limit.first, &limit.second) != 0) goto failure_out;
     }
 
     if (uid != uid_t(-1)) {
@@ -262,10 +495,30 @@ void base_process_service::run_child_proc(run_proc_params params) noexcept
         if (setregid(gid, gid) != 0) goto failure_out;
     }
 
-    sigprocmask(SIG_SETMASK, &sigwait_set, nullptr);
+    sigprocmask(SIG_SETMASK, &plan.sigmask, nullptr);
 
     err.stage = exec_stage::DO_EXEC;
-    execvp(args[0], const_cast<char **>(args));
+    {
+        // Try each candidate path (as execvp() would): a path which doesn't exist, or is not
+        // accessible, is skipped; other errors are reported immediately.
+        int exec_errno = ENOENT;
+        for (auto &exec_path : plan.exec_paths) {
+            execve(exec_path.c_str(), const_cast<char **>(args), plan.env->envp.data());
+            if (errno == ENOEXEC) {
+                // Not a recognised executable format; run it as a shell script:
+                plan.sh_args[1] = exec_path.c_str();
+                execve("/bin/sh", const_cast<char **>(plan.sh_args.data()), plan.env->envp.data());
+            }
+            if (errno == EACCES) {
+                exec_errno = EACCES;
+            }
+            else if (errno != ENOENT && errno != ENOTDIR) {
+                exec_errno = errno;
+                break;
+            }
+        }
+        errno = exec_errno;
+    }
 
     // If we got here, the exec failed:
     failure_out:
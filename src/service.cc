@@ -20,23 +20,184 @@
  * See service.h for details.
  */
 
-// Find the requested service by name
-static service_record * find_service(const std::list<service_record *> & records,
-                                    const char *name) noexcept
+// Hash a service name (FNV-1a)
+size_t service_name_index::hash_name(const char *name, size_t len) noexcept
 {
-    using std::list;
-    list<service_record *>::const_iterator i = records.begin();
-    for ( ; i != records.end(); ++i ) {
-        if (strcmp((*i)->get_name().c_str(), name) == 0) {
-            return *i;
+    size_t hash = (sizeof(size_t) > 4) ? (size_t)14695981039346656037ULL : (size_t)2166136261UL;
+    size_t prime = (sizeof(size_t) > 4) ? (size_t)1099511628211ULL : (size_t)16777619UL;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)name[i];
+        hash *= prime;
+    }
+    return hash;
+}
+
+auto service_name_index::find_slot(const char *name, size_t len, const service_record *svc) noexcept
+        -> slot *
+{
+    if (used == 0) return nullptr;
+
+    size_t hash = hash_name(name, len);
+    size_t mask = slots.size() - 1;
+    for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+        slot &s = slots[i];
+        if (s.state == slot_state::FREE) {
+            return nullptr;
+        }
+        if (s.state == slot_state::USED && s.hash == hash) {
+            service_record *rec = *s.pos;
+            if (svc != nullptr) {
+                if (rec == svc) return &s;
+            }
+            else {
+                const std::string &rec_name = rec->get_name();
+                if (rec_name.length() == len && memcmp(rec_name.data(), name, len) == 0) {
+                    return &s;
+                }
+            }
+        }
+    }
+}
+
+void service_name_index::rehash(size_t new_size)
+{
+    std::vector<slot> new_slots(new_size);
+    size_t mask = new_size - 1;
+    for (slot &s : slots) {
+        if (s.state == slot_state::USED) {
+            size_t i = s.hash & mask;
+            while (new_slots[i].state != slot_state::FREE) {
+                i = (i + 1) & mask;
+            }
+            new_slots[i] = s;
+        }
+    }
+    slots.swap(new_slots);
+    filled = used;
+}
+
+auto service_name_index::find(const service_record *svc) noexcept -> record_iter *
+{
+    const std::string &name = svc->get_name();
+    slot *s = find_slot(name.c_str(), name.length(), svc);
+    return (s == nullptr) ? nullptr : &s->pos;
+}
+
+void service_name_index::insert(record_iter pos)
+{
+    // Keep the load (including removed slots) at no more than 3/4:
+    if ((filled + 1) * 4 > slots.size() * 3) {
+        size_t new_size = 16;
+        while ((used + 1) * 2 > new_size) {
+            new_size *= 2;
+        }
+        rehash(new_size);
+    }
+
+    const std::string &name = (*pos)->get_name();
+    size_t hash = hash_name(name.c_str(), name.length());
+    size_t mask = slots.size() - 1;
+    size_t i = hash & mask;
+    while (slots[i].state == slot_state::USED) {
+        i = (i + 1) & mask;
+    }
+
+    slot &s = slots[i];
+    if (s.state == slot_state::FREE) filled++;
+    s.state = slot_state::USED;
+    s.hash = hash;
+    s.pos = pos;
+    used++;
+}
+
+bool service_name_index::remove(const service_record *svc) noexcept
+{
+    const std::string &name = svc->get_name();
+    slot *s = find_slot(name.c_str(), name.length(), svc);
+    if (s == nullptr) return false;
+
+    s->state = slot_state::REMOVED;
+    used--;
+
+    if (used == 0) {
+        // No records remain; clear removed markers so that they don't affect probe length
+        for (slot &sl : slots) {
+            sl.state = slot_state::FREE;
         }
+        filled = 0;
+    }
+    return true;
+}
+
+service_record::~service_record() noexcept
+{
+    // Release dependency records. (Any links from the dependencies should already have been
+    // removed, via prepare_for_unload(), if the dependencies remain loaded).
+    auto &pool = services->get_dep_pool();
+    for (service_dep *dep : depends_on.deps) {
+        pool.release(dep);
+    }
+}
+
+service_dep &service_record::add_dep_record(service_record *to, dependency_type dep_type)
+{
+    auto &deps = depends_on.deps;
+    if (deps.size() == deps.capacity()) {
+        deps.reserve(deps.size() * 2 + 4);
+    }
+
+    auto &pool = services->get_dep_pool();
+    service_dep *dep = pool.allocate(this, to, dep_type);
+    try {
+        to->dependents.push_back(dep);
+    }
+    catch (...) {
+        pool.release(dep);
+        throw;
+    }
+
+    deps.push_back(dep);
+    return *dep;
+}
+
+void service_record::rm_deps(size_t first, size_t last) noexcept
+{
+    auto &deps = depends_on.deps;
+    auto &pool = services->get_dep_pool();
+    for (size_t i = first; i < last; i++) {
+        service_dep *dep = deps[i];
+        auto to = dep->get_to();
+        auto &dep_dpts = to->dependents;
+        dep_dpts.erase(std::find(dep_dpts.begin(), dep_dpts.end(), dep));
+        if (dep->holding_acq) {
+            to->release();
+        }
+        pool.release(dep);
+    }
+    deps.erase(deps.begin() + first, deps.begin() + last);
+}
+
+void service_record::prepare_for_unload() noexcept
+{
+    // Remove all dependencies:
+    auto &pool = services->get_dep_pool();
+    for (service_dep *dep : depends_on.deps) {
+        auto &dep_dpts = dep->get_to()->dependents;
+        dep_dpts.erase(std::find(dep_dpts.begin(), dep_dpts.end(), dep));
+        pool.release(dep);
     }
-    return nullptr;
+    depends_on.deps.clear();
+}
+
+void service_record::mark_changed() noexcept
+{
+    services->mark_changed(this);
 }
 
-service_record * service_set::find_service(const std::string &name) noexcept
+void service_record::state_changed(service_state_t old_state) noexcept
 {
-    return ::find_service(records, name.c_str());
+    services->mark_changed(this);
+    services->notify_state_change(this, old_state);
 }
 
 // Called when a service has actually stopped; dependents have stopped already, unless this stop
@@ -47,6 +208,7 @@ void service_record::stopped() noexcept
         bp_sys::tcsetpgrp(0, bp_sys::getpgrp());
         release_console();
     }
+    release_start_slot();
 
     force_stop = false;
 
@@ -81,7 +243,7 @@ void service_record::stopped() noexcept
         dependency.get_to()->dependent_stopped();
     }
 
-    service_state = service_state_t::STOPPED;
+    set_state(service_state_t::STOPPED);
 
     if (will_restart) {
         // Desired state is "started".
@@ -145,7 +307,7 @@ void service_record::require() noexcept
 void service_record::release(bool issue_stop) noexcept
 {
     if (--required_by == 0) {
-        desired_state = service_state_t::STOPPED;
+        set_target_state(service_state_t::STOPPED);
         prop_require = false;
 
         // Can stop, and can release dependencies now. We don't need to issue a release if
@@ -187,7 +349,7 @@ void service_record::start(bool activate) noexcept
     }
 
     bool was_active = service_state != service_state_t::STOPPED || desired_state != service_state_t::STOPPED;
-    desired_state = service_state_t::STARTED;
+    set_target_state(service_state_t::STARTED);
     
     if (service_state != service_state_t::STOPPED) {
         // We're already starting/started, or we are stopping and need to wait for
@@ -212,8 +374,10 @@ void service_record::start(bool activate) noexcept
 
     start_failed = false;
     start_skipped = false;
-    service_state = service_state_t::STARTING;
+    set_state(service_state_t::STARTING);
     waiting_for_deps = true;
+    start_timeline.reset();
+    start_timeline.record(timeline_event_t::REQUIRED);
 
     if (start_check_dependencies()) {
         services->add_transition_queue(this);
@@ -286,7 +450,7 @@ void service_record::do_start() noexcept
         return;
     }
     
-    service_state = service_state_t::STARTING;
+    set_state(service_state_t::STARTING);
 
     waiting_for_deps = true;
 
@@ -318,6 +482,11 @@ bool service_record::start_check_dependencies() noexcept
                 to->prop_start = true;
                 services->add_prop_queue(to);
             }
+            if (dep.dep_type != dependency_type::MILESTONE && to->dependents_need_not_wait()) {
+                // Only the (already open) activation socket is needed; connections will queue
+                // until the service is ready.
+                continue;
+            }
             dep.waiting_on = true;
             all_deps_started = false;
         }
@@ -339,6 +508,10 @@ bool service_record::check_deps_started() noexcept
 
 void service_record::all_deps_started() noexcept
 {
+    if (! start_timeline.is_recorded(timeline_event_t::DEPS_STARTED)) {
+        start_timeline.record(timeline_event_t::DEPS_STARTED);
+    }
+
     if (onstart_flags.starts_on_console && ! have_console) {
         queue_for_console();
         return;
@@ -351,6 +524,15 @@ void service_record::all_deps_started() noexcept
         return;
     }
 
+    if (! have_start_slot && needs_start_slot()) {
+        if (! services->acquire_start_slot(this)) {
+            waiting_for_start_slot = true;
+            waiting_for_deps = true;
+            return;
+        }
+        have_start_slot = true;
+    }
+
     bool start_success = bring_up();
     restarting = false;
     if (! start_success) {
@@ -376,8 +558,28 @@ void service_record::acquired_console() noexcept
     }
 }
 
+void service_record::acquired_start_slot() noexcept
+{
+    waiting_for_start_slot = false;
+    have_start_slot = true;
+
+    // Continue the start via the transition queue; if we are no longer starting, the slot will be
+    // released when we stop.
+    services->add_transition_queue(this);
+}
+
+void service_record::release_start_slot() noexcept
+{
+    if (have_start_slot) {
+        have_start_slot = false;
+        services->release_start_slot();
+    }
+}
+
 void service_record::started() noexcept
 {
+    release_start_slot();
+
     // If we start on console but don't keep it, release it now:
     if (have_console && ! onstart_flags.runs_on_console) {
         bp_sys::tcsetpgrp(0, bp_sys::getpgrp());
@@ -385,7 +587,8 @@ void service_record::started() noexcept
     }
 
     log_service_started(get_name());
-    service_state = service_state_t::STARTED;
+    start_timeline.record(timeline_event_t::STARTED);
+    set_state(service_state_t::STARTED);
     notify_listeners(service_event_t::STARTED);
 
     if (onstart_flags.rw_ready) {
@@ -414,6 +617,11 @@ void service_record::failed_to_start(bool depfailed, bool immediate_stop) noexce
         services->unqueue_console(this);
         waiting_for_console = false;
     }
+    if (waiting_for_start_slot) {
+        services->unqueue_start_slot(this);
+        waiting_for_start_slot = false;
+    }
+    release_start_slot();
 
     if (start_explicit) {
         start_explicit = false;
@@ -425,10 +633,18 @@ void service_record::failed_to_start(bool depfailed, bool immediate_stop) noexce
         switch (dept->dep_type) {
         case dependency_type::REGULAR:
         case dependency_type::MILESTONE:
-            if (dept->get_from()->service_state == service_state_t::STARTING) {
+            if (dept->get_from()->service_state == service_state_t::STARTING && dept->waiting_on) {
                 dept->get_from()->prop_failure = true;
                 services->add_prop_queue(dept->get_from());
             }
+            else if ((dept->get_from()->service_state == service_state_t::STARTING
+                    || dept->get_from()->service_state == service_state_t::STARTED)
+                    && dept->holding_acq && dept->is_hard()) {
+                // The dependent started (or is starting, possibly with its process already
+                // launched) without waiting for us (see dependents_need_not_wait()); it must now
+                // stop.
+                dept->get_from()->forced_stop();
+            }
             break;
         case dependency_type::WAITS_FOR:
         case dependency_type::SOFT:
@@ -493,7 +709,7 @@ void service_record::stop(bool bring_down) noexcept
         bring_down = true;
     }
 
-    desired_state = service_state_t::STOPPED;
+    set_target_state(service_state_t::STOPPED);
 
     if (bring_down && service_state != service_state_t::STOPPED
     		&& service_state != service_state_t::STOPPING) {
@@ -545,6 +761,10 @@ void service_record::do_stop() noexcept
                 services->unqueue_console(this);
                 waiting_for_console = false;
             }
+            else if (waiting_for_start_slot) {
+                services->unqueue_start_slot(this);
+                waiting_for_start_slot = false;
+            }
 
             // We must have had desired_state == STARTED.
             notify_listeners(service_event_t::STARTCANCELLED);
@@ -561,7 +781,7 @@ void service_record::do_stop() noexcept
 
     if (pinned_started) return;
 
-    service_state = service_state_t::STOPPING;
+    set_state(service_state_t::STOPPING);
     waiting_for_deps = true;
     if (all_deps_stopped) {
         services->add_transition_queue(this);
@@ -624,7 +844,7 @@ void service_record::unpin() noexcept
         for (auto &dep : depends_on) {
             if (dep.is_hard()) {
                 if (dep.get_to()->get_state() != service_state_t::STARTED) {
-                    desired_state = service_state_t::STOPPED;
+                    set_target_state(service_state_t::STOPPED);
                 }
             }
             else if (dep.holding_acq) {
@@ -664,6 +884,78 @@ bool service_record::interrupt_start() noexcept
     return true;
 }
 
+// Find the length of the longest chain of starting services which wait (directly or indirectly) on
+// the given service to start, counting the service itself.
+static unsigned find_start_chain_length(service_record *svc, uint32_t stamp) noexcept
+{
+    if (svc->start_chain_stamp == stamp) {
+        return svc->start_chain_len;
+    }
+
+    svc->start_chain_stamp = stamp;
+    svc->start_chain_len = 1;
+
+    unsigned longest = 0;
+    for (auto dept : svc->get_dependents()) {
+        service_record *from = dept->get_from();
+        if (dept->waiting_on && from->get_state() == service_state_t::STARTING) {
+            unsigned len = find_start_chain_length(from, stamp);
+            if (len > longest) longest = len;
+        }
+    }
+
+    svc->start_chain_len = longest + 1;
+    return svc->start_chain_len;
+}
+
+unsigned service_set::start_chain_length(service_record *svc) noexcept
+{
+    // Chain lengths change as services start, so previously calculated lengths can't be re-used:
+    return find_start_chain_length(svc, ++start_chain_stamp);
+}
+
+void service_set::set_max_starting(unsigned max) noexcept
+{
+    max_starting = max;
+    pull_start_queue();
+}
+
+bool service_set::acquire_start_slot(service_record *service) noexcept
+{
+    if (max_starting == 0 || num_starting < max_starting) {
+        num_starting++;
+        return true;
+    }
+
+    if (! start_queue.is_queued(service)) {
+        start_chain_length(service);
+        start_queue.append(service);
+    }
+    return false;
+}
+
+void service_set::pull_start_queue() noexcept
+{
+    while (! start_queue.is_empty() && (max_starting == 0 || num_starting < max_starting)) {
+        // Choose the service with highest priority, and then longest chain; the queue is in order of
+        // arrival so the earliest arrival is chosen if there are several equal candidates.
+        service_record *first = start_queue.front();
+        service_record *best = first;
+        for (service_record *svc = first->start_queue_node.next; svc != first;
+                svc = svc->start_queue_node.next) {
+            if (svc->get_start_priority() > best->get_start_priority()
+                    || (svc->get_start_priority() == best->get_start_priority()
+                        && svc->start_chain_len > best->start_chain_len)) {
+                best = svc;
+            }
+        }
+
+        start_queue.unlink(best);
+        num_starting++;
+        best->acquired_start_slot();
+    }
+}
+
 void service_set::service_active(service_record *sr) noexcept
 {
     active_services++;
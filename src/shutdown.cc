@@ -4,7 +4,10 @@
 #include <cstring>
 #include <string>
 #include <iostream>
+#include <fstream>
 #include <exception>
+#include <vector>
+#include <list>
 
 #include <sys/reboot.h>
 #include <sys/types.h>
@@ -15,11 +18,17 @@
 #include <unistd.h>
 #include <fcntl.h>
 
+#ifdef __linux__
+#include <sys/mount.h>
+#include <sys/swap.h>
+#endif
+
 #include "cpbuffer.h"
 #include "control-cmds.h"
 #include "service-constants.h"
 #include "dinit-client.h"
 #include "dinit-util.h"
+#include "mount-table.h"
 #include "mconfig.h"
 
 #include "dasynq.h"
@@ -41,6 +50,9 @@ static void swap_off(loop_t &loop, subproc_buffer &sub_buf);
 
 constexpr static int subproc_bufsize = 4096;
 
+// Maximum number of concurrent processes used to unmount filesystems
+constexpr static int max_unmount_procs = 16;
+
 constexpr static char output_lost_msg[] = "[Some output has not been shown due to buffer overflow]\n";
 
 // A buffer which maintains a series of overflow markers, used for capturing and echoing
@@ -592,8 +604,189 @@ static void run_process(const char * prog_args[], loop_t &loop, subproc_buffer &
     }
 }
 
+#ifdef __linux__
+
+// Write a message directly to standard output (the console); used from unmount sub-processes,
+// which cannot use the subprocess buffer.
+static void write_msg(const std::string &msg)
+{
+    write(STDOUT_FILENO, msg.data(), msg.length());
+}
+
+// Result of unmounting a single filesystem
+enum class umount_result
+{
+    UNMOUNTED,
+    REMOUNTED_RO,
+    FAILED
+};
+
+// Unmount the filesystem mounted at the given path, or if that fails, remount it read-only
+// (as per "umount -r").
+static umount_result unmount_one(const char *path)
+{
+    if (umount(path) == 0) {
+        return umount_result::UNMOUNTED;
+    }
+
+    int umount_errno = errno;
+    if (umount_errno == EINVAL || umount_errno == ENOENT) {
+        // Not (or no longer) a mount point
+        return umount_result::UNMOUNTED;
+    }
+
+    if (mount(nullptr, path, nullptr, MS_REMOUNT | MS_RDONLY, nullptr) == 0) {
+        write_msg(std::string(path) + ": " + strerror(umount_errno) + "; remounted read-only\n");
+        return umount_result::REMOUNTED_RO;
+    }
+
+    int remount_errno = errno;
+    write_msg(std::string("Couldn't unmount ") + path + ": " + strerror(umount_errno)
+            + "; remount read-only failed: " + strerror(remount_errno) + "\n");
+    return umount_result::FAILED;
+}
+
+// Unmount all filesystems natively. A filesystem is unmounted once all filesystems mounted
+// beneath it have been, with independent filesystems being unmounted concurrently by
+// sub-processes (since unmounting may block while data is written out). Filesystems which
+// cannot be unmounted are remounted read-only. Returns false if the mount tree could not be
+// read or a filesystem could be neither unmounted nor remounted read-only.
+//   may throw: std::bad_alloc
+static bool unmount_disks_native(loop_t &loop, subproc_buffer &sub_buf)
+{
+    class umount_watcher : public loop_t::child_proc_watcher_impl<umount_watcher>
+    {
+        public:
+        int node;
+        bool terminated = false;
+        int status = 0;
+
+        umount_watcher(int node_p) : node(node_p) {}
+
+        rearm status_change(loop_t &, pid_t child, int status_p)
+        {
+            terminated = true;
+            status = status_p;
+            return rearm::REMOVE;
+        }
+    };
+
+    std::vector<mount_node> nodes;
+    std::ifstream mountinfo("/proc/self/mountinfo");
+    if (! mountinfo || ! read_mount_tree(mountinfo, nodes)) {
+        sub_buf.append("Couldn't read mount table\n");
+        return false;
+    }
+
+    unmount_order order(nodes);
+    bool all_ok = true;
+    std::list<umount_watcher> active;
+
+    auto complete = [&](int node, umount_result result) {
+        if (result == umount_result::FAILED) {
+            all_ok = false;
+        }
+        order.complete(node);
+    };
+
+    // Give any buffered output a chance to go out before sub-processes begin writing
+    loop.poll();
+
+    while (order.has_ready() || ! active.empty()) {
+        while (order.has_ready() && active.size() < (size_t)max_unmount_procs) {
+            int node = order.take_ready();
+
+            // Some virtual filesystems are left mounted, as with "umount -a"
+            if (is_unmount_exempt(nodes[node].fs_type)) {
+                complete(node, umount_result::UNMOUNTED);
+                continue;
+            }
+
+            const char *path = nodes[node].mount_point.c_str();
+            active.emplace_back(node);
+            pid_t ch_pid;
+            try {
+                ch_pid = active.back().fork(loop);
+            }
+            catch (std::exception &e) {
+                // Couldn't fork; unmount synchronously instead
+                active.pop_back();
+                complete(node, unmount_one(path));
+                continue;
+            }
+
+            if (ch_pid == 0) {
+                // child
+                _exit((int)unmount_one(path));
+            }
+        }
+
+        if (active.empty()) continue;
+
+        loop.run();
+
+        for (auto i = active.begin(); i != active.end(); ) {
+            if (i->terminated) {
+                umount_result result = umount_result::FAILED;
+                if (WIFEXITED(i->status) && WEXITSTATUS(i->status) <= (int)umount_result::FAILED) {
+                    result = (umount_result)WEXITSTATUS(i->status);
+                }
+                complete(i->node, result);
+                i = active.erase(i);
+            }
+            else {
+                ++i;
+            }
+        }
+    }
+
+    return all_ok;
+}
+
+// Turn off all swap devices/files listed in /proc/swaps. Returns false if the list could not
+// be read or any could not be turned off.
+//   may throw: std::bad_alloc
+static bool swap_off_native(subproc_buffer &sub_buf)
+{
+    std::vector<std::string> paths;
+    std::ifstream swaps("/proc/swaps");
+    if (! swaps || ! read_swap_list(swaps, paths)) {
+        sub_buf.append("Couldn't read swap list\n");
+        return false;
+    }
+
+    bool all_ok = true;
+
+    for (const std::string &path : paths) {
+        if (swapoff(path.c_str()) == -1) {
+            sub_buf.append("Couldn't turn off swap on ");
+            sub_buf.append(path.c_str());
+            sub_buf.append(": ");
+            sub_buf.append(strerror(errno));
+            sub_buf.append("\n");
+            all_ok = false;
+        }
+    }
+
+    return all_ok;
+}
+
+#endif
+
 static void unmount_disks(loop_t &loop, subproc_buffer &sub_buf)
 {
+#ifdef __linux__
+    try {
+        if (unmount_disks_native(loop, sub_buf)) {
+            return;
+        }
+    }
+    catch (std::bad_alloc &e) {
+        sub_buf.append("Out of memory while unmounting\n");
+    }
+    sub_buf.append("Retrying with umount...\n");
+#endif
+
     try {
         const char * unmount_args[] = { "/bin/umount", "-a", "-r", nullptr };
         run_process(unmount_args, loop, sub_buf);
@@ -607,6 +800,18 @@ static void unmount_disks(loop_t &loop, subproc_buffer &sub_buf)
 
 static void swap_off(loop_t &loop, subproc_buffer &sub_buf)
 {
+#ifdef __linux__
+    try {
+        if (swap_off_native(sub_buf)) {
+            return;
+        }
+    }
+    catch (std::bad_alloc &e) {
+        sub_buf.append("Out of memory while turning off swap\n");
+    }
+    sub_buf.append("Retrying with swapoff...\n");
+#endif
+
     try {
         const char * swapoff_args[] = { "/sbin/swapoff", "-a", nullptr };
         run_process(swapoff_args, loop, sub_buf);
@@ -0,0 +1,52 @@
+#ifndef DINIT_BENCH_H_INCLUDED
+#define DINIT_BENCH_H_INCLUDED
+
+#include <iostream>
+#include <chrono>
+
+// Common support for the (micro) benchmarks. Each benchmark is a function which performs some
+// operation repeatedly, timing it with a stopwatch, and prints its results; RUN_BENCH runs it under
+// a heading.
+
+// Measurement of elapsed (wall clock) time
+class stopwatch
+{
+    std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+
+    public:
+    void restart()
+    {
+        start_time = std::chrono::steady_clock::now();
+    }
+
+    double elapsed_secs() const
+    {
+        std::chrono::duration<double> secs = std::chrono::steady_clock::now() - start_time;
+        return secs.count();
+    }
+};
+
+// Print the rate at which some number of operations were performed in the given time
+inline void report_rate(const char *what, double count, double secs, const char *unit)
+{
+    std::cout << "    " << what << ": " << (unsigned long)(count / secs) << " " << unit << "/sec\n";
+}
+
+// Print the mean time taken per operation, in the given time
+inline void report_per_op(const char *what, double count, double secs)
+{
+    double ns = secs * 1e9 / count;
+    std::cout << "    " << what << ": ";
+    if (ns >= 10000) {
+        std::cout << (unsigned long)(ns / 1000) << " us/op\n";
+    }
+    else {
+        std::cout << (unsigned long)ns << " ns/op\n";
+    }
+}
+
+#define RUN_BENCH(name) \
+    std::cout << #name ":" << std::endl; \
+    name();
+
+#endif
@@ -0,0 +1,191 @@
+#ifndef DINIT_CONTROL_OUTBUF_H
+#define DINIT_CONTROL_OUTBUF_H
+
+#include <vector>
+#include <initializer_list>
+#include <algorithm>
+#include <cstring>
+#include <cstddef>
+
+#include <sys/uio.h>
+
+// Output buffer for a control connection.
+//
+// Packets are copied into a sequence of fixed-size chunks, one after the other, so that queueing a
+// packet does not normally require any allocation, and the buffered data (which may span several
+// chunks) can be written out with a single writev() call. A chunk which has been completely
+// written is kept for re-use (one such chunk is retained; any others are freed).
+//
+// Data is appended in whole units (packets): an append either succeeds entirely or (if allocation
+// fails) leaves the buffer unchanged. The buffer therefore only ever contains complete packets,
+// apart from the first, which may have been partially written.
+class control_outbuf
+{
+    public:
+    static constexpr size_t chunk_size = 4096;
+
+    // Maximum number of iovec entries produced by get_iov()
+    static constexpr int max_iov = 16;
+
+    // A part of a packet to append
+    struct part
+    {
+        const char *data;
+        size_t len;
+    };
+
+    private:
+    std::vector<char *> chunks;  // chunks holding data, in order
+    char *spare = nullptr;       // a free chunk, kept for re-use
+    size_t head = 0;             // offset of first unwritten byte in first chunk
+    size_t tail = chunk_size;    // offset of end of data in last chunk (chunk_size if no chunks)
+    size_t length = 0;           // total length of buffered data
+
+    char *alloc_chunk()
+    {
+        if (spare != nullptr) {
+            char *c = spare;
+            spare = nullptr;
+            return c;
+        }
+        return new char[chunk_size];
+    }
+
+    void release_chunk(char *c) noexcept
+    {
+        if (spare == nullptr) {
+            spare = c;
+        }
+        else {
+            delete[] c;
+        }
+    }
+
+    public:
+    control_outbuf() noexcept
+    {
+    }
+
+    control_outbuf(const control_outbuf &) = delete;
+    void operator=(const control_outbuf &) = delete;
+
+    ~control_outbuf()
+    {
+        for (char *c : chunks) {
+            delete[] c;
+        }
+        delete[] spare;
+    }
+
+    bool empty() const noexcept
+    {
+        return length == 0;
+    }
+
+    size_t size() const noexcept
+    {
+        return length;
+    }
+
+    // Append a packet, consisting of the given parts. Throws std::bad_alloc (leaving the buffer
+    // unchanged) if memory cannot be allocated.
+    void append(std::initializer_list<part> parts)
+    {
+        size_t total = 0;
+        for (auto &p : parts) {
+            total += p.len;
+        }
+        if (total == 0) return;
+
+        // Allocate any additional chunks needed, before copying anything:
+        size_t orig_chunks = chunks.size();
+        size_t avail = chunk_size - tail;
+        if (total > avail) {
+            size_t needed = (total - avail + chunk_size - 1) / chunk_size;
+            chunks.reserve(orig_chunks + needed);
+            try {
+                for (size_t i = 0; i < needed; i++) {
+                    chunks.push_back(alloc_chunk());
+                }
+            }
+            catch (...) {
+                while (chunks.size() > orig_chunks) {
+                    release_chunk(chunks.back());
+                    chunks.pop_back();
+                }
+                throw;
+            }
+        }
+
+        size_t ci = orig_chunks - 1;
+        if (orig_chunks == 0) {
+            ci = 0;
+            tail = 0;
+        }
+
+        for (auto &p : parts) {
+            const char *data = p.data;
+            size_t len = p.len;
+            while (len > 0) {
+                if (tail == chunk_size) {
+                    ++ci;
+                    tail = 0;
+                }
+                size_t n = std::min(len, chunk_size - tail);
+                memcpy(chunks[ci] + tail, data, n);
+                tail += n;
+                data += n;
+                len -= n;
+            }
+        }
+
+        length += total;
+    }
+
+    void append(const char *data, size_t len)
+    {
+        append({{data, len}});
+    }
+
+    // Fill in (up to max) iovec entries describing the buffered data, for writev(). Returns the
+    // number of entries filled.
+    int get_iov(struct iovec *iov, int max) const noexcept
+    {
+        int n = 0;
+        size_t last = chunks.size() - 1;
+        for (size_t i = 0; i < chunks.size() && n < max; i++) {
+            size_t start = (i == 0) ? head : 0;
+            size_t end = (i == last) ? tail : chunk_size;
+            if (end > start) {
+                iov[n].iov_base = chunks[i] + start;
+                iov[n].iov_len = end - start;
+                n++;
+            }
+        }
+        return n;
+    }
+
+    // Remove n bytes (which have been written) from the front of the buffer.
+    void consume(size_t n) noexcept
+    {
+        length -= n;
+        while (n > 0) {
+            size_t first_end = (chunks.size() == 1) ? tail : chunk_size;
+            size_t in_first = first_end - head;
+            if (n < in_first) {
+                head += n;
+                return;
+            }
+            n -= in_first;
+            release_chunk(chunks.front());
+            chunks.erase(chunks.begin());
+            head = 0;
+        }
+
+        if (chunks.empty()) {
+            tail = chunk_size;
+        }
+    }
+};
+
+#endif
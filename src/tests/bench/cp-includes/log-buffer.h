@@ -0,0 +1,146 @@
+#ifndef DINIT_LOG_BUFFER_H
+#define DINIT_LOG_BUFFER_H
+
+#include <new>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+
+#include "baseproc-sys.h"
+
+// Buffer for the output of a service process (for a service with log-type = buffer).
+//
+// This is a circular buffer, much like cpbuffer, except that its capacity is determined at run time
+// and its storage is allocated only once it is first needed. When the buffer is full, newly read data
+// overwrites the oldest data, so that the buffer always holds the most recent output.
+//
+// Each byte of output has a position in the output stream, counting from 0 for the first byte read
+// into the buffer; positions are not reset when data is overwritten or discarded, so that a reader
+// can resume reading from where it left off (and can tell if any data was lost meanwhile).
+class service_log_buffer
+{
+    char *buf = nullptr;
+    unsigned capacity;
+    unsigned cur_idx = 0;  // index of the oldest byte in the buffer
+    unsigned length = 0;   // number of bytes in the buffer
+    uint64_t end_pos = 0;  // stream position following the most recent byte
+
+    public:
+    explicit service_log_buffer(unsigned capacity_p) noexcept : capacity(capacity_p)
+    {
+    }
+
+    service_log_buffer(const service_log_buffer &) = delete;
+    void operator=(const service_log_buffer &) = delete;
+
+    ~service_log_buffer()
+    {
+        delete[] buf;
+    }
+
+    unsigned get_capacity() const noexcept
+    {
+        return capacity;
+    }
+
+    unsigned get_length() const noexcept
+    {
+        return length;
+    }
+
+    // Stream position of the oldest byte in the buffer
+    uint64_t get_start_pos() const noexcept
+    {
+        return end_pos - length;
+    }
+
+    // Stream position following the most recent byte in the buffer
+    uint64_t get_end_pos() const noexcept
+    {
+        return end_pos;
+    }
+
+    // Change the capacity of the buffer, retaining as much of the most recent data as fits. Returns
+    // false (leaving the buffer unchanged) if new storage could not be allocated.
+    bool set_capacity(unsigned new_capacity) noexcept
+    {
+        if (new_capacity == capacity) return true;
+        if (buf == nullptr) {
+            capacity = new_capacity;
+            return true;
+        }
+
+        char *new_buf = new(std::nothrow) char[new_capacity];
+        if (new_buf == nullptr) return false;
+
+        unsigned new_length = (length < new_capacity) ? length : new_capacity;
+        extract(new_buf, end_pos - new_length, new_length);
+        delete[] buf;
+        buf = new_buf;
+        capacity = new_capacity;
+        cur_idx = 0;
+        length = new_length;
+        return true;
+    }
+
+    // Fill by reading from the given fd, overwriting the oldest data if the buffer is full. Returns
+    // the number of bytes read (positive), 0 on end-of-file, or -1 on error (with errno set; ENOMEM
+    // if the buffer storage could not be allocated).
+    int fill(int fd) noexcept
+    {
+        if (buf == nullptr) {
+            buf = new(std::nothrow) char[capacity];
+            if (buf == nullptr) {
+                errno = ENOMEM;
+                return -1;
+            }
+        }
+
+        unsigned pos = cur_idx + length;
+        if (pos >= capacity) pos -= capacity;
+        ssize_t r = bp_sys::read(fd, buf + pos, capacity - pos);
+        if (r > 0) {
+            end_pos += r;
+            if (length + r >= capacity) {
+                // The buffer is full; the oldest byte follows the most recent one.
+                length = capacity;
+                cur_idx = pos + r;
+                if (cur_idx == capacity) cur_idx = 0;
+            }
+            else {
+                length += r;
+            }
+        }
+        return r;
+    }
+
+    // Extract bytes from the buffer, starting at the given stream position (which must be within the
+    // buffer). The bytes remain in the buffer.
+    void extract(void *dest, uint64_t from_pos, unsigned len) const noexcept
+    {
+        if (len == 0) return;
+        unsigned index = cur_idx + unsigned(from_pos - get_start_pos());
+        if (index >= capacity) index -= capacity;
+        if (index + len > capacity) {
+            // wrap-around copy
+            unsigned half = capacity - index;
+            std::memcpy(dest, buf + index, half);
+            std::memcpy(static_cast<char *>(dest) + half, buf, len - half);
+        }
+        else {
+            std::memcpy(dest, buf + index, len);
+        }
+    }
+
+    // Discard the contents of the buffer preceding the given stream position.
+    void discard_to(uint64_t pos) noexcept
+    {
+        if (pos <= get_start_pos()) return;
+        unsigned amount = (pos >= end_pos) ? length : unsigned(pos - get_start_pos());
+        cur_idx += amount;
+        if (cur_idx >= capacity) cur_idx -= capacity;
+        length -= amount;
+    }
+};
+
+#endif
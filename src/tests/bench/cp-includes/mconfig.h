@@ -0,0 +1,12 @@
+// This file is auto-generated by mconfig-gen.cc.
+#ifndef DINIT_MCONFIG_H
+#define DINIT_MCONFIG_H 1
+
+// Defines
+
+// Constants
+constexpr static char SYSCONTROLSOCKET[] = "/dev/dinitctl";
+constexpr static char SBINDIR[] = "/sbin";
+constexpr static char SHUTDOWN_PREFIX[] = "";
+
+#endif
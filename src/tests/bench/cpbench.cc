@@ -0,0 +1,81 @@
+#include <string>
+#include <vector>
+#include <cassert>
+
+#include "dinit.h"
+#include "service.h"
+#include "control.h"
+#include "baseproc-sys.h"
+
+#include "bench.h"
+
+// Benchmarks for the control protocol. As for the control protocol tests, connections are driven
+// through the mock event loop and system interface.
+
+extern eventloop_t event_loop;
+
+static void append_find_cmd(std::vector<char> &buf, const std::string &name)
+{
+    buf.push_back(DINIT_CP_FINDSERVICE);
+    uint16_t name_len = name.length();
+    char *name_len_cptr = reinterpret_cast<char *>(&name_len);
+    buf.insert(buf.end(), name_len_cptr, name_len_cptr + sizeof(name_len));
+    buf.insert(buf.end(), name.begin(), name.end());
+}
+
+// Throughput of pipelined requests (FINDSERVICE), received in bulk.
+void bench_pipelined()
+{
+    service_set sset;
+
+    constexpr int num_services = 100;
+    for (int i = 0; i < num_services; i++) {
+        std::string name = "test-service-" + std::to_string(i);
+        sset.add_service(new service_record(&sset, name, service_type_t::INTERNAL, {}));
+    }
+
+    constexpr int rounds = 200;
+    constexpr int reply_size = 3 + sizeof(control_conn_t::handle_t);
+    std::vector<char> cmd;
+    for (int i = 0; i < num_services; i++) {
+        append_find_cmd(cmd, "test-service-" + std::to_string(i));
+    }
+
+    size_t total_replies = 0;
+    size_t wakeups = 0;
+    std::vector<char> wdata;
+
+    stopwatch time;
+    for (int r = 0; r < rounds; r++) {
+        // (A new connection for each round, so that the handle map doesn't grow indefinitely)
+        int fd = bp_sys::allocfd();
+        auto *cc = new control_conn_t(event_loop, &sset, fd);
+        bp_sys::supply_read_data(fd, cmd);
+        bp_sys::set_blocking(fd);
+        size_t replies = 0;
+        while (replies < num_services) {
+            event_loop.regd_bidi_watchers[fd]->read_ready(event_loop, fd);
+            wakeups++;
+            bp_sys::extract_written_data(fd, wdata);
+            replies += wdata.size() / reply_size;
+        }
+        total_replies += replies;
+        delete cc;
+    }
+    double secs = time.elapsed_secs();
+
+    assert(total_replies == (size_t)num_services * rounds);
+    // Many requests should be processed per wakeup:
+    assert(wakeups * 10 < total_replies);
+
+    std::cout << "    " << total_replies << " requests in " << wakeups << " wakeups\n";
+    report_rate("pipelined", total_replies, secs, "requests");
+}
+
+int main(int argc, char **argv)
+{
+    bp_sys::init_bpsys();
+
+    RUN_BENCH(bench_pipelined);
+    return 0;
+}
@@ -0,0 +1,176 @@
+// Dinit control command packet types
+
+// Requests:
+
+// Query protocol version:
+constexpr static int DINIT_CP_QUERYVERSION = 0;
+
+// Find (but don't load) a service:
+constexpr static int DINIT_CP_FINDSERVICE = 1;
+
+// Find or load a service:
+constexpr static int DINIT_CP_LOADSERVICE = 2;
+
+// Start or stop a service:
+constexpr static int DINIT_CP_STARTSERVICE = 3;
+constexpr static int DINIT_CP_STOPSERVICE  = 4;
+constexpr static int DINIT_CP_WAKESERVICE = 5;
+constexpr static int DINIT_CP_RELEASESERVICE = 6;
+
+constexpr static int DINIT_CP_UNPINSERVICE = 7;
+
+// List services:
+constexpr static int DINIT_CP_LISTSERVICES = 8;
+
+// Unload a service:
+constexpr static int DINIT_CP_UNLOADSERVICE = 9;
+
+// Shutdown:
+constexpr static int DINIT_CP_SHUTDOWN = 10;
+ // followed by 1-byte shutdown type
+
+// Add/remove dependency to existing service:
+constexpr static int DINIT_CP_ADD_DEP = 11;
+constexpr static int DINIT_CP_REM_DEP = 12;
+
+// Query service load path / mechanism:
+constexpr static int DINIT_CP_QUERY_LOAD_MECH = 13;
+
+// Add a waits for dependency from one service to another, and start the dependency:
+constexpr static int DINIT_CP_ENABLESERVICE = 14;
+
+// Find the name of a service (from a handle)
+constexpr static int DINIT_CP_QUERYSERVICENAME = 15;
+
+// Reload a service:
+constexpr static int DINIT_CP_RELOADSERVICE = 16;
+
+// Find or load, and then start or stop, a batch of services (by name):
+constexpr static int DINIT_CP_BATCHSTARTSTOP = 17;
+
+// List services which have changed since a given state generation:
+constexpr static int DINIT_CP_LISTSERVICESSINCE = 18;
+
+// Subscribe to (or unsubscribe from) state changes of all services:
+constexpr static int DINIT_CP_SUBSCRIBEALL = 19;
+ // followed by 1-byte: 1 = subscribe, 0 = unsubscribe
+
+// Query the start timeline of all services (for boot analysis):
+constexpr static int DINIT_CP_QUERYTIMELINE = 20;
+
+// Read the buffered output of a service (with log-type = buffer):
+constexpr static int DINIT_CP_CATLOG = 21;
+ // followed by 1-byte flags (1 = discard the returned output from the buffer, 2 = if no output is
+ // available from the given position, wait until there is), 4-byte service handle, and uint64_t
+ // stream position from which to read
+
+// Query event loop statistics (only available if dinit was built with DASYNQ_INSTRUMENT):
+constexpr static int DINIT_CP_QUERYLOOPSTATS = 22;
+ // followed by 1-byte flags (1 = reset the statistics after returning them)
+
+// Query the status text of a service, as reported via the notification socket (STATUS=...):
+constexpr static int DINIT_CP_QUERYSTATUSTEXT = 23;
+ // followed by 4-byte service handle
+
+// Replies:
+
+// Reply: ACK/NAK to request
+constexpr static int DINIT_RP_ACK = 50;
+constexpr static int DINIT_RP_NAK = 51;
+
+// Request was bad (connection will be closed)
+constexpr static int DINIT_RP_BADREQ = 52;
+
+// Connection being closed due to out-of-memory condition
+constexpr static int DINIT_RP_OOM = 53;
+
+// Start service replies:
+constexpr static int DINIT_RP_SERVICELOADERR = 54;
+constexpr static int DINIT_RP_SERVICEOOM = 55; // couldn't start due to out-of-memory
+
+constexpr static int DINIT_RP_SSISSUED = 56;  // service start/stop was issued (includes 4-byte service handle)
+constexpr static int DINIT_RP_SSREDUNDANT = 57;  // service was already started/stopped (or for stop, not loaded)
+
+// Query version response:
+constexpr static int DINIT_RP_CPVERSION = 58;
+
+// Service record loaded/found
+constexpr static int DINIT_RP_SERVICERECORD = 59;
+//     followed by 4-byte service handle, 1-byte service state
+
+// Couldn't find/load service
+constexpr static int DINIT_RP_NOSERVICE = 60;
+
+// Service is already started/stopped
+constexpr static int DINIT_RP_ALREADYSS = 61;
+
+// Information on a service / list complete:
+constexpr static int DINIT_RP_SVCINFO = 62;
+constexpr static int DINIT_RP_LISTDONE = 63;
+
+// Service loader information:
+constexpr static int DINIT_RP_LOADER_MECH = 64;
+
+// Dependent services prevent stopping/restarting. Includes size_t count, handle_t * N handles.
+constexpr static int DINIT_RP_DEPENDENTS = 65;
+
+// Service name:
+constexpr static int DINIT_RP_SERVICENAME = 66;
+
+// Result of batch start/stop. Includes uint16_t count, and for each service: 1-byte result,
+// handle_t handle, 1-byte service state.
+constexpr static int DINIT_RP_BATCHRESULT = 67;
+
+// Start of incremental service list. Includes 1-byte flags (1 = full list: the client should
+// discard any previous list) and uint64_t current state generation.
+constexpr static int DINIT_RP_LISTGENERATION = 68;
+
+// Start of service timeline list. Includes uint32_t number of services and uint64_t current time
+// (monotonic clock, nanoseconds). Followed by SVCTIMELINE for each service, then LISTDONE.
+constexpr static int DINIT_RP_TIMELINE = 69;
+
+// Timeline of a service: 1-byte service state, uint16_t name length, uint32_t number of
+// dependencies, uint64_t time (monotonic clock, nanoseconds; 0 if not recorded) of each timeline
+// event (see timeline_event_t), the service name, and for each dependency: uint32_t index (in the
+// list) of the dependency service and 1-byte dependency type.
+constexpr static int DINIT_RP_SVCTIMELINE = 70;
+
+// Service output (reply to CATLOG): 1-byte reserved, uint64_t stream position of the returned output,
+// uint64_t stream position following the most recent output in the buffer, uint32_t length, and the
+// output itself. If the returned output begins at a later position than was requested, output has
+// been lost (overwritten or discarded) in between.
+constexpr static int DINIT_RP_SERVICELOG = 71;
+
+// Event loop statistics (reply to QUERYLOOPSTATS): 1-byte number of watcher categories (N), 1-byte
+// number of histogram buckets (B), followed by 1 + 2 * N histograms: the event batch size, then the
+// dispatch latency for each category, then the callback time for each category (times in
+// nanoseconds). Each histogram is: uint64_t count, uint64_t total, uint64_t max, and B * uint64_t
+// bucket counts (see dasynq::stats_histogram). The categories are as given by the DINIT_LS_*
+// constants below; a category number beyond those is not (currently) used.
+constexpr static int DINIT_RP_LOOPSTATS = 72;
+
+// Service status text (reply to QUERYSTATUSTEXT): 1-byte reserved, uint32_t length, and the text
+// (empty if the service has not reported any).
+constexpr static int DINIT_RP_STATUSTEXT = 73;
+
+// Information:
+
+// Service event occurred (4-byte service handle, 1 byte event code)
+constexpr static int DINIT_IP_SERVICEEVENT = 100;
+
+// Service identifier (for service state change subscription): 4-byte service id, followed by
+// the service name. Sent before the first state change for a service.
+constexpr static int DINIT_IP_SERVICENAMEID = 101;
+
+// Service state change (for service state change subscription): 4-byte service id, 1-byte old
+// state, 1-byte new state, 1-byte flags (1 = coalesced: intermediate states were not reported),
+// pid_t process id, 8-byte timestamp (monotonic clock, nanoseconds).
+constexpr static int DINIT_IP_SERVICESTATE = 102;
+
+// Event loop statistics categories (see DINIT_RP_LOOPSTATS):
+constexpr static int DINIT_LS_SIGNAL = 0;   // signal watchers
+constexpr static int DINIT_LS_FD = 1;       // other file descriptor watchers
+constexpr static int DINIT_LS_CHILD = 2;    // child process watchers
+constexpr static int DINIT_LS_TIMER = 3;    // timers
+constexpr static int DINIT_LS_CONTROL = 4;  // control socket and connections
+constexpr static int DINIT_LS_LOG = 5;      // log output (dinit's and services')
@@ -0,0 +1,149 @@
+#ifndef DINIT_CONTROL_HANDLES_H
+#define DINIT_CONTROL_HANDLES_H
+
+#include <vector>
+#include <unordered_map>
+#include <new>
+#include <cstdint>
+
+class service_record;
+
+// Table of service handles for a control connection.
+//
+// Handles are allocated from a dense table of slots, with free slots kept in a free list, so that
+// both allocation and lookup are O(1). A handle value encodes the slot index (low bits) together
+// with a generation count (high bits); the generation count for a slot is incremented each time the
+// slot is freed, so that a stale handle (for an unloaded service, say) is not mistaken for a handle
+// to whichever service is subsequently allocated the same slot.
+//
+// The handles for each service are linked together (through the slots) in a list, the head of which
+// is found via a map keyed by service record; this allows finding all handles for a service (to
+// issue service event notifications, or to release them) without searching the table.
+class control_handle_table
+{
+    public:
+    using handle_t = uint32_t;
+
+    static constexpr unsigned index_bits = 20;
+    static constexpr handle_t index_mask = (handle_t(1) << index_bits) - 1;
+
+    // The maximum number of handles in the table (at one time).
+    static constexpr uint32_t max_handles = index_mask;
+
+    private:
+    static constexpr uint32_t none = uint32_t(-1);
+
+    struct slot
+    {
+        service_record *service;  // nullptr if slot is free
+        uint32_t generation;
+        uint32_t next;            // next free slot (if free) or next slot for same service (if not)
+    };
+
+    std::vector<slot> slots;
+    uint32_t free_head = none;
+
+    // Map of service to first slot in its handle list
+    std::unordered_map<service_record *, uint32_t> service_heads;
+
+    static handle_t make_handle(uint32_t index, uint32_t generation) noexcept
+    {
+        return index | (generation << index_bits);
+    }
+
+    public:
+    // Allocate a new handle for a service. Sets first_for_service to true if the service had no
+    // other handles.
+    // Throws:  std::bad_alloc (table unchanged) if the handle could not be allocated.
+    handle_t allocate(service_record *service, bool &first_for_service)
+    {
+        auto head_it = service_heads.find(service);
+        first_for_service = (head_it == service_heads.end());
+        if (first_for_service) {
+            head_it = service_heads.emplace(service, uint32_t(none)).first;
+        }
+
+        uint32_t index = free_head;
+        if (index == none) {
+            index = slots.size();
+            try {
+                if (index == max_handles) throw std::bad_alloc();
+                slots.push_back(slot {nullptr, 0, none});
+            }
+            catch (...) {
+                if (first_for_service) {
+                    service_heads.erase(head_it);
+                }
+                throw;
+            }
+        }
+        else {
+            free_head = slots[index].next;
+        }
+
+        slot &s = slots[index];
+        s.service = service;
+        s.next = head_it->second;
+        head_it->second = index;
+        return make_handle(index, s.generation);
+    }
+
+    // Find the service corresponding to a handle; returns nullptr if the handle is not valid.
+    service_record *find(handle_t handle) const noexcept
+    {
+        uint32_t index = handle & index_mask;
+        if (index >= slots.size()) return nullptr;
+        const slot &s = slots[index];
+        if (s.generation != (handle >> index_bits)) return nullptr;
+        return s.service;
+    }
+
+    // Find an existing handle for a service. Returns false if the service has no handle.
+    bool find_handle(service_record *service, handle_t &handle) const noexcept
+    {
+        auto head_it = service_heads.find(service);
+        if (head_it == service_heads.end()) return false;
+        uint32_t index = head_it->second;
+        handle = make_handle(index, slots[index].generation);
+        return true;
+    }
+
+    // Call the given function for each handle for a service.
+    template <typename F> void for_each_handle(service_record *service, F f) const
+    {
+        auto head_it = service_heads.find(service);
+        if (head_it == service_heads.end()) return;
+        for (uint32_t index = head_it->second; index != none; index = slots[index].next) {
+            f(make_handle(index, slots[index].generation));
+        }
+    }
+
+    // Call the given function for each service which has at least one handle.
+    template <typename F> void for_each_service(F f) const
+    {
+        for (auto &entry : service_heads) {
+            f(entry.first);
+        }
+    }
+
+    // Release all handles for a service. Returns true if the service had any handles.
+    bool release_all(service_record *service) noexcept
+    {
+        auto head_it = service_heads.find(service);
+        if (head_it == service_heads.end()) return false;
+        uint32_t index = head_it->second;
+        while (index != none) {
+            slot &s = slots[index];
+            uint32_t next = s.next;
+            s.service = nullptr;
+            s.generation = (s.generation + 1) & (handle_t(-1) >> index_bits);
+            s.next = free_head;
+            free_head = index;
+            index = next;
+        }
+        service_heads.erase(head_it);
+        return true;
+    }
+};
+
+#endif
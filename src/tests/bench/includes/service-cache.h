@@ -0,0 +1,711 @@
+#ifndef DINIT_SERVICE_CACHE_H_INCLUDED
+#define DINIT_SERVICE_CACHE_H_INCLUDED 1
+
+#include <string>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <utility>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "dinit-util.h"
+#include "load-service.h"
+
+// Compiled service description cache.
+//
+// A service directory may contain a cache file (named ".dinit-cache") holding the already-parsed
+// settings of service descriptions in that directory, as produced by "dinitcheck --update-cache".
+// When loading a service, an entry from the cache may be used instead of reading and parsing the
+// service description. An entry is only used if it is still valid: the description file (and any
+// dependency directory it names) must have the same inode number, size and modification time as
+// when the cache was built. Since the cache holds resolved user and group ids, the whole cache is
+// disregarded if /etc/passwd or /etc/group has been modified since it was built. (Changes to other
+// user/group database sources are not detected; rebuild the cache after making such changes).
+//
+// The cache is written in host byte order. It consists of a header:
+//     magic (8 bytes), format version (u32), size of uid_t/gid_t/rlim_t (3 x u8, 1 pad byte),
+//     stamps of /etc/passwd and /etc/group, number of entries (u32)
+// followed by the entries, each of which is:
+//     entry length (u32, not including this field), service name, description file stamp,
+//     number of dependency directories (u32), followed by path and stamp for each,
+//     encoded settings (see write_cached_settings()).
+// Strings are encoded as a length (u32) followed by the characters (not nul-terminated). A stamp
+// is the inode number, size, modification time seconds and nanoseconds (4 x 64 bits).
+
+namespace dinit_load {
+
+constexpr const char *service_cache_name = ".dinit-cache";
+constexpr uint32_t service_cache_version = 6;
+
+inline const char *service_cache_magic() noexcept
+{
+    return "DINITSC\x01";
+}
+
+// Identifying attributes of a file (or directory), used to check whether it has changed
+struct file_stamp
+{
+    uint64_t ino = 0;
+    uint64_t size = 0;
+    int64_t mtime_sec = -1;
+    int64_t mtime_nsec = 0;
+
+    // Read the stamp of the file at the given path. On failure (including if the file does not
+    // exist), returns false and leaves the stamp in its "absent" state.
+    bool read(const char *path) noexcept
+    {
+        struct stat st;
+        if (stat(path, &st) == -1) {
+            *this = file_stamp();
+            return false;
+        }
+        ino = st.st_ino;
+        size = st.st_size;
+        mtime_sec = st.st_mtime;
+        #if defined(__APPLE__)
+        mtime_nsec = st.st_mtimespec.tv_nsec;
+        #else
+        mtime_nsec = st.st_mtim.tv_nsec;
+        #endif
+        return true;
+    }
+
+    bool operator==(const file_stamp &other) const noexcept
+    {
+        return ino == other.ino && size == other.size && mtime_sec == other.mtime_sec
+                && mtime_nsec == other.mtime_nsec;
+    }
+
+    bool operator!=(const file_stamp &other) const noexcept
+    {
+        return !(*this == other);
+    }
+};
+
+// Build the contents of a cache file in memory. May throw std::bad_alloc.
+class cache_writer
+{
+    std::vector<char> buf;
+
+    public:
+    void put_bytes(const void *data, size_t len)
+    {
+        const char *cdata = static_cast<const char *>(data);
+        buf.insert(buf.end(), cdata, cdata + len);
+    }
+
+    void put_u8(uint8_t v) { put_bytes(&v, sizeof(v)); }
+    void put_u32(uint32_t v) { put_bytes(&v, sizeof(v)); }
+    void put_u64(uint64_t v) { put_bytes(&v, sizeof(v)); }
+    void put_i64(int64_t v) { put_bytes(&v, sizeof(v)); }
+
+    void put_str(const char *s, size_t len)
+    {
+        put_u32(len);
+        put_bytes(s, len);
+    }
+
+    void put_str(const std::string &s)
+    {
+        put_str(s.data(), s.length());
+    }
+
+    void put_stamp(const file_stamp &stamp)
+    {
+        put_u64(stamp.ino);
+        put_u64(stamp.size);
+        put_i64(stamp.mtime_sec);
+        put_i64(stamp.mtime_nsec);
+    }
+
+    void put_timespec(const timespec &ts)
+    {
+        put_i64(ts.tv_sec);
+        put_i64(ts.tv_nsec);
+    }
+
+    size_t size() const noexcept
+    {
+        return buf.size();
+    }
+
+    const char *data() const noexcept
+    {
+        return buf.data();
+    }
+
+    // Overwrite a u32 value previously written at the given offset
+    void patch_u32(size_t offset, uint32_t v) noexcept
+    {
+        memcpy(buf.data() + offset, &v, sizeof(v));
+    }
+
+    // Write the contents to the given path, atomically (via a temporary file which is renamed).
+    // Returns false on failure, with errno set.
+    bool write_file(const std::string &path)
+    {
+        std::string tmp_path = path + ".tmp";
+        int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd == -1) return false;
+
+        size_t written = 0;
+        while (written < buf.size()) {
+            ssize_t r = write(fd, buf.data() + written, buf.size() - written);
+            if (r == -1) {
+                if (errno == EINTR) continue;
+                int errno_save = errno;
+                close(fd);
+                unlink(tmp_path.c_str());
+                errno = errno_save;
+                return false;
+            }
+            written += r;
+        }
+
+        if (fsync(fd) == -1 || close(fd) == -1) {
+            int errno_save = errno;
+            unlink(tmp_path.c_str());
+            errno = errno_save;
+            return false;
+        }
+
+        if (rename(tmp_path.c_str(), path.c_str()) == -1) {
+            int errno_save = errno;
+            unlink(tmp_path.c_str());
+            errno = errno_save;
+            return false;
+        }
+        return true;
+    }
+};
+
+// Read values from (a region of) a cache file. Reading beyond the end of the region puts the
+// reader into a failed state, in which all reads return zero values/empty strings.
+class cache_reader
+{
+    const char *pos;
+    const char *end;
+    bool ok = true;
+
+    public:
+    cache_reader(const char *start_p, const char *end_p) noexcept : pos(start_p), end(end_p)
+    {
+    }
+
+    bool good() const noexcept
+    {
+        return ok;
+    }
+
+    const char *get_pos() const noexcept
+    {
+        return pos;
+    }
+
+    bool get_bytes(void *out, size_t len) noexcept
+    {
+        if (! ok || (size_t)(end - pos) < len) {
+            ok = false;
+            memset(out, 0, len);
+            return false;
+        }
+        memcpy(out, pos, len);
+        pos += len;
+        return true;
+    }
+
+    bool skip(size_t len) noexcept
+    {
+        if (! ok || (size_t)(end - pos) < len) {
+            ok = false;
+            return false;
+        }
+        pos += len;
+        return true;
+    }
+
+    uint8_t get_u8() noexcept { uint8_t v; get_bytes(&v, sizeof(v)); return v; }
+    uint32_t get_u32() noexcept { uint32_t v; get_bytes(&v, sizeof(v)); return v; }
+    uint64_t get_u64() noexcept { uint64_t v; get_bytes(&v, sizeof(v)); return v; }
+    int64_t get_i64() noexcept { int64_t v; get_bytes(&v, sizeof(v)); return v; }
+
+    // Get a string, as a pointer into the cache data and a length (no allocation).
+    const char *get_str(uint32_t &len) noexcept
+    {
+        len = get_u32();
+        const char *s = pos;
+        if (! skip(len)) {
+            len = 0;
+            return "";
+        }
+        return s;
+    }
+
+    // Get a string. May throw std::bad_alloc.
+    std::string get_str()
+    {
+        uint32_t len;
+        const char *s = get_str(len);
+        return std::string(s, len);
+    }
+
+    file_stamp get_stamp() noexcept
+    {
+        file_stamp stamp;
+        stamp.ino = get_u64();
+        stamp.size = get_u64();
+        stamp.mtime_sec = get_i64();
+        stamp.mtime_nsec = get_i64();
+        return stamp;
+    }
+
+    timespec get_timespec() noexcept
+    {
+        timespec ts;
+        ts.tv_sec = get_i64();
+        ts.tv_nsec = get_i64();
+        return ts;
+    }
+};
+
+// Write the cache file header (not including the entry count, which must be written separately,
+// via put_u32() and later patch_u32() if necessary). Returns the offset of the entry count.
+inline size_t write_cache_header(cache_writer &writer, const file_stamp &passwd_stamp,
+        const file_stamp &group_stamp)
+{
+    writer.put_bytes(service_cache_magic(), 8);
+    writer.put_u32(service_cache_version);
+    writer.put_u8(sizeof(uid_t));
+    writer.put_u8(sizeof(gid_t));
+    writer.put_u8(sizeof(rlim_t));
+    writer.put_u8(0);
+    writer.put_stamp(passwd_stamp);
+    writer.put_stamp(group_stamp);
+    size_t count_offs = writer.size();
+    writer.put_u32(0);
+    return count_offs;
+}
+
+// Pack service flags into a single value (for the cache)
+inline uint32_t pack_service_flags(const service_flags_t &flags) noexcept
+{
+    return (flags.rw_ready ? 1u : 0u) | (flags.log_ready ? 2u : 0u) | (flags.no_sigterm ? 4u : 0u)
+            | (flags.runs_on_console ? 8u : 0u) | (flags.starts_on_console ? 16u : 0u)
+            | (flags.shares_console ? 32u : 0u) | (flags.pass_cs_fd ? 64u : 0u)
+            | (flags.start_interruptible ? 128u : 0u) | (flags.skippable ? 256u : 0u)
+            | (flags.signal_process_only ? 512u : 0u) | (flags.use_cgroup ? 1024u : 0u)
+            | (flags.ready_on_socket ? 2048u : 0u) | (flags.on_demand ? 4096u : 0u);
+}
+
+inline service_flags_t unpack_service_flags(uint32_t v) noexcept
+{
+    service_flags_t flags;
+    flags.rw_ready = v & 1u;
+    flags.log_ready = v & 2u;
+    flags.no_sigterm = v & 4u;
+    flags.runs_on_console = v & 8u;
+    flags.starts_on_console = v & 16u;
+    flags.shares_console = v & 32u;
+    flags.pass_cs_fd = v & 64u;
+    flags.start_interruptible = v & 128u;
+    flags.skippable = v & 256u;
+    flags.signal_process_only = v & 512u;
+    flags.use_cgroup = v & 1024u;
+    flags.ready_on_socket = v & 2048u;
+    flags.on_demand = v & 4096u;
+    return flags;
+}
+
+inline void put_offsets(cache_writer &writer, const std::list<std::pair<unsigned,unsigned>> &offsets)
+{
+    writer.put_u32(offsets.size());
+    for (auto &offs : offsets) {
+        writer.put_u32(offs.first);
+        writer.put_u32(offs.second);
+    }
+}
+
+inline void get_offsets(cache_reader &reader, std::list<std::pair<unsigned,unsigned>> &offsets)
+{
+    uint32_t count = reader.get_u32();
+    for (uint32_t i = 0; i < count && reader.good(); i++) {
+        unsigned first = reader.get_u32();
+        unsigned second = reader.get_u32();
+        offsets.emplace_back(first, second);
+    }
+}
+
+// Encode service settings. The dependency type of the settings wrapper must have 'name' (string),
+// 'dep_type' and 'from_dep_dir' (whether the dependency was found in a dependency directory)
+// members. May throw std::bad_alloc.
+template <typename settings_wrapper>
+void write_cached_settings(cache_writer &writer, const settings_wrapper &settings)
+{
+    writer.put_str(settings.command);
+    put_offsets(writer, settings.command_offsets);
+    writer.put_str(settings.stop_command);
+    put_offsets(writer, settings.stop_command_offsets);
+    writer.put_str(settings.working_dir);
+    writer.put_str(settings.pid_file);
+    writer.put_str(settings.env_file);
+    writer.put_u8(settings.do_sub_vars);
+    writer.put_u32((uint32_t)settings.service_type);
+
+    writer.put_u32(settings.depends.size());
+    for (auto &dep : settings.depends) {
+        writer.put_str(dep.name);
+        writer.put_u32((uint32_t)dep.dep_type);
+        writer.put_u8(dep.from_dep_dir);
+    }
+
+    writer.put_str(settings.logfile);
+    writer.put_u32((uint32_t)settings.log_type);
+    writer.put_u32(settings.log_buf_max);
+    writer.put_u32(pack_service_flags(settings.onstart_flags));
+    writer.put_u32(settings.term_signal);
+    writer.put_u8(settings.auto_restart);
+    writer.put_u8(settings.smooth_recovery);
+    writer.put_str(settings.socket_path);
+    writer.put_u32(settings.socket_perms);
+    writer.put_u64(settings.socket_uid);
+    writer.put_u64(settings.socket_gid);
+    writer.put_timespec(settings.restart_interval);
+    writer.put_u32(settings.max_restarts);
+    writer.put_timespec(settings.restart_delay);
+    writer.put_timespec(settings.restart_delay_max);
+    writer.put_timespec(settings.restart_jitter);
+    writer.put_timespec(settings.stop_timeout);
+    writer.put_timespec(settings.start_timeout);
+    writer.put_timespec(settings.activation_lifetime);
+    writer.put_u32(settings.start_priority);
+
+    writer.put_u32(settings.rlimits.size());
+    for (auto &rlimit : settings.rlimits) {
+        writer.put_u32(rlimit.resource_id);
+        writer.put_u8(rlimit.soft_set);
+        writer.put_u8(rlimit.hard_set);
+        writer.put_u64(rlimit.limits.rlim_cur);
+        writer.put_u64(rlimit.limits.rlim_max);
+    }
+
+    writer.put_u32(settings.readiness_fd);
+    writer.put_str(settings.readiness_var);
+    writer.put_u8(settings.readiness_socket);
+    writer.put_timespec(settings.watchdog_timeout);
+    writer.put_u64(settings.run_as_uid);
+    writer.put_u64(settings.run_as_gid);
+    writer.put_str(settings.chain_to_name);
+
+    #if USE_UTMPX
+    writer.put_str(settings.inittab_id, strnlen(settings.inittab_id, sizeof(settings.inittab_id)));
+    writer.put_str(settings.inittab_line, strnlen(settings.inittab_line, sizeof(settings.inittab_line)));
+    #else
+    writer.put_str("", 0);
+    writer.put_str("", 0);
+    #endif
+}
+
+// Decode service settings (as encoded by write_cached_settings()). Dependencies are added, after
+// all other settings have been successfully decoded, by calling:
+//     add_dep(std::list<dep_type> &depends, const std::string &name, dependency_type dep_type,
+//             bool from_dep_dir)
+// Returns false if the encoded settings are malformed (in which case no dependencies will have
+// been added). May throw std::bad_alloc, or any exception thrown by add_dep.
+template <typename settings_wrapper, typename add_dep_t>
+bool read_cached_settings(cache_reader &reader, settings_wrapper &settings, add_dep_t add_dep)
+{
+    settings.command = reader.get_str();
+    get_offsets(reader, settings.command_offsets);
+    settings.stop_command = reader.get_str();
+    get_offsets(reader, settings.stop_command_offsets);
+    settings.working_dir = reader.get_str();
+    settings.pid_file = reader.get_str();
+    settings.env_file = reader.get_str();
+    settings.do_sub_vars = reader.get_u8();
+    settings.service_type = (service_type_t)reader.get_u32();
+
+    struct cached_dep
+    {
+        std::string name;
+        dependency_type dep_type;
+        bool from_dep_dir;
+    };
+    std::vector<cached_dep> deps;
+
+    uint32_t num_deps = reader.get_u32();
+    for (uint32_t i = 0; i < num_deps && reader.good(); i++) {
+        std::string name = reader.get_str();
+        dependency_type dep_type = (dependency_type)reader.get_u32();
+        bool from_dep_dir = reader.get_u8();
+        deps.push_back({std::move(name), dep_type, from_dep_dir});
+    }
+
+    settings.logfile = reader.get_str();
+    settings.log_type = (log_type_id)reader.get_u32();
+    settings.log_buf_max = reader.get_u32();
+    settings.onstart_flags = unpack_service_flags(reader.get_u32());
+    settings.term_signal = (int)reader.get_u32();
+    settings.auto_restart = reader.get_u8();
+    settings.smooth_recovery = reader.get_u8();
+    settings.socket_path = reader.get_str();
+    settings.socket_perms = reader.get_u32();
+    settings.socket_uid = reader.get_u64();
+    settings.socket_gid = reader.get_u64();
+    settings.restart_interval = reader.get_timespec();
+    settings.max_restarts = reader.get_u32();
+    settings.restart_delay = reader.get_timespec();
+    settings.restart_delay_max = reader.get_timespec();
+    settings.restart_jitter = reader.get_timespec();
+    settings.stop_timeout = reader.get_timespec();
+    settings.start_timeout = reader.get_timespec();
+    settings.activation_lifetime = reader.get_timespec();
+    settings.start_priority = (int)reader.get_u32();
+
+    uint32_t num_rlimits = reader.get_u32();
+    for (uint32_t i = 0; i < num_rlimits && reader.good(); i++) {
+        service_rlimits &rlimit = find_rlimits(settings.rlimits, reader.get_u32());
+        rlimit.soft_set = reader.get_u8();
+        rlimit.hard_set = reader.get_u8();
+        rlimit.limits.rlim_cur = reader.get_u64();
+        rlimit.limits.rlim_max = reader.get_u64();
+    }
+
+    settings.readiness_fd = (int)reader.get_u32();
+    settings.readiness_var = reader.get_str();
+    settings.readiness_socket = reader.get_u8();
+    settings.watchdog_timeout = reader.get_timespec();
+    settings.run_as_uid = reader.get_u64();
+    settings.run_as_gid = reader.get_u64();
+    settings.chain_to_name = reader.get_str();
+
+    uint32_t id_len, line_len;
+    const char *inittab_id = reader.get_str(id_len);
+    const char *inittab_line = reader.get_str(line_len);
+    #if USE_UTMPX
+    if (id_len > sizeof(settings.inittab_id) || line_len > sizeof(settings.inittab_line)) {
+        return false;
+    }
+    memcpy(settings.inittab_id, inittab_id, id_len);
+    memcpy(settings.inittab_line, inittab_line, line_len);
+    #else
+    (void)inittab_id; (void)inittab_line;
+    #endif
+
+    if (! reader.good()) {
+        return false;
+    }
+
+    for (auto &dep : deps) {
+        add_dep(settings.depends, dep.name, dep.dep_type, dep.from_dep_dir);
+    }
+
+    return true;
+}
+
+// A (memory-mapped) service description cache file for a single service directory.
+class service_cache_file
+{
+    const char *map_base = nullptr;
+    size_t map_size = 0;
+
+    // Location of the data for each entry (following the name), by service name
+    std::unordered_map<std::string, const char *> entries;
+
+    public:
+    // Details of a cache entry
+    struct entry_info
+    {
+        const char *start;  // start of entry (following entry length)
+        const char *end;    // end of entry
+    };
+
+    service_cache_file() noexcept
+    {
+    }
+
+    service_cache_file(const service_cache_file &) = delete;
+    void operator=(const service_cache_file &) = delete;
+
+    service_cache_file(service_cache_file &&other) noexcept
+        : map_base(other.map_base), map_size(other.map_size), entries(std::move(other.entries))
+    {
+        other.map_base = nullptr;
+        other.map_size = 0;
+    }
+
+    ~service_cache_file()
+    {
+        close();
+    }
+
+    // Open the cache file in the given service directory, and check the header. Returns false if
+    // there is no cache or it is not usable (including if the user/group databases have changed).
+    // May throw std::bad_alloc.
+    bool open(const char *service_dir)
+    {
+        close();
+
+        std::string path = combine_paths(service_dir, service_cache_name);
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1) return false;
+
+        struct stat st;
+        if (fstat(fd, &st) == -1 || st.st_size == 0) {
+            ::close(fd);
+            return false;
+        }
+
+        void *base = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (base == MAP_FAILED) return false;
+
+        map_base = static_cast<const char *>(base);
+        map_size = st.st_size;
+
+        try {
+            if (! read_index()) {
+                close();
+                return false;
+            }
+        }
+        catch (...) {
+            close();
+            throw;
+        }
+
+        return true;
+    }
+
+    void close() noexcept
+    {
+        if (map_base != nullptr) {
+            munmap(const_cast<char *>(map_base), map_size);
+            map_base = nullptr;
+            map_size = 0;
+        }
+        entries.clear();
+    }
+
+    bool is_open() const noexcept
+    {
+        return map_base != nullptr;
+    }
+
+    // Find the entry for the named service. The entry is only returned if it is up-to-date with
+    // respect to the description file (whose path is given) and dependency directories.
+    bool find_valid(const std::string &name, const char *service_filename, entry_info &info) const
+    {
+        auto it = entries.find(name);
+        if (it == entries.end()) return false;
+
+        uint32_t entry_len;
+        memcpy(&entry_len, it->second, sizeof(entry_len));
+        const char *start = it->second + sizeof(entry_len);
+        cache_reader reader(start, start + entry_len);
+        uint32_t name_len;
+        reader.get_str(name_len);
+
+        file_stamp cur_stamp;
+        cur_stamp.read(service_filename);
+        if (reader.get_stamp() != cur_stamp) return false;
+
+        uint32_t num_dirs = reader.get_u32();
+        for (uint32_t i = 0; i < num_dirs; i++) {
+            uint32_t path_len;
+            const char *path = reader.get_str(path_len);
+            file_stamp dir_stamp = reader.get_stamp();
+            if (! reader.good()) return false;
+            cur_stamp.read(std::string(path, path_len).c_str());
+            if (dir_stamp != cur_stamp) return false;
+        }
+
+        if (! reader.good()) return false;
+
+        info.start = reader.get_pos();
+        info.end = start + entry_len;
+        return true;
+    }
+
+    // Find the complete encoded settings of the named service (regardless of validity); used to
+    // compare with a freshly-encoded entry.
+    bool find_raw(const std::string &name, entry_info &info) const noexcept
+    {
+        auto it = entries.find(name);
+        if (it == entries.end()) return false;
+
+        uint32_t entry_len;
+        memcpy(&entry_len, it->second, sizeof(entry_len));
+        info.start = it->second + sizeof(entry_len);
+        info.end = info.start + entry_len;
+        return true;
+    }
+
+    private:
+    bool read_index()
+    {
+        cache_reader reader(map_base, map_base + map_size);
+
+        char magic[8];
+        reader.get_bytes(magic, 8);
+        if (memcmp(magic, service_cache_magic(), 8) != 0) return false;
+        if (reader.get_u32() != service_cache_version) return false;
+        if (reader.get_u8() != sizeof(uid_t) || reader.get_u8() != sizeof(gid_t)
+                || reader.get_u8() != sizeof(rlim_t)) {
+            return false;
+        }
+        reader.get_u8();
+
+        file_stamp cur_stamp;
+        cur_stamp.read("/etc/passwd");
+        if (reader.get_stamp() != cur_stamp) return false;
+        cur_stamp.read("/etc/group");
+        if (reader.get_stamp() != cur_stamp) return false;
+
+        uint32_t num_entries = reader.get_u32();
+        for (uint32_t i = 0; i < num_entries; i++) {
+            const char *entry_pos = reader.get_pos();
+            uint32_t entry_len = reader.get_u32();
+            const char *entry_start = reader.get_pos();
+            if (! reader.skip(entry_len)) return false;
+
+            cache_reader entry_reader(entry_start, entry_start + entry_len);
+            std::string name = entry_reader.get_str();
+            if (! entry_reader.good()) return false;
+            entries[std::move(name)] = entry_pos;
+        }
+
+        return reader.good();
+    }
+};
+
+// Write a cache entry for a service. The settings dependency type must be suitable for
+// write_cached_settings(). May throw std::bad_alloc.
+template <typename settings_wrapper>
+void write_cache_entry(cache_writer &writer, const std::string &name, const file_stamp &desc_stamp,
+        const std::vector<std::pair<std::string, file_stamp>> &dep_dirs,
+        const settings_wrapper &settings)
+{
+    size_t len_offs = writer.size();
+    writer.put_u32(0);
+    writer.put_str(name);
+    writer.put_stamp(desc_stamp);
+    writer.put_u32(dep_dirs.size());
+    for (auto &dep_dir : dep_dirs) {
+        writer.put_str(dep_dir.first);
+        writer.put_stamp(dep_dir.second);
+    }
+    write_cached_settings(writer, settings);
+    writer.patch_u32(len_offs, writer.size() - len_offs - sizeof(uint32_t));
+}
+
+} // namespace dinit_load
+
+#endif
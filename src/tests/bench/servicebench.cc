@@ -0,0 +1,134 @@
+#include <string>
+#include <vector>
+#include <list>
+#include <fstream>
+#include <cassert>
+#include <cstdlib>
+
+#include <unistd.h>
+
+#include "service.h"
+#include "proc-service.h"
+#include "load-service.h"
+
+#include "bench.h"
+
+// Benchmarks for service loading, lookup and state propagation. As for the unit tests, these use the
+// mock event loop and system interface.
+
+constexpr static auto REG = dependency_type::REGULAR;
+constexpr static auto WAITS = dependency_type::WAITS_FOR;
+constexpr static auto MS = dependency_type::MILESTONE;
+
+// Load a synthetic tree of ~10k services (from service description files), and measure the service
+// lookup (by name) rate.
+void bench_find_service()
+{
+    const int groups = 100;
+    const int leaves_per_group = 100;
+
+    char dir_template[] = "/tmp/dinit-loadbench-XXXXXX";
+    const char *bench_dir = mkdtemp(dir_template);
+    assert(bench_dir != nullptr);
+
+    std::vector<std::string> names;
+    auto write_service = [&](const std::string &name, const std::string &contents) {
+        std::ofstream f(std::string(bench_dir) + "/" + name);
+        f << contents;
+        names.push_back(name);
+    };
+
+    write_service("base", "type = internal\n");
+    std::string root_desc = "type = internal\n";
+    for (int g = 0; g < groups; g++) {
+        std::string gname = "group-" + std::to_string(g);
+        std::string group_desc = "type = internal\n";
+        for (int l = 0; l < leaves_per_group; l++) {
+            std::string lname = gname + "-worker-" + std::to_string(l);
+            write_service(lname, "type = internal\nwaits-for = base\n");
+            group_desc += "depends-on = " + lname + "\n";
+        }
+        write_service(gname, group_desc);
+        root_desc += "depends-on = " + gname + "\n";
+    }
+    write_service("root", root_desc);
+
+    dirload_service_set sset(bench_dir);
+
+    stopwatch load_time;
+    sset.load_service("root");
+    double load_secs = load_time.elapsed_secs();
+
+    const int rounds = 20;
+    stopwatch find_time;
+    for (int r = 0; r < rounds; r++) {
+        for (auto &name : names) {
+            auto *sr = sset.find_service(name);
+            assert(sr != nullptr && sr->get_name() == name);
+            (void)sr;
+        }
+    }
+    double find_secs = find_time.elapsed_secs();
+
+    for (auto &name : names) {
+        unlink((std::string(bench_dir) + "/" + name).c_str());
+    }
+    rmdir(bench_dir);
+
+    report_rate("load", names.size(), load_secs, "services");
+    report_rate("find", (double)names.size() * rounds, find_secs, "lookups");
+}
+
+// Start/stop propagation through a synthetic graph, consisting of a "wide" milestone (many
+// dependencies) and a "deep" chain of dependencies.
+void bench_propagation()
+{
+    service_set sset;
+
+    constexpr int width = 800;
+    constexpr int depth = 200;
+
+    std::list<prelim_dep> top_deps;
+
+    service_record *base = new service_record(&sset, "base", service_type_t::INTERNAL, {});
+    sset.add_service(base);
+    for (int i = 0; i < width; i++) {
+        service_record *leaf = new service_record(&sset, "leaf-" + std::to_string(i),
+                service_type_t::INTERNAL, {{base, WAITS}});
+        sset.add_service(leaf);
+        top_deps.emplace_back(leaf, REG);
+    }
+
+    service_record *chain = base;
+    for (int i = 0; i < depth; i++) {
+        chain = new service_record(&sset, "chain-" + std::to_string(i), service_type_t::INTERNAL,
+                {{chain, REG}});
+        sset.add_service(chain);
+    }
+    top_deps.emplace_back(chain, MS);
+
+    service_record *top = new service_record(&sset, "multi-user", service_type_t::INTERNAL, top_deps);
+    sset.add_service(top);
+
+    constexpr int rounds = 200;
+    stopwatch time;
+    for (int r = 0; r < rounds; r++) {
+        sset.start_service(top);
+        assert(top->get_state() == service_state_t::STARTED);
+        sset.stop_service(top);
+        assert(base->get_state() == service_state_t::STOPPED);
+    }
+    double secs = time.elapsed_secs();
+
+    std::cout << "    " << (width + depth + 2) << " services\n";
+    report_per_op("start/stop cycle", rounds, secs);
+}
+
+int main(int argc, char **argv)
+{
+    bp_sys::init_bpsys();
+
+    RUN_BENCH(bench_find_service);
+    RUN_BENCH(bench_propagation);
+    return 0;
+}
@@ -0,0 +1,91 @@
+#include <string>
+#include <vector>
+#include <cassert>
+
+#include <sys/wait.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "proc-service.h"
+
+#include "bench.h"
+
+// Benchmarks for the process launch sequence (run_child_proc). As for the spawn tests, these create
+// real processes.
+
+static std::vector<service_rlimits> no_rlimits;
+
+// Launch a process (via vfork, or fork) with the given arguments, using (or building) the given
+// process environment; wait for it to exit. Returns the exit status. If exec fails, the error is
+// returned via exec_err (with exec_failed set true).
+static int launch(const char * const *args, bool use_vfork, run_proc_env &env, bool &exec_failed,
+        run_proc_err &exec_err)
+{
+    int pipefd[2];
+    assert(pipe2(pipefd, O_CLOEXEC) == 0);
+
+    run_proc_params params{args, nullptr, "/dev/null", pipefd[1], uid_t(-1), gid_t(-1), no_rlimits};
+    run_proc_plan plan;
+    prepare_child_proc(params, env, plan);
+
+    pid_t child = use_vfork ? vfork() : fork();
+    if (child == 0) {
+        run_child_proc(params, plan);
+    }
+    assert(child > 0);
+
+    close(pipefd[1]);
+
+    ssize_t r = read(pipefd[0], &exec_err, sizeof(exec_err));
+    exec_failed = (r == sizeof(exec_err));
+    close(pipefd[0]);
+
+    int status;
+    assert(waitpid(child, &status, 0) == child);
+    return status;
+}
+
+// Measure the rate at which processes can be launched, via fork() and via vfork(), with and without
+// a large (touched) memory footprint in the parent.
+void bench_spawn()
+{
+    constexpr int rounds = 300;
+    constexpr size_t ballast_size = 64 * 1024 * 1024;
+
+    bool exec_failed;
+    run_proc_err exec_err;
+    const char * const args[] = { "true", nullptr };
+
+    std::vector<char> ballast;
+    run_proc_env env;
+
+    for (int pass = 0; pass < 2; pass++) {
+        if (pass == 1) {
+            ballast.resize(ballast_size);
+            for (size_t i = 0; i < ballast_size; i += 4096) {
+                ballast[i] = 1;
+            }
+        }
+
+        for (bool use_vfork : {false, true}) {
+            stopwatch time;
+            for (int r = 0; r < rounds; r++) {
+                int status = launch(args, use_vfork, env, exec_failed, exec_err);
+                assert(! exec_failed);
+                assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+                (void)status;
+            }
+            double secs = time.elapsed_secs();
+
+            std::string what = std::string(use_vfork ? "vfork" : "fork") + ", "
+                    + std::to_string(ballast.size() / (1024 * 1024)) + "MB ballast";
+            report_rate(what.c_str(), rounds, secs, "spawns");
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    RUN_BENCH(bench_spawn);
+    return 0;
+}
@@ -0,0 +1,320 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <new>
+#include <cstdlib>
+#include <cstring>
+#include <cassert>
+#include <csignal>
+
+#include <time.h>
+#include <sys/resource.h>
+
+#include "service.h"
+#include "proc-service.h"
+#include "baseproc-sys.h"
+
+// Scale benchmarks for the service engine. Services are driven through the mock event loop and
+// system interface used by the unit tests, so no real processes are involved: launching a process
+// "succeeds" when its exec status pipe is signalled, and processes terminate when told to (by the
+// benchmark). Synthetic service graphs of various shapes and sizes are booted, subjected to a restart
+// storm (every process terminates at once, and is restarted via smooth recovery), and shut down. For
+// each step, the CPU time, number and size of heap allocations, and the peak RSS (of the benchmark
+// process, so far) are reported.
+//
+// Note that the figures include the (small) overhead of the mocks.
+
+extern eventloop_t event_loop;
+
+constexpr auto REG = dependency_type::REGULAR;
+
+// Allocation tracking. (The replacement operators are not inlined, so that the compiler doesn't
+// mistake the use of free() for a mismatched deallocation).
+
+static unsigned long alloc_count = 0;
+static unsigned long long alloc_bytes = 0;
+
+__attribute__((noinline)) void *operator new(std::size_t size)
+{
+    alloc_count++;
+    alloc_bytes += size;
+    void *p = std::malloc(size == 0 ? 1 : size);
+    if (p == nullptr) throw std::bad_alloc();
+    return p;
+}
+
+__attribute__((noinline)) void *operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+__attribute__((noinline)) void *operator new(std::size_t size, const std::nothrow_t &) noexcept
+{
+    alloc_count++;
+    alloc_bytes += size;
+    return std::malloc(size == 0 ? 1 : size);
+}
+
+__attribute__((noinline)) void *operator new[](std::size_t size, const std::nothrow_t &nt) noexcept
+{
+    return operator new(size, nt);
+}
+
+__attribute__((noinline)) void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+__attribute__((noinline)) void operator delete[](void *p) noexcept
+{
+    std::free(p);
+}
+
+__attribute__((noinline)) void operator delete(void *p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+__attribute__((noinline)) void operator delete[](void *p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+// Friend interface to access base_process_service private/protected members.
+class base_process_service_test
+{
+    public:
+    // Report termination of the service process (as service_child_watcher::status_change does)
+    static void process_exit(base_process_service *bsp, bp_sys::exit_status exit_status)
+    {
+        bsp->pid = -1;
+        bsp->exit_status = exit_status;
+        bsp->mark_changed();
+        if (bsp->stop_timer_armed) {
+            bsp->restart_timer.stop_timer(event_loop);
+            bsp->stop_timer_armed = false;
+        }
+        bsp->handle_exit_status(exit_status);
+    }
+};
+
+// Measurement of CPU time and allocations over a benchmark step
+class measurement
+{
+    uint64_t start_cpu;
+    unsigned long start_allocs;
+    unsigned long long start_bytes;
+
+    static uint64_t cpu_now()
+    {
+        timespec ts;
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+        return uint64_t(ts.tv_sec) * 1000000000u + ts.tv_nsec;
+    }
+
+    public:
+    measurement() : start_cpu(cpu_now()), start_allocs(alloc_count), start_bytes(alloc_bytes)
+    {
+    }
+
+    void report(const char *graph, size_t num_services, const char *step)
+    {
+        uint64_t cpu_ns = cpu_now() - start_cpu;
+        unsigned long allocs = alloc_count - start_allocs;
+        unsigned long long bytes = alloc_bytes - start_bytes;
+
+        rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+
+        std::cout << std::left << std::setw(9) << graph << std::right << std::setw(8) << num_services
+                << "  " << std::left << std::setw(9) << step << std::right
+                << std::setw(10) << std::fixed << std::setprecision(2) << (cpu_ns / 1000000.0)
+                << std::setw(10) << std::setprecision(0) << (cpu_ns / double(num_services))
+                << std::setw(11) << allocs
+                << std::setw(11) << (bytes / 1024)
+                << std::setw(11) << (usage.ru_maxrss / 1024) << std::endl;
+    }
+};
+
+// A synthetic service graph
+struct service_graph
+{
+    service_set sset;
+    service_record *top = nullptr;  // the service to start (all others are its dependencies)
+    std::vector<process_service *> procs;
+    size_t num_services = 0;
+};
+
+static process_service *add_process_service(service_graph &graph, const std::string &name,
+        const std::list<prelim_dep> &depends)
+{
+    std::string command = "bench-command";
+    std::list<std::pair<unsigned,unsigned>> command_offsets;
+    command_offsets.emplace_back(0, command.length());
+
+    process_service *p = new process_service(&graph.sset, name, std::move(command), command_offsets,
+            depends);
+    p->set_restart_interval(time_val(10, 0), 0);  // no restart limit
+    p->set_restart_delay(time_val(0, 100000000)); // 100ms
+    p->set_smooth_recovery(true);
+    graph.sset.add_service(p);
+    graph.procs.push_back(p);
+    graph.num_services++;
+    return p;
+}
+
+// A single (internal) milestone service which depends on (num - 1) process services
+static void make_wide(service_graph &graph, size_t num)
+{
+    std::list<prelim_dep> depends;
+    for (size_t i = 0; i + 1 < num; i++) {
+        depends.emplace_back(add_process_service(graph, "leaf" + std::to_string(i), {}), REG);
+    }
+    graph.top = new service_record(&graph.sset, "boot", service_type_t::INTERNAL, depends);
+    graph.sset.add_service(graph.top);
+    graph.num_services++;
+}
+
+// A chain of process services, each depending on the previous
+static void make_chain(service_graph &graph, size_t num)
+{
+    service_record *prev = nullptr;
+    for (size_t i = 0; i < num; i++) {
+        std::list<prelim_dep> depends;
+        if (prev != nullptr) depends.emplace_back(prev, REG);
+        prev = add_process_service(graph, "link" + std::to_string(i), depends);
+    }
+    graph.top = prev;
+}
+
+// A stack of diamonds: each consists of 8 process services depending on the previous diamond's
+// join service, and a join service depending on all 8
+static void make_diamonds(service_graph &graph, size_t num)
+{
+    constexpr size_t width = 8;
+    service_record *join = add_process_service(graph, "join0", {});
+    for (size_t d = 1; graph.num_services + width + 1 <= num; d++) {
+        std::list<prelim_dep> join_depends;
+        for (size_t i = 0; i < width; i++) {
+            std::string name = "mid" + std::to_string(d) + "-" + std::to_string(i);
+            join_depends.emplace_back(add_process_service(graph, name, {{join, REG}}), REG);
+        }
+        join = add_process_service(graph, "join" + std::to_string(d), join_depends);
+    }
+    graph.top = join;
+}
+
+// Report the exec status (success) of each launched process, until there are no more launches
+static void complete_launches()
+{
+    std::vector<int> fds;
+    while (! event_loop.regd_fd_watchers.empty()) {
+        fds.clear();
+        for (auto &watcher : event_loop.regd_fd_watchers) {
+            fds.push_back(watcher.first);
+        }
+        for (int fd : fds) {
+            event_loop.send_fd_event(fd, dasynq::IN_EVENTS);
+        }
+    }
+}
+
+static void check_all_in_state(service_graph &graph, service_state_t state)
+{
+    for (process_service *p : graph.procs) {
+        if (p->get_state() != state) {
+            std::cerr << "svcbench: service " << p->get_name() << " not in expected state" << std::endl;
+            std::exit(1);
+        }
+    }
+}
+
+static void run_graph(const char *graph_name, void (*make_graph)(service_graph &, size_t), size_t num)
+{
+    service_graph *graph = new service_graph();
+    graph->procs.reserve(num);
+
+    measurement create_m;
+    make_graph(*graph, num);
+    create_m.report(graph_name, graph->num_services, "create");
+
+    // Boot: start the top service, and so all others
+    measurement boot_m;
+    graph->sset.start_service(graph->top);
+    complete_launches();
+    boot_m.report(graph_name, graph->num_services, "boot");
+    check_all_in_state(*graph, service_state_t::STARTED);
+
+    // Restart storm: every process terminates at once, and is restarted after the restart delay
+    measurement storm_m;
+    for (process_service *p : graph->procs) {
+        base_process_service_test::process_exit(p, bp_sys::exit_status(true, false, 0));
+    }
+    event_loop.advance_time(time_val(1, 0));
+    complete_launches();
+    storm_m.report(graph_name, graph->num_services, "storm");
+    check_all_in_state(*graph, service_state_t::STARTED);
+
+    // Shutdown: stop all services. Each process terminates when signalled (after its dependents
+    // have stopped).
+    std::unordered_map<pid_t, process_service *> pid_map;
+    std::vector<pid_t> signalled;
+    std::vector<pid_t> signalled_batch;
+    pid_map.reserve(graph->procs.size());
+    signalled.reserve(graph->procs.size() * 2);
+    signalled_batch.reserve(graph->procs.size() * 2);
+    for (process_service *p : graph->procs) {
+        pid_map[p->get_pid()] = p;
+    }
+    bp_sys::record_signalled_pids(&signalled);
+
+    measurement shutdown_m;
+    graph->sset.stop_all_services();
+    while (! signalled.empty()) {
+        signalled_batch.swap(signalled);
+        for (pid_t pid : signalled_batch) {
+            process_service *p = pid_map[pid];
+            if (p->get_pid() == pid) {
+                base_process_service_test::process_exit(p, bp_sys::exit_status(false, true, SIGTERM));
+            }
+        }
+        signalled_batch.clear();
+    }
+    shutdown_m.report(graph_name, graph->num_services, "shutdown");
+    bp_sys::record_signalled_pids(nullptr);
+    check_all_in_state(*graph, service_state_t::STOPPED);
+
+    measurement destroy_m;
+    size_t num_services = graph->num_services;
+    delete graph;
+    destroy_m.report(graph_name, num_services, "destroy");
+}
+
+int main(int argc, char **argv)
+{
+    size_t max_services = 100000;
+    if (argc > 1) {
+        char *endp;
+        max_services = strtoul(argv[1], &endp, 10);
+        if (*endp != 0 || max_services == 0) {
+            std::cerr << "Usage: svcbench [max-services]" << std::endl;
+            return 1;
+        }
+    }
+
+    bp_sys::init_bpsys();
+
+    std::cout << "graph     services  step        cpu(ms)  ns/svc     allocs  alloc(KiB)  "
+            "peak RSS(MiB)" << std::endl;
+
+    for (size_t num = 1000; num <= max_services; num *= 10) {
+        run_graph("wide", make_wide, num);
+        run_graph("chain", make_chain, num);
+        run_graph("diamonds", make_diamonds, num);
+    }
+
+    return 0;
+}
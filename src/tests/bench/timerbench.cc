@@ -0,0 +1,95 @@
+#include <vector>
+#include <random>
+#include <cstdint>
+
+#include "dasynq-config.h"
+#include "dasynq-flags.h"
+#include "dasynq-timerbase.h"
+#include "dasynq-timerwheel.h"
+
+#include "bench.h"
+
+// Benchmarks for the timer queue implementations (timer_wheel and dary_heap, as used for
+// timer_queue_t).
+
+using dasynq::time_val;
+using dasynq::timer_data;
+using dasynq::clock_type;
+
+using heap_queue = dasynq::dary_heap<timer_data, time_val, dasynq::compare_timespec>;
+using wheel_queue = dasynq::timer_wheel<timer_data, time_val, 1000000>;
+
+static time_val now_mono()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts;
+}
+
+static time_val from_nsecs(uint64_t ns)
+{
+    return time_val(ns / 1000000000u, ns % 1000000000u);
+}
+
+// Benchmark a timer queue: with 10,000 active timers, repeatedly re-arm a random timer (as happens
+// for restart delays and start/stop timeouts), and count how often the earliest expiry time changes
+// (requiring the system timer to be re-armed).
+template <typename Q> void bench_queue(const char *name, Q &queue)
+{
+    constexpr int num_timers = 10000;
+    constexpr int num_ops = 1000000;
+
+    std::vector<typename Q::handle_t> handles(num_timers);
+    std::minstd_rand rng(1);
+
+    auto random_timeout = [&]() -> time_val {
+        // between 200ms and 60s:
+        return from_nsecs(200000000u + uint64_t(rng()) % 59800000000u);
+    };
+
+    time_val now = now_mono();
+    for (auto &h : handles) {
+        queue.allocate(h);
+        queue.insert(h, now + random_timeout());
+    }
+
+    unsigned long rearms = 0;
+    stopwatch time;
+    for (int i = 0; i < num_ops; i++) {
+        auto &h = handles[rng() % num_timers];
+        if ((i & 1) == 0) {
+            if (queue.set_priority(h, now + random_timeout())) rearms++;
+        }
+        else {
+            bool was_root = (&queue.get_root() == &h);
+            queue.remove(h);
+            if (was_root) rearms++;
+            if (queue.insert(h, now + random_timeout())) rearms++;
+        }
+    }
+    double secs = time.elapsed_secs();
+
+    for (auto &h : handles) {
+        queue.remove(h);
+        queue.deallocate(h);
+    }
+
+    report_per_op(name, num_ops, secs);
+    std::cout << "    " << name << " timer re-arms: " << rearms << "\n";
+}
+
+void bench_timer_queues()
+{
+    heap_queue heap;
+    bench_queue("heap", heap);
+
+    wheel_queue wheel;
+    wheel.set_clock(clock_type::MONOTONIC);
+    bench_queue("wheel", wheel);
+}
+
+int main(int argc, char **argv)
+{
+    RUN_BENCH(bench_timer_queues);
+    return 0;
+}
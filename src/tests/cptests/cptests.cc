@@ -3,6 +3,7 @@
 #include <vector>
 #include <string>
 #include <set>
+#include <map>
 
 #include "dinit.h"
 #include "service.h"
@@ -20,6 +21,11 @@ class control_conn_t_test
     {
         return cc->find_service_for_key(handle);
     }
+
+    static size_t pending_event_count(control_conn_t *cc)
+    {
+        return cc->pending_events.size();
+    }
 };
 
 void cptest_queryver()
@@ -104,6 +110,740 @@ void cptest_listservices()
 	delete cc;
 }
 
+// Issue a LISTSERVICESSINCE request and parse the reply: returns the state generation, sets
+// full_list, and sets names to the names of the listed services (with state).
+static uint64_t list_services_since(int fd, uint64_t since, bool &full_list,
+        std::vector<std::pair<std::string, service_state_t>> &names)
+{
+    std::vector<char> cmd = { DINIT_CP_LISTSERVICESSINCE };
+    char *since_cptr = reinterpret_cast<char *>(&since);
+    cmd.insert(cmd.end(), since_cptr, since_cptr + sizeof(since));
+    bp_sys::supply_read_data(fd, std::move(cmd));
+    event_loop.regd_bidi_watchers[fd]->read_ready(event_loop, fd);
+
+    std::vector<char> wdata;
+    bp_sys::extract_written_data(fd, wdata);
+
+    uint64_t gen;
+    assert(wdata.size() >= 2 + sizeof(gen));
+    assert(wdata[0] == DINIT_RP_LISTGENERATION);
+    full_list = (wdata[1] == 1);
+    memcpy(&gen, wdata.data() + 2, sizeof(gen));
+
+    names.clear();
+    unsigned pos = 2 + sizeof(gen);
+    while (wdata[pos] == DINIT_RP_SVCINFO) {
+        unsigned char name_len_c = wdata[pos + 1];
+        service_state_t state = static_cast<service_state_t>(wdata[pos + 2]);
+        pos += 8 + std::max(sizeof(int), sizeof(pid_t));
+        names.emplace_back(std::string(wdata.data() + pos, name_len_c), state);
+        pos += name_len_c;
+    }
+    assert(wdata[pos] == DINIT_RP_LISTDONE);
+    assert(pos + 1 == wdata.size());
+
+    return gen;
+}
+
+void cptest_listservicessince()
+{
+    service_set sset;
+
+    service_record *s1 = new service_record(&sset, "test-service-1", service_type_t::INTERNAL, {});
+    sset.add_service(s1);
+    service_record *s2 = new service_record(&sset, "test-service-2", service_type_t::INTERNAL, {});
+    sset.add_service(s2);
+    service_record *s3 = new service_record(&sset, "test-service-3", service_type_t::INTERNAL, {});
+    sset.add_service(s3);
+
+    int fd = bp_sys::allocfd();
+    auto *cc = new control_conn_t(event_loop, &sset, fd);
+
+    bool full_list;
+    std::vector<std::pair<std::string, service_state_t>> names;
+
+    // Initial request: full list
+    uint64_t gen0 = list_services_since(fd, 0, full_list, names);
+    assert(full_list);
+    assert(names.size() == 3);
+
+    // No changes:
+    uint64_t gen1 = list_services_since(fd, gen0, full_list, names);
+    assert(! full_list);
+    assert(gen1 == gen0);
+    assert(names.empty());
+
+    // Start a service; only it should be listed:
+    sset.start_service(s2);
+    std::vector<char> wdata;
+    bp_sys::extract_written_data(fd, wdata);
+
+    uint64_t gen2 = list_services_since(fd, gen1, full_list, names);
+    assert(! full_list);
+    assert(gen2 > gen1);
+    assert(names.size() == 1);
+    assert(names[0].first == "test-service-2");
+    assert(names[0].second == service_state_t::STARTED);
+
+    // Change two services; they should be listed in the order changed:
+    sset.start_service(s3);
+    sset.stop_service(s2);
+    uint64_t gen3 = list_services_since(fd, gen2, full_list, names);
+    assert(! full_list);
+    assert(gen3 > gen2);
+    assert(names.size() == 2);
+    assert(names[0].first == "test-service-3");
+    assert(names[0].second == service_state_t::STARTED);
+    assert(names[1].first == "test-service-2");
+    assert(names[1].second == service_state_t::STOPPED);
+
+    // Changes since an earlier generation include all the above:
+    list_services_since(fd, gen1, full_list, names);
+    assert(! full_list);
+    assert(names.size() == 2);
+
+    // Removing a service requires a full list:
+    sset.stop_service(s3);
+    sset.remove_service(s3);
+    delete s3;
+    uint64_t gen4 = list_services_since(fd, gen3, full_list, names);
+    assert(full_list);
+    assert(gen4 > gen3);
+    assert(names.size() == 2);
+
+    uint64_t gen5 = list_services_since(fd, gen4, full_list, names);
+    assert(! full_list);
+    assert(gen5 == gen4);
+    assert(names.empty());
+
+    delete cc;
+}
+
+// Write handler which accepts only a limited amount of data (until the limit is raised), then
+// fails with EAGAIN, to simulate a socket buffer filling up.
+class limited_write_handler : public bp_sys::default_write_handler
+{
+    public:
+    size_t avail = 0;
+
+    ssize_t write(int fd, const void *buf, size_t count) override
+    {
+        if (avail == 0) {
+            errno = EAGAIN;
+            return -1;
+        }
+        size_t n = std::min(count, avail);
+        avail -= n;
+        return default_write_handler::write(fd, buf, n);
+    }
+};
+
+void cptest_listservices_large()
+{
+    service_set sset;
+
+    constexpr int num_services = 1000;
+    for (int i = 0; i < num_services; i++) {
+        std::string name = "test-service-" + std::to_string(i);
+        sset.add_service(new service_record(&sset, name, service_type_t::INTERNAL, {}));
+    }
+
+    limited_write_handler *whandler = new limited_write_handler();
+    whandler->avail = 1000;
+    int fd = bp_sys::allocfd(whandler);
+    auto *cc = new control_conn_t(event_loop, &sset, fd);
+
+    bp_sys::supply_read_data(fd, { DINIT_CP_LISTSERVICES });
+    event_loop.regd_bidi_watchers[fd]->read_ready(event_loop, fd);
+
+    // Only part of the output can be written immediately; the rest is written as the connection
+    // becomes writable:
+    const int hdrsize = 8 + std::max(sizeof(int), sizeof(pid_t));
+    size_t expected_size = 1; // LISTDONE
+    for (int i = 0; i < num_services; i++) {
+        expected_size += hdrsize + ("test-service-" + std::to_string(i)).length();
+    }
+
+    assert(whandler->data.size() == 1000);
+    for (int i = 0; i < 1000 && whandler->data.size() < expected_size; i++) {
+        whandler->avail = 3000;
+        event_loop.regd_bidi_watchers[fd]->write_ready(event_loop, fd);
+    }
+
+    std::vector<char> wdata;
+    bp_sys::extract_written_data(fd, wdata);
+    assert(wdata.size() == expected_size);
+
+    std::set<std::string> names;
+    size_t pos = 0;
+    for (int i = 0; i < num_services; i++) {
+        assert(wdata[pos] == DINIT_RP_SVCINFO);
+        unsigned char name_len_c = wdata[pos + 1];
+        pos += hdrsize;
+        names.insert(std::string(wdata.data() + pos, name_len_c));
+        pos += name_len_c;
+    }
+    assert(wdata[pos] == DINIT_RP_LISTDONE);
+    assert(names.size() == num_services);
+    assert(names.count("test-service-0") == 1 && names.count("test-service-999") == 1);
+
+    delete cc;
+}
+
+// A service state change record, received via subscription
+struct state_change_rec
+{
+    uint32_t id;
+    service_state_t old_state;
+    service_state_t new_state;
+    bool coalesced;
+};
+
+// Parse subscription packets (service name announcements and state changes)
+static void parse_state_changes(const std::vector<char> &wdata, std::map<uint32_t, std::string> &names,
+        std::vector<state_change_rec> &changes)
+{
+    size_t pos = 0;
+    while (pos < wdata.size()) {
+        unsigned char pkt_len = wdata[pos + 1];
+        assert(pos + pkt_len <= wdata.size());
+        uint32_t id;
+        memcpy(&id, wdata.data() + pos + 2, sizeof(id));
+        if (wdata[pos] == DINIT_IP_SERVICENAMEID) {
+            assert(names.count(id) == 0);
+            names[id] = std::string(wdata.data() + pos + 2 + sizeof(id), pkt_len - 2 - sizeof(id));
+        }
+        else {
+            assert(wdata[pos] == DINIT_IP_SERVICESTATE);
+            assert(pkt_len == 2 + sizeof(id) + 3 + sizeof(pid_t) + sizeof(uint64_t));
+            // the name must be announced first:
+            assert(names.count(id) == 1);
+            state_change_rec rec;
+            rec.id = id;
+            rec.old_state = static_cast<service_state_t>(wdata[pos + 2 + sizeof(id)]);
+            rec.new_state = static_cast<service_state_t>(wdata[pos + 3 + sizeof(id)]);
+            rec.coalesced = wdata[pos + 4 + sizeof(id)] != 0;
+            changes.push_back(rec);
+        }
+        pos += pkt_len;
+    }
+}
+
+void cptest_subscribeall()
+{
+    service_set sset;
+
+    service_record *s1 = new service_record(&sset, "test-service-1", service_type_t::INTERNAL, {});
+    sset.add_service(s1);
+    service_record *s2 = new service_record(&sset, "test-service-2", service_type_t::INTERNAL, {});
+    sset.add_service(s2);
+    service_record *s3 = new service_record(&sset, "test-service-3", service_type_t::INTERNAL, {});
+    sset.add_service(s3);
+
+    unsigned saved_limit = control_conn_t::buffer_limit;
+    control_conn_t::buffer_limit = 1024;
+
+    limited_write_handler *whandler = new limited_write_handler();
+    whandler->avail = 100000;
+    int fd = bp_sys::allocfd(whandler);
+    auto *cc = new control_conn_t(event_loop, &sset, fd);
+
+    bp_sys::supply_read_data(fd, { DINIT_CP_SUBSCRIBEALL, 1 });
+    event_loop.regd_bidi_watchers[fd]->read_ready(event_loop, fd);
+
+    std::vector<char> wdata;
+    bp_sys::extract_written_data(fd, wdata);
+    assert(wdata.size() == 1 && wdata[0] == DINIT_RP_ACK);
+
+    // Changes to any service are reported, without a handle:
+    sset.start_service(s1);
+    sset.stop_service(s1);
+
+    std::map<uint32_t, std::string> names;
+    std::vector<state_change_rec> changes;
+    bp_sys::extract_written_data(fd, wdata);
+    parse_state_changes(wdata, names, changes);
+
+    assert(names.size() == 1);
+    uint32_t s1_id = names.begin()->first;
+    assert(names[s1_id] == "test-service-1");
+    assert(changes.size() == 4);
+    service_state_t expected[] = { service_state_t::STOPPED, service_state_t::STARTING,
+            service_state_t::STARTED, service_state_t::STOPPING, service_state_t::STOPPED };
+    for (int i = 0; i < 4; i++) {
+        assert(changes[i].id == s1_id);
+        assert(changes[i].old_state == expected[i]);
+        assert(changes[i].new_state == expected[i + 1]);
+        assert(! changes[i].coalesced);
+    }
+
+    // Now simulate a slow client: changes should be coalesced, rather than buffered without limit.
+    whandler->avail = 0;
+    for (int i = 0; i < 1000; i++) {
+        sset.start_service(s2);
+        sset.stop_service(s2);
+        sset.start_service(s3);
+        sset.stop_service(s3);
+    }
+    sset.start_service(s3);
+
+    assert(whandler->data.empty());
+
+    whandler->avail = 100000;
+    event_loop.regd_bidi_watchers[fd]->write_ready(event_loop, fd);
+
+    bp_sys::extract_written_data(fd, wdata);
+    // buffer limit, plus (at most) one change for each service:
+    assert(wdata.size() < 1024 + 3 * 64);
+
+    changes.clear();
+    parse_state_changes(wdata, names, changes);
+    assert(names.size() == 3);
+
+    // The last change for each service must reflect its current state, and be marked coalesced:
+    std::map<uint32_t, state_change_rec> last_change;
+    for (auto &change : changes) {
+        last_change[change.id] = change;
+    }
+    for (auto &name_ent : names) {
+        if (name_ent.second == "test-service-2") {
+            assert(last_change[name_ent.first].new_state == service_state_t::STOPPED);
+            assert(last_change[name_ent.first].coalesced);
+        }
+        else if (name_ent.second == "test-service-3") {
+            assert(last_change[name_ent.first].new_state == service_state_t::STARTED);
+            assert(last_change[name_ent.first].coalesced);
+        }
+    }
+
+    // Once caught up, changes are again reported individually:
+    sset.stop_service(s3);
+    bp_sys::extract_written_data(fd, wdata);
+    changes.clear();
+    parse_state_changes(wdata, names, changes);
+    assert(changes.size() == 2);
+    assert(! changes[0].coalesced && ! changes[1].coalesced);
+    assert(changes[1].new_state == service_state_t::STOPPED);
+
+    // Unsubscribe:
+    bp_sys::supply_read_data(fd, { DINIT_CP_SUBSCRIBEALL, 0 });
+    event_loop.regd_bidi_watchers[fd]->read_ready(event_loop, fd);
+    bp_sys::extract_written_data(fd, wdata);
+    assert(wdata.size() == 1 && wdata[0] == DINIT_RP_ACK);
+
+    sset.start_service(s1);
+    bp_sys::extract_written_data(fd, wdata);
+    assert(wdata.empty());
+
+    delete cc;
+    control_conn_t::buffer_limit = saved_limit;
+}
+
+// Subscribed client which reads only part of the output each time: the queue of pending state
+// changes must remain bounded even though it never fully drains.
+void cptest_subscribeall_backpressure()
+{
+    service_set sset;
+
+    constexpr int num_services = 20;
+    std::vector<service_record *> services;
+    for (int i = 0; i < num_services; i++) {
+        std::string name = "test-service-" + std::to_string(i);
+        service_record *sr = new service_record(&sset, name, service_type_t::INTERNAL, {});
+        sset.add_service(sr);
+        services.push_back(sr);
+    }
+
+    unsigned saved_limit = control_conn_t::buffer_limit;
+    control_conn_t::buffer_limit = 1024;
+
+    limited_write_handler *whandler = new limited_write_handler();
+    whandler->avail = 100000;
+    int fd = bp_sys::allocfd(whandler);
+    auto *cc = new control_conn_t(event_loop, &sset, fd);
+
+    bp_sys::supply_read_data(fd, { DINIT_CP_SUBSCRIBEALL, 1 });
+    event_loop.regd_bidi_watchers[fd]->read_ready(event_loop, fd);
+
+    std::vector<char> wdata;
+    bp_sys::extract_written_data(fd, wdata);
+    assert(wdata.size() == 1 && wdata[0] == DINIT_RP_ACK);
+
+    whandler->avail = 0;
+    for (int round = 0; round < 200; round++) {
+        for (service_record *sr : services) {
+            sset.start_service(sr);
+            sset.stop_service(sr);
+        }
+        assert(control_conn_t_test::pending_event_count(cc) <= 2 * num_services);
+
+        // The client reads less than is produced in each round
+        whandler->avail = 200;
+        event_loop.regd_bidi_watchers[fd]->write_ready(event_loop, fd);
+        assert(control_conn_t_test::pending_event_count(cc) != 0);
+        assert(control_conn_t_test::pending_event_count(cc) <= 2 * num_services);
+    }
+
+    // Once the client catches up, all changes are delivered:
+    whandler->avail = 1000000;
+    event_loop.regd_bidi_watchers[fd]->write_ready(event_loop, fd);
+    assert(control_conn_t_test::pending_event_count(cc) == 0);
+
+    delete cc;
+    control_conn_t::buffer_limit = saved_limit;
+}
+
+// Service timeline, as read from a QUERYTIMELINE reply
+struct timeline_entry
+{
+    std::string name;
+    service_state_t state;
+    uint64_t times[NUM_TIMELINE_EVENTS];
+    std::vector<std::pair<uint32_t, dependency_type>> deps;
+};
+
+static std::vector<timeline_entry> query_timeline(int fd)
+{
+    bp_sys::supply_read_data(fd, { DINIT_CP_QUERYTIMELINE });
+    event_loop.regd_bidi_watchers[fd]->read_ready(event_loop, fd);
+
+    std::vector<char> wdata;
+    bp_sys::extract_written_data(fd, wdata);
+
+    assert(wdata[0] == DINIT_RP_TIMELINE);
+    uint32_t count;
+    memcpy(&count, wdata.data() + 1, sizeof(count));
+    size_t pos = 1 + sizeof(count) + sizeof(uint64_t);
+
+    std::vector<timeline_entry> entries(count);
+    for (auto &entry : entries) {
+        assert(wdata[pos] == DINIT_RP_SVCTIMELINE);
+        entry.state = static_cast<service_state_t>(wdata[pos + 1]);
+        uint16_t name_len;
+        uint32_t num_deps;
+        memcpy(&name_len, wdata.data() + pos + 2, sizeof(name_len));
+        memcpy(&num_deps, wdata.data() + pos + 2 + sizeof(name_len), sizeof(num_deps));
+        pos += 2 + sizeof(name_len) + sizeof(num_deps);
+        memcpy(entry.times, wdata.data() + pos, sizeof(entry.times));
+        pos += sizeof(entry.times);
+        entry.name = std::string(wdata.data() + pos, name_len);
+        pos += name_len;
+        for (uint32_t i = 0; i < num_deps; i++) {
+            uint32_t index;
+            memcpy(&index, wdata.data() + pos, sizeof(index));
+            entry.deps.emplace_back(index, static_cast<dependency_type>(wdata[pos + sizeof(index)]));
+            pos += sizeof(index) + 1;
+        }
+    }
+
+    assert(wdata[pos] == DINIT_RP_LISTDONE);
+    assert(wdata.size() == pos + 1);
+    return entries;
+}
+
+void cptest_querytimeline()
+{
+    service_set sset;
+
+    test_service *s1 = new test_service(&sset, "test-service-1", service_type_t::INTERNAL, {});
+    sset.add_service(s1);
+    test_service *s2 = new test_service(&sset, "test-service-2", service_type_t::INTERNAL,
+            {{s1, dependency_type::REGULAR}});
+    sset.add_service(s2);
+
+    int fd = bp_sys::allocfd();
+    auto *cc = new control_conn_t(event_loop, &sset, fd);
+
+    // Nothing recorded before any start:
+    auto entries = query_timeline(fd);
+    assert(entries.size() == 2);
+    for (auto &entry : entries) {
+        for (uint64_t t : entry.times) {
+            assert(t == 0);
+        }
+    }
+
+    constexpr uint64_t one_sec = 1000000000u;
+
+    time_val t0;
+    event_loop.get_time(t0, dasynq::clock_type::MONOTONIC);
+    uint64_t t0_ns = uint64_t(t0.seconds()) * one_sec + t0.nseconds();
+
+    // Start s2 (and s1) at t0+1s; s1 starts at t0+3s, s2 at t0+4s.
+    event_loop.advance_time(time_val(1, 0));
+    sset.start_service(s2);
+    event_loop.advance_time(time_val(2, 0));
+    s1->started();
+    sset.process_queues();
+    event_loop.advance_time(time_val(1, 0));
+    s2->started();
+    sset.process_queues();
+
+    std::vector<char> wdata;
+    bp_sys::extract_written_data(fd, wdata);
+
+    entries = query_timeline(fd);
+    assert(entries.size() == 2);
+
+    timeline_entry *e1 = &entries[0];
+    timeline_entry *e2 = &entries[1];
+    if (e1->name != "test-service-1") std::swap(e1, e2);
+    assert(e1->name == "test-service-1");
+    assert(e2->name == "test-service-2");
+
+    assert(e1->state == service_state_t::STARTED);
+    assert(e1->times[(int)timeline_event_t::REQUIRED] == t0_ns + one_sec);
+    assert(e1->times[(int)timeline_event_t::DEPS_STARTED] == t0_ns + one_sec);
+    assert(e1->times[(int)timeline_event_t::FORKED] == 0);
+    assert(e1->times[(int)timeline_event_t::STARTED] == t0_ns + 3 * one_sec);
+    assert(e1->deps.empty());
+
+    assert(e2->times[(int)timeline_event_t::REQUIRED] == t0_ns + one_sec);
+    assert(e2->times[(int)timeline_event_t::DEPS_STARTED] == t0_ns + 3 * one_sec);
+    assert(e2->times[(int)timeline_event_t::STARTED] == t0_ns + 4 * one_sec);
+    assert(e2->deps.size() == 1);
+    assert(&entries[e2->deps[0].first] == e1);
+    assert(e2->deps[0].second == dependency_type::REGULAR);
+
+    // A new start resets the timeline:
+    sset.stop_service(s2);
+    event_loop.advance_time(time_val(1, 0));
+    sset.start_service(s2);
+    sset.process_queues();
+
+    entries = query_timeline(fd);
+    e2 = (entries[0].name == "test-service-2") ? &entries[0] : &entries[1];
+    assert(e2->times[(int)timeline_event_t::REQUIRED] == t0_ns + 5 * one_sec);
+    assert(e2->times[(int)timeline_event_t::STARTED] == 0);
+
+    delete cc;
+}
+
+// A service with buffered output; output is supplied directly by the test.
+class log_test_service : public service_record
+{
+    service_log_buffer log_buf {16};
+    int output_fd;
+
+    public:
+    log_test_service(service_set *sset, std::string name)
+        : service_record(sset, name, service_type_t::INTERNAL, {})
+    {
+        output_fd = bp_sys::allocfd();
+    }
+
+    service_log_buffer *get_log_buffer() noexcept override
+    {
+        return &log_buf;
+    }
+
+    void add_output(std::vector<char> &&data)
+    {
+        bp_sys::supply_read_data(output_fd, std::move(data));
+        while (log_buf.fill(output_fd) > 0) { }
+        notify_log_output();
+    }
+};
+
+static std::vector<char> catlog_cmd(control_conn_t::handle_t handle, char flags, uint64_t from_pos)
+{
+    std::vector<char> cmd = { DINIT_CP_CATLOG, flags };
+    char *handle_cptr = reinterpret_cast<char *>(&handle);
+    cmd.insert(cmd.end(), handle_cptr, handle_cptr + sizeof(handle));
+    char *pos_cptr = reinterpret_cast<char *>(&from_pos);
+    cmd.insert(cmd.end(), pos_cptr, pos_cptr + sizeof(from_pos));
+    return cmd;
+}
+
+// Check a DINIT_RP_SERVICELOG reply at the given offset of wdata; returns the offset following it.
+static size_t check_log_reply(std::vector<char> &wdata, size_t offs, uint64_t exp_pos, uint64_t exp_end,
+        const std::string &exp_data)
+{
+    assert(wdata.size() >= offs + 2 + 2 * sizeof(uint64_t) + sizeof(uint32_t));
+    assert(wdata[offs] == DINIT_RP_SERVICELOG);
+    uint64_t pos, end_pos;
+    uint32_t len;
+    offs += 2;
+    memcpy(&pos, wdata.data() + offs, sizeof(pos));
+    offs += sizeof(pos);
+    memcpy(&end_pos, wdata.data() + offs, sizeof(end_pos));
+    offs += sizeof(end_pos);
+    memcpy(&len, wdata.data() + offs, sizeof(len));
+    offs += sizeof(len);
+    assert(pos == exp_pos);
+    assert(end_pos == exp_end);
+    assert(len == exp_data.size());
+    assert(wdata.size() >= offs + len);
+    assert(std::string(wdata.data() + offs, len) == exp_data);
+    return offs + len;
+}
+
+// Find a service via the control connection, returning the handle.
+static control_conn_t::handle_t find_service(int fd, const char *name)
+{
+    std::vector<char> cmd = { DINIT_CP_FINDSERVICE };
+    uint16_t name_len = strlen(name);
+    char *name_len_cptr = reinterpret_cast<char *>(&name_len);
+    cmd.insert(cmd.end(), name_len_cptr, name_len_cptr + sizeof(name_len));
+    cmd.insert(cmd.end(), name, name + name_len);
+    bp_sys::supply_read_data(fd, std::move(cmd));
+    event_loop.regd_bidi_watchers[fd]->read_ready(event_loop, fd);
+
+    std::vector<char> wdata;
+    bp_sys::extract_written_data(fd, wdata);
+    assert(wdata.size() == 3 + sizeof(control_conn_t::handle_t));
+    assert(wdata[0] == DINIT_RP_SERVICERECORD);
+
+    control_conn_t::handle_t handle;
+    memcpy(&handle, wdata.data() + 2, sizeof(handle));
+    return handle;
+}
+
+void cptest_catlog()
+{
+    service_set sset;
+
+    const char * const service_name = "test-service-1";
+    log_test_service *s1 = new log_test_service(&sset, service_name);
+    sset.add_service(s1);
+    service_record *s2 = new service_record(&sset, "test-service-2", service_type_t::INTERNAL, {});
+    sset.add_service(s2);
+
+    int fd = bp_sys::allocfd();
+    auto *cc = new control_conn_t(event_loop, &sset, fd);
+
+    control_conn_t::handle_t h1 = find_service(fd, service_name);
+    control_conn_t::handle_t h2 = find_service(fd, "test-service-2");
+
+    // Read the available output:
+    s1->add_output({'h', 'e', 'l', 'l', 'o', ' '});
+    bp_sys::supply_read_data(fd, catlog_cmd(h1, 0, 0));
+    event_loop.regd_bidi_watchers[fd]->read_ready(event_loop, fd);
+
+    std::vector<char> wdata;
+    bp_sys::extract_written_data(fd, wdata);
+    assert(check_log_reply(wdata, 0, 0, 6, "hello ") == wdata.size());
+
+    // Wait for more output; a following request is not processed until the wait completes:
+    std::vector<char> cmd = catlog_cmd(h1, 2, 6);
+    cmd.push_back(DINIT_CP_QUERYVERSION);
+    bp_sys::supply_read_data(fd, std::move(cmd));
+    event_loop.regd_bidi_watchers[fd]->read_ready(event_loop, fd);
+
+    wdata.clear();
+    bp_sys::extract_written_data(fd, wdata);
+    assert(wdata.empty());
+
+    s1->add_output({'w', 'o', 'r', 'l', 'd'});
+    event_loop.regd_bidi_watchers[fd]->write_ready(event_loop, fd);
+
+    bp_sys::extract_written_data(fd, wdata);
+    size_t offs = check_log_reply(wdata, 0, 6, 11, "world");
+    assert(wdata.size() == offs + 5);
+    assert(wdata[offs] == DINIT_RP_CPVERSION);
+
+    // Output which has been overwritten is skipped, and output can be discarded once read:
+    std::vector<char> more_output;
+    for (char c = 'a'; c <= 't'; c++) more_output.push_back(c);
+    s1->add_output(std::move(more_output));
+    bp_sys::supply_read_data(fd, catlog_cmd(h1, 1, 11));
+    event_loop.regd_bidi_watchers[fd]->read_ready(event_loop, fd);
+
+    wdata.clear();
+    bp_sys::extract_written_data(fd, wdata);
+    assert(check_log_reply(wdata, 0, 15, 31, "efghijklmnopqrst") == wdata.size());
+
+    bp_sys::supply_read_data(fd, catlog_cmd(h1, 0, 0));
+    event_loop.regd_bidi_watchers[fd]->read_ready(event_loop, fd);
+
+    wdata.clear();
+    bp_sys::extract_written_data(fd, wdata);
+    assert(check_log_reply(wdata, 0, 31, 31, "") == wdata.size());
+
+    // A service without buffered output:
+    bp_sys::supply_read_data(fd, catlog_cmd(h2, 0, 0));
+    event_loop.regd_bidi_watchers[fd]->read_ready(event_loop, fd);
+
+    wdata.clear();
+    bp_sys::extract_written_data(fd, wdata);
+    assert(wdata.size() == 1);
+    assert(wdata[0] == DINIT_RP_NAK);
+
+    delete cc;
+}
+
+void cptest_queryloopstats()
+{
+    service_set sset;
+
+    int fd = bp_sys::allocfd();
+    auto *cc = new control_conn_t(event_loop, &sset, fd);
+
+    // Statistics not available (instrumentation not enabled):
+    event_loop.stats_enabled = false;
+    bp_sys::supply_read_data(fd, { DINIT_CP_QUERYLOOPSTATS, 0 });
+    event_loop.regd_bidi_watchers[fd]->read_ready(event_loop, fd);
+
+    std::vector<char> wdata;
+    bp_sys::extract_written_data(fd, wdata);
+    assert(wdata.size() == 1);
+    assert(wdata[0] == DINIT_RP_NAK);
+
+    event_loop.stats_enabled = true;
+    event_loop.stats = dasynq::loop_stats();
+    event_loop.stats.batch_size.record(3);
+    event_loop.stats.dispatch_latency[STATS_CONTROL].record(1500);
+    event_loop.stats.callback_time[STATS_CONTROL].record(20000);
+    event_loop.stats.callback_time[STATS_CONTROL].record(40000);
+
+    // Query and reset:
+    bp_sys::supply_read_data(fd, { DINIT_CP_QUERYLOOPSTATS, 1 });
+    event_loop.regd_bidi_watchers[fd]->read_ready(event_loop, fd);
+
+    constexpr unsigned num_cats = dasynq::STATS_CATEGORIES;
+    constexpr unsigned num_buckets = dasynq::stats_histogram::num_buckets;
+    constexpr size_t hist_size = (3 + num_buckets) * sizeof(uint64_t);
+
+    wdata.clear();
+    bp_sys::extract_written_data(fd, wdata);
+    assert(wdata.size() == 3 + (1 + 2 * num_cats) * hist_size);
+    assert(wdata[0] == DINIT_RP_LOOPSTATS);
+    assert((unsigned char)wdata[1] == num_cats);
+    assert((unsigned char)wdata[2] == num_buckets);
+
+    // Extract a value from histogram n (count = 0, total = 1, max = 2, buckets from 3):
+    auto hist_value = [&](unsigned n, unsigned i) -> uint64_t {
+        uint64_t v;
+        memcpy(&v, wdata.data() + 3 + n * hist_size + i * sizeof(uint64_t), sizeof(v));
+        return v;
+    };
+
+    // batch size: one batch of 3 (bucket 1, i.e. 2-3):
+    assert(hist_value(0, 0) == 1);
+    assert(hist_value(0, 1) == 3);
+    assert(hist_value(0, 3 + 1) == 1);
+
+    // dispatch latency (control):
+    assert(hist_value(1 + STATS_CONTROL, 0) == 1);
+    assert(hist_value(1 + STATS_CONTROL, 2) == 1500);
+    assert(hist_value(1 + dasynq::STATS_TIMER, 0) == 0);
+
+    // callback time (control):
+    unsigned cb_hist = 1 + num_cats + STATS_CONTROL;
+    assert(hist_value(cb_hist, 0) == 2);
+    assert(hist_value(cb_hist, 1) == 60000);
+    assert(hist_value(cb_hist, 2) == 40000);
+    assert(hist_value(cb_hist, 3 + 14) == 1);  // 20000: 2^14 - 2^15
+    assert(hist_value(cb_hist, 3 + 15) == 1);  // 40000: 2^15 - 2^16
+
+    // Statistics have been reset:
+    assert(event_loop.stats.batch_size.count == 0);
+    assert(event_loop.stats.callback_time[STATS_CONTROL].count == 0);
+
+    event_loop.stats_enabled = false;
+    delete cc;
+}
+
 void cptest_findservice1()
 {
     service_set sset;
@@ -505,6 +1245,238 @@ void cptest_gentlestop()
     delete cc;
 }
 
+void cptest_batchstartstop()
+{
+    service_set sset;
+
+    const char * const service_names[] = { "test-service-1", "test-service-2", "no-such-service" };
+
+    service_record *s1 = new service_record(&sset, service_names[0], service_type_t::INTERNAL, {});
+    sset.add_service(s1);
+    service_record *s2 = new service_record(&sset, service_names[1], service_type_t::INTERNAL,
+            {{s1, dependency_type::REGULAR}});
+    sset.add_service(s2);
+
+    int fd = bp_sys::allocfd();
+    auto *cc = new control_conn_t(event_loop, &sset, fd);
+
+    auto make_batch_cmd = [&](char command, char flags, std::initializer_list<const char *> names) {
+        std::vector<char> cmd = { DINIT_CP_BATCHSTARTSTOP, command, flags };
+        std::vector<char> name_data;
+        for (const char *name : names) {
+            uint16_t name_len = strlen(name);
+            char *name_len_cptr = reinterpret_cast<char *>(&name_len);
+            name_data.insert(name_data.end(), name_len_cptr, name_len_cptr + sizeof(name_len));
+            name_data.insert(name_data.end(), name, name + name_len);
+        }
+        uint16_t count = names.size();
+        uint16_t data_len = name_data.size();
+        cmd.insert(cmd.end(), (char *)&count, (char *)&count + sizeof(count));
+        cmd.insert(cmd.end(), (char *)&data_len, (char *)&data_len + sizeof(data_len));
+        cmd.insert(cmd.end(), name_data.begin(), name_data.end());
+        return cmd;
+    };
+
+    constexpr int entry_size = 2 + sizeof(control_conn_t::handle_t);
+    constexpr int ip_size = 3 + sizeof(control_conn_t::handle_t);
+
+    // Start all three; s2 and s1 start immediately, the third doesn't exist:
+    bp_sys::supply_read_data(fd, make_batch_cmd(DINIT_CP_STARTSERVICE, 0,
+            { service_names[1], service_names[0], service_names[2] }));
+    event_loop.regd_bidi_watchers[fd]->read_ready(event_loop, fd);
+
+    std::vector<char> wdata;
+    bp_sys::extract_written_data(fd, wdata);
+
+    // Two info packets (STARTED events) and then the batch reply:
+    assert(s1->get_state() == service_state_t::STARTED);
+    assert(s2->get_state() == service_state_t::STARTED);
+    assert(wdata.size() == 2 * ip_size + 3 + 3 * entry_size);
+    assert(wdata[0] == DINIT_IP_SERVICEEVENT);
+    assert(wdata[ip_size] == DINIT_IP_SERVICEEVENT);
+
+    const char *reply = wdata.data() + 2 * ip_size;
+    assert(reply[0] == DINIT_RP_BATCHRESULT);
+    uint16_t count;
+    memcpy(&count, reply + 1, sizeof(count));
+    assert(count == 3);
+
+    const char *entry = reply + 3;
+    control_conn_t::handle_t h1, h2;
+    assert(entry[0] == DINIT_RP_ALREADYSS);
+    memcpy(&h2, entry + 1, sizeof(h2));
+    assert(control_conn_t_test::service_from_handle(cc, h2) == s2);
+    entry += entry_size;
+    assert(entry[0] == DINIT_RP_ALREADYSS);
+    memcpy(&h1, entry + 1, sizeof(h1));
+    assert(control_conn_t_test::service_from_handle(cc, h1) == s1);
+    assert(static_cast<service_state_t>(entry[1 + sizeof(h1)]) == service_state_t::STARTED);
+    entry += entry_size;
+    assert(entry[0] == DINIT_RP_NOSERVICE);
+
+    // Gentle stop of s1 alone fails, due to its dependent (s2):
+    bp_sys::supply_read_data(fd, make_batch_cmd(DINIT_CP_STOPSERVICE, 2, { service_names[0] }));
+    event_loop.regd_bidi_watchers[fd]->read_ready(event_loop, fd);
+    bp_sys::extract_written_data(fd, wdata);
+
+    assert(wdata.size() == 3 + entry_size);
+    assert(wdata[0] == DINIT_RP_BATCHRESULT);
+    assert(wdata[3] == DINIT_RP_DEPENDENTS);
+    assert(s1->get_state() == service_state_t::STARTED);
+
+    // Gentle stop of both succeeds:
+    bp_sys::supply_read_data(fd, make_batch_cmd(DINIT_CP_STOPSERVICE, 2,
+            { service_names[0], service_names[1] }));
+    event_loop.regd_bidi_watchers[fd]->read_ready(event_loop, fd);
+    bp_sys::extract_written_data(fd, wdata);
+
+    assert(s1->get_state() == service_state_t::STOPPED);
+    assert(s2->get_state() == service_state_t::STOPPED);
+    assert(wdata.size() == 2 * ip_size + 3 + 2 * entry_size);
+    reply = wdata.data() + 2 * ip_size;
+    assert(reply[0] == DINIT_RP_BATCHRESULT);
+    assert(reply[3] == DINIT_RP_ALREADYSS);
+    assert(reply[3 + entry_size] == DINIT_RP_ALREADYSS);
+
+    // A count inconsistent with the name data is a bad request:
+    std::vector<char> cmd = make_batch_cmd(DINIT_CP_STARTSERVICE, 0, { service_names[0] });
+    cmd[3] = 2;
+    bp_sys::supply_read_data(fd, std::move(cmd));
+    event_loop.regd_bidi_watchers[fd]->read_ready(event_loop, fd);
+    bp_sys::extract_written_data(fd, wdata);
+
+    assert(wdata.size() == 1);
+    assert(wdata[0] == DINIT_RP_BADREQ);
+
+    delete cc;
+}
+
+// Append a FINDSERVICE request for the named service to a buffer
+static void append_find_cmd(std::vector<char> &buf, const std::string &name)
+{
+    buf.push_back(DINIT_CP_FINDSERVICE);
+    uint16_t name_len = name.length();
+    char *name_len_cptr = reinterpret_cast<char *>(&name_len);
+    buf.insert(buf.end(), name_len_cptr, name_len_cptr + sizeof(name_len));
+    buf.insert(buf.end(), name.begin(), name.end());
+}
+
+void cptest_pipelined()
+{
+    service_set sset;
+
+    service_record *s1 = new service_record(&sset, "test-service-1", service_type_t::INTERNAL, {});
+    sset.add_service(s1);
+
+    int fd = bp_sys::allocfd();
+    auto *cc = new control_conn_t(event_loop, &sset, fd);
+
+    // Several requests, received together, should all be processed:
+    std::vector<char> cmd = { DINIT_CP_QUERYVERSION };
+    append_find_cmd(cmd, "test-service-1");
+    append_find_cmd(cmd, "no-such-service");
+    cmd.push_back(DINIT_CP_QUERYVERSION);
+
+    bp_sys::supply_read_data(fd, std::move(cmd));
+    bp_sys::set_blocking(fd);
+    event_loop.regd_bidi_watchers[fd]->read_ready(event_loop, fd);
+
+    std::vector<char> wdata;
+    bp_sys::extract_written_data(fd, wdata);
+
+    assert(wdata.size() == 5 + (3 + sizeof(control_conn_t::handle_t)) + 1 + 5);
+    assert(wdata[0] == DINIT_RP_CPVERSION);
+    assert(wdata[5] == DINIT_RP_SERVICERECORD);
+    assert(wdata[5 + 3 + sizeof(control_conn_t::handle_t)] == DINIT_RP_NOSERVICE);
+    assert(wdata[5 + 3 + sizeof(control_conn_t::handle_t) + 1] == DINIT_RP_CPVERSION);
+
+    // A request larger than the initial buffer size (a batch start of many services):
+    std::vector<char> name_data;
+    constexpr uint16_t batch_count = 200;
+    for (int i = 0; i < batch_count; i++) {
+        const char *name = (i % 2 == 0) ? "test-service-1" : "no-such-service";
+        uint16_t name_len = strlen(name);
+        name_data.insert(name_data.end(), (char *)&name_len, (char *)&name_len + sizeof(name_len));
+        name_data.insert(name_data.end(), name, name + name_len);
+    }
+    assert(name_data.size() > control_inbuf::initial_size);
+    uint16_t data_len = name_data.size();
+    cmd = { DINIT_CP_BATCHSTARTSTOP, DINIT_CP_STARTSERVICE, 0 };
+    cmd.insert(cmd.end(), (const char *)&batch_count, (const char *)&batch_count + sizeof(batch_count));
+    cmd.insert(cmd.end(), (char *)&data_len, (char *)&data_len + sizeof(data_len));
+    cmd.insert(cmd.end(), name_data.begin(), name_data.end());
+
+    bp_sys::supply_read_data(fd, std::move(cmd));
+    for (int i = 0; i < 10; i++) {
+        event_loop.regd_bidi_watchers[fd]->read_ready(event_loop, fd);
+    }
+
+    bp_sys::extract_written_data(fd, wdata);
+    assert(s1->get_state() == service_state_t::STARTED);
+    // (STARTED event, then the batch reply)
+    size_t reply_pos = 3 + sizeof(control_conn_t::handle_t);
+    assert(wdata.size() == reply_pos + 3 + batch_count * (2 + sizeof(control_conn_t::handle_t)));
+    assert(wdata[reply_pos] == DINIT_RP_BATCHRESULT);
+
+    delete cc;
+}
+
+void cptest_outputlimit()
+{
+    service_set sset;
+
+    service_record *s1 = new service_record(&sset, "test-service-1", service_type_t::INTERNAL, {});
+    sset.add_service(s1);
+
+    unsigned saved_limit = control_conn_t::buffer_limit;
+    control_conn_t::buffer_limit = 1024;
+
+    limited_write_handler *whandler = new limited_write_handler();
+    int fd = bp_sys::allocfd(whandler);
+    auto *cc = new control_conn_t(event_loop, &sset, fd);
+
+    // Supply many requests, while the client isn't reading replies:
+    constexpr int num_requests = 400;
+    constexpr int reply_size = 3 + sizeof(control_conn_t::handle_t);
+    std::vector<char> cmd;
+    for (int i = 0; i < num_requests; i++) {
+        append_find_cmd(cmd, "test-service-1");
+    }
+    bp_sys::supply_read_data(fd, std::move(cmd));
+    bp_sys::set_blocking(fd);
+
+    for (int i = 0; i < num_requests; i++) {
+        event_loop.regd_bidi_watchers[fd]->read_ready(event_loop, fd);
+    }
+
+    // Processing should have stopped once the pending output reached the limit:
+    assert(whandler->data.empty());
+    int handles_allocated = 0;
+    while (control_conn_t_test::service_from_handle(cc, handles_allocated) != nullptr) {
+        handles_allocated++;
+    }
+    assert(handles_allocated < num_requests);
+    assert(handles_allocated * reply_size >= 1024);
+    assert(handles_allocated * reply_size < 1024 + reply_size);
+
+    // Once the client reads, processing resumes:
+    for (int i = 0; i < 100 && whandler->data.size() < num_requests * reply_size; i++) {
+        whandler->avail = 1000;
+        event_loop.regd_bidi_watchers[fd]->write_ready(event_loop, fd);
+        event_loop.regd_bidi_watchers[fd]->read_ready(event_loop, fd);
+    }
+
+    std::vector<char> wdata;
+    bp_sys::extract_written_data(fd, wdata);
+    assert(wdata.size() == num_requests * reply_size);
+    for (int i = 0; i < num_requests; i++) {
+        assert(wdata[i * reply_size] == DINIT_RP_SERVICERECORD);
+    }
+
+    delete cc;
+    control_conn_t::buffer_limit = saved_limit;
+}
+
 void cptest_queryname()
 {
     service_set sset;
@@ -706,6 +1678,94 @@ void cptest_unload()
     delete cc;
 }
 
+void cptest_handles()
+{
+    service_set sset;
+
+    constexpr int num_services = 2000;
+    std::vector<service_record *> records;
+    for (int i = 0; i < num_services; i++) {
+        std::string name = "test-service-" + std::to_string(i);
+        service_record *sr = new service_record(&sset, name, service_type_t::INTERNAL, {});
+        sset.add_service(sr);
+        records.push_back(sr);
+    }
+
+    int fd = bp_sys::allocfd();
+    auto *cc = new control_conn_t(event_loop, &sset, fd);
+
+    // Get a handle for each service (twice, for the first service):
+    std::vector<char> cmd;
+    append_find_cmd(cmd, "test-service-0");
+    for (int i = 0; i < num_services; i++) {
+        append_find_cmd(cmd, "test-service-" + std::to_string(i));
+    }
+    bp_sys::supply_read_data(fd, std::move(cmd));
+    bp_sys::set_blocking(fd);
+    for (int i = 0; i < 100; i++) {
+        event_loop.regd_bidi_watchers[fd]->read_ready(event_loop, fd);
+    }
+
+    constexpr int reply_size = 3 + sizeof(control_conn_t::handle_t);
+    std::vector<char> wdata;
+    bp_sys::extract_written_data(fd, wdata);
+    assert(wdata.size() == (num_services + 1) * reply_size);
+
+    std::vector<control_conn_t::handle_t> handles;
+    std::set<control_conn_t::handle_t> unique_handles;
+    for (int i = 0; i < num_services + 1; i++) {
+        assert(wdata[i * reply_size] == DINIT_RP_SERVICERECORD);
+        control_conn_t::handle_t h;
+        memcpy(&h, wdata.data() + i * reply_size + 2, sizeof(h));
+        handles.push_back(h);
+        unique_handles.insert(h);
+        assert(control_conn_t_test::service_from_handle(cc, h) == records[i == 0 ? 0 : i - 1]);
+    }
+    assert(unique_handles.size() == num_services + 1);
+
+    // A service event is reported via each handle for the service:
+    sset.start_service(records[0]);
+    sset.process_queues();
+    bp_sys::extract_written_data(fd, wdata);
+    assert(wdata.size() == 2 * (3 + sizeof(control_conn_t::handle_t)));
+    std::set<control_conn_t::handle_t> event_handles;
+    for (int i = 0; i < 2; i++) {
+        int pos = i * (3 + sizeof(control_conn_t::handle_t));
+        assert(wdata[pos] == DINIT_IP_SERVICEEVENT);
+        control_conn_t::handle_t h;
+        memcpy(&h, wdata.data() + pos + 2, sizeof(h));
+        event_handles.insert(h);
+    }
+    assert(event_handles.count(handles[0]) == 1 && event_handles.count(handles[1]) == 1);
+
+    // Unload a service; its handle becomes invalid:
+    control_conn_t::handle_t h_unload = handles[10];
+    cmd = { DINIT_CP_UNLOADSERVICE };
+    char *h_cp = reinterpret_cast<char *>(&h_unload);
+    cmd.insert(cmd.end(), h_cp, h_cp + sizeof(h_unload));
+    bp_sys::supply_read_data(fd, std::move(cmd));
+    event_loop.regd_bidi_watchers[fd]->read_ready(event_loop, fd);
+    bp_sys::extract_written_data(fd, wdata);
+    assert(wdata.size() == 1 && wdata[0] == DINIT_RP_ACK);
+    assert(control_conn_t_test::service_from_handle(cc, h_unload) == nullptr);
+
+    // A new handle does not match the stale handle:
+    cmd.clear();
+    append_find_cmd(cmd, "test-service-1");
+    bp_sys::supply_read_data(fd, std::move(cmd));
+    event_loop.regd_bidi_watchers[fd]->read_ready(event_loop, fd);
+    bp_sys::extract_written_data(fd, wdata);
+    assert(wdata.size() == reply_size);
+    control_conn_t::handle_t h_new;
+    memcpy(&h_new, wdata.data() + 2, sizeof(h_new));
+    assert(h_new != h_unload);
+    assert(unique_handles.count(h_new) == 0);
+    assert(control_conn_t_test::service_from_handle(cc, h_new) == records[1]);
+    assert(control_conn_t_test::service_from_handle(cc, h_unload) == nullptr);
+
+    delete cc;
+}
+
 void cptest_addrmdeps()
 {
     service_set sset;
@@ -1112,14 +2172,25 @@ int main(int argc, char **argv)
 {
     RUN_TEST(cptest_queryver, "           ");
     RUN_TEST(cptest_listservices, "       ");
+    RUN_TEST(cptest_listservicessince, "  ");
+    RUN_TEST(cptest_listservices_large, " ");
+    RUN_TEST(cptest_subscribeall, "       ");
+    RUN_TEST(cptest_subscribeall_backpressure, "");
+    RUN_TEST(cptest_querytimeline, "      ");
+    RUN_TEST(cptest_catlog, "             ");
+    RUN_TEST(cptest_queryloopstats, "     ");
     RUN_TEST(cptest_findservice1, "       ");
     RUN_TEST(cptest_findservice2, "       ");
     RUN_TEST(cptest_findservice3, "       ");
     RUN_TEST(cptest_loadservice, "        ");
     RUN_TEST(cptest_startstop, "          ");
     RUN_TEST(cptest_gentlestop, "         ");
+    RUN_TEST(cptest_batchstartstop, "     ");
+    RUN_TEST(cptest_pipelined, "          ");
+    RUN_TEST(cptest_outputlimit, "        ");
     RUN_TEST(cptest_queryname, "          ");
     RUN_TEST(cptest_unload, "             ");
+    RUN_TEST(cptest_handles, "            ");
     RUN_TEST(cptest_addrmdeps, "          ");
     RUN_TEST(cptest_enableservice, "      ");
     RUN_TEST(cptest_restart, "            ");
@@ -0,0 +1,383 @@
+#ifndef DINIT_CONTROL_H
+#define DINIT_CONTROL_H
+
+#include <list>
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <map>
+#include <limits>
+#include <cstddef>
+
+#include <unistd.h>
+
+#include "dinit.h"
+#include "dinit-log.h"
+#include "control-cmds.h"
+#include "service-listener.h"
+#include "cpbuffer.h"
+#include "control-inbuf.h"
+#include "control-outbuf.h"
+#include "control-handles.h"
+#include "log-buffer.h"
+
+// Control connection for dinit
+
+class control_conn_t;
+class control_conn_watcher;
+
+// forward-declaration of callback:
+inline dasynq::rearm control_conn_cb(eventloop_t *loop, control_conn_watcher *watcher, int revents);
+
+// Pointer to the control connection that is listening for rollback completion
+extern control_conn_t * rollback_handler_conn;
+
+extern int active_control_conns;
+
+// "packet" format:
+// (1 byte) packet type
+// (N bytes) additional data (service name, etc)
+//   for LOADSERVICE/FINDSERVICE:
+//      (2 bytes) service name length
+//      (M bytes) service name (without nul terminator)
+
+//   for BATCHSTARTSTOP:
+//      (1 byte) command: DINIT_CP_STARTSERVICE or DINIT_CP_STOPSERVICE
+//      (1 byte) flags: 1 = pin in requested state, 2 = gentle stop (fail if dependents)
+//      (2 bytes) number of services
+//      (2 bytes) length of following name data
+//      for each service: (2 bytes) service name length, (M bytes) service name
+
+//   for LISTSERVICESSINCE:
+//      (8 bytes) state generation (as returned by a previous LISTSERVICESSINCE, or 0)
+
+//   for SUBSCRIBEALL:
+//      (1 byte) 1 = subscribe, 0 = unsubscribe
+
+//   for CATLOG:
+//      (1 byte) flags: 1 = discard returned output, 2 = wait for output
+//      (4 bytes) service handle
+//      (8 bytes) stream position from which to read
+
+//   for QUERYLOOPSTATS:
+//      (1 byte) flags: 1 = reset statistics
+
+//   for QUERYSTATUSTEXT:
+//      (4 bytes) service handle
+
+// Information packet:
+// (1 byte) packet type, >= 100
+// (1 byte) packet length (including all fields)
+//       N bytes: packet data (N = (length - 2))
+
+class service_set;
+class service_record;
+
+class control_conn_watcher : public eventloop_t::bidi_fd_watcher_impl<control_conn_watcher>
+{
+    inline rearm receive_event(eventloop_t &loop, int fd, int flags) noexcept
+    {
+        return control_conn_cb(&loop, this, flags);
+    }
+
+    eventloop_t * event_loop;
+
+    public:
+    control_conn_watcher(eventloop_t & event_loop_p) : event_loop(&event_loop_p)
+    {
+        set_stats_category(STATS_CONTROL);
+    }
+
+    control_conn_watcher(const control_conn_watcher &) = delete;
+    void operator=(const control_conn_watcher &) = delete;
+
+    rearm read_ready(eventloop_t &loop, int fd) noexcept
+    {
+        return receive_event(loop, fd, dasynq::IN_EVENTS);
+    }
+    
+    rearm write_ready(eventloop_t &loop, int fd) noexcept
+    {
+        return receive_event(loop, fd, dasynq::OUT_EVENTS);
+    }
+
+    void set_watches(int flags)
+    {
+        eventloop_t::bidi_fd_watcher::set_watches(*event_loop, flags);
+    }
+};
+
+class control_conn_t : private service_listener, private service_set_listener
+{
+    friend rearm control_conn_cb(eventloop_t *loop, control_conn_watcher *watcher, int revents);
+    friend class control_conn_t_test;
+    
+    public:
+    // A mapping between service records and their associated numerical identifier used
+    // in communction
+    using handle_t = control_handle_table::handle_t;
+
+    // Per-connection buffer limit. The receive buffer will not grow beyond this size (so it
+    // limits the size of a request); no further requests are processed while the amount of
+    // output waiting to be sent exceeds it. (Must be set before connections are created).
+    static unsigned buffer_limit;
+
+    private:
+    control_conn_watcher iob;
+    eventloop_t &loop;
+    service_set *services;
+    
+    bool bad_conn_close = false; // close when finished output?
+    bool oom_close = false;      // send final 'out of memory' indicator
+
+    // The packet length before we need to re-check if the packet is complete.
+    // process_packet() will not be called until the packet reaches this size.
+    int chklen;
+    
+    // Receive buffer
+    control_inbuf rbuf;
+    
+    template <typename T> using list = std::list<T>;
+    template <typename T> using vector = std::vector<T>;
+    
+    // Service handles allocated to this connection
+    control_handle_table handles;
+    
+    // Buffer for outgoing packets.
+    control_outbuf outbuf;
+
+    // A service state change, not yet sent to a subscribed client
+    struct state_event
+    {
+        uint32_t service_id;
+        service_state_t old_state;
+        service_state_t new_state;
+        bool coalesced;         // whether intermediate state changes were dropped
+        pid_t pid;
+        uint64_t timestamp;
+        std::string name;       // service name, if not yet sent to the client
+    };
+
+    // Whether subscribed to state changes for all services
+    bool subscribed_all = false;
+
+    // Service identifiers for which the service name has been sent (to a subscribed client)
+    std::vector<bool> announced_ids;
+
+    // State changes waiting to be sent, in order (from pending_head), with an index by service
+    // identifier. When the client is slow to read and output has reached the buffer limit, state
+    // changes are queued here, with further changes for a service which already has a pending
+    // state change being merged into it; the queue therefore holds at most one change per service.
+    // Sent changes (before pending_head) are discarded once they make up half the queue.
+    std::vector<state_event> pending_events;
+    size_t pending_head = 0;
+    std::unordered_map<uint32_t, size_t> pending_index;
+
+    // A CATLOG request waiting for output from a service (log_wait_service is nullptr if none).
+    // While a request is waiting, no further requests are processed.
+    service_record *log_wait_service = nullptr;
+    uint64_t log_wait_pos;
+    char log_wait_flags;
+
+    // Whether output is being deferred (while processing received packets). When deferred,
+    // queued packets are not written immediately but are written together (via writev) once
+    // processing is complete.
+    bool defer_output = false;
+
+    // Queue a packet to be sent
+    //  Returns:  false if the packet could not be queued and a suitable error packet
+    //              could not be sent/queued (the connection should be closed);
+    //            true (with bad_conn_close == false) if the packet was successfully
+    //              queued;
+    //            true (with bad_conn_close == true) if the packet was not successfully
+    //              queued (but a suitable error packet has been queued).
+    // The in/out watch enabled state will also be set appropriately.
+    bool queue_packet(vector<char> &&v) noexcept;
+    bool queue_packet(const char *pkt, unsigned size) noexcept;
+    bool queue_packet(std::initializer_list<control_outbuf::part> parts) noexcept;
+
+    // Write as much buffered output as possible. Returns false if a write error occurred (the
+    // connection should be closed).
+    bool write_output() noexcept;
+
+    // Process all complete packets in the receive buffer (while the output buffer is below the
+    // limit), write the resulting output, and set watches appropriately. Returns true if the
+    // connection should be closed.
+    bool process_packets() noexcept;
+
+    // Set the in/out watches according to connection state and buffer contents.
+    void set_io_watches() noexcept;
+
+    // Process a packet.
+    //  Returns:  true (with bad_conn_close == false) if successful
+    //            true (with bad_conn_close == true) if an error packet was queued
+    //            false if an error occurred but no error packet could be queued
+    //                (connection should be closed).
+    // Throws:
+    //    std::bad_alloc - if an out-of-memory condition prevents processing
+    bool process_packet();
+    
+    // Process a STARTSERVICE/STOPSERVICE packet. May throw std::bad_alloc.
+    bool process_start_stop(int pktType);
+    
+    // Process a FINDSERVICE/LOADSERVICE packet. May throw std::bad_alloc.
+    bool process_find_load(int pktType);
+
+    // Process a BATCHSTARTSTOP packet. May throw std::bad_alloc.
+    bool process_batch_start_stop();
+
+    // Process an UNPINSERVICE packet. May throw std::bad_alloc.
+    bool process_unpin_service();
+    
+    // Process an UNLOADSERVICE packet.
+    bool process_unload_service();
+
+    // Process a RELOADSERVICE packet. May throw std::bad_alloc.
+    bool process_reload_service();
+
+    // Process a QUERYSERVICENAME packet.
+    bool process_query_name();
+
+    // List all loaded services and their state.
+    bool list_services();
+
+    // List services which have changed state since a given state generation.
+    bool list_services_since();
+
+    // Queue a SVCINFO packet for a service. Returns false if the connection should be closed.
+    bool queue_svc_info(service_record *sptr);
+
+    // List the start timeline (and dependencies) of all services.
+    bool list_timeline();
+
+    // Process a SUBSCRIBEALL packet.
+    bool process_subscribe_all();
+
+    // Process a CATLOG packet. May throw std::bad_alloc.
+    bool process_catlog();
+
+    // Process a QUERYLOOPSTATS packet.
+    bool process_query_loop_stats();
+
+    // Process a QUERYSTATUSTEXT packet.
+    bool process_query_status_text();
+
+    // Queue a SERVICELOG reply with buffered output from the given position. May throw
+    // std::bad_alloc.
+    bool queue_log_output(service_log_buffer *log_buf, uint64_t from_pos, char flags);
+
+    // Queue a state change packet (preceded by the service name, if not yet sent). May throw
+    // std::bad_alloc.
+    void queue_state_event(state_event &event);
+
+    // Queue pending state changes, while the output buffer is below the limit.
+    void flush_state_events() noexcept;
+
+    // Discard pending state changes.
+    void clear_state_events() noexcept
+    {
+        pending_events.clear();
+        pending_index.clear();
+        pending_head = 0;
+    }
+
+    // Add a dependency between two services.
+    bool add_service_dep(bool do_start = false);
+
+    // Remove a dependency between two services.
+    bool rm_service_dep();
+
+    // Query service path / load mechanism.
+    bool query_load_mech();
+
+    // Notify that data is ready to be read from the socket. Returns true if the connection should
+    // be closed.
+    bool data_ready() noexcept;
+    
+    bool send_data() noexcept;
+    
+    // Check if any dependents will be affected by stopping a service, generate a response packet if so.
+    // had_dependents will be set true if the service should not be stopped, false otherwise.
+    // Returns false if the connection must be closed, true otherwise.
+    bool check_dependents(service_record *service, bool &had_dependents);
+
+    // Allocate a new handle for a service; may throw std::bad_alloc
+    handle_t allocate_service_handle(service_record *record);
+    
+    // Find the service corresponding to a service handle; returns nullptr if not found.
+    service_record *find_service_for_key(handle_t key) noexcept
+    {
+        return handles.find(key);
+    }
+    
+    // Close connection due to out-of-memory condition.
+    void do_oom_close() noexcept
+    {
+        bad_conn_close = true;
+        oom_close = true;
+        iob.set_watches(dasynq::OUT_EVENTS);
+    }
+    
+    // Process service event broadcast.
+    // Note that this can potentially be called during packet processing (upon issuing
+    // service start/stop orders etc).
+    void service_event(service_record * service, service_event_t event) noexcept final override
+    {
+        // For each service handle corresponding to the event, send an information packet.
+        handles.for_each_handle(service, [&](handle_t key) {
+            constexpr int pktsize = 3 + sizeof(key);
+            char pkt[pktsize];
+            pkt[0] = DINIT_IP_SERVICEEVENT;
+            pkt[1] = pktsize;
+            memcpy(pkt + 2, &key, sizeof(key));
+            pkt[2 + sizeof(key)] = static_cast<char>(event);
+            queue_packet(pkt, pktsize);
+        });
+    }
+
+    // Output from a service was added to its log buffer.
+    void service_log_output(service_record *service) noexcept final override;
+
+    // Process a state change of any service (when subscribed to all services).
+    void service_state_change(service_record *service, service_state_t old_state) noexcept final override;
+    
+    public:
+    control_conn_t(eventloop_t &loop, service_set * services_p, int fd)
+            : iob(loop), loop(loop), services(services_p), chklen(0), rbuf(buffer_limit)
+    {
+        iob.add_watch(loop, fd, dasynq::IN_EVENTS);
+        active_control_conns++;
+    }
+    
+    control_conn_t(const control_conn_t &) = delete;
+
+    virtual ~control_conn_t() noexcept;
+};
+
+
+inline dasynq::rearm control_conn_cb(eventloop_t * loop, control_conn_watcher * watcher, int revents)
+{
+    // Get the address of the containing control_connt_t object:
+    _Pragma ("GCC diagnostic push")
+    _Pragma ("GCC diagnostic ignored \"-Winvalid-offsetof\"")
+    uintptr_t cc_addr = reinterpret_cast<uintptr_t>(watcher) - offsetof(control_conn_t, iob);
+    control_conn_t *conn = reinterpret_cast<control_conn_t *>(cc_addr);
+    _Pragma ("GCC diagnostic pop")
+
+    if (revents & dasynq::IN_EVENTS) {
+        if (conn->data_ready()) {
+            delete conn;
+            return dasynq::rearm::REMOVED;
+        }
+    }
+    if (revents & dasynq::OUT_EVENTS) {
+        if (conn->send_data()) {
+            delete conn;
+            return dasynq::rearm::REMOVED;
+        }
+    }
+    
+    return dasynq::rearm::NOOP;
+}
+
+#endif
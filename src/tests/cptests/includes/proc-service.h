@@ -0,0 +1,858 @@
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+#include "baseproc-sys.h"
+#include "service.h"
+#include "log-buffer.h"
+#include "dinit-utmp.h"
+
+// This header defines base_proc_service (base process service) and several derivatives, as well as some
+// utility functions and classes. See service.h for full details of services.
+
+// Given a string and a list of pairs of (start,end) indices for each argument in that string,
+// store a null terminator for the argument. Return a `char *` vector containing the beginning
+// of each argument and a trailing nullptr. (The returned array is invalidated if the string is later
+// modified).
+std::vector<const char *> separate_args(std::string &s,
+        const std::list<std::pair<unsigned,unsigned>> &arg_indices);
+
+// Parameters for process execution
+struct run_proc_params
+{
+    const char * const *args; // program arguments including executable (args[0])
+    const char *working_dir;  // working directory
+    const char *logfile;      // log file or nullptr (stdout/stderr); must be valid if !on_console
+                              //   and output_fd is -1
+    int output_fd;            // fd to use for stdout/stderr (instead of logfile), or -1
+    const char *env_file;     // file with environment settings (or nullptr)
+    bool on_console;          // whether to run on console
+    bool in_foreground;       // if on console: whether to run in foreground
+    int wpipefd;              // pipe to which error status will be sent (if error occurs)
+    int csfd;                 // control socket fd (or -1); may be moved
+    int socket_fd;            // pre-opened socket fd (or -1); may be moved
+    int notify_fd;            // pipe for readiness notification message (or -1); may be moved
+    int force_notify_fd;      // if not -1, notification fd must be moved to this fd
+    const char *notify_var;   // environment variable name where notification fd will be stored, or nullptr
+    const char *notify_socket; // path of notification socket (for NOTIFY_SOCKET), or nullptr
+    uint64_t watchdog_usec;   // watchdog timeout in microseconds (for WATCHDOG_USEC), or 0
+    int cgroup_fd;            // cgroup (directory) to place the process in, or -1
+    uid_t uid;
+    gid_t gid;
+    const std::vector<service_rlimits> &rlimits;
+
+    run_proc_params(const char * const *args, const char *working_dir, const char *logfile, int wpipefd,
+            uid_t uid, gid_t gid, const std::vector<service_rlimits> &rlimits)
+            : args(args), working_dir(working_dir), logfile(logfile), output_fd(-1), env_file(nullptr),
+              on_console(false),
+              in_foreground(false), wpipefd(wpipefd), csfd(-1), socket_fd(-1), notify_fd(-1),
+              force_notify_fd(-1), notify_var(nullptr), notify_socket(nullptr), watchdog_usec(0),
+              cgroup_fd(-1), uid(uid), gid(gid), rlimits(rlimits)
+    { }
+};
+
+enum class exec_stage {
+    ENTER_CGROUP, ARRANGE_FDS, READ_ENV_FILE, SET_NOTIFYFD_VAR, SETUP_ACTIVATION_SOCKET, SETUP_CONTROL_SOCKET,
+    CHDIR, SETUP_STDINOUTERR, SET_RLIMITS, SET_UIDGID, /* must be last: */ DO_EXEC
+};
+
+extern const char * const exec_stage_descriptions[static_cast<int>(exec_stage::DO_EXEC) + 1];
+
+// Error information from process execution transferred via this struct
+struct run_proc_err
+{
+    exec_stage stage;
+    int st_errno;
+};
+
+// The environment for a service process: dinit's own environment, with the settings from the
+// service's environment file and the variables set for the service process applied on top. It is
+// built in the parent, and kept (by the service) for re-use by subsequent launches, until the
+// environment file changes (as determined by its identity, size and modification times) or the
+// service settings change. Note that dinit's own environment is assumed not to change.
+struct run_proc_env
+{
+    std::vector<std::string> env_storage;  // environment settings (NAME=value)
+    std::vector<char *> envp;              // pointers to env_storage entries, with trailing nullptr
+
+    // Buffers (within env_storage) for the values of variables which can only be determined in
+    // the child; each has space for a decimal integer and nul terminator. nullptr if not needed.
+    char *notify_fd_val = nullptr;
+    char *listen_pid_val = nullptr;
+    char *cs_fd_val = nullptr;
+
+    // The settings from which the environment was built (valid only if "valid" is set):
+    bool valid = false;
+    std::string env_file;
+    struct stat env_file_stat;  // (st_ino == 0 if the file does not exist)
+    std::string notify_var;
+    std::string notify_socket;
+    uint64_t watchdog_usec = 0;
+    bool with_socket;
+    bool with_csfd;
+
+    void invalidate() noexcept
+    {
+        valid = false;
+    }
+};
+
+// A process launch, prepared (in the parent, from the run_proc_params) before the child process is
+// created. The child process then need only perform a short sequence of async-signal-safe system
+// calls (arranging file descriptors, setting limits and credentials, and executing the command),
+// which allows it to be created via vfork(), avoiding the cost of duplicating the address space of
+// the parent. Since such a child shares the parent's memory, it must not modify anything other than
+// the buffers reserved for values which are only known in the child.
+struct run_proc_plan
+{
+    run_proc_env *env = nullptr;           // the process environment
+    std::vector<std::string> exec_paths;   // paths to try for the executable (from PATH search)
+    std::vector<const char *> sh_args;     // arguments to run a script via /bin/sh (after ENOEXEC)
+
+    std::vector<std::pair<int, struct rlimit>> rlimits;  // resource id, limits
+    sigset_t sigmask;  // signal mask for the process
+    bool do_set_ctty;  // whether to make the console the controlling terminal (if run on console)
+};
+
+// Prepare to launch a process, using (and, if it is not valid for the given parameters, first
+// building) the given process environment. May throw std::bad_alloc, or std::system_error if
+// current resource limits cannot be determined.
+void prepare_child_proc(const run_proc_params &params, run_proc_env &env, run_proc_plan &plan);
+
+// Run a child process, as prepared via prepare_child_proc() (call after vfork() or fork()). Note
+// that some parameters specify file descriptors, but in general file descriptors may be moved
+// before the exec call. Does not return.
+void run_child_proc(const run_proc_params &params, run_proc_plan &plan) noexcept;
+
+class base_process_service;
+class bgproc_service;
+
+// A timer for process restarting. Used to ensure a minimum delay between process restarts (and
+// also for timing service stop before the SIGKILL hammer is used).
+class process_restart_timer : public eventloop_t::timer_impl<process_restart_timer>
+{
+    public:
+    base_process_service * service;
+
+    explicit process_restart_timer(base_process_service *service_p)
+        : service(service_p)
+    {
+    }
+
+    dasynq::rearm timer_expiry(eventloop_t &, int expiry_count);
+};
+
+// Watcher for the pipe used to receive exec() failure status errno
+class exec_status_pipe_watcher : public eventloop_t::fd_watcher_impl<exec_status_pipe_watcher>
+{
+    public:
+    base_process_service * service;
+    dasynq::rearm fd_event(eventloop_t &eloop, int fd, int flags) noexcept;
+
+    exec_status_pipe_watcher(base_process_service * sr) noexcept : service(sr) { }
+
+    exec_status_pipe_watcher(const exec_status_pipe_watcher &) = delete;
+    void operator=(const exec_status_pipe_watcher &) = delete;
+};
+
+// Watcher for readiness notification pipe
+class ready_notify_watcher : public eventloop_t::fd_watcher_impl<ready_notify_watcher>
+{
+    public:
+    base_process_service * service;
+    dasynq::rearm fd_event(eventloop_t &eloop, int fd, int flags) noexcept;
+
+    ready_notify_watcher(base_process_service * sr) noexcept : service(sr) { }
+
+    ready_notify_watcher(const ready_notify_watcher &) = delete;
+    void operator=(const ready_notify_watcher &) = delete;
+};
+
+// Watcher for the pipe from which the output of a service process is read (log-type = buffer)
+class log_output_watcher : public eventloop_t::fd_watcher_impl<log_output_watcher>
+{
+    public:
+    base_process_service * service;
+    dasynq::rearm fd_event(eventloop_t &eloop, int fd, int flags) noexcept;
+
+    log_output_watcher(base_process_service * sr) noexcept : service(sr)
+    {
+        set_stats_category(STATS_LOG);
+    }
+
+    log_output_watcher(const log_output_watcher &) = delete;
+    void operator=(const log_output_watcher &) = delete;
+};
+
+// Watcher for a pidfd referring to the daemon process of a bgprocess service, when that process is
+// not a child of dinit (and so its status is not reported via a child watch)
+class daemon_pidfd_watcher : public eventloop_t::fd_watcher_impl<daemon_pidfd_watcher>
+{
+    public:
+    bgproc_service * service;
+    dasynq::rearm fd_event(eventloop_t &eloop, int fd, int flags) noexcept;
+
+    daemon_pidfd_watcher(bgproc_service * sr) noexcept : service(sr) { }
+
+    daemon_pidfd_watcher(const daemon_pidfd_watcher &) = delete;
+    void operator=(const daemon_pidfd_watcher &) = delete;
+};
+
+// Watcher for changes to the events file of the cgroup of a process service, used to detect when
+// the cgroup has become empty
+class cgroup_events_watcher : public eventloop_t::fd_watcher_impl<cgroup_events_watcher>
+{
+    public:
+    base_process_service * service;
+    dasynq::rearm fd_event(eventloop_t &eloop, int fd, int flags) noexcept;
+
+    cgroup_events_watcher(base_process_service * sr) noexcept : service(sr) { }
+
+    cgroup_events_watcher(const cgroup_events_watcher &) = delete;
+    void operator=(const cgroup_events_watcher &) = delete;
+};
+
+// Watcher for the activation socket of an on-demand service, registered while the service is
+// stopped, which starts the service when a connection is pending
+class activation_socket_watcher : public eventloop_t::fd_watcher_impl<activation_socket_watcher>
+{
+    public:
+    base_process_service * service;
+    dasynq::rearm fd_event(eventloop_t &eloop, int fd, int flags) noexcept;
+
+    activation_socket_watcher(base_process_service * sr) noexcept : service(sr) { }
+
+    activation_socket_watcher(const activation_socket_watcher &) = delete;
+    void operator=(const activation_socket_watcher &) = delete;
+};
+
+// Timer for stopping an on-demand service once its activation lifetime has passed
+class lifetime_stop_timer : public eventloop_t::timer_impl<lifetime_stop_timer>
+{
+    public:
+    base_process_service * service;
+
+    explicit lifetime_stop_timer(base_process_service *service_p) noexcept : service(service_p) { }
+
+    dasynq::rearm timer_expiry(eventloop_t &, int expiry_count) noexcept;
+};
+
+// Timer for the watchdog of a service process (see the "watchdog-timeout" setting)
+class watchdog_timer : public eventloop_t::timer_impl<watchdog_timer>
+{
+    public:
+    base_process_service * service;
+
+    explicit watchdog_timer(base_process_service *service_p) noexcept : service(service_p) { }
+
+    dasynq::rearm timer_expiry(eventloop_t &, int expiry_count) noexcept;
+};
+
+class service_child_watcher : public eventloop_t::child_proc_watcher_impl<service_child_watcher>
+{
+    public:
+    base_process_service * service;
+    dasynq::rearm status_change(eventloop_t &eloop, pid_t child, int status) noexcept;
+
+    service_child_watcher(base_process_service * sr) noexcept : service(sr) { }
+
+    service_child_watcher(const service_child_watcher &) = delete;
+    void operator=(const service_child_watcher &) = delete;
+};
+
+// Base class for process-based services.
+class base_process_service : public service_record
+{
+    friend class service_child_watcher;
+    friend class exec_status_pipe_watcher;
+    friend class base_process_service_test;
+    friend class ready_notify_watcher;
+    friend class log_output_watcher;
+    friend class daemon_pidfd_watcher;
+    friend class cgroup_events_watcher;
+    friend class activation_socket_watcher;
+    friend class lifetime_stop_timer;
+    friend class watchdog_timer;
+
+    private:
+    // Re-launch process
+    void do_restart() noexcept;
+
+    protected:
+    string program_name;          // storage for program/script and arguments
+    // pointer to each argument/part of the program_name, and nullptr:
+    std::vector<const char *> exec_arg_parts;
+
+    string stop_command;          // storage for stop program/script and arguments
+    // pointer to each argument/part of the stop_command, and nullptr:
+    std::vector<const char *> stop_arg_parts;
+
+    string working_dir;       // working directory (or empty)
+    string env_file;          // file with environment settings for this service
+    run_proc_env proc_env;    // process environment, as prepared for the last launch
+
+    std::vector<service_rlimits> rlimits; // resource limits
+
+    service_child_watcher child_listener;
+    exec_status_pipe_watcher child_status_listener;
+    log_output_watcher log_output_listener;
+    process_restart_timer restart_timer;
+    time_val last_start_time;
+
+    // Restart interval time and restart count are used to track the number of automatic restarts
+    // over an interval. Too many restarts over an interval will inhibit further restarts.
+    time_val restart_interval_time;  // current restart interval
+    int restart_interval_count;      // count of restarts within current interval
+
+    time_val restart_interval;       // maximum restart interval
+    int max_restart_interval_count;  // number of restarts allowed over maximum interval
+    time_val restart_delay;          // delay between restarts
+
+    // Exponential backoff of the restart delay: the delay doubles with each restart, up to the
+    // maximum delay, unless the process runs for at least the maximum delay. A random delay of up
+    // to 'restart_jitter' is added to each restart.
+    time_val restart_delay_max = {0, 0};  // maximum delay; no backoff if not above restart_delay
+    time_val next_restart_delay;          // delay for next restart (with backoff)
+    time_val restart_jitter = {0, 0};
+
+    // Time allowed for service stop, after which SIGKILL is sent. 0 to disable.
+    time_val stop_timeout = {10, 0}; // default of 10 seconds
+
+    // Time allowed for service start, after which SIGINT is sent (and then SIGKILL after
+    // <stop_timeout>). 0 to disable.
+    time_val start_timeout = {60, 0}; // default of 1 minute
+
+    uid_t run_as_uid = -1;
+    gid_t run_as_gid = -1;
+    int force_notification_fd = -1;  // if set, notification fd for service process is set to this fd
+    string notification_var; // if set, name of an environment variable for notification fd
+
+    // For readiness notification via the (shared) notification socket: the process registered with
+    // the service set as the sender of messages via the socket (-1 if none), whether READY=1 has
+    // been received from the current process, and the status text (STATUS=...) it reported
+    bool use_notify_socket = false;
+    pid_t notify_pid = -1;
+    bool notify_ready_received = false;
+    string status_text;
+
+    // Watchdog: if the timeout is non-zero, the process must send WATCHDOG=1 at least this often
+    // (once it has notified readiness), or it is killed
+    time_val watchdog_timeout = {0, 0};
+    watchdog_timer watchdog {this};
+    bool watchdog_armed = false;
+
+    pid_t pid = -1;  // PID of the process. If state is STARTING or STOPPING,
+                     //   this is PID of the service script; otherwise it is the
+                     //   PID of the process itself (process service).
+    bp_sys::exit_status exit_status; // Exit status, if the process has exited (pid == -1).
+    int socket_fd = -1;  // For socket-activation services, this is the file
+                         // descriptor for the socket.
+    int notification_fd = -1;  // If readiness notification is via fd
+
+    // For log-type = buffer: the buffer for process output, and the write end of the pipe from which
+    // it is filled (-1 if not yet created). The pipe persists across process restarts, so that the
+    // buffer holds the output of successive runs.
+    service_log_buffer log_buffer {0};
+    int log_output_fd = -1;
+
+    // For the "cgroup" option: the cgroup (directory) in which the process runs (-1 if none), and
+    // the watcher for its events file, registered while waiting for the cgroup to become empty
+    int cgroup_fd = -1;
+    cgroup_events_watcher cgroup_watcher {this};
+    bool waiting_cgroup_empty = false;
+
+    // For the "on-demand" option: the watcher for the activation socket (registered while the
+    // service is stopped), and the activation lifetime (0 to disable) and the timer for it, which is
+    // armed when the service is started by a connection
+    activation_socket_watcher activation_watcher {this};
+    bool watching_activation = false;
+    time_val activation_lifetime = {0, 0};
+    lifetime_stop_timer lifetime_timer {this};
+    bool lifetime_timer_armed = false;
+
+    bool waiting_restart_timer : 1;
+    bool stop_timer_armed : 1;
+    bool reserved_child_watch : 1;
+    bool tracking_child : 1;  // whether we expect to see child process status
+
+    // Launch the process with the given arguments, return true on success
+    bool start_ps_process(const std::vector<const char *> &args, bool on_console) noexcept;
+
+    // Restart the process (due to start failure or unexpected termination). Restarts will be
+    // rate-limited.
+    bool restart_ps_process() noexcept;
+
+    // Perform smooth recovery process
+    void do_smooth_recovery() noexcept;
+
+    // Start the process, return true on success
+    virtual bool bring_up() noexcept override;
+
+    // Called (in the parent) after the child process has been created.
+    virtual void after_fork(pid_t child_pid) noexcept { }
+
+    // Called when the process exits. The exit_status is the status value yielded by
+    // the "wait" system call.
+    virtual void handle_exit_status(bp_sys::exit_status exit_status) noexcept = 0;
+
+    // Called if an exec fails.
+    virtual void exec_failed(run_proc_err errcode) noexcept = 0;
+
+    // Called if exec succeeds.
+    virtual void exec_succeeded() noexcept { };
+
+    virtual bool can_interrupt_start() noexcept override
+    {
+        return waiting_restart_timer || onstart_flags.start_interruptible
+                || service_record::can_interrupt_start();
+    }
+
+    virtual bool can_proceed_to_start() noexcept override
+    {
+        return ! waiting_restart_timer;
+    }
+
+    virtual bool interrupt_start() noexcept override;
+
+    void becoming_inactive() noexcept override;
+
+    // Kill with SIGKILL
+    void kill_with_fire() noexcept;
+
+    // Signal the process group of the service process (for SIGKILL, all processes in the cgroup,
+    // if the service has one)
+    void kill_pg(int signo) noexcept;
+
+    // After the service process has terminated: if the service has a cgroup which still contains
+    // processes, kill them and begin waiting for the cgroup to become empty (after which
+    // handle_exit_status() is called again) and return true. Otherwise return false.
+    bool wait_cgroup_empty() noexcept;
+
+    // Close and remove the cgroup of the service (if it has one)
+    void release_cgroup() noexcept;
+
+    // stop immediately
+    void emergency_stop() noexcept;
+
+    // Open the activation socket, return false on failure. If report_ro_failure is false, a failure
+    // to create the socket file because the filesystem is read-only or the directory does not (yet)
+    // exist is not reported.
+    bool open_socket(bool report_ro_failure = true) noexcept;
+
+    // For an on-demand service: watch the activation socket (if it is open, and not already
+    // watched), so that the service is started when a connection is pending
+    void watch_activation_socket() noexcept;
+
+    // Stop watching the activation socket (if it is watched)
+    void unwatch_activation_socket() noexcept;
+
+    // Cancel a restart which is waiting for the restart timer (if any), returning its token to the
+    // restart budget
+    void cancel_restart() noexcept;
+
+    // Stop the activation lifetime timer (if it is armed)
+    void stop_lifetime_timer() noexcept;
+
+    // (Re-)arm the watchdog timer, if the service has a watchdog timeout
+    void arm_watchdog() noexcept;
+
+    // The service process has terminated (or failed to execute): stop accepting notification
+    // messages from it, and stop the watchdog timer
+    void release_notify() noexcept;
+
+    // The watchdog timeout has expired: kill the (presumably hung) process
+    void watchdog_expired() noexcept;
+
+    // The activation lifetime has expired: stop the service (unless a connection is pending)
+    void lifetime_expired() noexcept;
+
+    bool dependents_need_not_wait() noexcept override
+    {
+        return onstart_flags.ready_on_socket && socket_fd != -1;
+    }
+
+    // Create the log output pipe (if not already created) and size the log buffer, for
+    // log-type = buffer; return false on failure.
+    bool ensure_log_pipe() noexcept;
+
+    // Read output from the log output pipe into the log buffer.
+    dasynq::rearm read_log_output(int fd) noexcept;
+
+    // Get the readiness notification watcher for this service, if it has one; may return nullptr.
+    virtual ready_notify_watcher *get_ready_watcher() noexcept
+    {
+        return nullptr;
+    }
+
+    public:
+    // Constructor for a base_process_service. Note that the various parameters not specified here must in
+    // general be set separately (using the appropriate set_xxx function for each).
+    base_process_service(service_set *sset, string name, service_type_t record_type_p, string &&command,
+            const std::list<std::pair<unsigned,unsigned>> &command_offsets,
+            const std::list<prelim_dep> &deplist_p);
+
+    ~base_process_service() noexcept
+    {
+        release_cgroup();
+        unwatch_activation_socket();
+        stop_lifetime_timer();
+        lifetime_timer.deregister(event_loop);
+        release_notify();
+        watchdog.deregister(event_loop);
+        if (socket_fd != -1) {
+            close(socket_fd);
+        }
+        if (reserved_child_watch) {
+            child_listener.unreserve(event_loop);
+        }
+        restart_timer.deregister(event_loop);
+        if (log_output_fd != -1) {
+            int rfd = log_output_listener.get_watched_fd();
+            log_output_listener.deregister(event_loop);
+            bp_sys::close(rfd);
+            bp_sys::close(log_output_fd);
+        }
+    }
+
+    void open_activation_socket(bool report_ro_failure) noexcept override;
+
+    void close_activation_socket() noexcept override;
+
+    // Set the command to run this service (executable and arguments, nul separated). The command_parts_p
+    // vector must contain pointers to each part.
+    void set_command(std::string &&command_p, std::vector<const char *> &&command_parts_p) noexcept
+    {
+        program_name = std::move(command_p);
+        exec_arg_parts = std::move(command_parts_p);
+    }
+
+    void get_command(std::string &command_p, std::vector<const char *> &command_parts_p)
+    {
+        command_p = program_name;
+        command_parts_p = exec_arg_parts;
+    }
+
+    // Set the stop command and arguments (may throw std::bad_alloc)
+    void set_stop_command(const std::string &command,
+            std::list<std::pair<unsigned,unsigned>> &stop_command_offsets)
+    {
+        stop_command = command;
+        stop_arg_parts = separate_args(stop_command, stop_command_offsets);
+    }
+
+    // Set the stop command as a sequence of nul-terminated parts (arguments).
+    //   command - the command and arguments, each terminated with nul ('\0')
+    //   command_parts - pointers to the beginning of each command part
+    void set_stop_command(std::string &&command,
+            std::vector<const char *> &&command_parts) noexcept
+    {
+        stop_command = std::move(command);
+        stop_arg_parts = std::move(command_parts);
+    }
+
+    void set_env_file(const std::string &env_file_p)
+    {
+        env_file = env_file_p;
+        proc_env.invalidate();
+    }
+
+    void set_env_file(std::string &&env_file_p) noexcept
+    {
+        env_file = std::move(env_file_p);
+        proc_env.invalidate();
+    }
+
+    void set_rlimits(std::vector<service_rlimits> &&rlimits_p)
+    {
+        rlimits = std::move(rlimits_p);
+    }
+
+    void set_restart_interval(timespec interval, int max_restarts) noexcept
+    {
+        restart_interval = interval;
+        max_restart_interval_count = max_restarts;
+    }
+
+    void set_restart_delay(timespec delay) noexcept
+    {
+        restart_delay = delay;
+        next_restart_delay = delay;
+    }
+
+    // Set the maximum restart delay (for exponential backoff) and restart jitter
+    void set_restart_backoff(timespec delay_max, timespec jitter) noexcept
+    {
+        restart_delay_max = delay_max;
+        restart_jitter = jitter;
+    }
+
+    void set_stop_timeout(timespec timeout) noexcept
+    {
+        stop_timeout = timeout;
+    }
+
+    void set_start_timeout(timespec timeout) noexcept
+    {
+        start_timeout = timeout;
+    }
+
+    // Set whether readiness notification is via the notification socket
+    void set_notification_socket(bool use_socket) noexcept
+    {
+        use_notify_socket = use_socket;
+    }
+
+    // Set the watchdog timeout (0 to disable)
+    void set_watchdog_timeout(timespec timeout) noexcept
+    {
+        watchdog_timeout = timeout;
+    }
+
+    const std::string &get_status_text() noexcept override
+    {
+        return status_text;
+    }
+
+    // Set the activation lifetime for an on-demand service (0 to disable)
+    void set_activation_lifetime(timespec timeout) noexcept
+    {
+        activation_lifetime = timeout;
+    }
+
+    // Set an additional signal (other than SIGTERM) to be used to terminate the process
+    void set_extra_termination_signal(int signo) noexcept
+    {
+        this->term_signal = signo;
+    }
+
+    // Set the uid/gid that the service process will be run as
+    void set_run_as_uid_gid(uid_t uid, gid_t gid) noexcept
+    {
+        run_as_uid = uid;
+        run_as_gid = gid;
+    }
+
+    // Set the working directory
+    void set_working_dir(const string &working_dir_p)
+    {
+        working_dir = working_dir_p;
+    }
+
+    void set_working_dir(string &&working_dir_p) noexcept
+    {
+        working_dir = std::move(working_dir_p);
+    }
+
+    // Set the notification fd number that the service process will use
+    void set_notification_fd(int fd)
+    {
+        force_notification_fd = fd;
+    }
+
+    // Set the name of the environment variable that will be set to the notification fd number
+    // when the service process is run
+    void set_notification_var(string &&varname)
+    {
+        notification_var = std::move(varname);
+    }
+
+    // The restart/stop timer expired.
+    void timer_expired() noexcept;
+
+    // Accessor for testing:
+    const std::vector<const char *> & get_exec_arg_parts() noexcept
+    {
+        return exec_arg_parts;
+    }
+
+    pid_t get_pid() override
+    {
+        return pid;
+    }
+
+    int get_exit_status() override
+    {
+        return exit_status.as_int();
+    }
+
+    service_log_buffer *get_log_buffer() noexcept override
+    {
+        return (log_type == log_type_id::BUFFER || log_output_fd != -1) ? &log_buffer : nullptr;
+    }
+};
+
+// Standard process service.
+class process_service : public base_process_service
+{
+    virtual void handle_exit_status(bp_sys::exit_status exit_status) noexcept override;
+    virtual void exec_failed(run_proc_err errcode) noexcept override;
+    virtual void exec_succeeded() noexcept override;
+    virtual void bring_down() noexcept override;
+
+    ready_notify_watcher readiness_watcher;
+
+    // Process readiness notification (READY=1) via the notification socket
+    void notify_ready() noexcept;
+
+#if USE_UTMPX
+
+    char inittab_id[sizeof(utmpx().ut_id)];
+    char inittab_line[sizeof(utmpx().ut_line)];
+
+    protected:
+    void after_fork(pid_t child_pid) noexcept override
+    {
+        if (*inittab_id || *inittab_line) {
+            create_utmp_entry(inittab_id, inittab_line, child_pid);
+        }
+    }
+
+#endif
+
+    protected:
+    ready_notify_watcher *get_ready_watcher() noexcept override
+    {
+        return &readiness_watcher;
+    }
+
+    public:
+    void notify_message(const char *msg, size_t len) noexcept override;
+
+    process_service(service_set *sset, const string &name, string &&command,
+            std::list<std::pair<unsigned,unsigned>> &command_offsets,
+            const std::list<prelim_dep> &depends_p)
+         : base_process_service(sset, name, service_type_t::PROCESS, std::move(command), command_offsets,
+             depends_p), readiness_watcher(this)
+    {
+    }
+
+#if USE_UTMPX
+
+    // Set the id of the process in utmp (the "inittab" id)
+    void set_utmp_id(const char *id)
+    {
+        strncpy(inittab_id, id, sizeof(inittab_id));
+    }
+
+    // Set the device line of the process in utmp database
+    void set_utmp_line(const char *line)
+    {
+        strncpy(inittab_line, line, sizeof(inittab_line));
+    }
+
+    // Get the utmp (inittab) id, may not be nul terminated if maximum length!
+    const char *get_utmp_id()
+    {
+        return inittab_id;
+    }
+
+    // Get the utmp (inittab) line, may not be nul terminated if maximum length!
+    const char *get_utmp_line()
+    {
+        return inittab_line;
+    }
+
+    constexpr size_t get_utmp_id_size() const { return sizeof(inittab_id); }
+    constexpr size_t get_utmp_line_size() const { return sizeof(inittab_line); }
+
+#endif
+
+    ~process_service() noexcept
+    {
+    }
+};
+
+// Bgproc (self-"backgrounding", i.e. double-forking) process service
+class bgproc_service : public base_process_service
+{
+    friend class daemon_pidfd_watcher;
+
+    virtual void handle_exit_status(bp_sys::exit_status exit_status) noexcept override;
+    virtual void exec_failed(run_proc_err errcode) noexcept override;
+    virtual void bring_down() noexcept override;
+
+    enum class pid_result_t {
+        OK,
+        FAILED,      // failed to read pid or read invalid pid
+        TERMINATED   // read pid successfully, but the process already terminated
+    };
+
+    string pid_file;
+
+    // If the daemon process is not our child, a pidfd (if supported) used to detect its termination:
+    int daemon_pidfd = -1;
+    daemon_pidfd_watcher daemon_watcher {this};
+
+    // Read the pid-file contents
+    pid_result_t read_pid_file(bp_sys::exit_status *exit_status) noexcept;
+
+    // Begin watching the (non-child) daemon process via a pidfd. Returns false if not possible (errno
+    // is set to ESRCH if the process does not exist).
+    bool watch_daemon_pidfd() noexcept;
+
+    // Stop watching the daemon process via pidfd, if doing so
+    void unwatch_daemon_pidfd() noexcept
+    {
+        if (daemon_pidfd != -1) {
+            daemon_watcher.deregister(event_loop);
+            bp_sys::close(daemon_pidfd);
+            daemon_pidfd = -1;
+        }
+    }
+
+    public:
+    bgproc_service(service_set *sset, const string &name, string &&command,
+            std::list<std::pair<unsigned,unsigned>> &command_offsets,
+            const std::list<prelim_dep> &depends_p)
+         : base_process_service(sset, name, service_type_t::BGPROCESS, std::move(command), command_offsets,
+             depends_p)
+    {
+    }
+
+    ~bgproc_service() noexcept
+    {
+        unwatch_daemon_pidfd();
+    }
+
+    void set_pid_file(string &&pid_file) noexcept
+    {
+        this->pid_file = std::move(pid_file);
+    }
+
+    const std::string &get_pid_file() noexcept
+    {
+        return pid_file;
+    }
+};
+
+// Service which is started and stopped via separate commands
+class scripted_service : public base_process_service
+{
+    virtual void handle_exit_status(bp_sys::exit_status exit_status) noexcept override;
+    virtual void exec_succeeded() noexcept override;
+    virtual void exec_failed(run_proc_err errcode) noexcept override;
+    virtual void bring_down() noexcept override;
+
+    virtual bool interrupt_start() noexcept override
+    {
+        // if base::interrupt_start() returns false, then start hasn't been fully interrupted, but an
+        // interrupt has been issued:
+        interrupting_start = ! base_process_service::interrupt_start();
+        return ! interrupting_start;
+    }
+
+    bool interrupting_start : 1;  // running start script (true) or stop script (false)
+
+    public:
+    scripted_service(service_set *sset, const string &name, string &&command,
+            std::list<std::pair<unsigned,unsigned>> &command_offsets,
+            const std::list<prelim_dep> &depends_p)
+         : base_process_service(sset, name, service_type_t::SCRIPTED, std::move(command), command_offsets,
+             depends_p), interrupting_start(false)
+    {
+    }
+
+    ~scripted_service() noexcept
+    {
+    }
+};
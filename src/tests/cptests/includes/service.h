@@ -0,0 +1,1718 @@
+#ifndef SERVICE_H
+#define SERVICE_H
+
+#include <string>
+#include <list>
+#include <vector>
+#include <csignal>
+#include <unordered_set>
+#include <unordered_map>
+#include <algorithm>
+#include <iterator>
+#include <cstring>
+#include <new>
+
+#include "dasynq.h"
+
+#include "dinit.h"
+#include "control.h"
+#include "service-listener.h"
+#include "service-constants.h"
+#include "load-service.h"
+#include "service-cache.h"
+#include "dinit-ll.h"
+#include "dinit-log.h"
+#include "options-processing.h" // TODO maybe remove, service_dir_pathlist can be moved?
+
+/*
+ * This header defines service_record, a data record maintaining information about a service,
+ * and service_set, a set of interdependent service records. It also defines some associated
+ * types and exceptions.
+ *
+ * Service states
+ * --------------
+ * Services have both a current state and a desired state. The desired state can be
+ * either STARTED or STOPPED. The current state can also be STARTING or STOPPING.
+ * A service can be "pinned" in either the STARTED or STOPPED states to prevent it
+ * from leaving that state until it is unpinned.
+ *
+ * The total state is a combination of the two, current and desired:
+ *      STOPPED/STOPPED  : stopped and will remain stopped
+ *      STOPPED/STARTED  : stopped (pinned), must be unpinned to start
+ *      STARTING/STARTED : starting, but not yet started. Dependencies may also be starting.
+ *      STARTING/STOPPED : as above, but the service will be stopped again as soon as it has
+ *                         completed startup.
+ *      STARTED/STARTED  : running and will continue running.
+ *      STARTED/STOPPED  : started (pinned), must be unpinned to stop
+ *      STOPPING/STOPPED : stopping and will stop. Dependents may be stopping.
+ *      STOPPING/STARTED : as above, but the service will be re-started again once it stops.
+ *
+ * A scripted service is in the STARTING/STOPPING states during the script execution.
+ * A process service is in the STOPPING state when it has been signalled to stop, and is
+ * in the STARTING state when waiting for dependencies to start or for the exec() call in
+ * the forked child to complete and return a status.
+ *
+ * Acquisition/release:
+ * ------------------
+ * Each service has a dependent-count ("required_by"). This starts at 0, adds 1 if the
+ * service has explicitly been started (i.e. "start_explicit" is true), and adds 1 for
+ * each dependent service which is not STOPPED (including dependents with a soft dependency).
+ * When required_by transitions to 0, the service is stopped (unless it is pinned). When
+ * require_by transitions from 0, the service is started (unless pinned).
+ *
+ * So, in general, the dependent-count determines the desired state (STARTED if the count
+ * is greater than 0, otherwise STOPPED). However, a service can be issued a stop-and-take
+ * down order (via `stop(true)'); this will first stop dependent services, which may restart
+ * and cancel the stop of the former service. Finally, a service can be force-stopped, which
+ * means that its stop process cannot be cancelled (though it may still be put in a desired
+ * state of STARTED, meaning it will start immediately upon stopping).
+ *
+ * Pinning
+ * -------
+ * A service may be "pinned" in either STARTED or STOPPED states (or even both). Once it
+ * reaches a pinned state, a service will not leave that state, though its desired state
+ * may still be set. (Note that pinning prevents, but never causes, state transition).
+ *
+ * The priority of the different state deciders is:
+ *  - pins
+ *  - force stop flag
+ *  - desired state (which is manipulated by require/release operations)
+ *
+ * So a forced stop cannot occur until the service is not pinned started, for instance.
+ *
+ * Two-phase transition
+ * --------------------
+ * Transition between states occurs in two phases: propagation and execution. In both phases
+ * a linked-list queue is used to keep track of which services need processing; this avoids
+ * recursion (which would be of unknown depth and therefore liable to stack overflow).
+ *
+ * In the propagation phase, acquisition/release messages are processed, and desired state may be
+ * altered accordingly. Start and stop requests are also propagated in this phase. The state may
+ * be set to STARTING or STOPPING to reflect the desired state, but will never be set to STARTED
+ * or STOPPED (that happens in the execution phase).
+ *
+ * The two-phase transition is needed to avoid problem where a service that becomes STOPPED has
+ * an incorrect acquisition count, which may cause it to restart when it should not. The
+ * propagation phase allows the acquisition count to settle before the transition to the STOPPED
+ * state occurs, and the decision whether to restart can then be made based on the (correct)
+ * acquisition count.
+ *
+ * Propagation variables:
+ *   prop_acquire:  the service has transitioned to an acquired state and must issue an acquire
+ *                  on its dependencies
+ *   prop_release:  the service has transitioned to a released state and must issue a release on
+ *                  its dependencies.
+ *
+ *   prop_start:    the service should start
+ *   prop_stop:     the service should stop
+ *
+ * Note that "prop_acquire"/"prop_release" form a pair which cannot both be set at the same time
+ * which is enforced via explicit checks. For "prop_start"/"prop_stop" this occurs implicitly.
+ *
+ * In the execution phase, actions are taken to achieve the desired state. Actual state may
+ * transition according to the current and desired states. Processes can be sent signals, etc
+ * in order to stop them. A process can restart if it stops, but it does so by raising prop_start
+ * which needs to be processed in a second transition phase. Seeing as starting never causes
+ * another process to stop, the transition-execute-transition cycle always ends at the 2nd
+ * transition stage, at the latest.
+ */
+
+class service_record;
+class service_set;
+class base_process_service;
+class service_log_buffer;
+
+/* Service dependency record */
+class service_dep
+{
+    service_record * from;
+    service_record * to;
+
+    public:
+    /* Whether the 'from' service is waiting for the 'to' service to start */
+    bool waiting_on;
+    /* Whether the 'from' service is holding an acquire on the 'to' service */
+    bool holding_acq;
+
+    const dependency_type dep_type;
+
+    // Check if the dependency is a hard dependency (including milestone still waiting).
+    bool is_hard()
+    {
+        return dep_type == dependency_type::REGULAR
+                || (dep_type == dependency_type::MILESTONE && waiting_on);
+    }
+
+    service_dep(service_record * from, service_record * to, dependency_type dep_type_p) noexcept
+            : from(from), to(to), waiting_on(false), holding_acq(false), dep_type(dep_type_p)
+    {  }
+
+    service_dep(const service_dep &) = delete;
+    void operator=(const service_dep &) = delete;
+
+    service_record * get_from() const noexcept
+    {
+        return from;
+    }
+
+    service_record * get_to() const noexcept
+    {
+        return to;
+    }
+
+    void set_to(service_record *new_to) noexcept
+    {
+        to = new_to;
+    }
+};
+
+/*
+ * Pool allocator for service dependency records (the edges of the dependency graph). Records are
+ * allocated from large chunks, so that allocating a record normally requires only a pointer
+ * increment, and so that the records for the dependencies of a service (which are allocated
+ * together, when the service is loaded) are contiguous in memory. Released records are kept in a
+ * free list for re-use. The pool belongs to the service_set; it must outlive all records allocated
+ * from it.
+ */
+class service_dep_pool
+{
+    static constexpr size_t chunk_size = 256;  // records per chunk
+
+    union slot
+    {
+        slot *next_free;
+        alignas(service_dep) char storage[sizeof(service_dep)];
+    };
+
+    std::vector<slot *> chunks;
+    slot *free_list = nullptr;
+    size_t chunk_used = chunk_size;  // number of slots used from the last chunk
+
+    public:
+    service_dep_pool() noexcept
+    {
+    }
+
+    service_dep_pool(const service_dep_pool &) = delete;
+    void operator=(const service_dep_pool &) = delete;
+
+    ~service_dep_pool()
+    {
+        for (slot *chunk : chunks) {
+            delete[] chunk;
+        }
+    }
+
+    // Allocate (and construct) a dependency record. May throw std::bad_alloc.
+    service_dep *allocate(service_record *from, service_record *to, dependency_type dep_type)
+    {
+        slot *s;
+        if (free_list != nullptr) {
+            s = free_list;
+            free_list = s->next_free;
+        }
+        else {
+            if (chunk_used == chunk_size) {
+                chunks.reserve(chunks.size() + 1);
+                chunks.push_back(new slot[chunk_size]);
+                chunk_used = 0;
+            }
+            s = &chunks.back()[chunk_used++];
+        }
+        return new (s->storage) service_dep(from, to, dep_type);
+    }
+
+    // Release (destroy) a dependency record.
+    void release(service_dep *dep) noexcept
+    {
+        dep->~service_dep();
+        slot *s = reinterpret_cast<slot *>(dep);
+        s->next_free = free_list;
+        free_list = s;
+    }
+};
+
+/*
+ * The dependencies of a service: a contiguous array of (pointers to) dependency records. Iteration
+ * yields references to the dependency records. The records themselves are allocated from the
+ * service set's service_dep_pool; their addresses remain stable (dependents refer to them by
+ * pointer). Modification is performed via service_record.
+ */
+class service_dep_list
+{
+    friend class service_record;
+
+    using vec_type = std::vector<service_dep *>;
+    vec_type deps;
+
+    public:
+    class iterator
+    {
+        vec_type::const_iterator i;
+
+        public:
+        iterator(vec_type::const_iterator i_p) noexcept : i(i_p) { }
+
+        service_dep &operator*() const noexcept { return **i; }
+        service_dep *operator->() const noexcept { return *i; }
+
+        iterator &operator++() noexcept
+        {
+            ++i;
+            return *this;
+        }
+
+        bool operator==(const iterator &other) const noexcept { return i == other.i; }
+        bool operator!=(const iterator &other) const noexcept { return i != other.i; }
+    };
+
+    iterator begin() const noexcept { return iterator(deps.begin()); }
+    iterator end() const noexcept { return iterator(deps.end()); }
+
+    size_t size() const noexcept { return deps.size(); }
+    bool empty() const noexcept { return deps.empty(); }
+
+    service_dep &operator[](size_t n) const noexcept { return *deps[n]; }
+};
+
+/* preliminary service dependency information */
+class prelim_dep
+{
+    public:
+    service_record * const to;
+    dependency_type const dep_type;
+
+    prelim_dep(service_record *to_p, dependency_type dep_type_p) : to(to_p), dep_type(dep_type_p)
+    {
+        // (constructor)
+    }
+};
+
+// Times (monotonic clock) at which the events in the most recent start of a service occurred. A
+// zero time means that the event has not been recorded.
+class service_timeline
+{
+    using time_val = dasynq::time_val;
+
+    time_val times[NUM_TIMELINE_EVENTS];
+
+    public:
+    service_timeline() noexcept
+    {
+        reset();
+    }
+
+    void reset() noexcept
+    {
+        for (auto &t : times) {
+            t = time_val(0, 0);
+        }
+    }
+
+    // Record the current time for the given event.
+    void record(timeline_event_t event) noexcept
+    {
+        event_loop.get_time(times[(int)event], dasynq::clock_type::MONOTONIC);
+    }
+
+    bool is_recorded(timeline_event_t event) const noexcept
+    {
+        const time_val &t = times[(int)event];
+        return t.seconds() != 0 || t.nseconds() != 0;
+    }
+
+    const time_val &get(timeline_event_t event) const noexcept
+    {
+        return times[(int)event];
+    }
+};
+
+// service_record: base class for service record containing static information
+// and current state of each service.
+//
+// This abstract base class defines the dependency behaviour of services. The actions to actually bring a
+// service up or down are specified by subclasses in the virtual methods (see especially bring_up() and
+// bring_down()).
+//
+class service_record
+{
+    protected:
+    using string = std::string;
+    using time_val = dasynq::time_val;
+    
+    private:
+    string service_name;
+    service_type_t record_type;  // service_type_t::DUMMY, PROCESS, SCRIPTED, or INTERNAL
+
+    // 'service_state' can be any valid state: STARTED, STARTING, STOPPING, STOPPED.
+    // 'desired_state' is only set to final states: STARTED or STOPPED.
+    service_state_t service_state = service_state_t::STOPPED;
+    service_state_t desired_state = service_state_t::STOPPED;
+
+    protected:
+    service_flags_t onstart_flags;
+
+    log_type_id log_type = log_type_id::LOGFILE;  // where process output goes
+    string logfile;           // log file name, empty string specifies /dev/null
+    unsigned log_buf_max = 0; // maximum size of log buffer (if log_type is BUFFER)
+    
+    bool auto_restart : 1;    // whether to restart this (process) if it dies unexpectedly
+    bool smooth_recovery : 1; // whether the service process can restart without bringing down service
+    
+    bool pinned_stopped : 1;
+    bool pinned_started : 1;
+    bool waiting_for_deps : 1;  // if STARTING, whether we are waiting for dependencies/console
+                                // if STOPPING, whether we are waiting for dependents to stop
+    bool waiting_for_console : 1;   // waiting for exclusive console access (while STARTING)
+    bool have_console : 1;      // whether we have exclusive console access (STARTING/STARTED)
+    bool waiting_for_start_slot : 1;  // waiting for a start slot (while STARTING; see service_set)
+    bool have_start_slot : 1;   // whether we hold a start slot (while STARTING)
+    bool waiting_for_execstat : 1;  // if we are waiting for exec status after fork()
+    bool start_explicit : 1;    // whether we are are explicitly required to be started
+
+    bool prop_require : 1;      // require must be propagated
+    bool prop_release : 1;      // release must be propagated
+    bool prop_failure : 1;      // failure to start must be propagated
+    bool prop_start   : 1;
+    bool prop_stop    : 1;
+
+    bool restarting   : 1;      // re-start after stopping
+    bool start_failed : 1;      // failed to start (reset when begins starting)
+    bool start_skipped : 1;     // start was skipped by interrupt
+    
+    int required_by = 0;        // number of dependents wanting this service to be started
+
+    int start_priority = 0;     // priority for allocation of start slots (higher is sooner)
+
+    // list of dependencies
+    typedef service_dep_list dep_list;
+    
+    // list of dependents
+    typedef std::vector<service_dep *> dpt_list;
+    
+    dep_list depends_on;  // services this one depends on
+    dpt_list dependents;  // services depending on this one
+    
+    service_set *services; // the set this service belongs to
+    
+    std::unordered_set<service_listener *> listeners;
+    
+    // Process services:
+    bool force_stop; // true if the service must actually stop. This is the
+                     // case if for example the process dies; the service,
+                     // and all its dependencies, MUST be stopped.
+    
+    int term_signal = -1;  // signal to use for process termination
+    
+    string socket_path; // path to the socket for socket-activation service
+    int socket_perms;   // socket permissions ("mode")
+    uid_t socket_uid = -1;  // socket user id or -1
+    gid_t socket_gid = -1;  // socket group id or -1
+
+    stopped_reason_t stop_reason = stopped_reason_t::NORMAL;  // reason why stopped
+
+    string start_on_completion;  // service to start when this one completes
+
+    // Data for use by service_set
+    public:
+    
+    // Console queue.
+    lld_node<service_record> console_queue_node;
+
+    // Start slot queue, and the length of the chain of starting services waiting on this service
+    // (as most recently calculated, when the chain stamp was assigned)
+    lld_node<service_record> start_queue_node;
+    unsigned start_chain_len = 0;
+    uint32_t start_chain_stamp = 0;
+    
+    // Propagation and start/stop queues
+    lls_node<service_record> prop_queue_node;
+    lls_node<service_record> stop_queue_node;
+
+    // List of services in order of change, and the state generation at which this service last
+    // changed
+    lld_node<service_record> change_list_node;
+    uint64_t change_generation = 0;
+
+    // Identifier of the service, unique (within the set) across all services ever added; 0 if not
+    // yet added
+    uint32_t service_id = 0;
+
+    // Times of events during the most recent start
+    service_timeline start_timeline;
+    
+    protected:
+
+    // Allocate a dependency record and link it into the dependencies list (of this service) and the
+    // dependents list (of the dependency). May throw std::bad_alloc.
+    service_dep &add_dep_record(service_record *to, dependency_type dep_type);
+
+    // Service has actually stopped (includes having all dependents
+    // reaching STOPPED state).
+    void stopped() noexcept;
+    
+    // Service has successfully started
+    void started() noexcept;
+    
+    // Service failed to start (only called when in STARTING state).
+    //   dep_failed: whether failure is recorded due to a dependency failing
+    //   immediate_stop: whether to set state as STOPPED and handle complete stop.
+    void failed_to_start(bool dep_failed = false, bool immediate_stop = true) noexcept;
+    
+    // A dependency has reached STARTED state
+    void dependency_started() noexcept;
+    
+    void all_deps_started() noexcept;
+
+    // Start all dependencies, return true if all have started
+    bool start_check_dependencies() noexcept;
+
+    // Check whether all dependencies have started (i.e. whether we can start now)
+    bool check_deps_started() noexcept;
+
+    // Whether a STOPPING service can immediately transition to STARTED.
+    bool can_interrupt_stop() noexcept
+    {
+        return waiting_for_deps && ! force_stop;
+    }
+
+    // A dependent has reached STOPPED state
+    void dependent_stopped() noexcept;
+
+    // check if all dependents have stopped
+    bool stop_check_dependents() noexcept;
+    
+    // issue a stop to all dependents, return true if they are all already stopped
+    bool stop_dependents() noexcept;
+    
+    void require() noexcept;
+    void release(bool issue_stop = true) noexcept;
+    void release_dependencies() noexcept;
+    
+    // Check if service is, fundamentally, stopped.
+    bool is_stopped() noexcept
+    {
+        return service_state == service_state_t::STOPPED
+            || (service_state == service_state_t::STARTING && waiting_for_deps);
+    }
+    
+    void notify_listeners(service_event_t event) noexcept
+    {
+        for (auto l : listeners) {
+            l->service_event(this, event);
+        }
+    }
+
+    // Notify listeners that output has been added to the log buffer.
+    void notify_log_output() noexcept
+    {
+        for (auto l : listeners) {
+            l->service_log_output(this);
+        }
+    }
+    
+    // Queue to run on the console. 'acquired_console()' will be called when the console is available.
+    // Has no effect if the service has already queued for console.
+    void queue_for_console() noexcept;
+    
+    // Release console (console must be currently held by this service)
+    void release_console() noexcept;
+
+    // Whether a start slot must be held to bring this service up (see service_set::set_max_starting).
+    // Only services which start a process, and only in STARTING state, need a slot.
+    bool needs_start_slot() noexcept
+    {
+        return service_state == service_state_t::STARTING && (record_type == service_type_t::PROCESS
+                || record_type == service_type_t::BGPROCESS || record_type == service_type_t::SCRIPTED);
+    }
+
+    // Release the start slot, if held
+    void release_start_slot() noexcept;
+    
+    // Started state reached
+    bool process_started() noexcept;
+
+    // Called on transition of desired state from stopped to started (or unpinned stop)
+    void do_start() noexcept;
+
+    // Begin stopping, release activation.
+    void do_stop() noexcept;
+
+    // Record that the externally visible state of the service (state, target state, process ID or
+    // exit status) has changed.
+    void mark_changed() noexcept;
+
+    // Record a change of state (including marking the service as changed), and notify service set
+    // listeners.
+    void state_changed(service_state_t old_state) noexcept;
+
+    // Set the service state
+    void set_state(service_state_t new_state) noexcept
+    {
+        if (service_state != new_state) {
+            service_state_t old_state = service_state;
+            service_state = new_state;
+            state_changed(old_state);
+        }
+    }
+
+    // Set the desired (target) state
+    void set_target_state(service_state_t new_state) noexcept
+    {
+        if (desired_state != new_state) {
+            desired_state = new_state;
+            mark_changed();
+        }
+    }
+
+    // Virtual functions, to be implemented by service implementations:
+
+    // Do any post-dependency startup; return false on failure
+    virtual bool bring_up() noexcept;
+
+    // All dependents have stopped, and this service should proceed to stop.
+    virtual void bring_down() noexcept;
+
+    // Whether a STARTING service can immediately transition to STOPPED (as opposed to
+    // having to wait for it reach STARTED and then go through STOPPING).
+    virtual bool can_interrupt_start() noexcept
+    {
+        return waiting_for_deps;
+    }
+
+    // Whether a STARTING service can transition to its STARTED state, once all
+    // dependencies have started.
+    virtual bool can_proceed_to_start() noexcept
+    {
+        return true;
+    }
+
+    // Interrupt startup. Returns true if service start is fully cancelled; returns false if cancel order
+    // issued but service has not yet responded (state will be set to STOPPING).
+    virtual bool interrupt_start() noexcept;
+
+    // The service is becoming inactive - i.e. it has stopped and will not be immediately restarted. Perform
+    // any appropriate cleanup.
+    virtual void becoming_inactive() noexcept { }
+
+    // Whether dependents may start without waiting for this service to start (because they need only
+    // its activation socket, which is already open).
+    virtual bool dependents_need_not_wait() noexcept
+    {
+        return false;
+    }
+
+    public:
+
+    service_record(service_set *set, const string &name)
+        : service_name(name), service_state(service_state_t::STOPPED),
+            desired_state(service_state_t::STOPPED), auto_restart(false), smooth_recovery(false),
+            pinned_stopped(false), pinned_started(false), waiting_for_deps(false),
+            waiting_for_console(false), have_console(false), waiting_for_start_slot(false),
+            have_start_slot(false), waiting_for_execstat(false),
+            start_explicit(false), prop_require(false), prop_release(false), prop_failure(false),
+            prop_start(false), prop_stop(false), restarting(false), start_failed(false),
+            start_skipped(false), force_stop(false)
+    {
+        services = set;
+        record_type = service_type_t::DUMMY;
+        socket_perms = 0;
+    }
+
+    service_record(service_set *set, const string &name, service_type_t record_type_p,
+            const std::list<prelim_dep> &deplist_p)
+        : service_record(set, name)
+    {
+        services = set;
+        service_name = name;
+        this->record_type = record_type_p;
+
+        depends_on.deps.reserve(deplist_p.size());
+        try {
+            for (auto & pdep : deplist_p) {
+                add_dep_record(pdep.to, pdep.dep_type);
+            }
+        }
+        catch (...) {
+            rm_deps(0, depends_on.size());
+            throw;
+        }
+    }
+
+    service_record(const service_record &) = delete;
+    void operator=(const service_record &) = delete;
+
+    virtual ~service_record() noexcept;
+    
+    // Get the type of this service record
+    service_type_t get_type() noexcept
+    {
+        return record_type;
+    }
+
+    // begin transition from stopped to started state or vice versa depending on current and desired state
+    void execute_transition() noexcept;
+    
+    void do_propagation() noexcept;
+
+    // Console is available.
+    void acquired_console() noexcept;
+
+    // A start slot has been assigned to this service.
+    void acquired_start_slot() noexcept;
+    
+    // Get the target (aka desired) state.
+    service_state_t get_target_state() noexcept
+    {
+        return desired_state;
+    }
+
+    // Is the service explicitly marked active?
+    bool is_marked_active() noexcept
+    {
+        return start_explicit;
+    }
+
+    // Set logfile, should be done before service is started
+    void set_log_file(const string &logfile)
+    {
+        this->logfile = logfile;
+    }
+    
+    void set_log_file(std::string &&logfile) noexcept
+    {
+        this->logfile = std::move(logfile);
+    }
+
+    // Set the log type (destination of process output), and the size of the log buffer for
+    // log_type_id::BUFFER.
+    void set_log_mode(log_type_id log_type, unsigned log_buf_max) noexcept
+    {
+        this->log_type = log_type;
+        this->log_buf_max = log_buf_max;
+    }
+
+    log_type_id get_log_type() noexcept
+    {
+        return log_type;
+    }
+
+    // Set the priority for allocation of start slots (see service_set::set_max_starting).
+    void set_start_priority(int priority) noexcept
+    {
+        start_priority = priority;
+    }
+
+    int get_start_priority() noexcept
+    {
+        return start_priority;
+    }
+
+    // Set whether this service should automatically restart when it dies
+    void set_auto_restart(bool auto_restart) noexcept
+    {
+        this->auto_restart = auto_restart;
+    }
+    
+    void set_smooth_recovery(bool smooth_recovery) noexcept
+    {
+        this->smooth_recovery = smooth_recovery;
+    }
+    
+    // Set "on start" flags (commands)
+    void set_flags(service_flags_t flags) noexcept
+    {
+        this->onstart_flags = flags;
+    }
+
+    service_flags_t get_flags() noexcept
+    {
+        return onstart_flags;
+    }
+
+    void set_socket_details(string &&socket_path, int socket_perms, uid_t socket_uid, uid_t socket_gid)
+            noexcept
+    {
+        this->socket_path = std::move(socket_path);
+        this->socket_perms = socket_perms;
+        this->socket_uid = socket_uid;
+        this->socket_gid = socket_gid;
+    }
+
+    // Set the service that this one "chains" to. When this service completes, the named service is started.
+    void set_chain_to(string &&chain_to) noexcept
+    {
+        start_on_completion = std::move(chain_to);
+    }
+
+    const std::string &get_name() const noexcept { return service_name; }
+    uint32_t get_id() const noexcept { return service_id; }
+    const service_timeline &get_start_timeline() const noexcept { return start_timeline; }
+    service_state_t get_state() const noexcept { return service_state; }
+    
+    void start(bool activate = true) noexcept;  // start the service
+    void stop(bool bring_down = true) noexcept;   // stop the service
+    bool restart() noexcept; // restart the service, returns true iff restart issued
+    
+    void forced_stop() noexcept; // force-stop this service and all dependents
+    
+    // Pin the service in "started" state (when it reaches the state)
+    void pin_start() noexcept
+    {
+        pinned_started = true;
+    }
+    
+    // Pin the service in "stopped" state (when it reaches the state)
+    void pin_stop() noexcept
+    {
+        pinned_stopped = true;
+    }
+    
+    // Remove both "started" and "stopped" pins. If the service is currently pinned
+    // in either state but would naturally be in the opposite state, it will immediately
+    // commence starting/stopping.
+    void unpin() noexcept;
+    
+    // Is this a dummy service (used only when loading a new service)?
+    bool is_dummy() noexcept
+    {
+        return record_type == service_type_t::DUMMY;
+    }
+    
+    bool did_start_fail() noexcept
+    {
+        return start_failed;
+    }
+
+    bool was_start_skipped() noexcept
+    {
+        return start_skipped;
+    }
+
+    // Add a listener. A listener must only be added once. May throw std::bad_alloc.
+    void add_listener(service_listener * listener)
+    {
+        listeners.insert(listener);
+    }
+    
+    // Remove a listener.    
+    void remove_listener(service_listener * listener) noexcept
+    {
+        listeners.erase(listener);
+    }
+    
+    // Assuming there is one reference (from a control link), return true if this is the only reference,
+    // or false if there are others (including dependents).
+    bool has_lone_ref(bool check_deps = true) noexcept
+    {
+        if (check_deps && ! dependents.empty()) return false;
+        auto i = listeners.begin();
+        return (++i == listeners.end());
+    }
+
+    // Prepare this service to be unloaded.
+    void prepare_for_unload() noexcept;
+
+    // Why did the service stop?
+    stopped_reason_t get_stop_reason()
+    {
+        return stop_reason;
+    }
+
+    bool is_waiting_for_console()
+    {
+        return waiting_for_console;
+    }
+
+    bool has_console()
+    {
+        return have_console;
+    }
+
+    virtual pid_t get_pid()
+    {
+        return -1;
+    }
+
+    // Open the activation socket of the service (if it has one, and it is not already open) ahead
+    // of starting the service. If the socket is open, but its file has disappeared (eg because a
+    // filesystem has since been mounted over its directory) and the service is stopped, it is
+    // re-created. Failure is logged (unless it may be due to the filesystem not yet being
+    // writable or mounted, and report_ro_failure is false), and the socket will be opened again
+    // when the service starts.
+    virtual void open_activation_socket(bool report_ro_failure) noexcept
+    {
+    }
+
+    // The service is no longer on-demand (after its settings were reloaded): stop listening for
+    // connections on its activation socket, and close the socket unless the service is active.
+    virtual void close_activation_socket() noexcept
+    {
+    }
+
+    virtual int get_exit_status()
+    {
+        return 0;
+    }
+
+    // Handle a message received via the notification socket from the service process (see
+    // service_set::find_notify_pid()). The message consists of newline-separated assignments
+    // (as for sd_notify), and is not nul-terminated.
+    virtual void notify_message(const char *msg, size_t len) noexcept
+    {
+    }
+
+    // Get the status text most recently reported by the service process via the notification
+    // socket (STATUS=...); empty if none.
+    virtual const std::string &get_status_text() noexcept
+    {
+        static const std::string empty;
+        return empty;
+    }
+
+    // Get the buffer holding the process output, if output is captured (log-type = buffer) and
+    // any has yet been captured; otherwise returns nullptr.
+    virtual service_log_buffer *get_log_buffer() noexcept
+    {
+        return nullptr;
+    }
+
+    dep_list & get_dependencies()
+    {
+        return depends_on;
+    }
+
+    dpt_list & get_dependents()
+    {
+        return dependents;
+    }
+
+    // Add a dependency. Caller must ensure that the services are in an appropriate state and that
+    // a circular dependency chain is not created. Propagation queues should be processed after
+    // calling this. May throw std::bad_alloc.
+    service_dep & add_dep(service_record *to, dependency_type dep_type)
+    {
+        return add_dep(to, dep_type, false);
+    }
+
+    // Add a dependency (at the end of the dependencies list). Caller must ensure that the services
+    // are in an appropriate state and that a circular dependency chain is not created. Propagation
+    // queues should be processed after calling this. May throw std::bad_alloc.
+    //   reattach - whether to acquire the required service if it and the dependent are started.
+    //             (if false, only REGULAR dependencies will cause acquire if the dependent is started,
+    //              doing so regardless of required service's state).
+    service_dep & add_dep(service_record *to, dependency_type dep_type, bool reattach)
+    {
+        service_dep &dep = add_dep_record(to, dep_type);
+
+        if (dep_type == dependency_type::REGULAR
+                || (reattach && to->get_state() == service_state_t::STARTED)) {
+            if (service_state == service_state_t::STARTING || service_state == service_state_t::STARTED) {
+                to->require();
+                dep.holding_acq = true;
+            }
+        }
+
+        return dep;
+    }
+
+    // Remove a dependency, of the given type, to the given service. Propagation queues should be processed
+    // after calling.
+    void rm_dep(service_record *to, dependency_type dep_type) noexcept
+    {
+        for (size_t i = 0; i < depends_on.size(); i++) {
+            auto & dep = depends_on[i];
+            if (dep.get_to() == to && dep.dep_type == dep_type) {
+                rm_deps(i, i + 1);
+                break;
+            }
+        }
+    }
+
+    // Remove the dependencies in the given range (of indexes into the dependencies list), releasing
+    // any acquisition they hold. Propagation queues should be processed after calling.
+    void rm_deps(size_t first, size_t last) noexcept;
+
+    // Start a speficic dependency of this service. Should only be called if this service is in an
+    // appropriate state (started, starting). The dependency is marked as holding acquired; when
+    // this service stops, the dependency will be released and may also stop.
+    void start_dep(service_dep &dep)
+    {
+        if (! dep.holding_acq) {
+            dep.get_to()->require();
+            dep.holding_acq = true;
+        }
+    }
+};
+
+inline auto extract_prop_queue(service_record *sr) -> decltype(sr->prop_queue_node) &
+{
+    return sr->prop_queue_node;
+}
+
+inline auto extract_stop_queue(service_record *sr) -> decltype(sr->stop_queue_node) &
+{
+    return sr->stop_queue_node;
+}
+
+inline auto extract_console_queue(service_record *sr) -> decltype(sr->console_queue_node) &
+{
+    return sr->console_queue_node;
+}
+
+inline auto extract_start_queue(service_record *sr) -> decltype(sr->start_queue_node) &
+{
+    return sr->start_queue_node;
+}
+
+inline auto extract_change_list(service_record *sr) -> decltype(sr->change_list_node) &
+{
+    return sr->change_list_node;
+}
+
+// A budget for automatic restarts across all services of a set, which limits the rate of restarts
+// during a "restart storm" (for example when a dependency shared by many services fails). This is a
+// token bucket (implemented as the equivalent "generic cell rate" algorithm): a burst of up to a
+// certain number of restarts is allowed, beyond which restarts are spread out at a fixed rate. A
+// restart beyond the budget is not refused, but deferred until the time when a token will be
+// available.
+class restart_budget_t
+{
+    using time_val = dasynq::time_val;
+
+    unsigned burst = 0;         // maximum burst of restarts; 0 for no limit
+    time_val token_interval;    // interval at which tokens are replenished
+    time_val burst_span;        // token_interval * (burst - 1)
+    time_val next_time = {0, 0};  // time of the next token if tokens are taken at the maximum rate
+
+    static time_val from_nsecs(uint64_t nsecs) noexcept
+    {
+        return time_val(nsecs / 1000000000u, nsecs % 1000000000u);
+    }
+
+    public:
+    // Allow 'count' restarts (in a burst) per 'interval'; 0 count for no limit.
+    void set_limit(unsigned count, time_val interval) noexcept
+    {
+        burst = count;
+        if (count != 0) {
+            uint64_t interval_ns = uint64_t(interval.seconds()) * 1000000000u + interval.nseconds();
+            token_interval = from_nsecs(interval_ns / count);
+            burst_span = from_nsecs(interval_ns / count * (count - 1));
+        }
+    }
+
+    unsigned get_limit() noexcept
+    {
+        return burst;
+    }
+
+    // Take a token for a restart at (or after) the given time. Returns the time at which the restart
+    // can proceed.
+    time_val reserve(const time_val &at) noexcept
+    {
+        if (burst == 0) return at;
+        time_val proceed_time = (next_time > at + burst_span) ? next_time - burst_span : at;
+        next_time = ((next_time > at) ? next_time : at) + token_interval;
+        return proceed_time;
+    }
+
+    // Return a token taken by reserve(), for a restart which was cancelled before it proceeded.
+    void release() noexcept
+    {
+        if (burst == 0) return;
+        next_time = (next_time > token_interval) ? next_time - token_interval : time_val(0, 0);
+    }
+};
+
+/*
+ * An index of service records by name, used by service_set to find services without scanning
+ * the full record list. This is an open-addressing hash table (with linear probing); each entry
+ * refers to the position of the record in the record list, so that a record can also be removed
+ * or replaced without a list scan. The service name must not change while a record is indexed.
+ */
+class service_name_index
+{
+    public:
+    using record_list = std::list<service_record *>;
+    using record_iter = record_list::iterator;
+
+    private:
+    enum class slot_state : char
+    {
+        FREE, USED, REMOVED
+    };
+
+    struct slot
+    {
+        slot_state state = slot_state::FREE;
+        size_t hash = 0;
+        record_iter pos;
+    };
+
+    std::vector<slot> slots;  // size is either 0 or a power of 2
+    size_t used = 0;          // number of USED slots
+    size_t filled = 0;        // number of USED or REMOVED slots
+
+    static size_t hash_name(const char *name, size_t len) noexcept;
+
+    // Find the slot holding the given record (if svc is not null) or the first record with the
+    // given name (if svc is null). Returns nullptr if there is no such slot.
+    slot *find_slot(const char *name, size_t len, const service_record *svc) noexcept;
+
+    // Re-build the table with the given number of slots (must be a power of 2). May throw
+    // std::bad_alloc.
+    void rehash(size_t new_size);
+
+    public:
+    // Find the record list position of the service with the given name; returns nullptr if not found.
+    record_iter *find(const char *name, size_t len) noexcept
+    {
+        slot *s = find_slot(name, len, nullptr);
+        return (s == nullptr) ? nullptr : &s->pos;
+    }
+
+    // Find the record list position of the given service; returns nullptr if not found.
+    record_iter *find(const service_record *svc) noexcept;
+
+    // Add the record at the given list position to the index. May throw std::bad_alloc (in which
+    // case the index is unchanged).
+    void insert(record_iter pos);
+
+    // Remove the given record from the index. Returns false if it was not present.
+    bool remove(const service_record *svc) noexcept;
+
+    size_t size() noexcept
+    {
+        return used;
+    }
+};
+
+/*
+ * A service_set, as the name suggests, manages a set of services.
+ *
+ * Other than the ability to find services by name, the service set manages various queues.
+ * One is the queue for processes wishing to acquire the console. There is also a set of
+ * processes that want to start, and another set of those that want to stop. These latter
+ * two "queues" (not really queues since their order is not important) are used to prevent too
+ * much recursion and to prevent service states from "bouncing" too rapidly.
+ * 
+ * A service that wishes to start or stop puts itself on the start/stop queue; a service that
+ * needs to propagate changes to dependent services or dependencies puts itself on the
+ * propagation queue. Any operation that potentially manipulates the queues must be followed
+ * by a "process queues" order (processQueues() method).
+ *
+ * Note that processQueues always repeatedly processes both queues until they are empty. The
+ * process is finite because starting a service can never cause services to stop, unless they
+ * fail to start, which should cause them to stop semi-permanently.
+ */
+class service_set
+{
+    protected:
+    int active_services;
+    std::list<service_record *> records;
+    service_name_index records_by_name;  // index into 'records', by service name
+    bool restart_enabled; // whether automatic restart is enabled (allowed)
+    
+    shutdown_type_t shutdown_type = shutdown_type_t::NONE;  // Shutdown type, if stopping
+    
+    // Services waiting for exclusive access to the console
+    dlist<service_record, extract_console_queue> console_queue;
+
+    // Services waiting for a start slot, the maximum number of slots (0 = unlimited), and the
+    // number of slots currently held
+    dlist<service_record, extract_start_queue> start_queue;
+    unsigned max_starting = 0;
+    unsigned num_starting = 0;
+
+    // Stamp identifying the most recent calculation of start chain lengths
+    uint32_t start_chain_stamp = 0;
+
+    unsigned start_chain_length(service_record *svc) noexcept;
+
+    // Propagation and start/stop "queues" - list of services waiting for processing
+    slist<service_record, extract_prop_queue> prop_queue;
+    slist<service_record, extract_stop_queue> stop_queue;
+
+    // The state generation: incremented each time a service changes state (or is added to or
+    // removed from the set)
+    uint64_t state_generation = 0;
+
+    // The state generation at which a service was last removed from the set
+    uint64_t removal_generation = 0;
+
+    // Storage for service dependency records
+    service_dep_pool dep_pool;
+
+    // All services, ordered by the state generation at which they last changed
+    dlist<service_record, extract_change_list> change_list;
+
+    // The most recently assigned service identifier
+    uint32_t last_service_id = 0;
+
+    // Listeners for state changes of all services
+    std::vector<service_set_listener *> set_listeners;
+
+    // Budget for automatic restarts of (process-based) services
+    restart_budget_t restart_budget;
+
+    // Parent cgroup (directory) for the cgroups of services with the "cgroup" option; empty if
+    // cgroups are not to be used
+    std::string cgroup_parent;
+
+    // Path of the (shared) notification socket, empty if it is not open; and the service processes
+    // which may send messages via the socket (identified by pid)
+    std::string notify_socket_path;
+    std::unordered_map<pid_t, service_record *> notify_pids;
+
+    // Whether the root filesystem is known to be writable (see set_rootfs_rw())
+    bool rootfs_rw = false;
+
+    public:
+    service_set()
+    {
+        active_services = 0;
+        restart_enabled = true;
+    }
+    
+    virtual ~service_set()
+    {
+        for (auto * s : records) {
+            delete s;
+        }
+    }
+
+    // Start the specified service. The service will be marked active.
+    void start_service(service_record *svc)
+    {
+        svc->start();
+        process_queues();
+    }
+
+    // Stop the specified service. Its active mark will be cleared.
+    void stop_service(service_record *svc)
+    {
+        svc->stop(true);
+        process_queues();
+    }
+
+    // Locate an existing service record.
+    service_record *find_service(const std::string &name) noexcept
+    {
+        return find_service(name.c_str(), name.length());
+    }
+
+    service_record *find_service(const char *name) noexcept
+    {
+        return find_service(name, strlen(name));
+    }
+
+    service_record *find_service(const char *name, size_t len) noexcept
+    {
+        auto *pos = records_by_name.find(name, len);
+        return (pos == nullptr) ? nullptr : **pos;
+    }
+
+    // Load a service description, and dependencies, if there is no existing
+    // record for the given name.
+    // Throws:
+    //   service_load_exc (or subclass) on problem with service description
+    //   std::bad_alloc on out-of-memory condition
+    virtual service_record *load_service(const char *name)
+    {
+        auto r = find_service(name);
+        if (r == nullptr) {
+            throw service_not_found(name);
+        }
+        return r;
+    }
+
+    // Re-load a service description from file. If the service type changes then this returns
+    // a new service instead (the old one should be removed and deleted by the caller).
+    // Throws:
+    //   service_load_exc (or subclass) on problem with service description
+    //   std::bad_alloc on out-of-memory condition
+    virtual service_record *reload_service(service_record *service)
+    {
+        return service;
+    }
+
+    // Start the service with the given name. The named service will begin
+    // transition to the 'started' state.
+    //
+    // Throws a service_load_exc (or subclass) if the service description
+    // cannot be loaded or is invalid;
+    // Throws std::bad_alloc if out of memory.
+    void start_service(const char *name)
+    {
+        using namespace std;
+        service_record *record = load_service(name);
+        service_set::start_service(record);
+    }
+    
+    // Add a service record to the set. May throw std::bad_alloc.
+    void add_service(service_record *svc)
+    {
+        records.push_back(svc);
+        try {
+            records_by_name.insert(std::prev(records.end()));
+        }
+        catch (...) {
+            records.pop_back();
+            throw;
+        }
+        svc->service_id = ++last_service_id;
+        svc->change_generation = ++state_generation;
+        change_list.append(svc);
+    }
+
+    // Remove a service record from the set (the record must be in the set).
+    void remove_service(service_record *svc) noexcept
+    {
+        auto *pos = records_by_name.find(svc);
+        auto i = *pos;
+        records_by_name.remove(svc);
+        records.erase(i);
+        if (change_list.is_queued(svc)) {
+            change_list.unlink(svc);
+        }
+        removal_generation = ++state_generation;
+    }
+
+    // Replace a service record in the set with another, with the same name (the original must be in
+    // the set).
+    void replace_service(service_record *orig, service_record *replacement) noexcept
+    {
+        // The index refers to the record list position, which remains valid:
+        auto *pos = records_by_name.find(orig);
+        **pos = replacement;
+        if (change_list.is_queued(orig)) {
+            change_list.unlink(orig);
+        }
+        replacement->service_id = ++last_service_id;
+        replacement->change_generation = ++state_generation;
+        change_list.append(replacement);
+    }
+
+    // Record a change in the state of a service, by assigning it a new state generation. Has no
+    // effect if the service is not in the set.
+    void mark_changed(service_record *svc) noexcept
+    {
+        if (change_list.is_queued(svc)) {
+            change_list.unlink(svc);
+            svc->change_generation = ++state_generation;
+            change_list.append(svc);
+        }
+    }
+
+    // Notify listeners of a state change of a service. Has no effect if the service is not in the
+    // set.
+    void notify_state_change(service_record *svc, service_state_t old_state) noexcept
+    {
+        if (change_list.is_queued(svc)) {
+            for (auto l : set_listeners) {
+                l->service_state_change(svc, old_state);
+            }
+        }
+    }
+
+    // Add a listener for state changes of all services. May throw std::bad_alloc.
+    void add_listener(service_set_listener *listener)
+    {
+        set_listeners.push_back(listener);
+    }
+
+    // Remove a listener for state changes of all services.
+    void remove_listener(service_set_listener *listener) noexcept
+    {
+        set_listeners.erase(std::remove(set_listeners.begin(), set_listeners.end(), listener),
+                set_listeners.end());
+    }
+
+    // Get the pool from which dependency records are allocated
+    service_dep_pool &get_dep_pool() noexcept
+    {
+        return dep_pool;
+    }
+
+    // Get the current state generation
+    uint64_t get_state_generation() noexcept
+    {
+        return state_generation;
+    }
+
+    // Get the state generation at which a service was last removed
+    uint64_t get_removal_generation() noexcept
+    {
+        return removal_generation;
+    }
+
+    // Find the first (least recently changed) service which has changed since the given state
+    // generation. Returns nullptr if there is none. Subsequent changed services can be found using
+    // next_changed(). The cost is proportional to the number of changed services.
+    service_record *first_changed_since(uint64_t generation) noexcept
+    {
+        service_record *sr = change_list.tail();
+        if (sr == nullptr || sr->change_generation <= generation) {
+            return nullptr;
+        }
+        service_record *first = change_list.front();
+        while (sr != first) {
+            service_record *prev = sr->change_list_node.prev;
+            if (prev->change_generation <= generation) break;
+            sr = prev;
+        }
+        return sr;
+    }
+
+    // Find the next (more recently changed) service following the given service in change order.
+    // Returns nullptr if there is none.
+    service_record *next_changed(service_record *svc) noexcept
+    {
+        service_record *next = svc->change_list_node.next;
+        return (next == change_list.front()) ? nullptr : next;
+    }
+
+    // Get the list of all loaded services.
+    const std::list<service_record *> &list_services() noexcept
+    {
+        return records;
+    }
+    
+    // Add a service record to the state propagation queue. The service record will have its
+    // do_propagation() method called when the queue is processed.
+    void add_prop_queue(service_record *service) noexcept
+    {
+        if (! prop_queue.is_queued(service)) {
+            prop_queue.insert(service);
+        }
+    }
+    
+    // Add a service record to the stop queue. The service record will have its
+    // execute_transition() method called when the queue is processed.
+    void add_transition_queue(service_record *service) noexcept
+    {
+        if (! stop_queue.is_queued(service)) {
+            stop_queue.insert(service);
+        }
+    }
+    
+    // Process state propagation and start/stop queues, until they are empty.
+    void process_queues() noexcept
+    {
+        while (! stop_queue.is_empty() || ! prop_queue.is_empty()) {
+            while (! prop_queue.is_empty()) {
+                auto next = prop_queue.pop_front();
+                next->do_propagation();
+            }
+            if (! stop_queue.is_empty()) {
+                auto next = stop_queue.pop_front();
+                next->execute_transition();
+            }
+        }
+    }
+    
+    // Set the console queue tail (returns previous tail)
+    void append_console_queue(service_record * newTail) noexcept
+    {
+        bool was_empty = console_queue.is_empty();
+        console_queue.append(newTail);
+        if (was_empty) {
+            enable_console_log(false);
+        }
+    }
+    
+    // Pull and dispatch a waiter from the console queue
+    void pull_console_queue() noexcept
+    {
+        if (console_queue.is_empty()) {
+            // Discard the log buffer now, because we've potentially blocked output for a while
+            // and allowed it to fill with stale messages. (If not much time has passed, the
+            // request to discard will be ignored anyway).
+            discard_console_log_buffer();
+            enable_console_log(true);
+        }
+        else {
+            service_record * front = console_queue.pop_front();
+            front->acquired_console();
+        }
+    }
+    
+    void unqueue_console(service_record * service) noexcept
+    {
+        if (console_queue.is_queued(service)) {
+            console_queue.unlink(service);
+        }
+    }
+
+    // Check if console queue is empty (possibly due to console already having
+    // been assigned to the only queueing service)
+    bool is_console_queue_empty() noexcept
+    {
+        return console_queue.is_empty();
+    }
+
+    // Check whether a service is queued for the console
+    bool is_queued_for_console(service_record * service) noexcept
+    {
+        return console_queue.is_queued(service);
+    }
+
+    // Set the maximum number of services which can concurrently be starting a process (i.e. hold a
+    // start slot); 0 for no limit. Services waiting for a slot are given one in order of their start
+    // priority, and then of the length of the chain of (starting) services which depend on them, so
+    // that the longest chains are started first. A subsequent process_queues() is required.
+    void set_max_starting(unsigned max) noexcept;
+
+    unsigned get_max_starting() noexcept
+    {
+        return max_starting;
+    }
+
+    // Get the budget for automatic restarts (see restart_budget_t)
+    restart_budget_t &get_restart_budget() noexcept
+    {
+        return restart_budget;
+    }
+
+    // Open the activation sockets of all services which have one (see
+    // service_record::open_activation_socket()). Until the root filesystem is known to be writable,
+    // failures which may be due to it not being writable (or not yet fully mounted) are not
+    // reported.
+    void open_activation_sockets() noexcept
+    {
+        for (auto *s : records) {
+            s->open_activation_socket(rootfs_rw);
+        }
+    }
+
+    // Note that the root filesystem is writable (and filesystems have been mounted); activation
+    // sockets are (re-)opened.
+    void set_rootfs_rw() noexcept
+    {
+        rootfs_rw = true;
+        open_activation_sockets();
+    }
+
+    bool is_rootfs_rw() noexcept
+    {
+        return rootfs_rw;
+    }
+
+    // Set the parent cgroup directory for per-service cgroups (empty to disable use of cgroups)
+    void set_cgroup_parent(std::string &&parent) noexcept
+    {
+        cgroup_parent = std::move(parent);
+    }
+
+    const std::string &get_cgroup_parent() noexcept
+    {
+        return cgroup_parent;
+    }
+
+    // Set the path of the notification socket (empty if it is not open)
+    void set_notify_socket_path(std::string &&path) noexcept
+    {
+        notify_socket_path = std::move(path);
+    }
+
+    const std::string &get_notify_socket_path() noexcept
+    {
+        return notify_socket_path;
+    }
+
+    // Register a service process which may send messages via the notification socket. May throw
+    // std::bad_alloc.
+    void add_notify_pid(pid_t pid, service_record *service)
+    {
+        notify_pids[pid] = service;
+    }
+
+    void remove_notify_pid(pid_t pid) noexcept
+    {
+        notify_pids.erase(pid);
+    }
+
+    // Find the service with the given (registered) process; returns nullptr if none.
+    service_record *find_notify_pid(pid_t pid) noexcept
+    {
+        auto i = notify_pids.find(pid);
+        return (i == notify_pids.end()) ? nullptr : i->second;
+    }
+
+    // Acquire a start slot for the given service, if one is available; otherwise queue the service
+    // (it will be notified via acquired_start_slot()). Returns true if a slot was acquired.
+    bool acquire_start_slot(service_record *service) noexcept;
+
+    // Release a start slot, assigning it to a waiting service if there is one. A subsequent
+    // process_queues() is required.
+    void release_start_slot() noexcept
+    {
+        num_starting--;
+        pull_start_queue();
+    }
+
+    // Assign free start slots to waiting services.
+    void pull_start_queue() noexcept;
+
+    void unqueue_start_slot(service_record *service) noexcept
+    {
+        if (start_queue.is_queued(service)) {
+            start_queue.unlink(service);
+        }
+    }
+
+    bool is_queued_for_start_slot(service_record *service) noexcept
+    {
+        return start_queue.is_queued(service);
+    }
+
+    unsigned get_num_starting() noexcept
+    {
+        return num_starting;
+    }
+
+    // Notification from service that it is active (state != STOPPED)
+    // Only to be called on the transition from inactive to active.
+    void service_active(service_record *) noexcept;
+    
+    // Notification from service that it is inactive (STOPPED)
+    // Only to be called on the transition from active to inactive.
+    void service_inactive(service_record *) noexcept;
+    
+    // Find out how many services are active (starting, running or stopping,
+    // but not stopped).
+    int count_active_services() noexcept
+    {
+        return active_services;
+    }
+    
+    void stop_all_services(shutdown_type_t type = shutdown_type_t::HALT) noexcept
+    {
+        restart_enabled = false;
+        shutdown_type = type;
+        for (std::list<service_record *>::iterator i = records.begin(); i != records.end(); ++i) {
+            (*i)->stop(false);
+            (*i)->unpin();
+        }
+        process_queues();
+    }
+    
+    bool is_shutting_down() noexcept
+    {
+        return !restart_enabled;
+    }
+
+    shutdown_type_t get_shutdown_type() noexcept
+    {
+        return shutdown_type;
+    }
+
+    // Get an identifier for the run-time type of the service set (similar to typeid, but without
+    // requiring RTTI to be enabled during compilation).
+    virtual int get_set_type_id()
+    {
+        return SSET_TYPE_NONE;
+    }
+};
+
+// A service set which loads services from one of several service directories.
+class dirload_service_set : public service_set
+{
+    service_dir_pathlist service_dirs;
+
+    // A service description which has been read into memory ahead of loading
+    struct preloaded_desc
+    {
+        std::string filename;
+        std::string contents;
+    };
+
+    // Preloaded service descriptions (see preload_services()), by service name
+    std::unordered_map<std::string, preloaded_desc> preloaded;
+
+    // Compiled service description caches, one per service directory (see service-cache.h).
+    // Opened on first use, and not used at all once discard_preloaded() has been called.
+    std::vector<dinit_load::service_cache_file> caches;
+    bool caches_opened = false;
+    bool caches_discarded = false;
+
+    // Open the description caches (if not already open, and not discarded).
+    void open_caches() noexcept;
+
+    // Implementation of service load/reload.
+    // Find a service record, or load it from file. If the service has dependencies, load those also.
+    //
+    // If reload_svc != nullptr, then reload the specified service (with name specified by name). The return
+    // points to the new service, which may be a new service record, in which case the caller must remove
+    // the original record.
+    //
+    // If avoid_circular != nullptr (but reload_svc == nullptr), and if the service name refers to the
+    // service referred to by avoid_circular, a circular dependency is recognised. (A circular dependency
+    // is otherwise recognised on services as they are loading; this mechanism should be used when
+    // reloading a service, to prevent new dependencies forming on the original service).
+    //
+    // Throws service_load_exc (or subclass) if a dependency cycle is found or if another
+    // problem occurs (I/O error, service description not found etc). Throws std::bad_alloc
+    // if a memory allocation failure occurs.
+    //
+    service_record *load_reload_service(const char *name, service_record *reload_svc,
+            const service_record *avoid_circular);
+
+    public:
+    dirload_service_set() : service_set()
+    {
+        // nothing to do.
+    }
+
+    dirload_service_set(service_dir_pathlist &&pathlist) : service_set(), service_dirs(std::move(pathlist))
+    {
+        // nothing to do.
+    }
+
+    dirload_service_set(const dirload_service_set &) = delete;
+
+    int get_service_dir_count()
+    {
+        return service_dirs.size();
+    }
+
+    const char * get_service_dir(int n)
+    {
+        return service_dirs[n].get_dir();
+    }
+
+    service_record *load_service(const char *name) override
+    {
+        return load_service(name, nullptr);
+    }
+
+    service_record *load_service(const char *name, const service_record *avoid_circular);
+
+    service_record *reload_service(service_record *service) override;
+
+    // Read the descriptions of the named services, and (transitively) of their dependencies, into
+    // memory using a small pool of worker threads, so that subsequently loading those services
+    // does not require (serialised) file I/O. The descriptions are only scanned for dependencies
+    // here; they are fully parsed when loaded. This is an optimisation only: any failure is
+    // ignored, and will instead be reported when the service is loaded.
+    void preload_services(const std::list<const char *> &names) noexcept;
+
+    // Discard any preloaded service descriptions which have not (yet) been used, and close the
+    // compiled description caches. This should be done once the initial set of services has been
+    // loaded, so that a later load does not see a stale description (the caches, in particular,
+    // are only checked against the user/group databases when they are opened).
+    void discard_preloaded() noexcept
+    {
+        preloaded.clear();
+        caches.clear();
+        caches_discarded = true;
+    }
+
+    int get_set_type_id() override
+    {
+        return SSET_TYPE_DIRLOAD;
+    }
+};
+
+#endif
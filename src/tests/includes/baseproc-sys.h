@@ -0,0 +1,169 @@
+#ifndef BPSYS_INCLUDED
+#define BPSYS_INCLUDED
+
+#include <string>
+#include <vector>
+
+#include <cerrno>
+
+#include <sys/types.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+// Mock system functions for testing.
+
+namespace bp_sys {
+
+class write_handler
+{
+public:
+    virtual ssize_t write(int fd, const void *buf, size_t count) = 0;
+    virtual ~write_handler() { }
+};
+
+class default_write_handler : public write_handler
+{
+public:
+    std::vector<char> data;
+
+    virtual ssize_t write(int fd, const void *buf, size_t count)
+    {
+        data.insert(data.end(), (char *)buf, (char *)buf + count);
+        return count;
+    }
+};
+
+// Test helper functions:
+
+void init_bpsys();
+
+// allocate a file descriptor
+int allocfd();
+int allocfd(write_handler *hndlr);
+
+void supply_read_data(int fd, std::vector<char> &data);
+void supply_read_data(int fd, std::vector<char> &&data);
+void set_blocking(int fd);
+void extract_written_data(int fd, std::vector<char> &data);
+
+// cgroup support: enable/disable (disabled by default), get the most recently opened cgroup fd, set
+// whether a cgroup is populated, and get the number of cgroup_kill() calls
+void set_cgroup_support(bool supported);
+int get_last_cgroup_fd();
+void set_cgroup_populated(int cgroup_fd, bool populated);
+int get_cgroup_kill_count();
+
+// pidfd support: enable/disable (disabled by default), and get the most recently opened pidfd
+void set_pidfd_support(bool supported);
+int get_last_pidfd();
+
+// Record the (absolute) process id given to each kill() in the given vector, or stop recording if
+// nullptr is given
+void record_signalled_pids(std::vector<pid_t> *pids);
+
+// Mock system calls:
+
+// implementations elsewhere:
+int pipe2(int pipefd[2], int flags);
+int close(int fd);
+int kill(pid_t pid, int sig);
+
+inline int fcntl(int fd, int cmd, ...)
+{
+    // This is used for setting the CLOEXEC flag, we can just return 0:
+    return 0;
+}
+
+inline pid_t getpgid(pid_t pid)
+{
+    return pid;
+}
+
+inline int tcsetpgrp(int fd, pid_t pgid)
+{
+    return 0;
+}
+
+inline pid_t getpgrp()
+{
+    return getpid();
+}
+
+class exit_status
+{
+    friend pid_t waitpid(pid_t, exit_status *, int);
+
+    bool did_exit_v;
+    bool was_signalled_v;
+    int status;
+
+    public:
+    exit_status() : did_exit_v(true), was_signalled_v(false), status(0) { }
+
+    // status_p is either the exit status or termination signal:
+    exit_status(bool did_exit_p, bool was_signalled_p, int status_p)
+        : did_exit_v(did_exit_p), was_signalled_v(was_signalled_p), status(status_p)
+    { }
+
+    explicit exit_status(int status_p)
+    {
+        throw std::string("initalised exit_status with integer argument");
+    }
+
+    bool did_exit()
+    {
+        return did_exit_v;
+    }
+
+    bool did_exit_clean()
+    {
+        return did_exit_v && status == 0;
+    }
+
+    bool was_signalled()
+    {
+        return was_signalled_v;
+    }
+
+    int get_exit_status()
+    {
+        return status;
+    }
+
+    int get_term_sig()
+    {
+        return status;
+    }
+
+    int as_int()
+    {
+        return -1;
+    }
+};
+
+// Processes are only (mock) children of the service manager if they were forked via the event loop,
+// which reports their termination; any other process (eg. a daemon whose pid is read from a pid
+// file) is not a child.
+inline pid_t waitpid(pid_t p, exit_status *statusp, int flags)
+{
+    errno = ECHILD;
+    return -1;
+}
+
+// Returns a (blocking) mock fd, if pidfd support is enabled; to signal termination of the process,
+// send an event for the fd via the event loop.
+int pidfd_open(pid_t pid, unsigned flags);
+
+ssize_t read(int fd, void *buf, size_t count);
+ssize_t write(int fd, const void *buf, size_t count);
+ssize_t writev (int fd, const struct iovec *iovec, int count);
+
+int cgroup_open(const char *parent, const char *name);
+int cgroup_remove(const char *parent, const char *name);
+int cgroup_populated(int cgroup_fd);
+int cgroup_kill(int cgroup_fd);
+int cgroup_watch_events(int cgroup_fd);
+
+}
+
+#endif
@@ -0,0 +1,131 @@
+#ifndef DINIT_CONTROL_INBUF_H
+#define DINIT_CONTROL_INBUF_H
+
+#include <string>
+#include <new>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+
+#include "baseproc-sys.h"
+
+// Receive buffer for a control connection.
+//
+// The buffer is linear (not circular): received data is read into the space following any data
+// already in the buffer; data is consumed from the front, and the remaining data is moved back to
+// the start of the buffer when more space is needed. If the buffer is full of unconsumed data (a
+// single packet larger than the buffer), it grows, up to a maximum size. A buffer that has grown is
+// shrunk back to its initial size once it is emptied.
+//
+// The interface (for extracting data) mirrors that of cpbuffer.
+class control_inbuf
+{
+    public:
+    static constexpr unsigned initial_size = 1024;
+
+    private:
+    char *buf = nullptr;
+    unsigned capacity = 0;
+    unsigned start = 0;   // offset of first unconsumed byte
+    unsigned length = 0;  // number of unconsumed bytes
+    unsigned max_size;
+
+    public:
+    control_inbuf(unsigned max_size_p) noexcept : max_size(max_size_p > initial_size ? max_size_p : initial_size)
+    {
+    }
+
+    control_inbuf(const control_inbuf &) = delete;
+    void operator=(const control_inbuf &) = delete;
+
+    ~control_inbuf()
+    {
+        delete[] buf;
+    }
+
+    int get_length() const noexcept
+    {
+        return length;
+    }
+
+    // Get the maximum size of the buffer (the largest packet that can be received).
+    int get_size() const noexcept
+    {
+        return max_size;
+    }
+
+    // Check whether the buffer is full (and cannot grow further).
+    bool is_full() const noexcept
+    {
+        return length == max_size;
+    }
+
+    // Fill by reading from the given fd. Returns the number of bytes read (positive), 0 on
+    // end-of-file, or -1 on error (with errno set; ENOMEM if the buffer needed to grow but could
+    // not). Must not be called if the buffer is full.
+    int fill(int fd) noexcept
+    {
+        if (start + length == capacity) {
+            if (start != 0) {
+                memmove(buf, buf + start, length);
+                start = 0;
+            }
+            else {
+                unsigned new_capacity = (capacity == 0) ? initial_size : std::min(capacity * 2, max_size);
+                char *new_buf = new(std::nothrow) char[new_capacity];
+                if (new_buf == nullptr) {
+                    errno = ENOMEM;
+                    return -1;
+                }
+                if (buf != nullptr) {
+                    memcpy(new_buf, buf, length);
+                    delete[] buf;
+                }
+                buf = new_buf;
+                capacity = new_capacity;
+            }
+        }
+
+        ssize_t r = bp_sys::read(fd, buf + start + length, capacity - start - length);
+        if (r > 0) {
+            length += r;
+        }
+        return r;
+    }
+
+    char operator[](int idx) const noexcept
+    {
+        return buf[start + idx];
+    }
+
+    // Remove the given number of bytes from the start of the buffer.
+    void consume(int amount) noexcept
+    {
+        start += amount;
+        length -= amount;
+        if (length == 0) {
+            start = 0;
+            if (capacity > initial_size) {
+                // Release the (grown) buffer; the initial size will be allocated when needed
+                delete[] buf;
+                buf = nullptr;
+                capacity = 0;
+            }
+        }
+    }
+
+    // Extract bytes from the buffer. The bytes remain in the buffer.
+    void extract(void *dest, int index, int len) const noexcept
+    {
+        memcpy(dest, buf + start + index, len);
+    }
+
+    // Extract string of given length from given index
+    // Throws:  std::bad_alloc on allocation failure
+    std::string extract_string(int index, int len) const
+    {
+        return std::string(buf + start + index, len);
+    }
+};
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef DINIT_MOUNT_TABLE_H
+#define DINIT_MOUNT_TABLE_H 1
+
+#include <string>
+#include <vector>
+#include <istream>
+
+// Parsing of the mount table (/proc/self/mountinfo) and swap list (/proc/swaps), and ordering of
+// unmounts, as used by shutdown.
+
+// Decode the octal escapes (eg "\\040" for space) used in /proc/self/mountinfo and /proc/swaps
+std::string unescape_octal(const std::string &s);
+
+// Split a line into fields separated by spaces (or tabs)
+std::vector<std::string> split_fields(const std::string &line);
+
+// A mounted filesystem, as listed in /proc/self/mountinfo
+struct mount_node
+{
+    std::string mount_point;
+    std::string fs_type;
+    int parent = -1;                 // index of parent mount, -1 if none
+    unsigned pending_children = 0;   // child mounts not yet unmounted
+};
+
+// Read the mount tree from a stream in /proc/self/mountinfo format. Returns false on failure,
+// including if any line is malformed or the table is empty.
+//   may throw: std::bad_alloc
+bool read_mount_tree(std::istream &mountinfo, std::vector<mount_node> &nodes);
+
+// Read the list of swap devices/files from a stream in /proc/swaps format. Returns false on
+// failure.
+//   may throw: std::bad_alloc
+bool read_swap_list(std::istream &swaps, std::vector<std::string> &paths);
+
+// Check whether a filesystem of the given type should be left mounted at shutdown; these are the
+// same (virtual) filesystem types that "umount -a" skips.
+bool is_unmount_exempt(const std::string &fs_type);
+
+// Ordering of unmounts: a mount becomes ready to be unmounted once all mounts beneath it have been
+// unmounted. Mounts which are ready may be unmounted concurrently.
+class unmount_order
+{
+    std::vector<mount_node> &nodes;
+    std::vector<int> ready;  // ready mounts, most recently readied (deepest) last
+
+    public:
+    //   may throw: std::bad_alloc
+    unmount_order(std::vector<mount_node> &nodes_p);
+
+    // Check whether any mount is ready to be unmounted
+    bool has_ready() const noexcept
+    {
+        return ! ready.empty();
+    }
+
+    // Take the next ready mount (index into nodes)
+    int take_ready() noexcept
+    {
+        int node = ready.back();
+        ready.pop_back();
+        return node;
+    }
+
+    // Record that a mount has been unmounted (or otherwise dealt with), possibly readying its
+    // parent.
+    void complete(int node) noexcept;
+};
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef SERVICE_LISTENER_H
+#define SERVICE_LISTENER_H
+
+#include "service-constants.h"
+
+class service_record;
+
+// Interface for listening to services
+class service_listener
+{
+    public:
+    
+    // An event occurred on the service being observed.
+    // Listeners must not be added or removed during event notification.
+    virtual void service_event(service_record * service, service_event_t event) noexcept = 0;
+
+    // Output from the service process was added to the service's log buffer.
+    // Listeners must not be added or removed during notification.
+    virtual void service_log_output(service_record * service) noexcept { }
+};
+
+// Interface for listening to state changes of all services in a service set
+class service_set_listener
+{
+    public:
+
+    // A service in the set changed state (the new state can be queried from the service).
+    // Listeners must not be added or removed during notification.
+    virtual void service_state_change(service_record * service, service_state_t old_state) noexcept = 0;
+};
+
+#endif
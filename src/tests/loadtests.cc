@@ -3,6 +3,9 @@
 #include <cassert>
 #include <cstdlib>
 #include <cstring>
+#include <fstream>
+
+#include <unistd.h>
 
 #include "service.h"
 #include "proc-service.h"
@@ -48,6 +51,87 @@ void test_nonexistent()
     assert(got_service_not_found);
 }
 
+void test_preload()
+{
+    dirload_service_set sset(test_service_dir.c_str());
+    sset.preload_services({"t1", "does-not-exist"});
+    auto t1 = sset.load_service("t1");
+    assert(t1->get_name() == "t1");
+
+    bool got_service_not_found = false;
+    try {
+        sset.load_service("does-not-exist");
+    }
+    catch (service_not_found &) {
+        got_service_not_found = true;
+    }
+    assert(got_service_not_found);
+    sset.discard_preloaded();
+}
+
+// Dependency type for building compiled description cache entries
+struct cache_test_dep
+{
+    std::string name;
+    dependency_type dep_type;
+    bool from_dep_dir;
+};
+
+void test_desc_cache()
+{
+    using namespace dinit_load;
+
+    char dir_template[] = "/tmp/dinit-cachetest-XXXXXX";
+    const char *cache_dir = mkdtemp(dir_template);
+    assert(cache_dir != nullptr);
+
+    std::string desc_path = std::string(cache_dir) + "/c1";
+    {
+        std::ofstream f(desc_path);
+        f << "type = process\ncommand = /bin/text-cmd\n";
+    }
+
+    // Build a cache with an entry for c1 which is distinguishable from the description file:
+    file_stamp passwd_stamp, group_stamp, desc_stamp;
+    passwd_stamp.read("/etc/passwd");
+    group_stamp.read("/etc/group");
+    assert(desc_stamp.read(desc_path.c_str()));
+
+    service_settings_wrapper<cache_test_dep> settings;
+    settings.service_type = service_type_t::PROCESS;
+    settings.command = "/bin/cached-cmd";
+    settings.command_offsets.emplace_back(0, settings.command.length());
+
+    cache_writer writer;
+    size_t count_offs = write_cache_header(writer, passwd_stamp, group_stamp);
+    write_cache_entry(writer, "c1", desc_stamp, {}, settings);
+    writer.patch_u32(count_offs, 1);
+    std::string cache_path = std::string(cache_dir) + "/" + service_cache_name;
+    assert(writer.write_file(cache_path));
+
+    {
+        dirload_service_set sset(cache_dir);
+        auto c1 = static_cast<base_process_service *>(sset.load_service("c1"));
+        assert(strcmp(c1->get_exec_arg_parts()[0], "/bin/cached-cmd") == 0);
+    }
+
+    // Once the description is modified, the cache entry must not be used:
+    {
+        std::ofstream f(desc_path);
+        f << "type = process\ncommand = /bin/text-cmd2\n";
+    }
+
+    {
+        dirload_service_set sset(cache_dir);
+        auto c1 = static_cast<base_process_service *>(sset.load_service("c1"));
+        assert(strcmp(c1->get_exec_arg_parts()[0], "/bin/text-cmd2") == 0);
+    }
+
+    unlink(desc_path.c_str());
+    unlink(cache_path.c_str());
+    rmdir(cache_dir);
+}
+
 #define RUN_TEST(name, spacing) \
     std::cout << #name "..." spacing << std::flush; \
     name(); \
@@ -59,5 +143,7 @@ int main(int argc, char **argv)
     RUN_TEST(test_basic, "                ");
     RUN_TEST(test_env_subst, "            ");
     RUN_TEST(test_nonexistent, "          ");
+    RUN_TEST(test_preload, "              ");
+    RUN_TEST(test_desc_cache, "           ");
     return 0;
 }
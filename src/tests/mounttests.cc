@@ -0,0 +1,257 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cassert>
+
+#include "mount-table.h"
+
+// Tests for parsing of the mount table and swap list, and the ordering of unmounts (as used by
+// shutdown).
+
+void test_unescape_octal()
+{
+    assert(unescape_octal("/mnt/plain") == "/mnt/plain");
+    assert(unescape_octal("/mnt/with\\040space") == "/mnt/with space");
+    assert(unescape_octal("/mnt/tab\\011and\\012newline") == "/mnt/tab\tand\nnewline");
+    assert(unescape_octal("/mnt/back\\134slash") == "/mnt/back\\slash");
+    assert(unescape_octal("\\040\\040") == "  ");
+
+    // Incomplete or out-of-range escapes are left as-is:
+    assert(unescape_octal("/mnt/end\\04") == "/mnt/end\\04");
+    assert(unescape_octal("/mnt/bad\\400") == "/mnt/bad\\400");
+    assert(unescape_octal("/mnt/bad\\08x") == "/mnt/bad\\08x");
+    assert(unescape_octal("\\") == "\\");
+}
+
+void test_split_fields()
+{
+    std::vector<std::string> fields = split_fields("  one two\t\tthree  ");
+    assert(fields.size() == 3);
+    assert(fields[0] == "one");
+    assert(fields[1] == "two");
+    assert(fields[2] == "three");
+
+    assert(split_fields("").empty());
+    assert(split_fields("   ").empty());
+}
+
+static bool read_mount_tree(const std::string &text, std::vector<mount_node> &nodes)
+{
+    std::istringstream mountinfo(text);
+    return read_mount_tree(mountinfo, nodes);
+}
+
+void test_mount_tree_escaped()
+{
+    std::vector<mount_node> nodes;
+    bool r = read_mount_tree(
+            "21 1 8:1 / / rw,relatime shared:1 - ext4 /dev/sda1 rw\n"
+            "35 21 8:2 / /mnt/my\\040disk rw,relatime shared:2 - vfat /dev/sda2 rw\n"
+            "36 21 0:5 / /mnt/back\\134slash rw - tmpfs tmpfs rw\n", nodes);
+    assert(r);
+    assert(nodes.size() == 3);
+    assert(nodes[0].mount_point == "/");
+    assert(nodes[0].fs_type == "ext4");
+    assert(nodes[1].mount_point == "/mnt/my disk");
+    assert(nodes[1].fs_type == "vfat");
+    assert(nodes[2].mount_point == "/mnt/back\\slash");
+    assert(nodes[2].fs_type == "tmpfs");
+}
+
+void test_mount_tree_nested()
+{
+    // Optional fields vary in number; the parent of the root mount isn't listed; mounts may be
+    // listed before their parent (after a move), and a mount may be stacked over another at the
+    // same mount point.
+    std::vector<mount_node> nodes;
+    bool r = read_mount_tree(
+            "40 25 0:40 / /home/user/mnt rw - fuse.sshfs host: rw\n"
+            "21 1 8:1 / / rw shared:1 - ext4 /dev/sda1 rw\n"
+            "22 21 0:20 / /proc rw,nosuid shared:12 - proc proc rw\n"
+            "23 21 0:21 / /sys rw shared:2 master:1 - sysfs sysfs rw\n"
+            "24 21 0:5 / /dev rw - devtmpfs devtmpfs rw\n"
+            "25 21 8:3 / /home rw shared:3 - ext4 /dev/sda3 rw\n"
+            "26 25 0:41 / /home rw - tmpfs tmpfs rw\n"
+            "27 21 0:6 / / rw - tmpfs tmpfs rw\n", nodes);
+    assert(r);
+    assert(nodes.size() == 8);
+
+    assert(nodes[0].mount_point == "/home/user/mnt");
+    assert(nodes[0].fs_type == "fuse.sshfs");
+    assert(nodes[0].parent == 5);
+    assert(nodes[0].pending_children == 0);
+
+    assert(nodes[1].parent == -1);
+    assert(nodes[1].pending_children == 5);
+
+    for (int i = 2; i <= 4; i++) {
+        assert(nodes[i].parent == 1);
+        assert(nodes[i].pending_children == 0);
+    }
+
+    // /home (sda3), with /home/user/mnt beneath it and a tmpfs stacked over it:
+    assert(nodes[5].parent == 1);
+    assert(nodes[5].pending_children == 2);
+    assert(nodes[6].mount_point == "/home");
+    assert(nodes[6].parent == 5);
+    assert(nodes[6].pending_children == 0);
+
+    // A mount stacked over the root:
+    assert(nodes[7].mount_point == "/");
+    assert(nodes[7].parent == 1);
+}
+
+void test_mount_tree_malformed()
+{
+    std::vector<mount_node> nodes;
+
+    // Empty table:
+    assert(! read_mount_tree("", nodes));
+
+    // Too few fields:
+    nodes.clear();
+    assert(! read_mount_tree(
+            "21 1 8:1 / / rw - ext4 /dev/sda1 rw\n"
+            "22 21 0:20 / /proc\n", nodes));
+
+    // No separator:
+    nodes.clear();
+    assert(! read_mount_tree("21 1 8:1 / / rw shared:1 ext4 /dev/sda1 rw\n", nodes));
+
+    // Separator without file system type:
+    nodes.clear();
+    assert(! read_mount_tree("21 1 8:1 / / rw shared:1 -\n", nodes));
+
+    // Bad mount ids:
+    nodes.clear();
+    assert(! read_mount_tree("x21 1 8:1 / / rw - ext4 /dev/sda1 rw\n", nodes));
+    nodes.clear();
+    assert(! read_mount_tree("21 -1 8:1 / / rw - ext4 /dev/sda1 rw\n", nodes));
+    nodes.clear();
+    assert(! read_mount_tree("21 1x 8:1 / / rw - ext4 /dev/sda1 rw\n", nodes));
+    nodes.clear();
+    assert(! read_mount_tree("99999999999 1 8:1 / / rw - ext4 /dev/sda1 rw\n", nodes));
+
+    // Duplicate mount id:
+    nodes.clear();
+    assert(! read_mount_tree(
+            "21 1 8:1 / / rw - ext4 /dev/sda1 rw\n"
+            "21 21 0:20 / /proc rw - proc proc rw\n", nodes));
+}
+
+// Unmount (sequentially) in the order given by unmount_order, returning the order
+static std::vector<std::string> unmount_sequence(std::vector<mount_node> &nodes)
+{
+    std::vector<std::string> sequence;
+    unmount_order order(nodes);
+    while (order.has_ready()) {
+        int node = order.take_ready();
+        sequence.push_back(nodes[node].mount_point + ":" + nodes[node].fs_type);
+        order.complete(node);
+    }
+    return sequence;
+}
+
+static int position(const std::vector<std::string> &sequence, const std::string &mount)
+{
+    for (size_t i = 0; i < sequence.size(); i++) {
+        if (sequence[i] == mount) return i;
+    }
+    return -1;
+}
+
+void test_unmount_order()
+{
+    std::vector<mount_node> nodes;
+    bool r = read_mount_tree(
+            "40 25 0:40 / /home/user/mnt rw - fuse.sshfs host: rw\n"
+            "21 1 8:1 / / rw shared:1 - ext4 /dev/sda1 rw\n"
+            "22 21 0:20 / /proc rw,nosuid shared:12 - proc proc rw\n"
+            "23 21 0:21 / /sys rw shared:2 master:1 - sysfs sysfs rw\n"
+            "28 23 0:22 / /sys/fs/cgroup rw - cgroup2 cgroup2 rw\n"
+            "25 21 8:3 / /home rw shared:3 - ext4 /dev/sda3 rw\n"
+            "26 25 0:41 / /home rw - tmpfs tmpfs rw\n", nodes);
+    assert(r);
+
+    std::vector<std::string> sequence = unmount_sequence(nodes);
+    assert(sequence.size() == nodes.size());
+
+    int root = position(sequence, "/:ext4");
+    int home = position(sequence, "/home:ext4");
+    int home_tmpfs = position(sequence, "/home:tmpfs");
+    int user_mnt = position(sequence, "/home/user/mnt:fuse.sshfs");
+    int sys = position(sequence, "/sys:sysfs");
+    int cgroup = position(sequence, "/sys/fs/cgroup:cgroup2");
+    int proc = position(sequence, "/proc:proc");
+
+    // Each mount comes after those beneath (or stacked over) it:
+    assert(root == (int)nodes.size() - 1);
+    assert(user_mnt < home && home_tmpfs < home);
+    assert(cgroup < sys);
+    assert(proc < root && sys < root && home < root);
+
+    // All mounts are counted as done:
+    for (auto &node : nodes) {
+        assert(node.pending_children == 0);
+    }
+}
+
+void test_unmount_exempt()
+{
+    // The same file system types as skipped by "umount -a":
+    assert(is_unmount_exempt("proc"));
+    assert(is_unmount_exempt("devfs"));
+    assert(is_unmount_exempt("devpts"));
+    assert(is_unmount_exempt("sysfs"));
+    assert(is_unmount_exempt("rpc_pipefs"));
+    assert(is_unmount_exempt("nfsd"));
+
+    assert(! is_unmount_exempt("devtmpfs"));
+    assert(! is_unmount_exempt("tmpfs"));
+    assert(! is_unmount_exempt("ext4"));
+    assert(! is_unmount_exempt("cgroup2"));
+}
+
+void test_swap_list()
+{
+    std::istringstream swaps(
+            "Filename\t\t\t\tType\t\tSize\t\tUsed\t\tPriority\n"
+            "/dev/sda2                               partition\t8388604\t\t0\t\t-2\n"
+            "\n"
+            "/swap\\040file                           file\t\t1048572\t\t0\t\t-3\n");
+    std::vector<std::string> paths;
+    assert(read_swap_list(swaps, paths));
+    assert(paths.size() == 2);
+    assert(paths[0] == "/dev/sda2");
+    assert(paths[1] == "/swap file");
+
+    // Header only:
+    std::istringstream no_swaps("Filename\t\t\t\tType\t\tSize\t\tUsed\t\tPriority\n");
+    paths.clear();
+    assert(read_swap_list(no_swaps, paths));
+    assert(paths.empty());
+
+    // Nothing at all (not even a header):
+    std::istringstream empty("");
+    paths.clear();
+    assert(! read_swap_list(empty, paths));
+}
+
+#define RUN_TEST(name, spacing) \
+    std::cout << #name "..." spacing << std::flush; \
+    name(); \
+    std::cout << "PASSED" << std::endl;
+
+int main(int argc, char **argv)
+{
+    RUN_TEST(test_unescape_octal, "        ");
+    RUN_TEST(test_split_fields, "          ");
+    RUN_TEST(test_mount_tree_escaped, "    ");
+    RUN_TEST(test_mount_tree_nested, "     ");
+    RUN_TEST(test_mount_tree_malformed, "  ");
+    RUN_TEST(test_unmount_order, "         ");
+    RUN_TEST(test_unmount_exempt, "        ");
+    RUN_TEST(test_swap_list, "             ");
+    return 0;
+}
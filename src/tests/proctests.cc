@@ -3,6 +3,11 @@
 #include <list>
 #include <utility>
 #include <string>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "service.h"
 #include "proc-service.h"
@@ -52,6 +57,26 @@ class base_process_service_test
     {
         return bsp->notification_fd;
     }
+
+    static int get_log_read_fd(base_process_service *bsp)
+    {
+        return (bsp->log_output_fd == -1) ? -1 : bsp->log_output_listener.get_watched_fd();
+    }
+
+    static void set_socket_fd(base_process_service *bsp, int fd)
+    {
+        bsp->socket_fd = fd;
+    }
+
+    static int get_socket_fd(base_process_service *bsp)
+    {
+        return bsp->socket_fd;
+    }
+
+    static int get_cgroup_watch_fd(base_process_service *bsp)
+    {
+        return bsp->waiting_cgroup_empty ? bsp->cgroup_watcher.get_watched_fd() : -1;
+    }
 };
 
 namespace bp_sys {
@@ -658,6 +683,51 @@ void test_proc_smooth_recovery2()
     sset.remove_service(&p);
 }
 
+// Smooth recovery, with the service stopped while waiting to restart
+void test_proc_smooth_recovery3()
+{
+    using namespace std;
+
+    service_set sset;
+
+    string command = "test-command";
+    list<pair<unsigned,unsigned>> command_offsets;
+    command_offsets.emplace_back(0, command.length());
+    std::list<prelim_dep> depends;
+
+    process_service p {&sset, "testproc", std::move(command), command_offsets, depends};
+    init_service_defaults(p);
+    p.set_smooth_recovery(true);
+    p.set_restart_delay(time_val {0, 1000});
+    sset.add_service(&p);
+
+    p.start(true);
+    sset.process_queues();
+
+    base_process_service_test::exec_succeeded(&p);
+    sset.process_queues();
+
+    pid_t first_instance = bp_sys::last_forked_pid;
+
+    base_process_service_test::handle_exit(&p, 0);
+    sset.process_queues();
+    assert(p.get_state() == service_state_t::STARTED);
+    assert(event_loop.active_timers.size() == 1);
+
+    // Stopping cancels the restart:
+    p.stop(true);
+    sset.process_queues();
+    assert(p.get_state() == service_state_t::STOPPED);
+    assert(event_loop.active_timers.size() == 0);
+
+    event_loop.advance_time(time_val {0, 1000});
+    sset.process_queues();
+    assert(first_instance == bp_sys::last_forked_pid);
+    assert(p.get_state() == service_state_t::STOPPED);
+
+    sset.remove_service(&p);
+}
+
 // Test stop timeout
 void test_scripted_stop_timeout()
 {
@@ -991,6 +1061,827 @@ void test_waitsfor_restart()
     sset.remove_service(&p);
 }
 
+// Exponential backoff of restart delay
+void test_proc_restart_backoff()
+{
+    using namespace std;
+
+    service_set sset;
+
+    string command = "test-command";
+    list<pair<unsigned,unsigned>> command_offsets;
+    command_offsets.emplace_back(0, command.length());
+    std::list<prelim_dep> depends;
+
+    process_service p {&sset, "testproc", std::move(command), command_offsets, depends};
+    init_service_defaults(p);
+    p.set_restart_interval(time_val(10,0), 10);
+    p.set_restart_backoff(time_val(1, 0), time_val(0, 0));
+    p.set_auto_restart(true);
+    sset.add_service(&p);
+
+    p.start(true);
+    sset.process_queues();
+    base_process_service_test::exec_succeeded(&p);
+    sset.process_queues();
+    assert(p.get_state() == service_state_t::STARTED);
+
+    // The delay doubles with each restart, up to the maximum of 1 second:
+    for (long delay_ms : {200, 400, 800, 1000, 1000}) {
+        base_process_service_test::handle_exit(&p, 0);
+        sset.process_queues();
+        assert(p.get_state() == service_state_t::STARTING);
+        assert(event_loop.active_timers.size() == 1);
+
+        event_loop.advance_time(time_val(0, (delay_ms - 1) * 1000000));
+        assert(event_loop.active_timers.size() == 1);
+        event_loop.advance_time(time_val(0, 1000000));
+        assert(event_loop.active_timers.size() == 0);
+
+        sset.process_queues();
+        base_process_service_test::exec_succeeded(&p);
+        sset.process_queues();
+        assert(p.get_state() == service_state_t::STARTED);
+    }
+
+    // After running for at least the maximum delay, the delay resets (so the process restarts
+    // immediately, and the following delay is doubled from the initial delay):
+    event_loop.advance_time(time_val(1, 0));
+    base_process_service_test::handle_exit(&p, 0);
+    sset.process_queues();
+    assert(event_loop.active_timers.size() == 0);
+    base_process_service_test::exec_succeeded(&p);
+    sset.process_queues();
+    assert(p.get_state() == service_state_t::STARTED);
+
+    base_process_service_test::handle_exit(&p, 0);
+    sset.process_queues();
+    event_loop.advance_time(time_val(0, 399000000));
+    assert(event_loop.active_timers.size() == 1);
+    event_loop.advance_time(time_val(0, 1000000));
+    assert(event_loop.active_timers.size() == 0);
+    sset.process_queues();
+    base_process_service_test::exec_succeeded(&p);
+    sset.process_queues();
+    assert(p.get_state() == service_state_t::STARTED);
+
+    sset.remove_service(&p);
+}
+
+// Restart budget shared across services
+void test_proc_restart_budget()
+{
+    using namespace std;
+
+    service_set sset;
+    sset.get_restart_budget().set_limit(2, time_val(1, 0));
+
+    string command = "test-command";
+    list<pair<unsigned,unsigned>> command_offsets;
+    command_offsets.emplace_back(0, command.length());
+    std::list<prelim_dep> depends;
+
+    process_service p1 {&sset, "testproc1", string(command), command_offsets, depends};
+    process_service p2 {&sset, "testproc2", string(command), command_offsets, depends};
+    process_service p3 {&sset, "testproc3", string(command), command_offsets, depends};
+    for (process_service *p : {&p1, &p2, &p3}) {
+        init_service_defaults(*p);
+        p->set_restart_delay(time_val(0, 0));
+        p->set_auto_restart(true);
+        sset.add_service(p);
+
+        p->start(true);
+        sset.process_queues();
+        base_process_service_test::exec_succeeded(p);
+        sset.process_queues();
+        assert(p->get_state() == service_state_t::STARTED);
+    }
+
+    event_loop.advance_time(time_val(1, 0));
+
+    // A burst of two restarts is allowed; the third is deferred (by 500ms):
+    pid_t last_pid = bp_sys::last_forked_pid;
+    for (process_service *p : {&p1, &p2, &p3}) {
+        base_process_service_test::handle_exit(p, 0);
+        sset.process_queues();
+    }
+    assert(bp_sys::last_forked_pid == last_pid + 2);
+    assert(event_loop.active_timers.size() == 1);
+
+    event_loop.advance_time(time_val(0, 499000000));
+    assert(event_loop.active_timers.size() == 1);
+    event_loop.advance_time(time_val(0, 1000000));
+    assert(event_loop.active_timers.size() == 0);
+    sset.process_queues();
+    assert(bp_sys::last_forked_pid == last_pid + 3);
+
+    for (process_service *p : {&p1, &p2, &p3}) {
+        base_process_service_test::exec_succeeded(p);
+        sset.process_queues();
+        assert(p->get_state() == service_state_t::STARTED);
+    }
+
+    // A deferred restart which is cancelled (here, by stopping the service) gives back its token:
+    event_loop.advance_time(time_val(1, 0));
+    last_pid = bp_sys::last_forked_pid;
+    for (process_service *p : {&p1, &p2, &p3}) {
+        base_process_service_test::handle_exit(p, 0);
+        sset.process_queues();
+    }
+    assert(bp_sys::last_forked_pid == last_pid + 2);
+    assert(event_loop.active_timers.size() == 1);
+
+    p3.stop(true);
+    sset.process_queues();
+    assert(p3.get_state() == service_state_t::STOPPED);
+    assert(event_loop.active_timers.size() == 0);
+
+    // The next restart is deferred by 500ms (not 1s, as it would be had the token been kept):
+    base_process_service_test::exec_succeeded(&p1);
+    sset.process_queues();
+    base_process_service_test::handle_exit(&p1, 0);
+    sset.process_queues();
+    assert(bp_sys::last_forked_pid == last_pid + 2);
+    event_loop.advance_time(time_val(0, 500000000));
+    sset.process_queues();
+    assert(bp_sys::last_forked_pid == last_pid + 3);
+
+    for (process_service *p : {&p1, &p2}) {
+        base_process_service_test::exec_succeeded(p);
+        sset.process_queues();
+        assert(p->get_state() == service_state_t::STARTED);
+    }
+
+    for (process_service *p : {&p1, &p2, &p3}) {
+        sset.remove_service(p);
+    }
+}
+
+// Capture of process output in a buffer (log-type = buffer)
+void test_proc_log_buffer()
+{
+    using namespace std;
+
+    service_set sset;
+
+    string command = "test-command";
+    list<pair<unsigned,unsigned>> command_offsets;
+    command_offsets.emplace_back(0, command.length());
+    std::list<prelim_dep> depends;
+
+    process_service p {&sset, "testproc", std::move(command), command_offsets, depends};
+    init_service_defaults(p);
+    p.set_auto_restart(true);
+    p.set_log_mode(log_type_id::BUFFER, 8);
+    sset.add_service(&p);
+
+    service_log_buffer *log_buf = p.get_log_buffer();
+    assert(log_buf != nullptr);
+
+    p.start(true);
+    sset.process_queues();
+    base_process_service_test::exec_succeeded(&p);
+    sset.process_queues();
+    assert(p.get_state() == service_state_t::STARTED);
+
+    int rfd = base_process_service_test::get_log_read_fd(&p);
+    assert(rfd != -1);
+    bp_sys::set_blocking(rfd);
+
+    char out[8];
+    bp_sys::supply_read_data(rfd, {'a', 'b', 'c', 'd', 'e'});
+    event_loop.send_fd_event(rfd, dasynq::IN_EVENTS);
+    assert(log_buf->get_start_pos() == 0 && log_buf->get_end_pos() == 5);
+    log_buf->extract(out, 0, 5);
+    assert(memcmp(out, "abcde", 5) == 0);
+
+    // Once the buffer is full, the oldest output is overwritten:
+    bp_sys::supply_read_data(rfd, {'f', 'g', 'h', 'i', 'j', 'k'});
+    event_loop.send_fd_event(rfd, dasynq::IN_EVENTS);
+    assert(log_buf->get_start_pos() == 3 && log_buf->get_end_pos() == 11);
+    log_buf->extract(out, 3, 8);
+    assert(memcmp(out, "defghijk", 8) == 0);
+
+    // The pipe (and buffered output) persists across a restart of the process:
+    base_process_service_test::handle_exit(&p, 0);
+    sset.process_queues();
+    event_loop.advance_time(time_val(0, 200000000));
+    sset.process_queues();
+    base_process_service_test::exec_succeeded(&p);
+    sset.process_queues();
+    assert(p.get_state() == service_state_t::STARTED);
+    assert(base_process_service_test::get_log_read_fd(&p) == rfd);
+    assert(log_buf->get_length() == 8);
+
+    bp_sys::supply_read_data(rfd, {'l'});
+    event_loop.send_fd_event(rfd, dasynq::IN_EVENTS);
+    log_buf->discard_to(10);
+    assert(log_buf->get_start_pos() == 10 && log_buf->get_length() == 2);
+    log_buf->extract(out, 10, 2);
+    assert(memcmp(out, "kl", 2) == 0);
+
+    sset.remove_service(&p);
+}
+
+
+// Process service with a cgroup: service is not stopped until the cgroup is empty
+void test_proc_cgroup()
+{
+    using namespace std;
+
+    service_set sset;
+    sset.set_cgroup_parent("/sys/fs/cgroup/test");
+    bp_sys::set_cgroup_support(true);
+
+    string command = "test-command";
+    list<pair<unsigned,unsigned>> command_offsets;
+    command_offsets.emplace_back(0, command.length());
+    std::list<prelim_dep> depends;
+
+    process_service p {&sset, "testproc", std::move(command), command_offsets, depends};
+    init_service_defaults(p);
+    service_flags_t sflags;
+    sflags.use_cgroup = true;
+    p.set_flags(sflags);
+    sset.add_service(&p);
+
+    p.start(true);
+    sset.process_queues();
+    base_process_service_test::exec_succeeded(&p);
+    sset.process_queues();
+    assert(p.get_state() == service_state_t::STARTED);
+
+    int cgroup_fd = bp_sys::get_last_cgroup_fd();
+    assert(cgroup_fd != -1);
+    int kill_count = bp_sys::get_cgroup_kill_count();
+
+    p.stop(true);
+    sset.process_queues();
+    assert(p.get_state() == service_state_t::STOPPING);
+    assert(bp_sys::last_sig_sent == SIGTERM);
+
+    // The process terminates, but leaves another process in the cgroup, which must be killed:
+    bp_sys::set_cgroup_populated(cgroup_fd, true);
+    base_process_service_test::handle_exit(&p, 0);
+    sset.process_queues();
+    assert(p.get_state() == service_state_t::STOPPING);
+    assert(bp_sys::get_cgroup_kill_count() == kill_count + 1);
+
+    int watch_fd = base_process_service_test::get_cgroup_watch_fd(&p);
+    assert(watch_fd != -1);
+
+    // Spurious event (still populated):
+    event_loop.send_fd_event(watch_fd, dasynq::IN_EVENTS);
+    sset.process_queues();
+    assert(p.get_state() == service_state_t::STOPPING);
+
+    bp_sys::set_cgroup_populated(cgroup_fd, false);
+    event_loop.send_fd_event(watch_fd, dasynq::IN_EVENTS);
+    sset.process_queues();
+    assert(p.get_state() == service_state_t::STOPPED);
+    assert(p.get_stop_reason() == stopped_reason_t::NORMAL);
+    assert(event_loop.active_timers.size() == 0);
+    assert(base_process_service_test::get_cgroup_watch_fd(&p) == -1);
+
+    // If the cgroup is already empty when the process terminates, the service stops immediately:
+    p.start(true);
+    sset.process_queues();
+    base_process_service_test::exec_succeeded(&p);
+    sset.process_queues();
+    assert(p.get_state() == service_state_t::STARTED);
+
+    p.stop(true);
+    sset.process_queues();
+    base_process_service_test::handle_exit(&p, 0);
+    sset.process_queues();
+    assert(p.get_state() == service_state_t::STOPPED);
+
+    bp_sys::set_cgroup_support(false);
+    sset.remove_service(&p);
+}
+
+// Dependents of a service with the ready-on-socket option (and an open socket) start without
+// waiting for it, but are stopped if it fails to start
+void test_proc_ready_on_socket()
+{
+    using namespace std;
+
+    service_set sset;
+
+    string command = "test-command";
+    list<pair<unsigned,unsigned>> command_offsets;
+    command_offsets.emplace_back(0, command.length());
+    std::list<prelim_dep> depends;
+
+    process_service p {&sset, "testproc", std::move(command), command_offsets, depends};
+    init_service_defaults(p);
+    service_flags_t sflags;
+    sflags.ready_on_socket = true;
+    p.set_flags(sflags);
+    sset.add_service(&p);
+
+    // (the socket is closed by the service when it becomes inactive; it must be a real fd)
+    base_process_service_test::set_socket_fd(&p, open("/dev/null", O_RDONLY));
+
+    service_record *s2 = new service_record(&sset, "test-service-2", service_type_t::INTERNAL, {{&p, REG}});
+    sset.add_service(s2);
+
+    s2->start(true);
+    sset.process_queues();
+
+    assert(p.get_state() == service_state_t::STARTING);
+    assert(s2->get_state() == service_state_t::STARTED);
+
+    base_process_service_test::exec_failed(&p, ENOENT);
+    sset.process_queues();
+
+    assert(p.get_state() == service_state_t::STOPPED);
+    assert(p.get_stop_reason() == stopped_reason_t::EXECFAILED);
+    assert(s2->get_state() == service_state_t::STOPPED);
+    assert(sset.count_active_services() == 0);
+
+    sset.remove_service(&p);
+}
+
+// A process service which depends on a ready-on-socket service may have launched its process
+// before the dependency fails to start; it must then be stopped (rather than being marked as
+// stopped while its process continues to run)
+void test_proc_ready_on_socket_launched()
+{
+    using namespace std;
+
+    service_set sset;
+
+    string command = "test-command";
+    list<pair<unsigned,unsigned>> command_offsets;
+    command_offsets.emplace_back(0, command.length());
+    std::list<prelim_dep> depends;
+
+    process_service p {&sset, "testproc", std::move(command), command_offsets, depends};
+    init_service_defaults(p);
+    service_flags_t sflags;
+    sflags.ready_on_socket = true;
+    p.set_flags(sflags);
+    sset.add_service(&p);
+
+    // (the socket is closed by the service when it becomes inactive; it must be a real fd)
+    base_process_service_test::set_socket_fd(&p, open("/dev/null", O_RDONLY));
+
+    string command2 = "test-command-2";
+    list<pair<unsigned,unsigned>> command_offsets2;
+    command_offsets2.emplace_back(0, command2.length());
+    std::list<prelim_dep> depends2 = {{&p, REG}};
+
+    process_service d {&sset, "testproc-2", std::move(command2), command_offsets2, depends2};
+    init_service_defaults(d);
+    sset.add_service(&d);
+
+    d.start(true);
+    sset.process_queues();
+
+    assert(p.get_state() == service_state_t::STARTING);
+    assert(d.get_state() == service_state_t::STARTING);
+    assert(d.get_pid() != -1);
+
+    bp_sys::last_sig_sent = -1;
+    base_process_service_test::exec_failed(&p, ENOENT);
+    sset.process_queues();
+
+    assert(p.get_state() == service_state_t::STOPPED);
+
+    // The dependent (whose start is not interruptible) is not marked stopped while its process
+    // is still running; once it has started, it is stopped:
+    assert(d.get_state() == service_state_t::STARTING);
+    assert(d.get_pid() != -1);
+
+    base_process_service_test::exec_succeeded(&d);
+    sset.process_queues();
+
+    assert(d.get_state() == service_state_t::STOPPING);
+    assert(bp_sys::last_sig_sent == SIGTERM);
+
+    base_process_service_test::handle_signal_exit(&d, SIGTERM);
+    sset.process_queues();
+
+    assert(d.get_state() == service_state_t::STOPPED);
+    assert(sset.count_active_services() == 0);
+
+    sset.remove_service(&d);
+    sset.remove_service(&p);
+}
+
+// An on-demand service is started by a connection to its socket, and stopped once its activation lifetime has passed
+void test_proc_on_demand()
+{
+    using namespace std;
+
+    service_set sset;
+
+    string command = "test-command";
+    list<pair<unsigned,unsigned>> command_offsets;
+    command_offsets.emplace_back(0, command.length());
+    std::list<prelim_dep> depends;
+
+    process_service p {&sset, "testproc", std::move(command), command_offsets, depends};
+    init_service_defaults(p);
+    service_flags_t sflags;
+    sflags.on_demand = true;
+    p.set_flags(sflags);
+    p.set_activation_lifetime(time_val(30, 0));
+    sset.add_service(&p);
+
+    // The socket must be a real fd (which is polled when the activation lifetime expires); use the read
+    // end of an (empty) pipe, with a high fd number so as not to clash with the mock fds.
+    int pipefds[2];
+    assert(pipe(pipefds) == 0);
+    int sock_fd = fcntl(pipefds[0], F_DUPFD, 512);
+    assert(sock_fd != -1);
+    close(pipefds[0]);
+    base_process_service_test::set_socket_fd(&p, sock_fd);
+
+    p.open_activation_socket(true);
+    assert(event_loop.regd_fd_watchers.count(sock_fd) == 1);
+
+    // Connection: service starts
+    event_loop.send_fd_event(sock_fd, dasynq::IN_EVENTS);
+    assert(event_loop.regd_fd_watchers.count(sock_fd) == 0);
+    assert(p.get_state() == service_state_t::STARTING);
+    assert(p.is_marked_active());
+
+    base_process_service_test::exec_succeeded(&p);
+    sset.process_queues();
+    assert(p.get_state() == service_state_t::STARTED);
+
+    // Activation lifetime expires: service stops
+    event_loop.advance_time(time_val(30, 0));
+    assert(p.get_state() == service_state_t::STOPPING);
+    assert(! p.is_marked_active());
+
+    base_process_service_test::handle_signal_exit(&p, SIGTERM);
+    sset.process_queues();
+    assert(p.get_state() == service_state_t::STOPPED);
+    assert(event_loop.active_timers.size() == 0);
+
+    // The socket remains open, and is watched again
+    assert(base_process_service_test::get_socket_fd(&p) == sock_fd);
+    assert(event_loop.regd_fd_watchers.count(sock_fd) == 1);
+
+    sset.remove_service(&p);
+    close(pipefds[1]);
+}
+
+// A service which is no longer on-demand (after a reload) is not started by a connection, and
+// stops listening on its activation socket
+void test_proc_on_demand_cleared()
+{
+    using namespace std;
+
+    service_set sset;
+
+    string command = "test-command";
+    list<pair<unsigned,unsigned>> command_offsets;
+    command_offsets.emplace_back(0, command.length());
+    std::list<prelim_dep> depends;
+
+    process_service p {&sset, "testproc", std::move(command), command_offsets, depends};
+    init_service_defaults(p);
+    service_flags_t sflags;
+    sflags.on_demand = true;
+    p.set_flags(sflags);
+    p.set_activation_lifetime(time_val(30, 0));
+    sset.add_service(&p);
+
+    int pipefds[2];
+    assert(pipe(pipefds) == 0);
+    int sock_fd = fcntl(pipefds[0], F_DUPFD, 512);
+    assert(sock_fd != -1);
+    close(pipefds[0]);
+    base_process_service_test::set_socket_fd(&p, sock_fd);
+
+    p.open_activation_socket(true);
+    assert(event_loop.regd_fd_watchers.count(sock_fd) == 1);
+
+    // A connection after the flag is cleared (but before the socket is unwatched) doesn't start
+    // the service
+    p.set_flags(service_flags_t());
+    event_loop.send_fd_event(sock_fd, dasynq::IN_EVENTS);
+    sset.process_queues();
+    assert(p.get_state() == service_state_t::STOPPED);
+    assert(event_loop.regd_fd_watchers.count(sock_fd) == 0);
+
+    // Stopped service: the socket is closed
+    p.set_flags(sflags);
+    p.open_activation_socket(true);
+    assert(event_loop.regd_fd_watchers.count(sock_fd) == 1);
+    p.set_flags(service_flags_t());
+    p.close_activation_socket();
+    assert(event_loop.regd_fd_watchers.count(sock_fd) == 0);
+    assert(base_process_service_test::get_socket_fd(&p) == -1);
+    close(pipefds[1]);
+
+    // Started service: the socket remains open (the service process has it) until the service
+    // stops, and the activation lifetime no longer applies
+    assert(pipe(pipefds) == 0);
+    sock_fd = fcntl(pipefds[0], F_DUPFD, 512);
+    assert(sock_fd != -1);
+    close(pipefds[0]);
+    base_process_service_test::set_socket_fd(&p, sock_fd);
+
+    p.set_flags(sflags);
+    p.open_activation_socket(true);
+    event_loop.send_fd_event(sock_fd, dasynq::IN_EVENTS);
+    base_process_service_test::exec_succeeded(&p);
+    sset.process_queues();
+    assert(p.get_state() == service_state_t::STARTED);
+    assert(event_loop.active_timers.size() == 1);
+
+    p.set_flags(service_flags_t());
+    p.close_activation_socket();
+    assert(base_process_service_test::get_socket_fd(&p) == sock_fd);
+    assert(event_loop.active_timers.size() == 0);
+
+    event_loop.advance_time(time_val(30, 0));
+    assert(p.get_state() == service_state_t::STARTED);
+
+    p.stop(true);
+    sset.process_queues();
+    base_process_service_test::handle_signal_exit(&p, SIGTERM);
+    sset.process_queues();
+    assert(p.get_state() == service_state_t::STOPPED);
+    assert(base_process_service_test::get_socket_fd(&p) == -1);
+    assert(event_loop.regd_fd_watchers.count(sock_fd) == 0);
+
+    sset.remove_service(&p);
+    close(pipefds[1]);
+}
+
+// An activation socket which can't be opened early (because its directory doesn't yet exist) is
+// opened when activation sockets are opened again, and one whose file has disappeared (eg been
+// hidden by a mount) is re-created
+void test_proc_activation_socket_reopen()
+{
+    using namespace std;
+
+    service_set sset;
+
+    char dir_template[] = "/tmp/dinit-proctest-XXXXXX";
+    const char *tmp_dir = mkdtemp(dir_template);
+    assert(tmp_dir != nullptr);
+    string sock_dir = string(tmp_dir) + "/run";
+    string sock_path = sock_dir + "/test.sock";
+
+    string command = "test-command";
+    list<pair<unsigned,unsigned>> command_offsets;
+    command_offsets.emplace_back(0, command.length());
+    std::list<prelim_dep> depends;
+
+    process_service p {&sset, "testproc", std::move(command), command_offsets, depends};
+    init_service_defaults(p);
+    p.set_socket_details(string(sock_path), 0600, -1, -1);
+    sset.add_service(&p);
+
+    p.open_activation_socket(false);
+    assert(base_process_service_test::get_socket_fd(&p) == -1);
+
+    assert(mkdir(sock_dir.c_str(), 0700) == 0);
+    p.open_activation_socket(true);
+    int sock_fd = base_process_service_test::get_socket_fd(&p);
+    assert(sock_fd != -1);
+
+    // Socket file disappears; it is re-created:
+    assert(unlink(sock_path.c_str()) == 0);
+    p.open_activation_socket(true);
+    sock_fd = base_process_service_test::get_socket_fd(&p);
+    assert(sock_fd != -1);
+    struct stat stat_buf;
+    assert(stat(sock_path.c_str(), &stat_buf) == 0 && S_ISSOCK(stat_buf.st_mode));
+
+    // Otherwise, opening again has no effect:
+    p.open_activation_socket(true);
+    assert(base_process_service_test::get_socket_fd(&p) == sock_fd);
+
+    sset.remove_service(&p);
+    unlink(sock_path.c_str());
+    rmdir(sock_dir.c_str());
+    rmdir(tmp_dir);
+}
+
+// Readiness, status and watchdog notification via the shared notification socket
+void test_proc_notify_socket()
+{
+    using namespace std;
+
+    service_set sset;
+    sset.set_notify_socket_path("/run/test.notify");
+
+    string command = "test-command";
+    list<pair<unsigned,unsigned>> command_offsets;
+    command_offsets.emplace_back(0, command.length());
+    std::list<prelim_dep> depends;
+
+    process_service p {&sset, "testproc", std::move(command), command_offsets, depends};
+    init_service_defaults(p);
+    p.set_notification_socket(true);
+    p.set_watchdog_timeout(timespec {5, 0});
+    p.set_auto_restart(true);
+    sset.add_service(&p);
+
+    p.start(true);
+    sset.process_queues();
+    base_process_service_test::exec_succeeded(&p);
+    sset.process_queues();
+
+    // Not started until READY=1 received
+    assert(p.get_state() == service_state_t::STARTING);
+    assert(sset.find_notify_pid(p.get_pid()) == &p);
+
+    string msg = "STATUS=working\nREADY=1\n";
+    p.notify_message(msg.data(), msg.length());
+    assert(p.get_state() == service_state_t::STARTED);
+    assert(p.get_status_text() == "working");
+
+    // Watchdog message re-arms the timer
+    event_loop.advance_time(time_val(4, 0));
+    msg = "WATCHDOG=1";
+    p.notify_message(msg.data(), msg.length());
+    event_loop.advance_time(time_val(4, 0));
+    assert(p.get_state() == service_state_t::STARTED);
+    assert(bp_sys::last_sig_sent != SIGKILL);
+
+    // Watchdog expiry: process killed
+    event_loop.advance_time(time_val(1, 0));
+    assert(bp_sys::last_sig_sent == SIGKILL);
+    pid_t pid = p.get_pid();
+
+    base_process_service_test::handle_signal_exit(&p, SIGKILL);
+    sset.process_queues();
+    assert(sset.find_notify_pid(pid) == nullptr);
+
+    // Service is restarted (after the restart delay), and must notify readiness again
+    assert(p.get_state() == service_state_t::STARTING);
+    event_loop.advance_time(time_val(0, 200000000));
+    sset.process_queues();
+    base_process_service_test::exec_succeeded(&p);
+    sset.process_queues();
+    assert(p.get_state() == service_state_t::STARTING);
+    assert(sset.find_notify_pid(p.get_pid()) == &p);
+
+    msg = "READY=1";
+    p.notify_message(msg.data(), msg.length());
+    assert(p.get_state() == service_state_t::STARTED);
+
+    p.stop(true);
+    sset.process_queues();
+    assert(p.get_state() == service_state_t::STOPPING);
+    base_process_service_test::handle_signal_exit(&p, SIGTERM);
+    sset.process_queues();
+    assert(p.get_state() == service_state_t::STOPPED);
+    assert(sset.find_notify_pid(pid) == nullptr);
+    assert(event_loop.active_timers.size() == 0);
+
+    sset.remove_service(&p);
+}
+
+// Write a pid file (for a bgprocess service) containing the given pid, and return its path
+static std::string write_pid_file(pid_t pid)
+{
+    char path[] = "/tmp/dinit-proctests-pidXXXXXX";
+    int fd = mkstemp(path);
+    assert(fd != -1);
+    std::string pid_str = std::to_string(pid);
+    assert(write(fd, pid_str.data(), pid_str.length()) == (ssize_t)pid_str.length());
+    close(fd);
+    return path;
+}
+
+// Start a bgprocess service whose daemon process (read from its pid file) is not a child, and is
+// therefore watched via a pidfd.
+static void start_bgproc_pidfd(service_set &sset, bgproc_service &p, pid_t daemon_pid)
+{
+    std::string pid_file = write_pid_file(daemon_pid);
+    p.set_pid_file(std::string(pid_file));
+    sset.add_service(&p);
+
+    p.start(true);
+    sset.process_queues();
+    base_process_service_test::exec_succeeded(&p);
+    sset.process_queues();
+    assert(p.get_state() == service_state_t::STARTING);
+
+    // launcher process exits, having written the pid file:
+    base_process_service_test::handle_exit(&p, 0);
+    sset.process_queues();
+    unlink(pid_file.c_str());
+
+    assert(p.get_state() == service_state_t::STARTED);
+    assert(p.get_pid() == daemon_pid);
+    assert(event_loop.regd_fd_watchers.count(bp_sys::get_last_pidfd()) == 1);
+}
+
+// The (non-child) daemon process of a bgprocess service terminates while started
+void test_bgproc_pidfd_exit()
+{
+    using namespace std;
+
+    service_set sset;
+    bp_sys::set_pidfd_support(true);
+
+    string command = "test-command";
+    list<pair<unsigned,unsigned>> command_offsets;
+    command_offsets.emplace_back(0, command.length());
+    std::list<prelim_dep> depends;
+
+    bgproc_service p {&sset, "testproc", std::move(command), command_offsets, depends};
+    init_service_defaults(p);
+    start_bgproc_pidfd(sset, p, 12345);
+
+    int pidfd = bp_sys::get_last_pidfd();
+    event_loop.send_fd_event(pidfd, dasynq::IN_EVENTS);
+    sset.process_queues();
+
+    assert(p.get_state() == service_state_t::STOPPED);
+    assert(p.get_pid() == -1);
+    assert(event_loop.regd_fd_watchers.count(pidfd) == 0);
+
+    sset.remove_service(&p);
+    bp_sys::set_pidfd_support(false);
+}
+
+// Stopping a bgprocess service whose daemon is watched via pidfd: the service stops once the pidfd
+// reports termination
+void test_bgproc_pidfd_stop()
+{
+    using namespace std;
+
+    service_set sset;
+    bp_sys::set_pidfd_support(true);
+
+    string command = "test-command";
+    list<pair<unsigned,unsigned>> command_offsets;
+    command_offsets.emplace_back(0, command.length());
+    std::list<prelim_dep> depends;
+
+    bgproc_service p {&sset, "testproc", std::move(command), command_offsets, depends};
+    init_service_defaults(p);
+    start_bgproc_pidfd(sset, p, 12345);
+    int pidfd = bp_sys::get_last_pidfd();
+
+    p.stop(true);
+    sset.process_queues();
+
+    assert(p.get_state() == service_state_t::STOPPING);
+    assert(bp_sys::last_sig_sent == SIGTERM);
+    assert(event_loop.active_timers.size() == 1);
+
+    event_loop.send_fd_event(pidfd, dasynq::IN_EVENTS);
+    sset.process_queues();
+
+    assert(p.get_state() == service_state_t::STOPPED);
+    assert(event_loop.active_timers.size() == 0);
+    assert(event_loop.regd_fd_watchers.count(pidfd) == 0);
+
+    sset.remove_service(&p);
+    bp_sys::set_pidfd_support(false);
+}
+
+// As above, but the daemon doesn't terminate until after the stop timeout (and SIGKILL)
+void test_bgproc_pidfd_stop_timeout()
+{
+    using namespace std;
+
+    service_set sset;
+    bp_sys::set_pidfd_support(true);
+
+    string command = "test-command";
+    list<pair<unsigned,unsigned>> command_offsets;
+    command_offsets.emplace_back(0, command.length());
+    std::list<prelim_dep> depends;
+
+    bgproc_service p {&sset, "testproc", std::move(command), command_offsets, depends};
+    init_service_defaults(p);
+    start_bgproc_pidfd(sset, p, 12345);
+    int pidfd = bp_sys::get_last_pidfd();
+
+    p.stop(true);
+    sset.process_queues();
+    assert(p.get_state() == service_state_t::STOPPING);
+    assert(bp_sys::last_sig_sent == SIGTERM);
+
+    event_loop.advance_time(time_val {10, 0}); // expire stop timer
+    assert(bp_sys::last_sig_sent == SIGKILL);
+    assert(p.get_state() == service_state_t::STOPPING);
+    assert(event_loop.regd_fd_watchers.count(pidfd) == 1);
+
+    event_loop.send_fd_event(pidfd, dasynq::IN_EVENTS);
+    sset.process_queues();
+
+    assert(p.get_state() == service_state_t::STOPPED);
+    assert(event_loop.active_timers.size() == 0);
+    assert(event_loop.regd_fd_watchers.count(pidfd) == 0);
+
+    sset.remove_service(&p);
+    bp_sys::set_pidfd_support(false);
+}
 
 #define RUN_TEST(name, spacing) \
     std::cout << #name "..." spacing << std::flush; \
@@ -1013,10 +1904,24 @@ int main(int argc, char **argv)
     RUN_TEST(test_proc_stop_timeout, "    ");
     RUN_TEST(test_proc_smooth_recovery1, "");
     RUN_TEST(test_proc_smooth_recovery2, "");
+    RUN_TEST(test_proc_smooth_recovery3, "");
     RUN_TEST(test_scripted_stop_timeout, "");
     RUN_TEST(test_scripted_start_fail, "  ");
     RUN_TEST(test_scripted_stop_fail, "   ");
     RUN_TEST(test_scripted_start_skip, "  ");
     RUN_TEST(test_scripted_start_skip2, " ");
     RUN_TEST(test_waitsfor_restart, "     ");
+    RUN_TEST(test_proc_log_buffer, "      ");
+    RUN_TEST(test_proc_restart_backoff, " ");
+    RUN_TEST(test_proc_restart_budget, "  ");
+    RUN_TEST(test_proc_cgroup, "          ");
+    RUN_TEST(test_proc_ready_on_socket, " ");
+    RUN_TEST(test_proc_ready_on_socket_launched, " ");
+    RUN_TEST(test_proc_on_demand, "       ");
+    RUN_TEST(test_proc_on_demand_cleared, "");
+    RUN_TEST(test_proc_activation_socket_reopen, " ");
+    RUN_TEST(test_proc_notify_socket, "   ");
+    RUN_TEST(test_bgproc_pidfd_exit, "    ");
+    RUN_TEST(test_bgproc_pidfd_stop, "    ");
+    RUN_TEST(test_bgproc_pidfd_stop_timeout, "");
 }
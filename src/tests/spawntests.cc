@@ -0,0 +1,180 @@
+#include <iostream>
+#include <vector>
+#include <cstring>
+
+#include <cerrno>
+#include <cassert>
+
+#include <sys/wait.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "proc-service.h"
+
+// Tests for the process launch sequence (run_child_proc), which (unlike the other tests) create
+// real processes.
+
+static std::vector<service_rlimits> no_rlimits;
+
+// Launch a process (via vfork, or fork) with the given arguments, using (or building) the given
+// process environment; wait for it to exit. Returns the exit status. If exec fails, the error is
+// returned via exec_err (with exec_failed set true).
+static int launch(const char * const *args, bool use_vfork, run_proc_env &env, bool &exec_failed,
+        run_proc_err &exec_err, const char *notify_var = nullptr, const char *env_file = nullptr)
+{
+    int pipefd[2];
+    assert(pipe2(pipefd, O_CLOEXEC) == 0);
+
+    int notify_pipe[2] = {-1, -1};
+    if (notify_var != nullptr) {
+        assert(pipe2(notify_pipe, 0) == 0);
+    }
+
+    run_proc_params params{args, nullptr, "/dev/null", pipefd[1], uid_t(-1), gid_t(-1), no_rlimits};
+    params.notify_fd = notify_pipe[1];
+    params.notify_var = notify_var;
+    params.env_file = env_file;
+    run_proc_plan plan;
+    prepare_child_proc(params, env, plan);
+
+    pid_t child = use_vfork ? vfork() : fork();
+    if (child == 0) {
+        run_child_proc(params, plan);
+    }
+    assert(child > 0);
+
+    close(pipefd[1]);
+    if (notify_pipe[1] != -1) close(notify_pipe[1]);
+
+    ssize_t r = read(pipefd[0], &exec_err, sizeof(exec_err));
+    exec_failed = (r == sizeof(exec_err));
+    close(pipefd[0]);
+
+    int status;
+    assert(waitpid(child, &status, 0) == child);
+
+    if (notify_pipe[0] != -1) close(notify_pipe[0]);
+    return status;
+}
+
+void test_spawn_exit_status()
+{
+    bool exec_failed;
+    run_proc_err exec_err;
+
+    const char * const args[] = { "sh", "-c", "exit 3", nullptr };
+    for (bool use_vfork : {false, true}) {
+        run_proc_env env;
+        int status = launch(args, use_vfork, env, exec_failed, exec_err);
+        assert(! exec_failed);
+        assert(WIFEXITED(status) && WEXITSTATUS(status) == 3);
+    }
+}
+
+void test_spawn_exec_fail()
+{
+    bool exec_failed;
+    run_proc_err exec_err;
+
+    const char * const args[] = { "dinit-test-no-such-command", nullptr };
+    for (bool use_vfork : {false, true}) {
+        run_proc_env env;
+        launch(args, use_vfork, env, exec_failed, exec_err);
+        assert(exec_failed);
+        assert(exec_err.stage == exec_stage::DO_EXEC);
+        assert(exec_err.st_errno == ENOENT);
+    }
+}
+
+void test_spawn_env()
+{
+    bool exec_failed;
+    run_proc_err exec_err;
+
+    // The notification fd variable is filled in by the child; the fd must be open in the child.
+    setenv("DINIT_TEST_VAR", "value", true);
+    const char * const args[] = { "sh", "-c",
+            "test \"$DINIT_TEST_VAR\" = value && test -n \"$NOTIFY_FD\" && test -e /dev/fd/$NOTIFY_FD",
+            nullptr };
+    for (bool use_vfork : {false, true}) {
+        run_proc_env env;
+        int status = launch(args, use_vfork, env, exec_failed, exec_err, "NOTIFY_FD");
+        assert(! exec_failed);
+        assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+    unsetenv("DINIT_TEST_VAR");
+}
+
+void test_spawn_env_cache()
+{
+    bool exec_failed;
+    run_proc_err exec_err;
+
+    char env_file[] = "/tmp/dinit-spawntests-XXXXXX";
+    int env_fd = mkstemp(env_file);
+    assert(env_fd != -1);
+
+    const char * const args_unset[] = { "sh", "-c", "test -z \"$DINIT_TEST_VAR\"", nullptr };
+    const char * const args_set[] = { "sh", "-c", "test \"$DINIT_TEST_VAR\" = value", nullptr };
+
+    run_proc_env env;
+    unsetenv("DINIT_TEST_VAR");
+    int status = launch(args_unset, true, env, exec_failed, exec_err, nullptr, env_file);
+    assert(! exec_failed && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    assert(env.valid);
+
+    // The environment is re-used, so a change to our own environment is not seen:
+    setenv("DINIT_TEST_VAR", "value", true);
+    status = launch(args_unset, true, env, exec_failed, exec_err, nullptr, env_file);
+    assert(! exec_failed && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    // A change to the environment file causes the environment to be rebuilt:
+    assert(write(env_fd, "X=1\n", 4) == 4);
+    status = launch(args_set, true, env, exec_failed, exec_err, nullptr, env_file);
+    assert(! exec_failed && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    // As does explicit invalidation (eg on service reload):
+    unsetenv("DINIT_TEST_VAR");
+    env.invalidate();
+    status = launch(args_unset, true, env, exec_failed, exec_err, nullptr, env_file);
+    assert(! exec_failed && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    // And a change to the service settings (here, a notification variable):
+    setenv("DINIT_TEST_VAR", "value", true);
+    status = launch(args_set, true, env, exec_failed, exec_err, "NOTIFY_FD", env_file);
+    assert(! exec_failed && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    unsetenv("DINIT_TEST_VAR");
+
+    // A rewrite of the file which leaves its size (and the seconds part of its modification time)
+    // unchanged is also seen:
+    struct timespec times[2] = { {1000000000, 100}, {1000000000, 100} };
+    assert(pwrite(env_fd, "X=2\n", 4, 0) == 4);
+    assert(futimens(env_fd, times) == 0);
+    status = launch(args_unset, true, env, exec_failed, exec_err, "NOTIFY_FD", env_file);
+    assert(! exec_failed && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    setenv("DINIT_TEST_VAR", "value", true);
+    assert(pwrite(env_fd, "X=3\n", 4, 0) == 4);
+    times[0].tv_nsec = times[1].tv_nsec = 200;
+    assert(futimens(env_fd, times) == 0);
+    status = launch(args_set, true, env, exec_failed, exec_err, "NOTIFY_FD", env_file);
+    assert(! exec_failed && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    unsetenv("DINIT_TEST_VAR");
+
+    close(env_fd);
+    unlink(env_file);
+}
+
+#define RUN_TEST(name, spacing) \
+    std::cout << #name "..." spacing << std::flush; \
+    name(); \
+    std::cout << "PASSED" << std::endl;
+
+int main(int argc, char **argv)
+{
+    RUN_TEST(test_spawn_exit_status, "    ");
+    RUN_TEST(test_spawn_exec_fail, "      ");
+    RUN_TEST(test_spawn_env, "            ");
+    RUN_TEST(test_spawn_env_cache, "      ");
+}
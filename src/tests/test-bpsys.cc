@@ -3,15 +3,18 @@
 #include <algorithm>
 #include <memory>
 #include <map>
+#include <set>
 
 #include <cstdlib>
 #include <cerrno>
+#include <csignal>
 
 #include "baseproc-sys.h"
 
 namespace {
 
 std::vector<bool> usedfds = {true, true, true};
+std::set<int> freefds; // unused fds below usedfds.size(), so that the lowest can be found quickly
 
 struct read_result
 {
@@ -39,6 +42,19 @@ std::map<int,read_cond> read_data;
 // map of fd to the handler for writes to that fd
 std::map<int, std::unique_ptr<bp_sys::write_handler>> write_hndlr_map;
 
+// cgroups: whether supported, and the populated state of each (open) cgroup
+bool cgroups_supported = false;
+std::map<int,bool> cgroup_populated_map;
+int last_cgroup_fd = -1;
+int cgroup_kill_count = 0;
+
+// pidfds: whether supported, and the most recently opened
+bool pidfds_supported = false;
+int last_pidfd = -1;
+
+// if not null, process ids passed to kill() are recorded here
+std::vector<pid_t> *signalled_pids = nullptr;
+
 } // anon namespace
 
 namespace bp_sys {
@@ -63,16 +79,16 @@ int allocfd()
 
 int allocfd(write_handler *whndlr)
 {
-    auto f = std::find(usedfds.begin(), usedfds.end(), false);
-    if (f == usedfds.end()) {
+    if (freefds.empty()) {
         int r = usedfds.size();
         usedfds.push_back(true);
         write_hndlr_map[r] = std::unique_ptr<bp_sys::write_handler>(whndlr);
         return r;
     }
 
-    *f = true;
-    auto r = f - usedfds.begin();
+    int r = *freefds.begin();
+    freefds.erase(freefds.begin());
+    usedfds[r] = true;
     write_hndlr_map[r] = std::unique_ptr<bp_sys::write_handler>(whndlr);
     return r;
 }
@@ -103,6 +119,42 @@ void extract_written_data(int fd, std::vector<char> &data)
 }
 
 
+void set_cgroup_support(bool supported)
+{
+    cgroups_supported = supported;
+}
+
+int get_last_cgroup_fd()
+{
+    return last_cgroup_fd;
+}
+
+void set_cgroup_populated(int cgroup_fd, bool populated)
+{
+    cgroup_populated_map[cgroup_fd] = populated;
+}
+
+int get_cgroup_kill_count()
+{
+    return cgroup_kill_count;
+}
+
+void set_pidfd_support(bool supported)
+{
+    pidfds_supported = supported;
+}
+
+int get_last_pidfd()
+{
+    return last_pidfd;
+}
+
+void record_signalled_pids(std::vector<pid_t> *pids)
+{
+    signalled_pids = pids;
+}
+
+
 // Mock implementations of system calls:
 
 int pipe2(int fds[2], int flags)
@@ -118,6 +170,7 @@ int close(int fd)
     if (! usedfds[fd]) abort();
 
     usedfds[fd] = false;
+    freefds.insert(fd);
     write_hndlr_map.erase(fd);
     return 0;
 }
@@ -125,6 +178,9 @@ int close(int fd)
 int kill(pid_t pid, int sig)
 {
     last_sig_sent = sig;
+    if (signalled_pids != nullptr) {
+        signalled_pids->push_back(pid < 0 ? -pid : pid);
+    }
     return 0;
 }
 
@@ -188,4 +244,52 @@ ssize_t writev(int fd, const struct iovec *iov, int iovcnt)
     return r;
 }
 
+int pidfd_open(pid_t pid, unsigned flags)
+{
+    if (!pidfds_supported) {
+        errno = ENOSYS;
+        return -1;
+    }
+    int fd = allocfd();
+    set_blocking(fd);
+    last_pidfd = fd;
+    return fd;
+}
+
+int cgroup_open(const char *parent, const char *name)
+{
+    if (!cgroups_supported) {
+        errno = ENOSYS;
+        return -1;
+    }
+    int fd = allocfd();
+    cgroup_populated_map[fd] = false;
+    last_cgroup_fd = fd;
+    return fd;
+}
+
+int cgroup_remove(const char *parent, const char *name)
+{
+    return 0;
+}
+
+int cgroup_populated(int cgroup_fd)
+{
+    return cgroup_populated_map[cgroup_fd] ? 1 : 0;
+}
+
+int cgroup_kill(int cgroup_fd)
+{
+    cgroup_kill_count++;
+    last_sig_sent = SIGKILL;
+    return 0;
+}
+
+int cgroup_watch_events(int cgroup_fd)
+{
+    int fd = allocfd();
+    set_blocking(fd);
+    return fd;
+}
+
 }
@@ -4,6 +4,8 @@
 #include <string>
 #include <vector>
 
+#include <cerrno>
+
 #include <sys/types.h>
 #include <unistd.h>
 #include <sys/uio.h>
@@ -44,6 +46,21 @@ void supply_read_data(int fd, std::vector<char> &&data);
 void set_blocking(int fd);
 void extract_written_data(int fd, std::vector<char> &data);
 
+// cgroup support: enable/disable (disabled by default), get the most recently opened cgroup fd, set
+// whether a cgroup is populated, and get the number of cgroup_kill() calls
+void set_cgroup_support(bool supported);
+int get_last_cgroup_fd();
+void set_cgroup_populated(int cgroup_fd, bool populated);
+int get_cgroup_kill_count();
+
+// pidfd support: enable/disable (disabled by default), and get the most recently opened pidfd
+void set_pidfd_support(bool supported);
+int get_last_pidfd();
+
+// Record the (absolute) process id given to each kill() in the given vector, or stop recording if
+// nullptr is given
+void record_signalled_pids(std::vector<pid_t> *pids);
+
 // Mock system calls:
 
 // implementations elsewhere:
@@ -124,15 +141,29 @@ class exit_status
     }
 };
 
+// Processes are only (mock) children of the service manager if they were forked via the event loop,
+// which reports their termination; any other process (eg. a daemon whose pid is read from a pid
+// file) is not a child.
 inline pid_t waitpid(pid_t p, exit_status *statusp, int flags)
 {
-    throw std::string("not implemented");
+    errno = ECHILD;
+    return -1;
 }
 
+// Returns a (blocking) mock fd, if pidfd support is enabled; to signal termination of the process,
+// send an event for the fd via the event loop.
+int pidfd_open(pid_t pid, unsigned flags);
+
 ssize_t read(int fd, void *buf, size_t count);
 ssize_t write(int fd, const void *buf, size_t count);
 ssize_t writev (int fd, const struct iovec *iovec, int count);
 
+int cgroup_open(const char *parent, const char *name);
+int cgroup_remove(const char *parent, const char *name);
+int cgroup_populated(int cgroup_fd);
+int cgroup_kill(int cgroup_fd);
+int cgroup_watch_events(int cgroup_fd);
+
 }
 
 #endif
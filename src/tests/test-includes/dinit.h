@@ -14,6 +14,9 @@ using clock_type = dasynq::clock_type;
 using rearm = dasynq::rearm;
 using time_val = dasynq::time_val;
 
+constexpr unsigned STATS_CONTROL = dasynq::STATS_USER;
+constexpr unsigned STATS_LOG = dasynq::STATS_USER + 1;
+
 namespace bp_sys {
     extern pid_t last_forked_pid;
 }
@@ -29,13 +32,25 @@ class eventloop_t
         tv = current_time;
     }
 
+    // Statistics to be returned by get_stats() (if stats_enabled is true)
+    bool stats_enabled = false;
+    dasynq::loop_stats stats;
+
+    bool get_stats(dasynq::loop_stats &stats_r, bool reset = false) noexcept
+    {
+        if (! stats_enabled) return false;
+        stats_r = stats;
+        if (reset) stats = dasynq::loop_stats();
+        return true;
+    }
+
     // Advance the simulated current time by the given amount, and call timer callbacks.
     void advance_time(time_val amount)
     {
         current_time += amount;
         auto active_copy = active_timers;
         for (timer * t : active_copy) {
-            if (t->expiry_time >= current_time) {
+            if (t->expiry_time <= current_time) {
                 t->stop_timer(*this);
                 rearm r = t->expired(*this, 1);
                 assert(r == rearm::NOOP); // others not handled
@@ -64,6 +79,14 @@ class eventloop_t
             return bp_sys::last_forked_pid;
         }
 
+        template <typename F>
+        pid_t vfork(eventloop_t &loop, F child_func, bool reserved_child_watcher,
+                int priority = dasynq::DEFAULT_PRIORITY)
+        {
+            bp_sys::last_forked_pid++;
+            return bp_sys::last_forked_pid;
+        }
+
         void add_reserved(eventloop_t &eloop, pid_t child, int prio = dasynq::DEFAULT_PRIORITY) noexcept
         {
 
@@ -110,6 +133,11 @@ class eventloop_t
             return watched_fd;
         }
 
+        void set_stats_category(unsigned category) noexcept
+        {
+
+        }
+
         void set_enabled(eventloop_t &loop, bool enable) noexcept
         {
 
@@ -157,6 +185,11 @@ class eventloop_t
     		return watched_fd;
     	}
 
+    	void set_stats_category(unsigned category) noexcept
+    	{
+
+    	}
+
     	void deregister(eventloop_t &eloop) noexcept
     	{
     		eloop.regd_bidi_watchers.erase(watched_fd);
@@ -235,6 +268,10 @@ inline void read_env_file(const char *env_file_path)
 {
 }
 
+inline void read_env_file(const char *env_file_path, std::vector<std::string> &env_vars)
+{
+}
+
 extern eventloop_t event_loop;
 
 #endif
@@ -2,9 +2,14 @@
 
 #include "proc-service.h"
 
-// Stub out run_child_proc function, for testing purposes.
+// Stub out process launch functions, for testing purposes.
 
-void base_process_service::run_child_proc(run_proc_params params) noexcept
+void prepare_child_proc(const run_proc_params &params, run_proc_env &env, run_proc_plan &plan)
+{
+
+}
+
+void run_child_proc(const run_proc_params &params, run_proc_plan &plan) noexcept
 {
 
 }
@@ -792,6 +792,131 @@ void test_log2()
     close_log();
 }
 
+// Limit on the number of concurrently starting (process) services
+void test_start_limit()
+{
+    service_set sset;
+    sset.set_max_starting(2);
+
+    test_service *s1 = new test_service(&sset, "test-service-1", service_type_t::PROCESS, {});
+    test_service *s2 = new test_service(&sset, "test-service-2", service_type_t::PROCESS, {});
+    test_service *s3 = new test_service(&sset, "test-service-3", service_type_t::PROCESS, {});
+    test_service *s4 = new test_service(&sset, "test-service-4", service_type_t::PROCESS, {});
+    test_service *s5 = new test_service(&sset, "test-service-5", service_type_t::PROCESS,
+            {{s4, REG}});
+    test_service *s6 = new test_service(&sset, "test-service-6", service_type_t::PROCESS,
+            {{s5, REG}});
+    test_service *s7 = new test_service(&sset, "test-service-7", service_type_t::PROCESS, {});
+    s7->set_start_priority(1);
+    test_service *s8 = new test_service(&sset, "test-service-8", service_type_t::INTERNAL,
+            {{s3, REG}, {s6, REG}});
+    for (auto *s : {s1, s2, s3, s4, s5, s6, s7, s8}) {
+        sset.add_service(s);
+    }
+
+    // s1 and s2 take both slots:
+    sset.start_service(s1);
+    sset.start_service(s2);
+    assert(sset.get_num_starting() == 2);
+
+    sset.start_service(s8);
+    sset.start_service(s7);
+    assert(sset.is_queued_for_start_slot(s3));
+    assert(sset.is_queued_for_start_slot(s4));
+    assert(sset.is_queued_for_start_slot(s7));
+    assert(! sset.is_queued_for_start_slot(s5));
+
+    // The highest priority service is next:
+    s1->started();
+    sset.process_queues();
+    assert(! sset.is_queued_for_start_slot(s7));
+    assert(sset.get_num_starting() == 2);
+
+    // Then the service with the longest chain of dependents:
+    s2->started();
+    sset.process_queues();
+    assert(! sset.is_queued_for_start_slot(s4));
+    assert(sset.is_queued_for_start_slot(s3));
+
+    // A service which fails to start releases its slot:
+    s7->failed_to_start();
+    sset.process_queues();
+    assert(s7->get_state() == service_state_t::STOPPED);
+    assert(! sset.is_queued_for_start_slot(s3));
+    assert(sset.get_num_starting() == 2);
+
+    // A queued service which is stopped leaves the queue:
+    sset.start_service(s7);
+    assert(sset.is_queued_for_start_slot(s7));
+    sset.stop_service(s7);
+    assert(! sset.is_queued_for_start_slot(s7));
+    assert(s7->get_state() == service_state_t::STOPPED);
+    assert(sset.get_num_starting() == 2);
+
+    // Removing the limit starts any waiting services:
+    sset.start_service(s7);
+    assert(sset.is_queued_for_start_slot(s7));
+    sset.set_max_starting(0);
+    sset.process_queues();
+    assert(! sset.is_queued_for_start_slot(s7));
+    assert(sset.get_num_starting() == 3);
+
+    s3->started();
+    s4->started();
+    s7->started();
+    sset.process_queues();
+    assert(s5->get_state() == service_state_t::STARTING);
+    s5->started();
+    sset.process_queues();
+    s6->started();
+    sset.process_queues();
+    assert(s6->get_state() == service_state_t::STARTED);
+    assert(sset.get_num_starting() == 0);
+}
+
+// Dependency records are re-used (from the pool) after removal, with links kept consistent
+void test_dep_storage()
+{
+    service_set sset;
+
+    service_record *s1 = new service_record(&sset, "test-service-1", service_type_t::INTERNAL, {});
+    service_record *s2 = new service_record(&sset, "test-service-2", service_type_t::INTERNAL, {});
+    service_record *s3 = new service_record(&sset, "test-service-3", service_type_t::INTERNAL,
+            {{s1, REG}, {s2, WAITS}});
+    sset.add_service(s1);
+    sset.add_service(s2);
+    sset.add_service(s3);
+
+    assert(s3->get_dependencies().size() == 2);
+    assert(s1->get_dependents().size() == 1);
+    assert(s2->get_dependents().size() == 1);
+
+    sset.start_service(s3);
+    assert(s1->get_state() == service_state_t::STARTED);
+    assert(s2->get_state() == service_state_t::STARTED);
+
+    // Remove and re-add dependencies many times:
+    for (int i = 0; i < 1000; i++) {
+        s3->rm_dep(s2, WAITS);
+        assert(s3->get_dependencies().size() == 1);
+        assert(s2->get_dependents().empty());
+        service_dep &dep = s3->add_dep(s2, WAITS);
+        assert(&dep == s2->get_dependents().front());
+        assert(s3->get_dependencies().size() == 2);
+    }
+
+    s3->rm_dep(s1, REG);
+    assert(s3->get_dependencies().size() == 1);
+    assert(&s3->get_dependencies()[0] == s2->get_dependents().front());
+    assert(s1->get_dependents().empty());
+    sset.process_queues();
+    // s1 is no longer required:
+    assert(s1->get_state() == service_state_t::STOPPED);
+
+    sset.stop_service(s3);
+    assert(s3->get_state() == service_state_t::STOPPED);
+}
+
 #define RUN_TEST(name, spacing) \
     std::cout << #name "..." spacing << std::flush; \
     name(); \
@@ -819,6 +944,8 @@ int main(int argc, char **argv)
     RUN_TEST(test13, "                    ");
     RUN_TEST(test14, "                    ");
     RUN_TEST(test15, "                    ");
+    RUN_TEST(test_start_limit, "          ");
+    RUN_TEST(test_dep_storage, "          ");
     RUN_TEST(test_log1, "                 ");
     RUN_TEST(test_log2, "                 ");
 }
@@ -0,0 +1,125 @@
+#include <iostream>
+#include <cassert>
+#include <random>
+#include <vector>
+
+#include "dasynq-config.h"
+#include "dasynq-flags.h"
+#include "dasynq-timerbase.h"
+#include "dasynq-timerwheel.h"
+
+// Tests for the timer queue implementations (timer_wheel and dary_heap, as used for timer_queue_t).
+
+using dasynq::time_val;
+using dasynq::timer_data;
+using dasynq::clock_type;
+
+using heap_queue = dasynq::dary_heap<timer_data, time_val, dasynq::compare_timespec>;
+using wheel_queue = dasynq::timer_wheel<timer_data, time_val, 1000000>;
+
+static time_val now_mono()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts;
+}
+
+static uint64_t to_nsecs(const time_val &t)
+{
+    return uint64_t(t.seconds()) * 1000000000u + t.nseconds();
+}
+
+static time_val from_nsecs(uint64_t ns)
+{
+    return time_val(ns / 1000000000u, ns % 1000000000u);
+}
+
+// Timers are removed from the wheel in order, not before their requested time, and not too late
+void test_wheel_order()
+{
+    wheel_queue queue;
+    queue.set_clock(clock_type::MONOTONIC);
+
+    constexpr int num_timers = 1000;
+    std::vector<wheel_queue::handle_t> handles(num_timers);
+    std::vector<time_val> requested(num_timers);
+
+    std::minstd_rand rng(1);
+    time_val now = now_mono();
+    for (int i = 0; i < num_timers; i++) {
+        // up to ~1000 seconds, in a range of magnitudes:
+        uint64_t delay = rng() % (uint64_t(1) << (10 + rng() % 30));
+        requested[i] = now + from_nsecs(delay);
+        queue.allocate(handles[i], (void *)&requested[i]);
+        queue.insert(handles[i], requested[i]);
+    }
+
+    time_val prev = {0, 0};
+    int count = 0;
+    while (! queue.empty()) {
+        time_val expiry = queue.get_root_priority();
+        time_val req = *(time_val *)queue.node_data(queue.get_root()).userdata;
+        assert(prev <= expiry);
+        assert(req <= expiry);
+        // lateness is at most around 1/8 of the delay (plus the resolution, 1ms, and allowing for
+        // the coarse clock used by the wheel lagging behind):
+        uint64_t delay = (now < req) ? to_nsecs(req - now) : 0;
+        assert(to_nsecs(expiry - req) <= delay / 7 + 5000000);
+        prev = expiry;
+        queue.pull_root();
+        count++;
+    }
+    assert(count == num_timers);
+
+    for (auto &h : handles) {
+        queue.deallocate(h);
+    }
+}
+
+// Removal, and changing expiry time, of queued timers
+void test_wheel_remove()
+{
+    wheel_queue queue;
+    queue.set_clock(clock_type::MONOTONIC);
+
+    wheel_queue::handle_t h1, h2, h3;
+    queue.allocate(h1);
+    queue.allocate(h2);
+    queue.allocate(h3);
+
+    time_val now = now_mono();
+    assert(queue.insert(h1, now + time_val(10, 0)));
+    assert(! queue.insert(h2, now + time_val(20, 0)));
+    assert(queue.insert(h3, now + time_val(0, 200000000)));
+    assert(&queue.get_root() == &h3);
+
+    // Timers due at around the same time share an expiry time, so the earliest doesn't change:
+    assert(! queue.set_priority(h2, now + time_val(0, 200000001)));
+
+    queue.remove(h3);
+    assert(! queue.is_queued(h3));
+    assert(&queue.get_root() == &h2);
+
+    assert(! queue.set_priority(h2, now + time_val(30, 0)));
+    assert(&queue.get_root() == &h1);
+    queue.remove(h1);
+    assert(&queue.get_root() == &h2);
+    queue.remove(h2);
+    assert(queue.empty());
+
+    queue.deallocate(h1);
+    queue.deallocate(h2);
+    queue.deallocate(h3);
+}
+
+#define RUN_TEST(name, spacing) \
+    std::cout << #name "..." spacing << std::flush; \
+    name(); \
+    std::cout << "PASSED" << std::endl;
+
+int main(int argc, char **argv)
+{
+    RUN_TEST(test_wheel_order, "    ");
+    RUN_TEST(test_wheel_remove, "   ");
+    return 0;
+}